@@ -5,22 +5,86 @@
 #include <ctype.h>   // For isdigit, isxdigit, isspace, tolower
 #include <errno.h>   // For checking file errors
 #include <limits.h>  // For LONG_MAX, LONG_MIN, INT_MAX, INT_MIN
+#include <float.h>   // For FLT_MAX (open-ended viewStock price filter)
+#include <sys/stat.h> // For stat() on stock/journal files
+#include <stdarg.h>  // For outPrintf
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h> // SSE2/AVX2 CSV scanning, selected at runtime
+#define CSV_SIMD_X86 1
+#endif
 #ifdef _WIN32
 #include <process.h> // For _getpid() on Windows
+#include <io.h>      // For _commit/_chsize (journal durability)
 #define getpid _getpid // Define getpid for Windows
+#define fsync _commit
+#define ftruncate _chsize
 #else
 #include <unistd.h>  // For getpid() on POSIX
+#include <strings.h>     // For strncasecmp() on HTTP headers
+#include <signal.h>      // For ignoring SIGPIPE in server mode
+#include <sys/socket.h>  // Server mode HTTP listener
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>    // mmap() for the binary stock snapshot
+#include <fcntl.h>       // fcntl() record locks on STOCK_LOCK_FILE
+#include <pthread.h>     // Parallel stock/sales loading (link with -pthread)
 #endif
 
 #define STOCK_FILE "stock.csv"
 #define SALES_FILE "sales.csv"
-#define TEMP_STOCK_FILE_UPDATE "stock_temp_update.csv" // Used by processUpdateStock
-#define TEMP_STOCK_FILE_BILLING "stock_temp_billing.csv" // Used by processBilling
+#define STOCK_JOURNAL_FILE "stock.journal" // Append-only log of quantity changes, replayed on load
+#define TEMP_STOCK_FILE_COMPACT "stock_temp_compact.csv" // Used by compactStockJournal
+#define JOURNAL_COMPACT_BYTES (256*1024) // Fold the journal into STOCK_FILE once it grows past this
+#define STOCK_SNAPSHOT_FILE "stock.snap" // Binary, mmap-able copy of STOCK_FILE's parsed rows and the indexes built over them
+#define TEMP_STOCK_SNAPSHOT_FILE "stock_temp.%d.snap" // Used by writeStockSnapshot (per pid: concurrent CGI processes may rebuild it at once)
+#define STOCK_LOCK_FILE "stock.lock" // Byte-range locks: byte <mcode> per item, plus the three bytes below
+#define STOCK_LOCK_JOURNAL_BYTE 0LL // Held while appending to STOCK_JOURNAL_FILE (codes are > 0)
+#define STOCK_LOCK_SALES_BYTE ((long long)INT_MAX + 1) // Held while appending to SALES_FILE / SALES_INDEX_FILE
+#define STOCK_LOCK_SNAPSHOT_BYTE ((long long)INT_MAX + 2) // Held while rebuilding STOCK_SNAPSHOT_FILE: one process parses STOCK_FILE, the rest wait and attach
+#define SNAPSHOT_MAGIC 0x50414E53u // "SNAP" (little-endian)
+#define SNAPSHOT_VERSION 4 // 4: source stamp includes the mtime's nanoseconds. 3: hot/cold records and the interned name pools, plus the built hash/ordered/name indexes, attached in place
+#define CSV_READ_CHUNK (1024*1024) // SALES_FILE is indexed this many bytes at a time (per loader thread)
+#define LOAD_MAX_THREADS 8 // Loader threads for large STOCK_FILE / SALES_FILE reads
+#define LOAD_MIN_CHUNK_BYTES (256*1024) // Smaller inputs use fewer threads, down to the plain sequential loader
+#define STOCK_CSV_FIELDS 9 // name,code,supplier,contact,price,quantity,year,month,day
+#define STOCK_CSV_ROW_MAX 320 // Longest formatStockCsvRow line: both names quoted with every char a doubled quote (2*40+3, 2*50+3), contact 20, code 11, price 48, qty/y/m/d 4*11, 8 commas + newline
+#define SALE_CSV_FIELDS 9 // invoice,date,time,customer,code,medicine,quantity,price,total
+#define SALES_INDEX_FILE "sales.idx" // Columns (offset, invoice, day, code, quantity, paise) and running totals for SALES_FILE
+#define TEMP_SALES_INDEX_FILE "sales_temp.idx" // Used by writeSalesIndexFile
+#define SALES_DAY_NONE INT_MIN // Rollup day of a sales row whose date does not parse
+#define SALES_INDEX_MAGIC 0x58444953u // "SIDX" (little-endian)
+#define SALES_INDEX_VERSION 3 // 3: one contiguous region per column, amounts in paise; older files are rebuilt from SALES_FILE
+#define SALES_COLUMNS 7 // Column regions of SALES_INDEX_FILE: offset, invoice, amount, day, code, quantity, first_of_invoice
+#define SALES_REPORT_PAGE_ROWS 100 // Detail rows per generateReport page
+#define STOCK_PAGE_ROWS 100 // viewStock rows per page when no 'limit' is given
+#define STOCK_PAGE_MAX_ROWS 1000 // Largest 'limit' viewStock accepts
+#define STOCK_PAGE_SCAN_MAX 20000 // Rows a filtered viewStock page examines before it stops and offers Next from there
 #define MAX_BILL_ITEMS 50 // Maximum number of different medicines per bill
-#define HASH_TABLE_SIZE 101 // Prime number for better distribution
+#define IMPORT_MAX_ERRORS_SHOWN 500 // Rejected rows listed on the import_stock result page (all are counted)
+#define HASH_TABLE_SIZE 1024 // Initial slot count; the table doubles past a 7/8 load factor
+#define STOCK_STORE_CHUNK 4096 // Records per stock store arena chunk
+#define STOCK_PRICE_MAX 21474836.47 // Largest price (in rupees) whose paise fit a StockItem
+#define STRING_POOL_NONE UINT_MAX // stringPoolIntern's failure id
+#define ORDERED_KEY_MIN LLONG_MIN
+#define ORDERED_KEY_MAX LLONG_MAX
+#define EXPIRY_DEFAULT_DAYS 90 // checkExpiry window when no 'days' parameter is given
+#define EXPIRY_MAX_DAYS 36500
+#define JSON_LOOKUP_MAX_CODES 1000 // Codes one action=lookup request may ask for
+#define ORDERED_DELTA_MAX 256 // Buffered out-of-order inserts before the ordered index merges them into its main array
+#define MAX_POST_SIZE (20*1024*1024) // Upper bound for CONTENT_LENGTH (CGI and server mode)
+#define SERVER_DEFAULT_PORT 8080 // Port for --serve when none given
+#define SERVER_MAX_HEADER 16384 // Max bytes of HTTP request line + headers in server mode
+#define SERVER_STATIC_MAX_AGE 3600 // Cache-Control max-age (seconds) for static files in server mode
+#define RESPONSE_FLUSH_BYTES (64*1024) // outPrintf/outHtml hand the page to stdout in batches of about this size
+#define LOG_ERROR 0 // logLevel values. Errors themselves are always printed (plain fprintf(stderr))
+#define LOG_WARN 1  // Bad input rows, rejected requests, stale caches
+#define LOG_INFO 2  // Loads, reloads, compactions (the default)
+#define LOG_DEBUG 3 // Per-request and per-item progress
+#define logAt(level, ...) do { if ((level) <= logLevel) fprintf(stderr, __VA_ARGS__); } while (0)
+#define METRIC_BUCKETS 12 // Latency histogram bounds: 1us * 4^i for i < METRIC_BUCKETS (about 4.2 s), then +Inf
 
 // --- Data Structures ---
-struct medicine
+struct medicine // One stock row as STOCK_FILE and the add/import forms carry it; the store keeps it split (StockItem + StockItemCold)
 {
     char name[40];
     int mcode;
@@ -35,7 +99,7 @@ struct medicine
 
 struct sale_record // Used by billing and reporting
 {
-    char invoice_id[30]; // Increased size for timestamp-pid ID (e.g., 16897...-12345)
+    char invoice_id[30]; // Timestamp-pid-sequence ID (e.g., 16897...-12345-1)
     char date_str[11]; // YYYY-MM-DD
     char time_str[9];  // HH:MM:SS
     char customer_name[50];
@@ -44,20 +108,152 @@ struct sale_record // Used by billing and reporting
     int quantity;
     float price_per_item;
     float total_cost; // Cost for this specific line item
+    long long total_paise; // The same in paise: exact, and what SALES_FILE and the sales index record
 };
 
-// --- BST Node Structure (Renamed from TreeNode) ---
-typedef struct node {
-    struct medicine data; // Store the actual data
-    struct node *left;
-    struct node *right;
-} node; // Use 'node' as the type name
+// --- Sales Index (column store and running totals for SALES_FILE, persisted as SALES_INDEX_FILE) ---
+typedef struct { // One valid row on its way into the columns (loader threads parse these in parallel)
+    long long offset, amount;                  // Byte offset of the row, line total in paise
+    unsigned long long invoice;                // Integer invoice ID: invoiceHash of the row's invoice text
+    int day, mcode, quantity;                  // day = daysFromCivil(date_str) or SALES_DAY_NONE
+} SalesIndexEntry;
+
+typedef struct { // The indexed rows as parallel columns: row i is offset[i], invoice[i], ..., so an aggregate reads only what it sums
+    long long *offset, *amount;
+    unsigned long long *invoice;
+    int *day, *mcode, *quantity;
+    unsigned char *first_of_invoice;           // 1 on the first row of each invoice, so its sum counts invoices
+} SalesColumns;
+
+typedef struct { long long units, paise, invoices; } SalesSums; // What the aggregation kernels add up over a run of rows
+
+// Daily rollups, derived from the columns (built on the first date-range query, then kept up to date on add)
+typedef struct { int mcode; long long units, revenue_paise; } SalesRollupItem;
+typedef struct { int day; long long units, invoices, revenue_paise; SalesRollupItem *items; int item_count, item_capacity; } SalesDay;
+typedef struct { int mcode, item; unsigned pass; } SalesCodeSlot; // Code -> day->items index while grouping one day; live only if stamped with the current pass
+
+typedef struct {
+    unsigned int magic, version;
+    long long sales_bytes;                     // Prefix of SALES_FILE the columns cover
+    long long rows, transactions, items_sold;  // transactions = unique invoice IDs
+    long long total_paise;
+    long long column_capacity;                 // Rows each column region of SALES_INDEX_FILE has room for (appends fill the slack)
+} SalesIndexHeader;
+
+typedef struct {
+    SalesIndexHeader hdr;
+    SalesColumns col; long long capacity;
+    unsigned long long *invoices; long long invoice_capacity, invoice_count; // Invoice hash set (0 = empty), built on the first add
+    SalesDay *days; int day_count, day_capacity, rollup_built;               // Sorted by day
+    SalesCodeSlot *code_slots; int code_slot_capacity; unsigned code_pass;  // Scratch table of the group-by-code kernel
+    int loaded;
+} SalesIndex;
+
+// --- Stock Page Query (viewStock's cursor and filters) ---
+typedef struct {
+    int from_code, to_code, limit;   // Window of the code order: codes from_code..to_code, at most 'limit' rows
+    int min_qty, max_qty;            // Optional filters; the defaults (INT_MIN..INT_MAX, -FLT_MAX..FLT_MAX) let every row through
+    double min_price, max_price;
+} StockPageQuery;
+
+// --- Request Parameters (form body or query string, split once, values decoded on first use) ---
+typedef struct { const char *key; char *value; int next, decoded; } RequestParam; // next: index of the next pair with the same key, -1 at the end
+typedef struct { int first, last; } RequestParamSlot; // Open-addressing slot per distinct key: its first and last pair
+typedef struct { RequestParam *params; int count; RequestParamSlot *slots; int slot_count; } RequestParams; // keys/values point into the parsed buffer
+
+// --- CSV Scanner (STOCK_FILE / SALES_FILE rows, 64 bytes classified at a time) ---
+typedef struct { const char *ptr; int len; int quoted, escaped; } CsvField; // Inside the scanned buffer, quotes and edge blanks stripped; escaped: holds "" pairs
+typedef struct {
+    const char *buf; size_t len, pos;         // pos: start of the next row
+    size_t block, block_end; unsigned long long mask; // Bit i set: buf[block + i] is ',' '"' or '\n'
+    size_t row_start, row_end; int row_complete;      // Last row returned: [row_start, row_end), and whether it ended in '\n'
+} CsvScanner;
+
+// --- Gzip Stream (deflate with the fixed Huffman codes; no zlib dependency) ---
+typedef struct {
+    unsigned char *out; size_t len, cap; // Compressed bytes not yet taken by the caller
+    unsigned long long bitbuf; int bitcount; unsigned long crc, isize;
+    int *head, *prev; // LZ77 match finder: newest position per 3-byte hash, and the chain of older ones
+} GzipStream;
+
+// --- Response Output (page body buffered in memory, written to stdout in large batches) ---
+typedef struct { char *buf; size_t len, cap; long long bytes, writes; int gzip; GzipStream gz; } ResponseOut;
+
+// --- Metrics (per-phase latency histograms and counters, exported in Prometheus text format) ---
+typedef enum { METRIC_LOAD, METRIC_PARSE, METRIC_LOOKUP, METRIC_STOCK_WRITE, METRIC_COMPACT, METRIC_SALES_APPEND, METRIC_RENDER, METRIC_OUTPUT, METRIC_REQUEST, METRIC_PHASES } MetricPhase;
+typedef enum { METRIC_ACTION_VIEW, METRIC_ACTION_SEARCH, METRIC_ACTION_ADD, METRIC_ACTION_IMPORT, METRIC_ACTION_UPDATE, METRIC_ACTION_BILLING, METRIC_ACTION_EXPIRY, METRIC_ACTION_REPORT, METRIC_ACTION_METRICS, METRIC_ACTION_LOG_LEVEL, METRIC_ACTION_LOOKUP, METRIC_ACTION_OTHER, METRIC_ACTIONS } MetricAction;
+typedef struct { unsigned long long count, sum_ns, buckets[METRIC_BUCKETS]; } MetricHistogram; // buckets[i]: samples in (bound i-1, bound i]; slower ones only in count
+typedef struct {
+    MetricHistogram phases[METRIC_PHASES];
+    unsigned long long requests[METRIC_ACTIONS], not_modified; // Requests by action; 304 answers
+    unsigned long long stock_rows_malformed, sales_rows_malformed;
+} Metrics;
+
+// --- Stock Record Store (the only copy of each loaded medicine) ---
+typedef unsigned int StockHandle; // 1-based record number in the StockStore; 0 = none
+
+typedef struct { // Hot part: what scans, filters and bills touch (16 bytes, four to a cache line)
+    int mcode;
+    int price_paise;  // Price in paise, rounded from the row's rupees
+    int quantity;
+    int expiry;       // stockExpiryPack(year, month, day): orders like the date
+} StockItem;
 
-// --- Hash Table Node Structure (for Separate Chaining) ---
-typedef struct HashNode {
-    struct medicine data; // Store the actual data
-    struct HashNode *next;
-} HashNode;
+typedef struct { // Cold part: read only when a row is shown
+    unsigned int name, supplier; // Ids in StockStore.names / StockStore.suppliers
+    long long s_contact;
+} StockItemCold;
+
+typedef struct { // Interned NUL-terminated strings, each stored once; ids are dense, in first-seen order
+    char *data; unsigned int len, cap;            // The strings back to back
+    unsigned int *offsets; unsigned int count, id_cap; // offsets[id] into data
+    unsigned int *slots; unsigned int slot_count; // id + 1 per slot (0 = empty), linear probing; built on the first intern
+} StringPool;
+
+typedef struct StockStore {
+    StockItem **chunks; StockItemCold **cold; int chunk_count, chunk_capacity; // Fixed-size chunks, so record addresses never move
+    unsigned int count;
+    StringPool names, suppliers;
+} StockStore;
+
+typedef struct { unsigned char *base; size_t size; } StockSnapshotMap; // Copy-on-write mapping of STOCK_SNAPSHOT_FILE (heap copy on Windows)
+
+// --- Ordered Index Structure (sorted array + small sorted insert buffer) ---
+typedef long long OrderedKey; // Unique per record: the code, or e.g. (expiry day << 32 | code)
+typedef OrderedKey (*OrderedKeyFn)(const StockItem *m);
+typedef struct { OrderedKey key; StockHandle handle; } OrderedEntry; // Key copied next to the handle so binary search stays in the index
+
+typedef struct OrderedIndex {
+    StockStore *store;                         // Records the handles refer to
+    OrderedKeyFn key_of;                       // Derives a record's key (orderedKeyByCode, orderedKeyByExpiry)
+    OrderedEntry *items; int count, capacity;  // Sorted by key
+    OrderedEntry *delta; int delta_count;      // Recent inserts, sorted, merged into items once ORDERED_DELTA_MAX fill up
+    int unsorted;                              // Set by orderedIndexAppend on out-of-order rows until orderedIndexFinishLoad
+} OrderedIndex;
+
+typedef struct { const OrderedIndex *idx; int i, j; } OrderedIndexIter; // Cursor merging items[] and delta[] in key order
+
+// --- Name Search Index Structure (lower-cased trigram postings) ---
+typedef struct {
+    unsigned int trigram;                         // Three lower-cased name bytes, packed; 0 = empty slot
+    StockHandle *postings; int count, capacity;   // Handles whose name contains the trigram, ascending (handles only grow)
+} NameTrigramSlot;
+
+typedef struct NameIndex {
+    StockStore *store;
+    NameTrigramSlot *slots; int capacity, count;  // Linear probing on trigram, capacity a power of two
+} NameIndex;
+
+// --- Hash Table Structure (Open Addressing, Robin Hood probing) ---
+typedef struct HashSlot {
+    int mcode;             // Key, kept in the slot so probing never touches the record
+    StockHandle handle;    // Record in HashTable.store; 0 = empty slot
+} HashSlot;
+
+typedef struct HashTable {
+    HashSlot *slots; int capacity, count; // capacity is a power of two
+    StockStore *store;                    // Records the handles refer to (shared with the ordered index)
+} HashTable;
 
 // --- Structure for handling multiple billing items (Unchanged) ---
 struct bill_item_request {
@@ -72,60 +268,218 @@ struct bill_item_request {
     int original_stock_qty;
     int new_stock_qty; // Calculated new quantity IF successful
     char error_msg[100]; // To store specific error for this item
-    struct medicine* stock_data_ptr; // Pointer to the medicine data in hash table (for easy update)
+    StockItem* stock_data_ptr; // The item's record in the stock store (for easy update)
 };
 
 
 // --- Global Data Structures ---
 // Initialized in main, freed in main
-HashNode **globalHashTable = NULL;
-int globalHashTableSize = HASH_TABLE_SIZE;
-node *globalBstRoot = NULL;
+StockStore *globalStockStore = NULL;
+HashTable *globalHashTable = NULL;
+OrderedIndex *globalStockIndex = NULL;  // By code
+OrderedIndex *globalExpiryIndex = NULL; // By expiry date, then code
+NameIndex *globalNameIndex = NULL;      // Trigram postings for name search
+SalesIndex globalSales;                 // Loaded lazily by refreshSalesIndex
+ResponseOut globalOut;                  // Pending page output (see outFlush)
+int serverMode = 0; // 1 when running the built-in HTTP listener (--serve), 0 for one-shot CGI
+const char *requestAcceptEncoding = NULL, *requestIfNoneMatch = NULL, *requestAccept = NULL; // Headers of the request being answered (CGI environment or parsed in server mode), NULL if absent
+char *requestCsvBody = NULL; // Body of a text/csv POST (a delivery file for import_stock), NULL otherwise; see requestSplitCsvBody
+time_t stockFileMtime = 0; long long stockFileSize = -1, stockFileMtimeNs = 0, stockFileInode = 0; // Stamp of STOCK_FILE when last loaded/written by us
+long long stockJournalApplied = 0; // Bytes of STOCK_JOURNAL_FILE replayed into memory (end of the last complete group)
+StockSnapshotMap stockSnapshotMap; // Snapshot the global stock is attached to; its structures point into it until they outgrow it
+int loadThreadCount = 0; // Loader threads: 0 = one per online CPU (up to LOAD_MAX_THREADS), 1 = sequential
+int logLevel = LOG_INFO; // logAt threshold: MEDICAL_LOG_LEVEL at startup, action=log_level at runtime
+Metrics globalMetrics;   // This process's counters (cumulative across requests under --serve). Only the request thread records
 
 
 // --- Function Prototypes ---
 
+// Metrics / Logging
+unsigned long long metricsNow(); // Monotonic clock in nanoseconds
+void metricsRecord(MetricPhase phase, unsigned long long start_ns); // Adds metricsNow() - start_ns to the phase's histogram
+MetricAction metricsAction(const char *action, const char *action_type); // Request label for medical_requests_total
+void metricsWritePrometheus(); // outPrintf's every metric in the Prometheus text exposition format
+int logLevelFromName(const char *name); // "error"/"warn"/"info"/"debug" (or 0-3) -> LOG_*, -1 if unknown
+const char *logLevelName(int level);
+
 // Helpers
 void urlDecode(char *dst, const char *src);
-char* get_param(const char *data, const char *param_name);
 const char *stristr(const char *haystack, const char *needle);
-int parse_multi_value_param(const char *data, const char *param_name, char **values, int max_values);
-char* get_csv_field(char **line_ptr, int *is_quoted); // For robust CSV parsing
+int parseRequestParams(char *data, RequestParams *req); // Splits the key=value pairs in place in 'data' and decodes the keys. 1 ok, 0 alloc failure (data may be NULL)
+int requestParamFind(const RequestParams *req, const char *name); // Index of the first 'name' pair (follow .next for the rest), -1 if absent
+const char *requestParamAt(const RequestParams *req, int i); // Value of pair i, URL-decoded in place the first time it is asked for
+const char *requestParam(const RequestParams *req, const char *name); // First value of 'name', or NULL. Valid while the parsed buffer is
+int requestParamValues(const RequestParams *req, const char *name, const char **values, int max_values); // Fills up to max_values in request order; returns how many there are in total
+int requestParamInt(const RequestParams *req, const char *name, long lo, long hi, int *out); // 1 and *out set if 'name' is a whole number in [lo, hi], 0 if absent, -1 if invalid
+int requestParamDouble(const RequestParams *req, const char *name, double lo, double hi, double *out); // Same for a decimal number
+void freeRequestParams(RequestParams *req);
+char *readWholeFile(const char *path, size_t *len); // NUL-terminated contents (caller frees), or NULL with errno set
+long long statMtimeNs(const struct stat *st); // Sub-second part of st's mtime, 0 where the platform keeps none
+
+// CSV Scanner
+int csvSetScanLevel(int level); // 0 scalar, 1 SSE2, 2 AVX2, -1 best available. Returns the level in use (capped by the CPU)
+const char *csvScanLevelName(int level);
+void csvScanInit(CsvScanner *sc, const char *buf, size_t len);
+int csvNextRow(CsvScanner *sc, CsvField *fields, int max_fields); // Splits the next row; returns its field count (all counted, max_fields stored), 0 at the end
+size_t csvFieldCopy(const CsvField *f, char *dst, size_t size); // Unescapes "" and NUL-terminates, truncating like snprintf. Returns the full length
+int csvFieldEquals(const CsvField *f, const char *text);
+int csvFieldInt(const CsvField *f, long long *out); // 1 if the whole field is a (signed) decimal integer of up to 18 digits
+int csvFieldDecimal(const CsvField *f, double *out); // 1 if the whole field is a number; plain d.dd without strtod
+const char *csvQuoteField(const char *text, char *buf, size_t size); // 'text' itself, or a quoted copy in buf if it holds ',' '"' or a line break
+
+// Gzip Stream
+int gzipBegin(GzipStream *gz); // Emits the gzip header into gz->out. 1 ok, 0 alloc failure
+int gzipWrite(GzipStream *gz, const unsigned char *data, size_t n, int final); // Compresses data into gz->out (byte-aligned afterwards); final ends the stream
+void gzipFree(GzipStream *gz);
+unsigned char *gzipCompress(const void *data, size_t n, size_t *out_len); // One-shot; caller frees. NULL on failure
+
+// Response Output (all page output goes through these)
+void outPrintf(const char *fmt, ...); // Buffered printf
+void outHtml(const char *text); // Buffered, HTML-escaped text
+void outFlush(); // Flushes stdio first, then writes the buffer (compressed after outStartGzip) to stdout's fd
+int outPrepareGzip(); // Sets up the gzip stream before the headers promise it. 1 ok, 0 send identity
+void outStartGzip(); // After outPrepareGzip: everything written so far (the headers) goes out as is, the rest gzipped
+void outFinish(); // Ends the response: closes the gzip stream, if any, and flushes
+const char *htmlEscape(const char *text, char *dst, size_t size); // For printf callers; truncates to fit
+const char *urlEncode(const char *text, char *dst, size_t size); // Query-string value for a link; truncates to fit
+void outStockRow(const StockStore *store, StockHandle handle); // One stock-table row, with Rupee symbol
+
+// Stock Record Store
+StockStore* createStockStore();
+StockHandle stockStoreAdd(StockStore *store, const struct medicine *med); // Splits the row into its hot and cold parts. Returns 0 on error
+StockItem* stockStoreGet(const StockStore *store, StockHandle handle); // Hot part. Stable until freeStockStore
+StockItemCold* stockStoreCold(const StockStore *store, StockHandle handle); // Cold part. Stable until freeStockStore
+const char *stockStoreName(const StockStore *store, StockHandle handle); // Valid until the next stockStoreAdd
+void stockStoreRow(const StockStore *store, StockHandle handle, struct medicine *row); // Reassembles the flat row
+int stockExpiryPack(int year, int month, int day); // year << 9 | month << 5 | day, -1 outside 1-9999 / 1-12 / 1-31
+void stockExpiryUnpack(int expiry, int *year, int *month, int *day);
+unsigned int stringPoolIntern(StringPool *pool, const char *text); // Id of 'text', added if new. STRING_POOL_NONE on alloc failure
+const char *stringPoolGet(const StringPool *pool, unsigned int id); // Valid until the next intern
+void freeStockStore(StockStore *store);
+size_t stockStoreBytes(const StockStore *store); // Heap held by the store
+void stockFree(void *p); // free(), except for memory borrowed from stockSnapshotMap
+void *stockRealloc(void *p, size_t old_bytes, size_t new_bytes); // realloc(); a block in stockSnapshotMap is copied out instead of resized
+int addStockRecord(const struct medicine *med, int bulk); // Stores and indexes one medicine in the global stock. 1 ok, 0 duplicate, -1 error
+int addStockRecords(const struct medicine *meds, int count); // Batch of new medicines (codes absent and distinct): indexes built in one pass. 1 ok, -1 error
 
 // Hashing Functions
-unsigned int hashFunction(int key, int tableSize);
-HashNode** createHashTable(int size);
-int insertIntoHashTable(HashNode **table, int tableSize, struct medicine med); // Returns 1 on success, 0 on duplicate/error
-struct medicine* searchHashTableByCode(HashNode **table, int tableSize, int code); // Returns pointer to medicine data or NULL
-void freeHashTable(HashNode **table, int tableSize);
-int updateHashTableQuantity(HashNode **table, int tableSize, int code, int new_quantity);
-
-// BST Functions (using 'struct node')
-node* createBstNode(struct medicine med);
-node* insertBstNode(node* root, struct medicine med);
-node* searchBSTByCode(node* root, int code);
-void searchBSTByNameSubstring(node* root, const char* nameQuery, int* matchCount); // Prints matches
-void freeTree(node* root);
-int updateBstQuantity(node* root, int code, int new_quantity);
-void printBstInOrder(node *root); // Modified for Rupee symbol
-void checkExpiryRecursive(node *root, time_t today_start_t, time_t warning_start_t, int *relevant_items_found, int warning_days);
+unsigned int hashFunction(int key, int tableSize); // tableSize must be a power of two
+HashTable* createHashTable(int size, StockStore *store); // size is rounded up to a power of two
+int insertIntoHashTable(HashTable *table, StockHandle handle); // Returns 1 on success, 0 on duplicate, -1 on error
+int hashTableReserve(HashTable *table, int count); // Room for 'count' records without regrowing. 1 ok, 0 alloc failure
+StockHandle hashTableFind(const HashTable *table, int code); // The code's record, 0 if absent
+StockItem* searchHashTableByCode(HashTable *table, int code); // Returns pointer to the stored record or NULL
+void freeHashTable(HashTable *table); // Does not free the store
+int updateHashTableQuantity(HashTable *table, int code, int new_quantity); // Writes the shared record, so the ordered index sees it too
+
+// Ordered Index Functions (key order, no recursion)
+OrderedKey orderedKeyByCode(const StockItem *m);
+OrderedKey orderedKeyByExpiry(const StockItem *m); // Expiry day, ties broken by code
+long daysFromCivil(int year, int month, int day); // Days since 1970-01-01 (proleptic Gregorian), no mktime/timezone involved
+void civilFromDays(long days, int *year, int *month, int *day); // Inverse of daysFromCivil
+OrderedIndex* createOrderedIndex(StockStore *store, OrderedKeyFn key_of);
+int insertOrderedIndex(OrderedIndex *idx, StockHandle handle); // Returns 1 on success, 0 on duplicate, -1 on error
+int orderedIndexAppend(OrderedIndex *idx, StockHandle handle); // Bulk load: append without ordering, then call orderedIndexFinishLoad. Returns 1/0
+int orderedIndexFinishLoad(OrderedIndex *idx); // Sorts appended rows (skipped when they arrived ascending)
+int orderedIndexInsertBatch(OrderedIndex *idx, const StockHandle *handles, int count); // New distinct keys, merged into the sorted array in one pass. 1 ok, 0 alloc failure
+StockItem* searchOrderedIndex(OrderedIndex *idx, OrderedKey key);
+void orderedIndexSeek(const OrderedIndex *idx, OrderedKey from, OrderedIndexIter *it); // Positions 'it' at the first key >= from (ORDERED_KEY_MIN for all)
+StockHandle orderedIndexNextHandle(OrderedIndexIter *it); // Next record in key order, 0 at the end
+StockItem* orderedIndexNext(OrderedIndexIter *it); // Same, as the record (NULL at the end)
+OrderedKey orderedIndexPeekKey(const OrderedIndexIter *it); // Key orderedIndexNext would return next, ORDERED_KEY_MAX at the end
+int orderedIndexSize(const OrderedIndex *idx);
+void freeOrderedIndex(OrderedIndex *idx); // Does not free the store
+size_t orderedIndexBytes(const OrderedIndex *idx);
+
+// Name Search Index
+NameIndex* createNameIndex(StockStore *store);
+int nameIndexAdd(NameIndex *idx, StockHandle handle); // Returns 1 on success, 0 on alloc failure
+int nameIndexMerge(NameIndex *dst, const NameIndex *src); // Appends src's postings; every src handle must be above every dst handle. 1 ok, 0 alloc failure
+int searchNameIndex(NameIndex *idx, const char *query, int prefix, OrderedEntry **results); // Case-insensitive substring (or prefix) match; fills *results (code, handle) sorted by code, caller frees. Returns count or -1
+void freeNameIndex(NameIndex *idx);
+size_t nameIndexBytes(const NameIndex *idx);
+void searchStockByName(const char* nameQuery, int prefix, int* matchCount); // Prints matches (buffered; caller calls outFlush)
+int printStockPage(OrderedIndex *idx, const StockPageQuery *q, int *next_code); // Rows of one viewStock window (buffered). Returns rows printed; *next_code: next page's from_code, -1 at the end
+void printExpiringStock(OrderedIndex *expiry_index, long today, int warning_days, int *relevant_items_found); // Range scan up to today + warning_days (buffered)
 
 // Data Loading
-int loadStockData(const char* filename, HashNode ***hashTablePtr, int *hashTableSizePtr, node **bstRootPtr); // Returns 1 on success, 0 on failure
+typedef int (*StockRowHandler)(const struct medicine *m, void *ctx); // Called per stock row; return 0 to abort the load
+int stockRowFromCsv(const CsvField *f, int count, struct medicine *m); // One STOCK_FILE row. Returns 1 if well formed
+int formatStockCsvRow(const struct medicine *m, char *buf, size_t size); // STOCK_FILE line (with '\n'), snprintf-style return
+int readStockCsv(const char *filename, StockRowHandler handler, void *ctx); // Returns 1 on success (missing file is OK), 0 on failure
+int loadStockData(const char* filename); // Into the (empty) global stock, on loadThreads() threads. Returns 1 on success, 0 on failure
+
+// Parallel Loading
+int loadThreads(size_t bytes); // Threads worth using on 'bytes' of input (1 = sequential)
+void runLoadTasks(void (*fn)(void *task), void *tasks, size_t task_size, int count); // fn on every task, each on its own thread (the first on the caller's)
+int csvSplitRows(const char *buf, size_t len, int parts, size_t *bounds); // bounds[0..parts] on row starts, bounds[parts] = len. Returns parts actually used
+int writeStockSnapshot(const char *filename, const struct stat *source); // Dumps the global stock and its indexes as a snapshot of 'source' (STOCK_FILE's stat)
+int readStockSnapshot(const char *filename, const struct stat *source, StockRowHandler handler, void *ctx); // 1 ok, 0 missing/stale/invalid, -1 handler abort
+int loadStockSnapshot(const char *filename, const struct stat *source); // Attaches the (empty) global stock to the mapped file. 1 ok, 0 missing/stale/invalid, -1 alloc failure
+void stockSnapshotRelease(); // Unmaps stockSnapshotMap; only once nothing points into it (freeGlobalStock)
+
+// Stock Journal
+int journalAppendGroup(const int *codes, const int *deltas, const int *new_qtys, int count); // One fsync'd all-or-nothing group. Returns 1 on success, 0 on failure
+int replayStockJournal(const char *filename, long long from, long long *applied_end); // Applies committed groups after byte 'from'; *applied_end = end of the last one. Returns groups applied, -1 on read error
+int compactStockJournal(); // Rewrites STOCK_FILE with in-memory quantities and empties the journal. Returns 1 on success
+void maybeCompactStockJournal(); // Compacts once the journal passes JOURNAL_COMPACT_BYTES
 
 // Core Logic Functions
-void processAddStock(char *post_data);
-void viewStock(); // Uses BST traversal (modified for Rupee symbol)
-void processUpdateStock(char *request_data); // Uses Hash find, rewrites file, updates memory
-int saveSaleRecord(const struct sale_record *sale); // Modified for Invoice ID
-void processBillingMultiple(char *request_data); // Modified for Invoice ID
-void checkExpiry(); // Uses BST traversal
-void generateReport(); // Modified for Invoice ID and Rupee Symbol in totals
-void searchMedicine(char *request_data); // Modified for Rupee symbol
+// Sales Index
+unsigned long long invoiceHash(const char *invoice_id);
+int saleFromCsv(const CsvField *f, int count, struct sale_record *sale); // One SALES_FILE row's fields. Returns 1 if it is a valid sale row
+int parseSaleLine(const char *line, struct sale_record *sale); // saleFromCsv for a single line
+int salesDayFromDate(const char *date_str); // "YYYY-MM-DD" -> daysFromCivil, or SALES_DAY_NONE
+int salesSetKernelLevel(int level); // Picks the scalar (0), SSE2 (1) or AVX2 (2) aggregation kernels; -1 or an unsupported level = best available. Returns the level used
+void salesSumRows(const SalesColumns *col, long long from, long long to, SalesSums *sums); // Totals of rows [from, to) with the current kernels
+int buildSalesRollup(SalesIndex *si); // Aggregates the columns into daily rollups if not done yet. Returns 1 on success, 0 on alloc failure
+int querySalesRange(SalesIndex *si, int from_day, int to_day, SalesDay *totals, SalesRollupItem **items); // Sums the days in [from_day, to_day]; per-code totals into *items (caller frees). Returns item count or -1
+int refreshSalesIndex(); // Loads SALES_INDEX_FILE (once) and indexes rows appended to SALES_FILE since. Returns 1 on success, 0 on failure
+void freeSalesIndex();
+
+void processAddStock(const RequestParams *req);
+const char *stockRowProblem(const struct medicine *m); // Why a new stock item is unacceptable (add_stock/import_stock rules), NULL if it is fine
+void processImportStock(const RequestParams *req, const char *csv); // Delivery file: 'csv' (text/csv body) or the stockCsv field; valid rows appended in one write
+void viewStock(const RequestParams *req); // One page of the code order: from_code/to_code/limit, optional min_/max_ qty and price filters
+int applyStockUpdate(int code, int qty_change, int *final_qty, int *clamped, char *name, size_t name_size); // Locked, journalled quantity change (clamped at 0). 1 ok, 0 code not in stock, -1 internal error
+void processUpdateStock(const RequestParams *req); // Uses Hash find, appends to stock journal, updates memory
+int saveSaleRecords(const struct sale_record *sales, int count); // Appends all rows with one write + fsync (all or nothing), then indexes them. Returns 1 on success, 0 on failure
+int saveSaleRecord(const struct sale_record *sale); // saveSaleRecords for a single row
+int commitBill(const char *cust_name, struct bill_item_request *items, int n_items, char *invoice_id, size_t id_size, int *sales_saved); // Validates, journals and records one bill. 1 billed, 0 stock validation failed (items' error_msg), -1 internal error
+void processBillingMultiple(const RequestParams *req); // Modified for Invoice ID
+void checkExpiry(const RequestParams *req); // Range scan of the expiry index; 'days' param (default EXPIRY_DEFAULT_DAYS)
+void generateReport(const RequestParams *req); // Summary from the sales index totals, one 'page' of detail rows (default: the newest)
+int parseSearchQuery(const RequestParams *req, const char *query, char *name_query, size_t size, int *prefix); // The code searched for, or 0 for a name search (name_query and *prefix set)
+void searchMedicine(const RequestParams *req); // Modified for Rupee symbol
+
+// JSON API
+int requestWantsJson(const RequestParams *req); // format=json, or an Accept header naming application/json (format=html overrides)
+void outJsonString(const char *text); // Buffered, quoted and escaped JSON string
+int handleJsonRequest(const char *req_method, const RequestParams *req); // Answers the request as JSON if it asks for that. 1 handled, 0 not a JSON request
+
+// Request Handling / Server Mode
+int createGlobalStock(); // Allocates the empty global store and indexes. Returns 1 on success, 0 on failure
+int loadGlobalStock(); // createGlobalStock + loads STOCK_FILE (or the snapshot) and the journal. Returns 1 on success, 0 on failure
+void freeGlobalStock();
+void recordStockFileStamp(); // Remember STOCK_FILE size/mtime after we load or write it
+void forgetStockFileStamp(); // Makes the next stockFileChanged() report a change, so syncStockFromDisk reloads everything
+int stockFileChanged(); // 1 if STOCK_FILE was modified by someone else since recordStockFileStamp()
+int syncStockFromDisk(); // Catches memory up with other processes: journal tail, or a full reload if STOCK_FILE changed / the journal was compacted. 1 ok, 0 failure
+// Stock Locking (POSIX fcntl record locks; no-ops on Windows)
+int stockLockItems(const int *codes, int count); // Exclusive lock on each code, taken in ascending order. Blocks. Returns 1 on success, 0 on failure
+void stockUnlockItems(const int *codes, int count);
+int stockLockRange(long long start, long long len, int lock); // lock=1 blocks for an exclusive lock, 0 unlocks; len 0 = to the end (everything). Returns 1/0
+int clientAcceptsGzip(); // From requestAcceptEncoding
+int etagMatches(const char *if_none_match, const char *etag); // Weak comparison against an If-None-Match list
+int pageEtag(const char *req_method, const RequestParams *req, char *etag, size_t size); // 1 and a weak ETag if the page is a cacheable read-only view, else 0
+void printResponseHeaders(const char *status, const char *content_type, const char *etag, int gzip); // CGI headers or HTTP status line in server mode; content_type NULL for 304
+void handleRequest(const char *req_method, char *req_data); // Renders one full page for the given request
+char *requestSplitCsvBody(const char *content_type, char *body, const char *query); // text/csv POST: body -> requestCsvBody, returns a copy of the query string to parse instead
+int runServer(int port, const char *doc_root); // Long-running localhost HTTP listener keeping stock resident
 
 // --- Helper Function Implementations ---
 
-// urlDecode, get_param, parse_multi_value_param, stristr remain unchanged...
+// urlDecode, stristr remain unchanged...
 void urlDecode(char *dst, const char *src) {
     char a, b; if (!dst || !src) { fprintf(stderr, "urlDecode: NULL pointer.\n"); fflush(stderr); return; }
     size_t src_len = strlen(src); char *dst_start = dst;
@@ -139,755 +493,2864 @@ void urlDecode(char *dst, const char *src) {
     } *dst = '\0';
 }
 
-char* get_param(const char *data, const char *param_name) {
-    if (data == NULL || param_name == NULL || *data == '\0') { return NULL; }
-    const char *pair_start = data; char *found_value_encoded = NULL; char *found_value_decoded = NULL;
-    size_t param_len = strlen(param_name);
-    while (pair_start && *pair_start) {
-        const char *pair_end = strchr(pair_start, '&'); size_t current_pair_len = pair_end ? (pair_end - pair_start) : strlen(pair_start);
-        const char *eq_pos = NULL; size_t i; for (i = 0; i < current_pair_len; ++i) { if (pair_start[i] == '=') { eq_pos = pair_start + i; break; } }
-        if (eq_pos && (size_t)(eq_pos - pair_start) == param_len && strncmp(pair_start, param_name, param_len) == 0) {
-            const char *value_start = eq_pos + 1; size_t value_len = (pair_start + current_pair_len) - value_start;
-            found_value_encoded = (char *)malloc(value_len + 1); if (!found_value_encoded) { return NULL; }
-            strncpy(found_value_encoded, value_start, value_len); found_value_encoded[value_len] = '\0';
-            found_value_decoded = (char *)malloc(value_len + 1); if (!found_value_decoded) { free(found_value_encoded); return NULL; }
-            urlDecode(found_value_decoded, found_value_encoded); free(found_value_encoded); return found_value_decoded;
-        } if (pair_end) { pair_start = pair_end + 1; } else { break; }
-    } return NULL;
-}
-
-int parse_multi_value_param(const char *data, const char *param_name, char **values, int max_values) {
-    if (data == NULL || param_name == NULL || values == NULL || max_values <= 0) { return 0; }
-    const char *pair_start = data; size_t param_len = strlen(param_name); int count = 0;
-    while (pair_start && *pair_start && count < max_values) {
-        const char *pair_end = strchr(pair_start, '&'); size_t current_pair_len = pair_end ? (pair_end - pair_start) : strlen(pair_start);
-        const char *eq_pos = NULL; size_t i; for (i = 0; i < current_pair_len; ++i) { if (pair_start[i] == '=') { eq_pos = pair_start + i; break; } }
-        if (eq_pos && (size_t)(eq_pos - pair_start) == param_len && strncmp(pair_start, param_name, param_len) == 0) {
-            const char *value_start = eq_pos + 1; size_t value_len = (pair_start + current_pair_len) - value_start;
-            char *encoded_val = (char *)malloc(value_len + 1); char *decoded_val = (char *)malloc(value_len + 1);
-            if (!encoded_val || !decoded_val) { fprintf(stderr, "parse_multi_value_param: Mem alloc failed.\n"); if (encoded_val) free(encoded_val); if (decoded_val) free(decoded_val); for (int k = 0; k < count; k++) { free(values[k]); values[k] = NULL; } return -1; }
-            strncpy(encoded_val, value_start, value_len); encoded_val[value_len] = '\0';
-            urlDecode(decoded_val, encoded_val); free(encoded_val); values[count++] = decoded_val;
-        } if (pair_end) { pair_start = pair_end + 1; } else { break; }
-    } return count;
+static unsigned int requestParamHash(const char *key) { unsigned int h = 2166136261u; while (*key) { h ^= (unsigned char)*key++; h *= 16777619u; } return h; } // FNV-1a
+
+static int requestHexDigit(char c) { return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1; }
+
+// '+' -> ' ' and %XX -> byte, in place: decoding never lengthens a field, so it writes over its own encoded bytes
+static void requestDecodeInPlace(char *s) {
+    s += strcspn(s, "%+"); char *dst = s; if (*s == '\0') return; // Most values have nothing to decode
+    for (char c; (c = *s) != '\0'; s++) {
+        if (c == '+') { c = ' '; }
+        else if (c == '%') { int hi = requestHexDigit(s[1]), lo = hi >= 0 ? requestHexDigit(s[2]) : -1; if (lo >= 0) { c = (char)(hi * 16 + lo); s += 2; } }
+        *dst++ = c; }
+    *dst = '\0';
+}
+
+// Splits the body/query string in place in a single strchr pass: each '&' and each key's '=' become NULs, and keys
+// are decoded over their own bytes (they are short, and the hash table needs them). Values stay encoded until
+// requestParamAt first reads them, so a large field nobody asks for costs only the strchr that finds its end; the
+// last field is never measured at all. The pair table grows as it goes and the hash slots are appended to the same
+// block afterwards. Pairs without '=' are ignored.
+int parseRequestParams(char *data, RequestParams *req) {
+    memset(req, 0, sizeof(*req)); if (data == NULL || *data == '\0') return 1;
+    int cap = 16; RequestParam *params = (RequestParam *)malloc(sizeof(RequestParam) * (size_t)cap);
+    if (!params) { fprintf(stderr, "parseRequestParams: Mem alloc failed.\n"); return 0; }
+    for (char *p = data; p != NULL; ) {
+        char *key = p, *amp = strchr(p, '&'), *eq; // eq: the first '=' before amp (anywhere, for the last pair)
+        if (amp != NULL) { *amp = '\0'; p = amp + 1; eq = (char *)memchr(key, '=', (size_t)(amp - key)); } else { p = NULL; eq = strchr(key, '='); }
+        if (eq == NULL) continue;
+        if (req->count == cap) {
+            RequestParam *grown = (RequestParam *)realloc(params, sizeof(RequestParam) * (size_t)cap * 2);
+            if (!grown) { fprintf(stderr, "parseRequestParams: Mem alloc failed (%d pairs).\n", cap * 2); free(params); return 0; }
+            params = grown; cap *= 2; }
+        *eq = '\0'; requestDecodeInPlace(key);
+        RequestParam *rp = &params[req->count++]; rp->key = key; rp->value = eq + 1; rp->next = -1; rp->decoded = 0;
+    }
+    int slot_count = 16; while (slot_count < req->count * 2) slot_count *= 2;
+    char *block = (char *)realloc(params, sizeof(RequestParam) * (size_t)req->count + sizeof(RequestParamSlot) * (size_t)slot_count); // params, then slots
+    if (!block) { fprintf(stderr, "parseRequestParams: Mem alloc failed (%d pairs).\n", req->count); free(params); req->count = 0; return 0; }
+    req->params = (RequestParam *)block; req->slots = (RequestParamSlot *)(block + sizeof(RequestParam) * (size_t)req->count);
+    req->slot_count = slot_count; for (int i = 0; i < slot_count; i++) { req->slots[i].first = -1; }
+    for (int i = 0; i < req->count; i++) {
+        unsigned int slot = requestParamHash(req->params[i].key) & (unsigned int)(slot_count - 1);
+        while (req->slots[slot].first >= 0 && strcmp(req->params[req->slots[slot].first].key, req->params[i].key) != 0) { slot = (slot + 1) & (unsigned int)(slot_count - 1); }
+        if (req->slots[slot].first < 0) { req->slots[slot].first = i; } else { req->params[req->slots[slot].last].next = i; }
+        req->slots[slot].last = i;
+    }
+    return 1;
+}
+
+int requestParamFind(const RequestParams *req, const char *name) {
+    if (req == NULL || req->count == 0) return -1;
+    unsigned int slot = requestParamHash(name) & (unsigned int)(req->slot_count - 1);
+    while (req->slots[slot].first >= 0) { if (strcmp(req->params[req->slots[slot].first].key, name) == 0) return req->slots[slot].first; slot = (slot + 1) & (unsigned int)(req->slot_count - 1); }
+    return -1;
+}
+
+const char *requestParamAt(const RequestParams *req, int i) {
+    RequestParam *rp = &req->params[i]; if (!rp->decoded) { requestDecodeInPlace(rp->value); rp->decoded = 1; } return rp->value;
+}
+
+const char *requestParam(const RequestParams *req, const char *name) { int i = requestParamFind(req, name); return i >= 0 ? requestParamAt(req, i) : NULL; }
+
+int requestParamValues(const RequestParams *req, const char *name, const char **values, int max_values) {
+    int n = 0; for (int i = requestParamFind(req, name); i >= 0; i = req->params[i].next) { if (n < max_values) { values[n] = requestParamAt(req, i); } n++; }
+    return n;
+}
+
+int requestParamInt(const RequestParams *req, const char *name, long lo, long hi, int *out) {
+    const char *v = requestParam(req, name); if (v == NULL || *v == '\0') return 0;
+    char *e; errno = 0; long n = strtol(v, &e, 10); if (errno != 0 || *e != '\0' || n < lo || n > hi) return -1;
+    *out = (int)n; return 1;
 }
 
+int requestParamDouble(const RequestParams *req, const char *name, double lo, double hi, double *out) {
+    const char *v = requestParam(req, name); if (v == NULL || *v == '\0') return 0;
+    char *e; errno = 0; double n = strtod(v, &e); if (errno != 0 || *e != '\0' || !(n >= lo && n <= hi)) return -1;
+    *out = n; return 1;
+}
+
+void freeRequestParams(RequestParams *req) { free(req->params); memset(req, 0, sizeof(*req)); } // params is the start of the block holding both tables
+
 const char *stristr(const char *haystack, const char *needle) {
     if (!needle || !*needle) { return haystack; } if (!haystack) { return NULL; }
     while (*haystack) { const char *h = haystack; const char *n = needle; while (*h && *n && (tolower((unsigned char)*h) == tolower((unsigned char)*n))) { h++; n++; } if (!*n) { return haystack; } haystack++; } return NULL;
 }
 
-// Robust CSV field extractor (Unchanged)
-char* get_csv_field(char **line_ptr, int *is_quoted) {
-    if (line_ptr == NULL || *line_ptr == NULL || **line_ptr == '\0') return NULL;
-
-    char *start;
-    char *ptr = *line_ptr;
-    char *field_end = NULL;
-    *is_quoted = 0;
-
-    // Trim leading whitespace (optional, but good practice)
-    while (isspace((unsigned char)*ptr)) ptr++;
-
-    // Check if field starts with a quote
-    if (*ptr == '"') {
-        *is_quoted = 1;
-        ptr++; // Move past the opening quote
-        start = ptr; // Actual data starts here
-        while (*ptr) {
-            if (*ptr == '"') {
-                // Check for escaped quote ("")
-                if (*(ptr + 1) == '"') {
-                    // Copy the content before the escape sequence
-                    memmove(ptr, ptr + 1, strlen(ptr)); // Shift rest of string left by 1
-                    // ptr remains at the current position (which now holds the second quote)
-                     ptr++; // Move past the single quote that was kept
-                } else {
-                    // This is the closing quote
-                    field_end = ptr; // Mark the position of the closing quote
-                    *field_end = '\0'; // Null-terminate the field content
-                    ptr++; // Move past the (now null) closing quote
-                    // Find the next comma or end of line after the closing quote
-                    while (*ptr && *ptr != ',') {
-                         if (!isspace((unsigned char)*ptr)) {
-                              // Allow non-space characters after quotes, as the invoice ID might contain dashes
-                              // fprintf(stderr, "get_csv_field: Warning - Non-space char after closing quote: '%c'\n", *ptr);
-                         }
-                         ptr++;
-                    }
-                    if (*ptr == ',') ptr++; // Consume the comma
-                    *line_ptr = ptr; // Update the main line pointer
-                    return start; // Return the field data
-                }
-            } else {
-                ptr++;
-            }
-        }
-         // If loop finished without finding closing quote, it's malformed or end of line
-         *field_end = '\0'; // Null terminate at current position
-         *line_ptr = ptr; // Update the main line pointer
-         return start; // Return whatever was parsed
+char *readWholeFile(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "rb"); if (fp == NULL) return NULL;
+    struct stat st; char *data = NULL; int saved_errno = 0;
+    if (fstat(fileno(fp), &st) != 0 || (data = (char *)malloc((size_t)st.st_size + 1)) == NULL || fread(data, 1, (size_t)st.st_size, fp) != (size_t)st.st_size) { saved_errno = errno ? errno : EIO; free(data); data = NULL; }
+    fclose(fp); if (data) { data[st.st_size] = '\0'; *len = (size_t)st.st_size; } else { errno = saved_errno; } return data;
+}
 
-    } else {
-        // Unquoted field
-        start = ptr;
-        while (*ptr && *ptr != ',') {
-            // Special case for invoice ID which might contain '-'
-            if (*ptr == '"') {
-                // An unquoted field should ideally not contain quotes.
-                // Handle as error or just continue parsing? Let's continue.
-                fprintf(stderr, "get_csv_field: Warning - Quote found in unquoted field near '%s'\n", start);
-            }
-            ptr++;
-        }
-        field_end = ptr;
-        if (*ptr == ',') {
-            *ptr = '\0'; // Null-terminate the field
-            ptr++; // Move past the comma
+
+// --- CSV Scanner ---
+// A row can only break on ',', '"' or '\n'. csvScanMask turns 64 bytes into a bitmask of where those are, so the
+// tokenizer hops between them with a count-trailing-zeros instead of testing every byte of every name. The SSE2 and
+// AVX2 versions are chosen at runtime on x86 GCC/Clang builds; everything else uses the scalar loop. As with the
+// old line-at-a-time reader, a newline always ends the row, even inside quotes (saveSaleRecords never writes one).
+
+typedef unsigned long long (*CsvMaskFn)(const char *p); // Classifies p[0..63]
+
+static unsigned long long csvScanMaskScalar(const char *p) {
+    unsigned long long m = 0; for (int i = 0; i < 64; i++) { char c = p[i]; if (c == ',' || c == '"' || c == '\n') m |= 1ULL << i; } return m;
+}
+
+#ifdef CSV_SIMD_X86
+__attribute__((target("sse2"))) static unsigned long long csvScanMaskSse2(const char *p) {
+    const __m128i comma = _mm_set1_epi8(','), quote = _mm_set1_epi8('"'), nl = _mm_set1_epi8('\n'); unsigned long long m = 0;
+    for (int i = 0; i < 64; i += 16) { __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, quote)), _mm_cmpeq_epi8(v, nl));
+        m |= (unsigned long long)(unsigned int)_mm_movemask_epi8(hit) << i; }
+    return m;
+}
+
+__attribute__((target("avx2"))) static unsigned long long csvScanMaskAvx2(const char *p) {
+    const __m256i comma = _mm256_set1_epi8(','), quote = _mm256_set1_epi8('"'), nl = _mm256_set1_epi8('\n'); unsigned long long m = 0;
+    for (int i = 0; i < 64; i += 32) { __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, comma), _mm256_cmpeq_epi8(v, quote)), _mm256_cmpeq_epi8(v, nl));
+        m |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(hit) << i; }
+    return m;
+}
+#endif
+
+static int csvLevel = -1; // Not chosen yet
+static CsvMaskFn csvScanMask = csvScanMaskScalar;
+
+// Best SIMD level this CPU runs: 0 scalar, 1 SSE2, 2 AVX2 (also used by the sales aggregation kernels)
+static int simdBestLevel() {
+    int best = 0;
+#ifdef CSV_SIMD_X86
+    __builtin_cpu_init(); if (__builtin_cpu_supports("sse2")) best = 1; if (best && __builtin_cpu_supports("avx2")) best = 2;
+#endif
+    return best;
+}
+
+int csvSetScanLevel(int level) {
+    int best = simdBestLevel();
+    if (level < 0 || level > best) level = best;
+    csvLevel = level; csvScanMask = csvScanMaskScalar;
+#ifdef CSV_SIMD_X86
+    if (level == 1) csvScanMask = csvScanMaskSse2; else if (level == 2) csvScanMask = csvScanMaskAvx2;
+#endif
+    return level;
+}
+
+const char *csvScanLevelName(int level) { return level == 2 ? "avx2" : level == 1 ? "sse2" : "scalar"; }
+
+static int csvCtz64(unsigned long long m) {
+#ifdef __GNUC__
+    return __builtin_ctzll(m);
+#else
+    int n = 0; while (!(m & 1)) { m >>= 1; n++; } return n;
+#endif
+}
+
+void csvScanInit(CsvScanner *sc, const char *buf, size_t len) {
+    if (csvLevel < 0) csvSetScanLevel(-1);
+    memset(sc, 0, sizeof(*sc)); sc->buf = buf; sc->len = len;
+}
+
+// Offset of the first ',' '"' or '\n' at or after 'from', or sc->len. Blocks are classified lazily as the scan reaches them.
+static size_t csvNextSpecial(CsvScanner *sc, size_t from) {
+    while (from < sc->len) {
+        if (from >= sc->block_end || from < sc->block) {
+            sc->block = from; sc->block_end = from + 64 <= sc->len ? from + 64 : sc->len;
+            if (sc->block_end - from == 64) { sc->mask = csvScanMask(sc->buf + from); }
+            else { char tail[64] = { 0 }; memcpy(tail, sc->buf + from, sc->block_end - from); sc->mask = csvScanMask(tail); } } // Never read past the buffer
+        unsigned long long m = sc->mask & (~0ULL << (from - sc->block));
+        if (m) return sc->block + (size_t)csvCtz64(m);
+        from = sc->block_end;
+    }
+    return sc->len;
+}
+
+static int csvBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+int csvNextRow(CsvScanner *sc, CsvField *fields, int max_fields) {
+    const char *buf = sc->buf; size_t len = sc->len, p = sc->pos; int n = 0;
+    if (p >= len) return 0;
+    sc->row_start = p;
+    for (;;) {
+        while (p < len && csvBlank(buf[p])) p++;
+        CsvField f = { buf + p, 0, 0, 0 }; size_t stop, field_end;
+        if (p < len && buf[p] == '"') {
+            size_t start = ++p; f.quoted = 1;
+            for (;;) { stop = csvNextSpecial(sc, p);
+                if (stop >= len || buf[stop] == '\n') break; // Unterminated: the field runs to the end of the line
+                if (buf[stop] == '"') { if (stop + 1 < len && buf[stop + 1] == '"') { f.escaped = 1; p = stop + 2; continue; } break; }
+                p = stop + 1; } // A comma inside the quotes
+            f.ptr = buf + start; field_end = stop;
+            if (stop < len && buf[stop] == '"') { do { stop = csvNextSpecial(sc, stop + 1); } while (stop < len && buf[stop] == '"'); } // Anything after the closing quote is dropped
         } else {
-             *ptr = '\0'; // Null-terminate at end of line
+            stop = csvNextSpecial(sc, p); while (stop < len && buf[stop] == '"') stop = csvNextSpecial(sc, stop + 1); // A stray quote in an unquoted field is data
+            field_end = stop;
         }
-        *line_ptr = ptr; // Update the main line pointer
+        while (f.quoted && f.ptr < buf + field_end && csvBlank(*f.ptr)) f.ptr++;
+        while (field_end > (size_t)(f.ptr - buf) && csvBlank(buf[field_end - 1])) field_end--;
+        f.len = (int)(field_end - (size_t)(f.ptr - buf));
+        if (n < max_fields) fields[n] = f;
+        n++;
+        if (stop >= len) { sc->pos = sc->row_end = len; sc->row_complete = 0; return n; }
+        if (buf[stop] == '\n') { sc->pos = sc->row_end = stop + 1; sc->row_complete = 1; return n; }
+        p = stop + 1;
+    }
+}
+
+size_t csvFieldCopy(const CsvField *f, char *dst, size_t size) {
+    size_t n = 0;
+    if (!f->escaped) { n = (size_t)f->len; if (size > 0) { size_t c = n < size ? n : size - 1; memcpy(dst, f->ptr, c); dst[c] = '\0'; } return n; }
+    for (int i = 0; i < f->len; i++) { char c = f->ptr[i]; if (f->escaped && c == '"' && i + 1 < f->len && f->ptr[i + 1] == '"') i++; if (n + 1 < size) dst[n] = c; n++; }
+    if (size > 0) dst[n < size ? n : size - 1] = '\0';
+    return n;
+}
+
+int csvFieldEquals(const CsvField *f, const char *text) { size_t n = strlen(text); return !f->escaped && (size_t)f->len == n && memcmp(f->ptr, text, n) == 0; }
+
+int csvFieldInt(const CsvField *f, long long *out) {
+    const char *p = f->ptr, *e = f->ptr + f->len; int neg = 0; unsigned long long v = 0;
+    if (p < e && (*p == '-' || *p == '+')) { neg = (*p == '-'); p++; }
+    if (p == e || e - p > 18) return 0; // 18 digits cannot overflow
+    for (; p < e; p++) { unsigned int d = (unsigned int)(unsigned char)*p - '0'; if (d > 9) return 0; v = v * 10 + d; }
+    *out = neg ? -(long long)v : (long long)v; return 1;
+}
+
+static int csvFieldInt32(const CsvField *f, int *out) { long long v; if (!csvFieldInt(f, &v) || v < INT_MIN || v > INT_MAX) return 0; *out = (int)v; return 1; }
+
+// Up to 15 significant digits are exact in a double, so digits / 10^k is correctly rounded (the same value strtod gives)
+int csvFieldDecimal(const CsvField *f, double *out) {
+    static const double pow10[16] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+    const char *p = f->ptr, *e = f->ptr + f->len; int neg = 0, digits = 0, frac = -1; unsigned long long v = 0;
+    if (p < e && (*p == '-' || *p == '+')) { neg = (*p == '-'); p++; }
+    for (; p < e; p++) {
+        if (*p == '.' && frac < 0) { frac = 0; continue; }
+        unsigned int d = (unsigned int)(unsigned char)*p - '0'; if (d > 9 || digits == 15) break;
+        v = v * 10 + d; digits++; if (frac >= 0) frac++; }
+    if (p == e && digits > 0) { double x = (double)v / pow10[frac > 0 ? frac : 0]; *out = neg ? -x : x; return 1; }
+    char tmp[64]; char *end; if (f->len == 0 || (size_t)f->len >= sizeof(tmp)) return 0; // Exponents, long mantissas: the general path
+    memcpy(tmp, f->ptr, (size_t)f->len); tmp[f->len] = '\0'; double x = strtod(tmp, &end);
+    if (end == tmp || *end != '\0') return 0;
+    *out = x; return 1;
+}
+
+const char *csvQuoteField(const char *text, char *buf, size_t size) {
+    if (strpbrk(text, ",\"\r\n") == NULL || size < 3) return text;
+    size_t n = 0; buf[n++] = '"';
+    for (const char *p = text; *p && n + 3 < size; p++) { if (*p == '\r' || *p == '\n') continue; if (*p == '"') buf[n++] = '"'; buf[n++] = *p; }
+    buf[n++] = '"'; buf[n] = '\0'; return buf;
+}
+
+
+// --- Gzip Stream Implementation ---
+// Enough of RFC 1951/1952 to shrink HTML tables several times over: greedy LZ77 matches within each
+// gzipWrite call, coded with the fixed Huffman tables (no per-block code tables to build or send).
+
+#define GZIP_HASH_BITS 14
+#define GZIP_WINDOW 32768
+#define GZIP_MAX_CHAIN 8 // Match candidates tried per position
+
+static const unsigned short gzipLenBase[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+static const unsigned char gzipLenExtra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+static const unsigned short gzipDistBase[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+static const unsigned char gzipDistExtra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+static unsigned long gzipCrc32(unsigned long crc, const unsigned char *p, size_t n) {
+    static unsigned long table[256]; static int ready = 0;
+    if (!ready) { for (unsigned long i = 0; i < 256; i++) { unsigned long c = i; for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1; table[i] = c; } ready = 1; }
+    crc ^= 0xFFFFFFFFUL; while (n--) crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8); return crc ^ 0xFFFFFFFFUL;
+}
+
+static int gzipReserve(GzipStream *gz, size_t extra) {
+    if (gz->cap - gz->len >= extra) return 1;
+    size_t cap = gz->cap ? gz->cap : 4096; while (cap - gz->len < extra) cap *= 2;
+    unsigned char *nb = realloc(gz->out, cap); if (nb == NULL) { fprintf(stderr, "gzipReserve: Out of memory (%zu bytes).\n", cap); return 0; }
+    gz->out = nb; gz->cap = cap; return 1;
+}
+
+// Bits go out LSB first; callers reserve room beforehand (a symbol is at most 31 bits with its extra bits).
+static void gzipBits(GzipStream *gz, unsigned int value, int count) {
+    gz->bitbuf |= (unsigned long long)value << gz->bitcount; gz->bitcount += count;
+    while (gz->bitcount >= 8) { gz->out[gz->len++] = (unsigned char)gz->bitbuf; gz->bitbuf >>= 8; gz->bitcount -= 8; }
+}
+
+// Huffman codes are defined MSB first, so they are written bit-reversed.
+static void gzipCode(GzipStream *gz, unsigned int code, int count) {
+    unsigned int r = 0; for (int i = 0; i < count; i++) { r = (r << 1) | (code & 1); code >>= 1; } gzipBits(gz, r, count);
+}
+
+static void gzipLiteral(GzipStream *gz, int sym) { // 0-255 literals, 256 end of block, 257-287 lengths
+    if (sym < 144) gzipCode(gz, 0x30 + sym, 8); else if (sym < 256) gzipCode(gz, 0x190 + sym - 144, 9);
+    else if (sym < 280) gzipCode(gz, sym - 256, 7); else gzipCode(gz, 0xC0 + sym - 280, 8);
+}
+
+static void gzipMatch(GzipStream *gz, int len, int dist) {
+    int l = 28; while (gzipLenBase[l] > len) l--; gzipLiteral(gz, 257 + l); if (gzipLenExtra[l]) gzipBits(gz, (unsigned int)(len - gzipLenBase[l]), gzipLenExtra[l]);
+    int d = 29; while (gzipDistBase[d] > dist) d--; gzipCode(gz, (unsigned int)d, 5); if (gzipDistExtra[d]) gzipBits(gz, (unsigned int)(dist - gzipDistBase[d]), gzipDistExtra[d]);
+}
+
+int gzipBegin(GzipStream *gz) {
+    static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff }; // deflate, no name/mtime, unknown OS
+    memset(gz, 0, sizeof(*gz)); gz->head = malloc(sizeof(int) << GZIP_HASH_BITS); gz->prev = malloc(sizeof(int) * GZIP_WINDOW);
+    if (gz->head == NULL || gz->prev == NULL || !gzipReserve(gz, sizeof(header))) { gzipFree(gz); return 0; }
+    memcpy(gz->out, header, sizeof(header)); gz->len = sizeof(header); return 1;
+}
 
-        // Trim trailing whitespace from unquoted field
-        char *trimmed_end = field_end - 1;
-        while(trimmed_end >= start && isspace((unsigned char)*trimmed_end)) {
-            *trimmed_end = '\0';
-            trimmed_end--;
+// One fixed-Huffman block per call. A non-final block is followed by an empty stored block (a "sync flush"),
+// so everything written so far can be decoded by the client before the rest of the page arrives.
+int gzipWrite(GzipStream *gz, const unsigned char *data, size_t n, int final) {
+    if (!gzipReserve(gz, n + n / 2 + 64)) return 0; // Worst case: 3-byte matches at 31 bits each
+    gz->crc = gzipCrc32(gz->crc, data, n); gz->isize += (unsigned long)n;
+    for (int i = 0; i < (1 << GZIP_HASH_BITS); i++) gz->head[i] = -1; // Matches never reach back into earlier calls
+    gzipBits(gz, final ? 1 : 0, 1); gzipBits(gz, 1, 2); // BFINAL, BTYPE=01 (fixed codes)
+    size_t i = 0;
+    while (i < n) {
+        int best_len = 0, best_dist = 0;
+        if (i + 3 <= n) {
+            unsigned int h = (((unsigned int)data[i] << 16 | (unsigned int)data[i + 1] << 8 | data[i + 2]) * 2654435761u) >> (32 - GZIP_HASH_BITS);
+            int cand = gz->head[h], chain = GZIP_MAX_CHAIN; size_t max_len = n - i < 258 ? n - i : 258;
+            while (cand >= 0 && i - (size_t)cand <= GZIP_WINDOW && chain-- > 0) {
+                if (data[cand + best_len] == data[i + best_len]) { size_t l = 0; while (l < max_len && data[cand + l] == data[i + l]) l++;
+                    if ((int)l > best_len) { best_len = (int)l; best_dist = (int)(i - (size_t)cand); if (l == max_len) break; } }
+                int older = gz->prev[cand % GZIP_WINDOW]; if (older >= cand) break; cand = older; }
+            gz->prev[i % GZIP_WINDOW] = gz->head[h]; gz->head[h] = (int)i;
         }
-        return start; // Return the unquoted field
+        if (best_len >= 3) { gzipMatch(gz, best_len, best_dist);
+            for (size_t k = i + 1; k < i + (size_t)best_len && k + 3 <= n; k++) { // Index the covered positions too
+                unsigned int h = (((unsigned int)data[k] << 16 | (unsigned int)data[k + 1] << 8 | data[k + 2]) * 2654435761u) >> (32 - GZIP_HASH_BITS);
+                gz->prev[k % GZIP_WINDOW] = gz->head[h]; gz->head[h] = (int)k; }
+            i += (size_t)best_len; }
+        else { gzipLiteral(gz, data[i]); i++; }
     }
+    gzipLiteral(gz, 256);
+    if (!final) { gzipBits(gz, 0, 3); if (gz->bitcount > 0) gzipBits(gz, 0, 8 - gz->bitcount); gzipBits(gz, 0, 16); gzipBits(gz, 0xFFFF, 16); return 1; }
+    if (gz->bitcount > 0) gzipBits(gz, 0, 8 - gz->bitcount);
+    unsigned long trailer[2] = { gz->crc, gz->isize }; for (int t = 0; t < 2; t++) for (int b = 0; b < 4; b++) gz->out[gz->len++] = (unsigned char)(trailer[t] >> (8 * b));
+    return 1;
 }
 
+void gzipFree(GzipStream *gz) { free(gz->out); free(gz->head); free(gz->prev); memset(gz, 0, sizeof(*gz)); }
 
-// --- Hashing Function Implementations ---
+unsigned char *gzipCompress(const void *data, size_t n, size_t *out_len) {
+    GzipStream gz; if (!gzipBegin(&gz)) return NULL;
+    if (!gzipWrite(&gz, (const unsigned char *)data, n, 1)) { gzipFree(&gz); return NULL; }
+    unsigned char *out = gz.out; *out_len = gz.len; gz.out = NULL; gzipFree(&gz); return out;
+}
 
-// hashFunction, createHashTable, insertIntoHashTable, searchHashTableByCode, freeHashTable, updateHashTableQuantity remain unchanged...
-unsigned int hashFunction(int key, int tableSize) {
-    unsigned int hash = (key < 0) ? (unsigned int)(-key) : (unsigned int)key;
-    return hash % tableSize;
+
+// --- Metrics Implementation ---
+// Recording is two clock reads and a few increments, cheap enough for every request and lookup. The handlers run
+// on a single thread (one CGI request, or --serve's one-at-a-time loop) so the counters need no atomics; the loader
+// threads are timed as a whole by the caller under "load".
+
+static const char *metricPhaseNames[METRIC_PHASES] = { "load", "parse", "lookup", "stock_write", "compact", "sales_append", "render", "output", "request" };
+static const char *metricActionNames[METRIC_ACTIONS] = { "view", "search", "add_stock", "import_stock", "update_stock", "billing", "check_expiry", "generate_report", "metrics", "log_level", "lookup", "other" };
+static const char *logLevelNames[] = { "error", "warn", "info", "debug" };
+
+unsigned long long metricsNow() {
+    struct timespec ts;
+#ifdef _WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
 }
 
-HashNode** createHashTable(int size) {
-    if (size <= 0) { fprintf(stderr, "Error: Invalid hash table size (%d).\n", size); return NULL; }
-    HashNode **table = (HashNode **)calloc(size, sizeof(HashNode *));
-    if (table == NULL) { fprintf(stderr, "Error: Mem alloc failed for hash table (size %d).\n", size); }
-    else { fprintf(stderr, "Hash table created (size %d).\n", size); }
-    return table;
+void metricsRecord(MetricPhase phase, unsigned long long start_ns) {
+    unsigned long long ns = metricsNow() - start_ns, bound = 1000; MetricHistogram *h = &globalMetrics.phases[phase];
+    h->count++; h->sum_ns += ns;
+    for (int i = 0; i < METRIC_BUCKETS; i++, bound *= 4) { if (ns <= bound) { h->buckets[i]++; break; } }
 }
 
-int insertIntoHashTable(HashNode **table, int tableSize, struct medicine med) {
-    if (table == NULL) return -1;
-    unsigned int index = hashFunction(med.mcode, tableSize);
-    HashNode *current = table[index];
-    while (current != NULL) { if (current->data.mcode == med.mcode) { fprintf(stderr, "Warn: Duplicate code %d in hash insert.\n", med.mcode); return 0; } current = current->next; }
-    HashNode *newNode = (HashNode *)malloc(sizeof(HashNode));
-    if (newNode == NULL) { fprintf(stderr, "Error: Mem alloc failed hash node (code %d).\n", med.mcode); return -1; }
-    newNode->data = med; newNode->next = table[index]; table[index] = newNode; return 1;
-}
-
-struct medicine* searchHashTableByCode(HashNode **table, int tableSize, int code) {
-    if (table == NULL) return NULL;
-    unsigned int index = hashFunction(code, tableSize);
-    HashNode *current = table[index];
-    while (current != NULL) { if (current->data.mcode == code) { return &(current->data); } current = current->next; }
-    return NULL;
+MetricAction metricsAction(const char *action, const char *action_type) {
+    if (action == NULL) return action_type == NULL ? METRIC_ACTION_VIEW : strcmp(action_type, "searchStock") == 0 ? METRIC_ACTION_SEARCH : METRIC_ACTION_OTHER;
+    for (int i = METRIC_ACTION_ADD; i < METRIC_ACTION_OTHER; i++) { if (strcmp(action, metricActionNames[i]) == 0) return (MetricAction)i; }
+    return METRIC_ACTION_OTHER;
 }
 
-void freeHashTable(HashNode **table, int tableSize) {
-    if (table == NULL) return;
-    fprintf(stderr, "Freeing hash table...\n");
-    for (int i = 0; i < tableSize; i++) { HashNode *current = table[i]; while (current != NULL) { HashNode *temp = current; current = current->next; free(temp); } table[i] = NULL; }
-    free(table); fprintf(stderr, "Hash table freed.\n");
+void metricsWritePrometheus() {
+    const Metrics *m = &globalMetrics;
+    outPrintf("# HELP medical_phase_seconds Time spent per phase: stock load, request parsing, stock lookups, stock file writes, journal compaction, sales appends, page rendering, response writes, whole requests.\n# TYPE medical_phase_seconds histogram\n");
+    for (int p = 0; p < METRIC_PHASES; p++) { const MetricHistogram *h = &m->phases[p]; unsigned long long cumulative = 0, bound = 1000;
+        for (int i = 0; i < METRIC_BUCKETS; i++, bound *= 4) { cumulative += h->buckets[i]; outPrintf("medical_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %llu\n", metricPhaseNames[p], bound / 1e9, cumulative); }
+        outPrintf("medical_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\nmedical_phase_seconds_sum{phase=\"%s\"} %.9f\nmedical_phase_seconds_count{phase=\"%s\"} %llu\n", metricPhaseNames[p], h->count, metricPhaseNames[p], h->sum_ns / 1e9, metricPhaseNames[p], h->count); }
+    outPrintf("# HELP medical_requests_total Requests handled, by action.\n# TYPE medical_requests_total counter\n");
+    for (int a = 0; a < METRIC_ACTIONS; a++) outPrintf("medical_requests_total{action=\"%s\"} %llu\n", metricActionNames[a], m->requests[a]);
+    outPrintf("# HELP medical_not_modified_total Pages answered with 304 Not Modified.\n# TYPE medical_not_modified_total counter\nmedical_not_modified_total %llu\n", m->not_modified);
+    outPrintf("# HELP medical_malformed_rows_total CSV rows skipped as malformed.\n# TYPE medical_malformed_rows_total counter\nmedical_malformed_rows_total{file=\"stock\"} %llu\nmedical_malformed_rows_total{file=\"sales\"} %llu\n", m->stock_rows_malformed, m->sales_rows_malformed);
+    outPrintf("# HELP medical_response_bytes_total Response bytes written (after compression).\n# TYPE medical_response_bytes_total counter\nmedical_response_bytes_total %lld\n", globalOut.bytes);
+    outPrintf("# HELP medical_response_writes_total write() calls for responses.\n# TYPE medical_response_writes_total counter\nmedical_response_writes_total %lld\n", globalOut.writes);
+    outPrintf("# HELP medical_stock_items Medicines in memory.\n# TYPE medical_stock_items gauge\nmedical_stock_items %lld\n", globalStockStore ? (long long)globalStockStore->count : 0LL);
+    outPrintf("# HELP medical_sales_rows Rows in the sales index.\n# TYPE medical_sales_rows gauge\nmedical_sales_rows %lld\n", globalSales.hdr.rows);
+    outPrintf("# HELP medical_log_level Current stderr log level (0 error, 1 warn, 2 info, 3 debug).\n# TYPE medical_log_level gauge\nmedical_log_level %d\n", logLevel);
 }
 
-int updateHashTableQuantity(HashNode **table, int tableSize, int code, int new_quantity) {
-    if (table == NULL) return -1;
-    struct medicine* med_ptr = searchHashTableByCode(table, tableSize, code);
-    if (med_ptr != NULL) { med_ptr->quantity = new_quantity; fprintf(stderr, "Hash qty updated code %d -> %d.\n", code, new_quantity); return 1; }
-    fprintf(stderr, "Warn: Code %d not found in hash for qty update.\n", code); return 0;
+int logLevelFromName(const char *name) {
+    if (name == NULL) return -1;
+    for (int i = LOG_ERROR; i <= LOG_DEBUG; i++) { const char *a = name, *b = logLevelNames[i]; while (*a && tolower((unsigned char)*a) == *b) { a++; b++; } if (*a == '\0' && *b == '\0') return i; }
+    return (name[0] >= '0' && name[0] <= '3' && name[1] == '\0') ? name[0] - '0' : -1;
 }
 
+const char *logLevelName(int level) { return level >= LOG_ERROR && level <= LOG_DEBUG ? logLevelNames[level] : "?"; }
+
 
-// --- BST Function Implementations ---
+// --- Response Output Implementation ---
 
-// createBstNode, insertBstNode, searchBSTByCode remain unchanged...
-node* createBstNode(struct medicine med) {
-    node* newNode = (node*)malloc(sizeof(node)); if (newNode == NULL) { fprintf(stderr, "Error: Mem alloc failed BST node.\n"); return NULL; }
-    newNode->data = med; newNode->left = newNode->right = NULL; return newNode;
+static const char *htmlEntity(char c) {
+    switch (c) { case '&': return "&amp;"; case '<': return "&lt;"; case '>': return "&gt;"; case '"': return "&quot;"; case '\'': return "&#39;"; default: return NULL; }
 }
 
-node* insertBstNode(node* root, struct medicine med) {
-    if (root == NULL) { return createBstNode(med); }
-    if (med.mcode < root->data.mcode) { root->left = insertBstNode(root->left, med); }
-    else if (med.mcode > root->data.mcode) { root->right = insertBstNode(root->right, med); }
-    else { fprintf(stderr, "Warn: Duplicate code %d in BST insert.\n", med.mcode); }
-    return root;
+static int outReserve(size_t extra) {
+    ResponseOut *o = &globalOut; if (o->cap - o->len >= extra) return 1;
+    size_t cap = o->cap ? o->cap : 4096; while (cap - o->len < extra) cap *= 2;
+    char *nb = realloc(o->buf, cap); if (nb == NULL) { fprintf(stderr, "outReserve: Out of memory (%zu bytes).\n", cap); return 0; }
+    o->buf = nb; o->cap = cap; return 1;
 }
 
-node* searchBSTByCode(node* root, int code) {
-    if (root == NULL || root->data.mcode == code) { return root; }
-    if (code < root->data.mcode ) { return searchBSTByCode(root->left, code); }
-    return searchBSTByCode(root->right, code);
+static void outWrite(const char *data, size_t n) {
+    if (n == 0) return;
+    if (!outReserve(n)) { outFlush(); fwrite(data, 1, n, stdout); return; } // Unbuffered fallback keeps the page intact
+    memcpy(globalOut.buf + globalOut.len, data, n); globalOut.len += n;
+    if (globalOut.len >= RESPONSE_FLUSH_BYTES) outFlush();
 }
 
-// Modified searchBSTByNameSubstring to add Rupee symbol
-void searchBSTByNameSubstring(node* root, const char* nameQuery, int* matchCount) {
-    if (root == NULL || nameQuery == NULL || matchCount == NULL) { return; }
-    searchBSTByNameSubstring(root->left, nameQuery, matchCount);
-    if (stristr(root->data.name, nameQuery) != NULL) {
-        (*matchCount)++; struct medicine m = root->data;
-        // Added Rupee Symbol below
-        printf("<tr><td>%d</td><td>%s</td><td>%s</td><td>%lld</td><td>₹%.2f</td><td style='text-align:center;'>%d</td><td>%04d-%02d-%02d</td></tr>\n",
-               m.mcode, m.name, m.s_name, m.s_contact, m.price, m.quantity, m.year, m.month, m.day); fflush(stdout); }
-    searchBSTByNameSubstring(root->right, nameQuery, matchCount);
+void outPrintf(const char *fmt, ...) {
+    ResponseOut *o = &globalOut; va_list ap;
+    if (!outReserve(256)) { outFlush(); va_start(ap, fmt); vprintf(fmt, ap); va_end(ap); return; }
+    va_start(ap, fmt); int n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap); va_end(ap);
+    if (n < 0) { fprintf(stderr, "outPrintf: Format error.\n"); return; }
+    if ((size_t)n >= o->cap - o->len) { // Did not fit: grow and format again
+        if (!outReserve((size_t)n + 1)) { outFlush(); va_start(ap, fmt); vprintf(fmt, ap); va_end(ap); return; }
+        va_start(ap, fmt); vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap); va_end(ap); }
+    o->len += (size_t)n; if (o->len >= RESPONSE_FLUSH_BYTES) outFlush();
 }
 
-// freeTree, updateBstQuantity remain unchanged...
-void freeTree(node* root) {
-    if (root == NULL) { return; } freeTree(root->left); freeTree(root->right); free(root);
+void outHtml(const char *text) {
+    while (text && *text) { size_t run = strcspn(text, "&<>\"'"); outWrite(text, run); text += run;
+        if (*text) { const char *ent = htmlEntity(*text++); outWrite(ent, strlen(ent)); } }
 }
 
-int updateBstQuantity(node* root, int code, int new_quantity) {
-    node* targetNode = searchBSTByCode(root, code);
-    if (targetNode != NULL) { targetNode->data.quantity = new_quantity; fprintf(stderr, "BST qty updated code %d -> %d.\n", code, new_quantity); return 1; }
-    fprintf(stderr, "Warn: Code %d not found in BST for qty update.\n", code); return 0;
+// Writes to stdout's fd in as few write() calls as it takes. In server mode that fd is the client socket.
+static void outWriteFd(const char *data, size_t n) {
+    ResponseOut *o = &globalOut; size_t done = 0; unsigned long long t0 = metricsNow();
+    while (done < n) {
+#ifdef _WIN32
+        int w = _write(_fileno(stdout), data + done, (unsigned int)(n - done));
+#else
+        ssize_t w = write(fileno(stdout), data + done, n - done);
+#endif
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) { fprintf(stderr, "outFlush: Write failed after %zu of %zu bytes: %s\n", done, n, strerror(errno)); break; } // Client gone; drop the batch
+        done += (size_t)w; o->writes++; }
+    o->bytes += (long long)done; metricsRecord(METRIC_OUTPUT, t0);
 }
 
-// Modified printBstInOrder to add Rupee symbol
-void printBstInOrder(node *root) {
-    if (root != NULL) {
-        printBstInOrder(root->left); struct medicine m = root->data;
-        // Added Rupee Symbol below
-        printf("<tr><td>%d</td><td>%s</td><td>%s</td><td>%lld</td><td>₹%.2f</td><td style='text-align:center;'>%d</td><td>%04d-%02d-%02d</td></tr>\n",
-               m.mcode, m.name, m.s_name, m.s_contact, m.price, m.quantity, m.year, m.month, m.day); fflush(stdout);
-        printBstInOrder(root->right);
-    }
+// Anything still in stdio's buffer was printed earlier, so it goes first.
+void outFlush() {
+    ResponseOut *o = &globalOut; fflush(stdout); if (o->len == 0) return;
+    if (o->gzip) { if (gzipWrite(&o->gz, (const unsigned char *)o->buf, o->len, 0)) { outWriteFd((const char *)o->gz.out, o->gz.len); } else { fprintf(stderr, "outFlush: Compression failed, batch dropped.\n"); } o->gz.len = 0; }
+    else { outWriteFd(o->buf, o->len); }
+    o->len = 0;
 }
 
-// checkExpiryRecursive remains unchanged...
-void checkExpiryRecursive(node *root, time_t today_start_t, time_t warning_start_t, int *relevant_items_found, int warning_days) {
-    if (root == NULL) { return; } checkExpiryRecursive(root->left, today_start_t, warning_start_t, relevant_items_found, warning_days);
-    struct medicine m = root->data; struct tm expiry_tm = {0}; expiry_tm.tm_year = m.year - 1900; expiry_tm.tm_mon = m.month - 1; expiry_tm.tm_mday = m.day; expiry_tm.tm_isdst = -1; time_t expiry_t = mktime(&expiry_tm);
-    char *status_class = NULL, *status_text = NULL, *row_class = NULL;
-    if (expiry_t == (time_t)-1) { fprintf(stderr, "Warn: Cannot convert expiry %04d-%02d-%02d code %d.\n", m.year, m.month, m.day, m.mcode); }
-    else if (expiry_t < today_start_t) { status_class = "status-expired"; status_text = "Expired"; row_class = "status-expired"; (*relevant_items_found)++; }
-    else if (expiry_t < warning_start_t) { status_class = "status-warning"; status_text = "Expiring Soon"; row_class = "status-warning"; (*relevant_items_found)++; }
-    if (status_class != NULL) { printf("<tr class='%s'><td>%s</td><td>%d</td><td>%04d-%02d-%02d</td><td style='text-align: center;'><span class='status-cell %s'>%s</span></td></tr>\n", row_class, m.name, m.mcode, m.year, m.month, m.day, status_class, status_text); fflush(stdout); }
-    checkExpiryRecursive(root->right, today_start_t, warning_start_t, relevant_items_found, warning_days);
+int outPrepareGzip() {
+    ResponseOut *o = &globalOut; if (o->gz.out != NULL) return 1;
+    if (!gzipBegin(&o->gz)) { fprintf(stderr, "outPrepareGzip: Out of memory, sending the page uncompressed.\n"); return 0; }
+    return 1;
 }
 
+void outStartGzip() { outFlush(); globalOut.gzip = 1; }
 
-// --- Data Loading Implementation ---
+void outFinish() {
+    ResponseOut *o = &globalOut; if (!o->gzip) { outFlush(); if (o->gz.out != NULL) gzipFree(&o->gz); return; } // Prepared but never started (304)
+    fflush(stdout); if (gzipWrite(&o->gz, (const unsigned char *)o->buf, o->len, 1)) { outWriteFd((const char *)o->gz.out, o->gz.len); } else { fprintf(stderr, "outFinish: Compression failed.\n"); }
+    o->len = 0; gzipFree(&o->gz); o->gzip = 0;
+}
 
-// loadStockData remains unchanged...
-int loadStockData(const char* filename, HashNode ***hashTablePtr, int *hashTableSizePtr, node **bstRootPtr) {
-    fprintf(stderr, "loadStockData: Loading from %s\n", filename); FILE *fp = fopen(filename, "r");
-    if (fp == NULL) { if (errno == ENOENT) { fprintf(stderr, "loadStockData: File %s not found. OK.\n", filename); return 1; } else { fprintf(stderr, "FATAL: Error opening %s: %s\n", filename, strerror(errno)); return 0; } }
-    if (*hashTablePtr == NULL || *bstRootPtr != NULL) { fprintf(stderr, "loadStockData: Error - Structures not pre-initialized.\n"); fclose(fp); return 0; }
-    struct medicine m; char line[256]; int line_num = 0, items_loaded_hash = 0, items_loaded_bst = 0, hash_insert_result;
-    while (fgets(line, sizeof(line), fp)) {
-        line_num++; line[strcspn(line, "\r\n")] = 0; if (strspn(line, " \t") == strlen(line)) continue;
-        memset(&m, 0, sizeof(m)); int items_parsed = sscanf(line, "%39[^,],%d,%49[^,],%lld,%f,%d,%d,%d,%d", m.name, &m.mcode, m.s_name, &m.s_contact, &m.price, &m.quantity, &m.year, &m.month, &m.day);
-        if (items_parsed == 9) { hash_insert_result = insertIntoHashTable(*hashTablePtr, *hashTableSizePtr, m);
-            if (hash_insert_result == 1) { items_loaded_hash++; *bstRootPtr = insertBstNode(*bstRootPtr, m); if (*bstRootPtr == NULL && items_loaded_hash == 1) { fprintf(stderr, "FATAL: BST insert failed.\n"); fclose(fp); return 0; } if (*bstRootPtr != NULL) { items_loaded_bst++;} }
-            else if (hash_insert_result == -1) { fprintf(stderr, "FATAL: Hash insert failed.\n"); fclose(fp); return 0; } }
-        else { fprintf(stderr, "loadStockData: Malformed line %d in %s.\n", line_num, filename); } }
-    if (ferror(fp)) { fprintf(stderr, "loadStockData: Error reading %s: %s\n", filename, strerror(errno)); } fclose(fp);
-    fprintf(stderr, "loadStockData: Loaded %d hash, %d BST.\n", items_loaded_hash, items_loaded_bst); return 1;
+const char *htmlEscape(const char *text, char *dst, size_t size) {
+    size_t n = 0; if (size == 0) return dst;
+    for (; text && *text; text++) { const char *ent = htmlEntity(*text); size_t len = ent ? strlen(ent) : 1;
+        if (n + len >= size) break;
+        if (ent) { memcpy(dst + n, ent, len); } else { dst[n] = *text; } n += len; }
+    dst[n] = '\0'; return dst;
 }
 
+const char *urlEncode(const char *text, char *dst, size_t size) {
+    static const char hex[] = "0123456789ABCDEF"; size_t n = 0; if (size == 0) return dst;
+    for (; text && *text; text++) { unsigned char c = (unsigned char)*text;
+        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') { if (n + 1 >= size) { break; } dst[n++] = (char)c; }
+        else { if (n + 3 >= size) { break; } dst[n++] = '%'; dst[n++] = hex[c >> 4]; dst[n++] = hex[c & 15]; } }
+    dst[n] = '\0'; return dst;
+}
 
-// --- Core Logic Functions ---
+void outStockRow(const StockStore *store, StockHandle handle) {
+    const StockItem *m = stockStoreGet(store, handle); const StockItemCold *c = stockStoreCold(store, handle); int y, mo, d; if (m == NULL) return;
+    stockExpiryUnpack(m->expiry, &y, &mo, &d);
+    outPrintf("<tr><td>%d</td><td>", m->mcode); outHtml(stringPoolGet(&store->names, c->name)); outPrintf("</td><td>"); outHtml(stringPoolGet(&store->suppliers, c->supplier));
+    outPrintf("</td><td>%lld</td><td>₹%.2f</td><td style='text-align:center;'>%d</td><td>%04d-%02d-%02d</td></tr>\n", c->s_contact, m->price_paise / 100.0, m->quantity, y, mo, d);
+}
 
-// processAddStock remains unchanged...
-void processAddStock(char *post_data) {
-    fprintf(stderr, "processAddStock: Started.\n"); struct medicine m; memset(&m, 0, sizeof(m)); char *temp = NULL; int y=0, mo=0, d=0, parse_error = 0;
-    temp = get_param(post_data, "medicineName"); if (temp) { strncpy(m.name, temp, 39); m.name[39] = '\0'; free(temp); } else { parse_error=1; fprintf(stderr,"Missing Name\n");}
-    temp = get_param(post_data, "medicineCode"); if (temp) { m.mcode = atoi(temp); free(temp); } else { parse_error=1; fprintf(stderr,"Missing Code\n");}
-    temp = get_param(post_data, "suppliername"); if (temp) { strncpy(m.s_name, temp, 49); m.s_name[49] = '\0'; free(temp); } else { parse_error=1; fprintf(stderr,"Missing S.Name\n");}
-    temp = get_param(post_data, "suppliercontact"); if (temp) { m.s_contact = atoll(temp); free(temp); } else { parse_error=1; fprintf(stderr,"Missing S.Contact\n");}
-    temp = get_param(post_data, "price"); if (temp) { m.price = atof(temp); free(temp); } else { parse_error=1; fprintf(stderr,"Missing Price\n");}
-    temp = get_param(post_data, "quantity"); if (temp) { m.quantity = atoi(temp); free(temp); } else { parse_error=1; fprintf(stderr,"Missing Qty\n");}
-    temp = get_param(post_data, "expiry"); if (temp) { if (sscanf(temp, "%d-%d-%d", &y, &mo, &d) == 3) { m.year = y; m.month = mo; m.day = d; } else { parse_error=1; printf("<p class='error'>Invalid Expiry '%s'.</p>", temp); fflush(stdout); } free(temp); } else { parse_error=1; fprintf(stderr,"Missing Expiry\n"); }
-    int validation_failed = (parse_error || strlen(m.name) == 0 || m.mcode <= 0 || strlen(m.s_name) == 0 || m.s_contact <= 0 || m.quantity <= 0 || m.price < 0 || m.year < 1970 || m.month < 1 || m.month > 12 || m.day < 1 || m.day > 31);
-    if (validation_failed) { fprintf(stderr, "Add Validation Failed.\n"); printf("<h2>Error Adding</h2><p class='error'>Invalid/missing data.</p><p><a href='../add_stock.html' class='btn btn-secondary'>Back</a></p>"); fflush(stdout); return; }
-    if (searchHashTableByCode(globalHashTable, globalHashTableSize, m.mcode) != NULL) { fprintf(stderr, "Add Error: Code %d exists.\n", m.mcode); printf("<h2>Error Adding</h2><p class='error'>Code %d already exists.</p><p><a href='../add_stock.html' class='btn btn-secondary'>Back</a></p>", m.mcode); fflush(stdout); return; }
-    FILE *fp = fopen(STOCK_FILE, "a"); if (fp == NULL) { fprintf(stderr, "FATAL: Error opening %s: %s\n", STOCK_FILE, strerror(errno)); printf("<h2>Internal Error</h2><p class='error'>Cannot open file.</p>"); fflush(stdout); return; }
-    int write_result = fprintf(fp, "%s,%d,%s,%lld,%.2f,%d,%d,%d,%d\n", m.name, m.mcode, m.s_name, m.s_contact, m.price, m.quantity, m.year, m.month, m.day); fclose(fp);
-    if (write_result < 0) { fprintf(stderr, "Error writing %s: %s\n", STOCK_FILE, strerror(errno)); printf("<h2>Error Adding</h2><p class='error'>Failed write.</p><p><a href='../add_stock.html' class='btn btn-secondary'>Back</a></p>"); fflush(stdout); }
-    else { fprintf(stderr, "Written code %d. Adding mem.\n", m.mcode); int hash_add = insertIntoHashTable(globalHashTable, globalHashTableSize, m);
-        if (hash_add == 1) { globalBstRoot = insertBstNode(globalBstRoot, m); fprintf(stderr, "Added code %d hash/BST.\n", m.mcode); printf("<div class='success'><h2>Stock Added</h2><p>%s (%d)</p><p>Qty: %d</p><p>%04d-%02d-%02d</p><p><a href='../add_stock.html' class='btn btn-primary'>Add Another</a>|<a href='medical.exe' class='btn btn-secondary'>View</a></p></div>", m.name, m.mcode, m.quantity, m.year, m.month, m.day); fflush(stdout); }
-        else if (hash_add == 0){ fprintf(stderr, "Warn: Code %d already in hash?\n", m.mcode); printf("<h2>Internal Warning</h2><p class='warning'>File saved, error live view.</p>"); }
-        else { fprintf(stderr, "FATAL: Mem error add code %d.\n", m.mcode); printf("<h2>Internal Error</h2><p class='error'>File saved, mem error live view.</p>"); } }
-    fprintf(stderr, "processAddStock: Finished.\n"); fflush(stderr);
-}
-
-// Modified viewStock to use the updated printBstInOrder (which includes Rupee symbol)
-void viewStock() {
-    fprintf(stderr, "viewStock: Called.\n"); printf("<div style='overflow-x:auto;'><table class='stock-table'><thead><tr><th>Code</th><th>Name</th><th>Supplier</th><th>Contact</th><th>Price</th><th>Quantity</th><th>Expiry Date</th></tr></thead><tbody>"); fflush(stdout);
-    if (globalBstRoot == NULL) { fprintf(stderr, "viewStock: BST empty.\n"); printf("<tr><td colspan='7' style='text-align:center; font-style:italic;'>No stock.</td></tr>"); } else { printBstInOrder(globalBstRoot); } // This now prints with ₹
-    printf("</tbody></table></div>"); fprintf(stderr, "viewStock: Finished.\n"); fflush(stderr);
+
+// --- Stock Record Store Implementation ---
+// Every loaded medicine lives exactly once here, in chunks of STOCK_STORE_CHUNK records that are never
+// reallocated. The hash table and the ordered index only hold StockHandles, so a quantity change is a
+// single write that both indexes see, and pointers into the store stay valid while more stock is added.
+// A record is split in two parallel chunk arrays: the 16-byte StockItem that code/quantity/price/expiry
+// scans read, and the StockItemCold with the name and supplier, which only page output touches. Names
+// and supplier names are interned, so a supplier's name is stored once however many items it delivers.
+
+// The stock may be attached to a mapped STOCK_SNAPSHOT_FILE (loadStockSnapshot), in which case the store's chunks,
+// the hash slots, the ordered arrays and the name postings start out inside the mapping. Everything that frees or
+// grows them goes through these two, so the first growth copies that section to the heap and the rest stays shared.
+
+static int stockSnapshotOwns(const void *p) {
+    return stockSnapshotMap.base != NULL && (const unsigned char *)p >= stockSnapshotMap.base && (const unsigned char *)p < stockSnapshotMap.base + stockSnapshotMap.size;
 }
 
-// processUpdateStock remains unchanged...
-void processUpdateStock(char *request_data) {
-    fprintf(stderr, "processUpdateStock: Started.\n"); char *code_str = get_param(request_data, "medicineCode"), *qty_add_str = get_param(request_data, "newQuantity"), *name_str = get_param(request_data, "medicineName");
-    char tname[40] = "N/A"; int code = 0, qty_change = 0, final_qty = 0, validation_error = 0;
-    if (!code_str || strlen(code_str) == 0) { printf("<p class='error'>Code needed.</p>"); validation_error = 1; } else { char *e; errno=0; long c=strtol(code_str,&e,10); if(errno!=0||*e!='\0'||c<=0||c>INT_MAX){ printf("<p class='error'>Invalid Code.</p>");validation_error=1;} else code=(int)c; }
-    if (!qty_add_str || strlen(qty_add_str)==0) { printf("<p class='error'>Qty needed.</p>"); validation_error=1; } else { char *e; errno=0; long q=strtol(qty_add_str,&e,10); if(errno!=0||*e!='\0'||q>INT_MAX||q<INT_MIN){ printf("<p class='error'>Invalid Qty.</p>");validation_error=1;} else qty_change=(int)q; }
-    if (code_str) free(code_str); if (qty_add_str) free(qty_add_str); if (validation_error) { printf("<p><a href='../update_stock.html' class='btn'>Back</a>|<a href='medical.exe' class='btn'>View</a></p>"); if (name_str) free(name_str); fprintf(stderr, "Update validation failed.\n"); fflush(stderr); return; }
-    fprintf(stderr, "Update Req: Code=%d, Change=%d\n", code, qty_change); struct medicine* med_ptr = searchHashTableByCode(globalHashTable, globalHashTableSize, code);
-    if (med_ptr == NULL) { fprintf(stderr, "Update Error: Code %d not found.\n", code); printf("<div class='error'>Code %d not found.</div>", code); printf("<p><a href='../update_stock.html' class='btn'>Back</a>|<a href='medical.exe' class='btn'>View</a></p>"); if (name_str) free(name_str); return; }
-    strncpy(tname, med_ptr->name, 39); tname[39]='\0'; final_qty = med_ptr->quantity + qty_change; if (final_qty < 0) { fprintf(stderr, "Warn: Update %d -> neg stock. Set 0.\n", code); printf("<p class='warning'>Warn: Update %s (%d) -> neg stock. Set 0.</p>", tname, code); final_qty = 0; }
-    FILE *in = fopen(STOCK_FILE, "r"), *out = fopen(TEMP_STOCK_FILE_UPDATE, "w"); int file_error = 0, found_in_file = 0; if (!in || !out) { fprintf(stderr, "FATAL: Cannot open files update! %s\n", strerror(errno)); printf("<p class='error'>Internal Error: files.</p>"); if(in)fclose(in); if(out)fclose(out); remove(TEMP_STOCK_FILE_UPDATE); if (name_str) free(name_str); return; }
-    struct medicine m_line; char line[512], orig_line[512]; int ln = 0;
-    while (fgets(line, sizeof(line), in)) { ln++; strcpy(orig_line, line); line[strcspn(line, "\r\n")] = 0; if (strspn(line, " \t")==strlen(line)) { if (fputs(orig_line, out)==EOF) { file_error=1; break; } continue; }
-        int line_code = 0; sscanf(line, "%*[^,],%d", &line_code);
-        if (line_code == code) { found_in_file=1; int items = sscanf(line, "%39[^,],%d,%49[^,],%lld,%f,%d,%d,%d,%d", m_line.name,&m_line.mcode,m_line.s_name,&m_line.s_contact,&m_line.price,&m_line.quantity,&m_line.year,&m_line.month,&m_line.day);
-             if (items!=9) { fprintf(stderr, "Parse err ln %d update.\n", ln); if (fputs(orig_line, out)==EOF) { file_error=1; break; } continue; }
-            if (fprintf(out, "%s,%d,%s,%lld,%.2f,%d,%d,%d,%d\n", m_line.name,m_line.mcode,m_line.s_name,m_line.s_contact,m_line.price,final_qty,m_line.year,m_line.month,m_line.day) < 0) { file_error=1; break; }
-        } else { if (fputs(orig_line, out)==EOF) { file_error=1; break; } } if (ferror(out)) { file_error=1; break; } }
-    if (ferror(in)) { file_error=1; } fclose(in); if (fclose(out)!=0) { file_error=1; } if (!found_in_file && !file_error) { fprintf(stderr, "Error: Code %d mem not file!\n", code); printf("<p class='error'>Internal Inconsistency (Code: %d).</p>", code); file_error=1; }
-    if (file_error) { fprintf(stderr, "Update fail: file IO err. Clean %s.\n", TEMP_STOCK_FILE_UPDATE); remove(TEMP_STOCK_FILE_UPDATE); printf("<div class='error'>Internal file error. Stock not modified.</div>"); }
-    else { fprintf(stderr, "File rewrite OK %d. Replace.\n", code);
-        if (remove(STOCK_FILE)!=0) { fprintf(stderr, "CRIT: Fail remove %s! %s\n", STOCK_FILE, strerror(errno)); remove(TEMP_STOCK_FILE_UPDATE); printf("<div class='error'>CRIT ERR: Cannot remove orig file. Not saved.</div>"); file_error=1; }
-        else if (rename(TEMP_STOCK_FILE_UPDATE, STOCK_FILE)!=0) { fprintf(stderr, "CRIT: Fail rename %s->%s! %s\n", TEMP_STOCK_FILE_UPDATE, STOCK_FILE, strerror(errno)); printf("<div class='error'>CRIT ERR: Cannot rename temp. Data in '%s'.</div>", TEMP_STOCK_FILE_UPDATE); file_error=1; }
-        else { fprintf(stderr, "File updated %d. Update mem.\n", code); int h_upd = updateHashTableQuantity(globalHashTable, globalHashTableSize, code, final_qty); int b_upd = updateBstQuantity(globalBstRoot, code, final_qty);
-            if (h_upd && b_upd) { fprintf(stderr, "Mem updated %d.\n", code); printf("<div class='success'><h2>Stock Updated</h2><p>%s (%d)</p><p>Change: %d</p><p>New Qty: %d</p><p><a href='../update_stock.html' class='btn'>Update Another</a>|<a href='medical.exe' class='btn'>View</a></p></div>", tname, code, qty_change, final_qty); }
-            else { fprintf(stderr, "Err: Mem update fail %d (H:%d, B:%d)\n", code, h_upd, b_upd); printf("<div class='warning'><h2>Update Partial</h2><p>File updated, live view error.</p><p>%s (%d)</p><p>New Qty: %d</p><p><a href='../update_stock.html' class='btn'>Update Another</a>|<a href='medical.exe' class='btn'>View</a></p></div>", tname, code, final_qty); } } }
-    if (file_error) { printf("<p><a href='../update_stock.html' class='btn'>Back</a>|<a href='medical.exe' class='btn'>View</a></p>"); }
-    fflush(stdout); if (name_str) free(name_str); fprintf(stderr, "processUpdateStock: Finished.\n"); fflush(stderr);
-}
-
-// Modified saveSaleRecord to include Invoice ID
-int saveSaleRecord(const struct sale_record *sale) {
-    FILE *fp = fopen(SALES_FILE, "a"); if (fp == NULL) { fprintf(stderr, "Err opening sales %s: %s\n", SALES_FILE, strerror(errno)); return 0; }
-    fseek(fp, 0, SEEK_END); long size = ftell(fp);
-    if (size == 0) {
-        // Write header with InvoiceID
-        fprintf(fp, "InvoiceID,Date,Time,CustomerName,MedicineCode,MedicineName,Quantity,PricePerItem,TotalCost\n");
-    } else {
-        // Ensure newline before appending data
-        fseek(fp, -1, SEEK_END);
-        if (fgetc(fp) != '\n') {
-            fprintf(fp, "\n");
-        }
-        fseek(fp, 0, SEEK_END); // Go back to end for appending
-    }
-    // Write sale data including InvoiceID (ensure it's quoted if it contains commas, though unlikely with timestamp-pid)
-    // Using "%s" for invoice ID assumes it doesn't contain quotes or commas. If it might, it should be quoted properly.
-    int r = fprintf(fp, "\"%s\",%s,%s,\"%s\",%d,\"%s\",%d,%.2f,%.2f\n",
-                    sale->invoice_id, sale->date_str, sale->time_str, sale->customer_name,
-                    sale->medicine_code, sale->medicine_name, sale->quantity,
-                    sale->price_per_item, sale->total_cost);
-    fclose(fp);
-    if (r < 0) { fprintf(stderr, "Err writing sales %s: %s\n", SALES_FILE, strerror(errno)); return 0; }
-    fprintf(stderr, "Sale saved: Inv# %s, Cust %s, Code %d, Qty %d\n", sale->invoice_id, sale->customer_name, sale->medicine_code, sale->quantity); return 1;
+void stockFree(void *p) { if (!stockSnapshotOwns(p)) free(p); }
+
+void *stockRealloc(void *p, size_t old_bytes, size_t new_bytes) {
+    if (!stockSnapshotOwns(p)) return realloc(p, new_bytes);
+    void *n = malloc(new_bytes); if (n != NULL) memcpy(n, p, old_bytes < new_bytes ? old_bytes : new_bytes);
+    return n;
 }
 
+StockStore* createStockStore() {
+    StockStore *store = (StockStore *)calloc(1, sizeof(StockStore)); if (store == NULL) { fprintf(stderr, "Error: Mem alloc failed stock store.\n"); }
+    return store;
+}
 
-// Modified processBillingMultiple to generate, display, and save Invoice ID
-void processBillingMultiple(char *request_data) {
-    fprintf(stderr, "processBillingMultiple: Started.\n"); char *cust_raw = NULL, *code_s[MAX_BILL_ITEMS] = {NULL}, *qty_s[MAX_BILL_ITEMS] = {NULL}; struct bill_item_request req_items[MAX_BILL_ITEMS]; char cust_name[50] = "";
-    int n_codes = 0, n_qtys = 0, n_items = 0, err = 0, valid = 1, stock_upd_ok = 0, sales_saved = 0, saved_count = 0 ; double grand_total = 0.0;
-    // Invoice ID generation variable
-    char generated_invoice_id[30] = "";
+int stockExpiryPack(int year, int month, int day) {
+    if (year < 1 || year > 9999 || month < 1 || month > 12 || day < 1 || day > 31) return -1;
+    return year << 9 | month << 5 | day;
+}
 
-    cust_raw = get_param(request_data, "customerName"); if (!cust_raw || strlen(cust_raw) == 0) { printf("<p class='error'>Customer Name needed.</p>"); err = 1; } else { strncpy(cust_name, cust_raw, 49); cust_name[49] = '\0'; for (int i = 0; cust_name[i]; i++) { if (strchr("<>\"", cust_name[i])) { printf("<p class='error'>Invalid chars in Name.</p>"); err = 1; break; } } free(cust_raw); }
-    n_codes = parse_multi_value_param(request_data, "medicineCode%5B%5D", code_s, MAX_BILL_ITEMS); n_qtys = parse_multi_value_param(request_data, "quantity%5B%5D", qty_s, MAX_BILL_ITEMS);
-    fprintf(stderr, "Parsed %d codes, %d qtys.\n", n_codes, n_qtys);
-    if (n_codes <= 0 || n_qtys <= 0) { printf("<p class='error'>No items.</p>"); err = 1; } else if (n_codes != n_qtys) { printf("<p class='error'>Code/Qty mismatch.</p>"); err = 1; } else if (n_codes == -1 || n_qtys == -1) { printf("<p class='error'>Internal Error: Mem fail parse.</p>"); err = 1; }
-    else { n_items = n_codes;
-        for (int i = 0; i < n_items; i++) { memset(&req_items[i], 0, sizeof(req_items[0])); strcpy(req_items[i].error_msg, ""); long c_val = 0, q_val = 0; char *e_c, *e_q; errno = 0;
-            if (!code_s[i] || strlen(code_s[i])==0) { snprintf(req_items[i].error_msg, 100, "Item %d: No Code.", i+1); valid=0; } else { c_val=strtol(code_s[i],&e_c,10); if(errno!=0||*e_c!='\0'||c_val<=0||c_val>INT_MAX){ snprintf(req_items[i].error_msg, 100, "Item %d: Bad Code '%s'.", i+1, code_s[i]); valid=0;} else req_items[i].code=(int)c_val; }
-            if (!qty_s[i] || strlen(qty_s[i])==0) { snprintf(req_items[i].error_msg, 100, "Item %d (C%d): No Qty.", i+1, req_items[i].code); valid=0; } else { q_val=strtol(qty_s[i],&e_q,10); if(errno!=0||*e_q!='\0'||q_val<=0||q_val>INT_MAX){ snprintf(req_items[i].error_msg, 100, "Item %d (C%d): Bad Qty '%s'.", i+1, req_items[i].code, qty_s[i]); valid=0;} else req_items[i].quantity_requested=(int)q_val; } } }
-    for (int i = 0; i < n_codes; i++) { if (code_s[i]) free(code_s[i]); } for (int i = 0; i < n_qtys; i++) { if (qty_s[i]) free(qty_s[i]); }
-    if (err || !valid) { printf("<h3>Billing Errors</h3>"); for (int i = 0; i < n_items; i++) { if (strlen(req_items[i].error_msg) > 0) { printf("<p class='error'>%s</p>", req_items[i].error_msg); } } printf("<p><a href='../billing.html' class='btn'>Back</a></p>"); fflush(stdout); fprintf(stderr, "Billing abort: input validation.\n"); return; }
-    fprintf(stderr, "Input OK %d items for '%s'. Validate stock hash.\n", n_items, cust_name);
-    valid = 1; for (int i = 0; i < n_items; i++) { struct medicine* med = searchHashTableByCode(globalHashTable, globalHashTableSize, req_items[i].code);
-        if (med == NULL) { req_items[i].found_in_stock = 0; snprintf(req_items[i].error_msg, 100, "Code %d not found.", req_items[i].code); fprintf(stderr, " [FAIL] Code %d: Not found hash.\n", req_items[i].code); valid = 0; }
-        else { req_items[i].found_in_stock = 1; req_items[i].stock_data_ptr = med; strncpy(req_items[i].name, med->name, 39); req_items[i].name[39] = '\0'; req_items[i].price_per_item = med->price; req_items[i].original_stock_qty = med->quantity;
-            if (med->quantity >= req_items[i].quantity_requested) { req_items[i].sufficient_stock = 1; req_items[i].new_stock_qty = med->quantity - req_items[i].quantity_requested; fprintf(stderr, " [OK] C%d (%s): Stock %d >= Req %d. New %d\n", req_items[i].code, req_items[i].name, med->quantity, req_items[i].quantity_requested, req_items[i].new_stock_qty); }
-            else { req_items[i].sufficient_stock = 0; req_items[i].new_stock_qty = med->quantity; snprintf(req_items[i].error_msg, 100, "Insufficient '%s' (C%d). Has: %d, Req: %d.", req_items[i].name, req_items[i].code, med->quantity, req_items[i].quantity_requested); fprintf(stderr, " [FAIL] C%d (%s): Insufficient. Has %d, needs %d.\n", req_items[i].code, req_items[i].name, med->quantity, req_items[i].quantity_requested); valid = 0; } }
-        req_items[i].stock_validation_done = 1; }
-    if (!valid) { printf("<h3>Billing Errors</h3>"); for (int i = 0; i < n_items; i++) { if (strlen(req_items[i].error_msg) > 0) { printf("<p class='error'>%s</p>", req_items[i].error_msg); } } printf("<p><a href='../billing.html' class='btn'>Back</a></p>"); fflush(stdout); fprintf(stderr, "Billing abort: stock validation.\n"); return; }
-    fprintf(stderr, "All validated. Update stock file.\n");
-    // --- Start File Update Transaction ---
-    FILE *fp_in = fopen(STOCK_FILE, "r"), *fp_out = fopen(TEMP_STOCK_FILE_BILLING, "w"); int file_error = 0;
-    if (!fp_in || !fp_out) { fprintf(stderr, "FATAL: Cannot open files billing update! %s\n", strerror(errno)); printf("<p class='error'>Internal Error: files.</p>"); if(fp_in) fclose(fp_in); if(fp_out) fclose(fp_out); remove(TEMP_STOCK_FILE_BILLING); printf("<p><a href='../billing.html' class='btn'>Back</a></p>"); fflush(stdout); return; }
-    char line[512], orig_line[512]; struct medicine m_line; int ln = 0;
-    while (fgets(line, sizeof(line), fp_in)) { ln++; strcpy(orig_line, line); line[strcspn(line, "\r\n")] = 0; if (strspn(line, " \t")==strlen(line)) { if (fputs(orig_line, fp_out)==EOF) { file_error=1; break; } continue; }
-        int line_code = 0; sscanf(line, "%*[^,],%d", &line_code); int billed_this = 0;
-        for (int i = 0; i < n_items; i++) { if (req_items[i].code == line_code) { int items = sscanf(line, "%39[^,],%d,%49[^,],%lld,%f,%d,%d,%d,%d", m_line.name,&m_line.mcode,m_line.s_name,&m_line.s_contact,&m_line.price,&m_line.quantity,&m_line.year,&m_line.month,&m_line.day);
-                 if (items!=9) { fprintf(stderr, "Parse err ln %d billing.\n", ln); file_error = 1; /* Mark error but try to continue to avoid inconsistent temp file */ break; }
-                 if (fprintf(fp_out, "%s,%d,%s,%lld,%.2f,%d,%d,%d,%d\n", m_line.name,m_line.mcode,m_line.s_name,m_line.s_contact,m_line.price,req_items[i].new_stock_qty,m_line.year,m_line.month,m_line.day) < 0) { file_error=1; }
-                 else { fprintf(stderr, " Updated C%d -> temp bill (New Qty: %d).\n", line_code, req_items[i].new_stock_qty); } billed_this = 1; break; } }
-        if (!billed_this && !file_error) { if (fputs(orig_line, fp_out)==EOF) { file_error=1; } } if(ferror(fp_out) || file_error) { file_error=1; break; } }
-    if(ferror(fp_in)) { file_error=1; } fclose(fp_in); if (fclose(fp_out)!=0) { file_error=1; }
-    // --- End File Update Transaction Attempt ---
-
-    if (file_error) { fprintf(stderr, "Billing fail: IO err file update. Clean temp.\n"); remove(TEMP_STOCK_FILE_BILLING); printf("<p class='error'>Internal file error updating stock. Aborted.</p>"); printf("<p><a href='../billing.html' class='btn'>Back</a></p>"); fflush(stdout); return; }
-    else { // File write successful, attempt rename
-        fprintf(stderr, "Replace stock file bill.\n"); if (remove(STOCK_FILE)!=0 && errno != ENOENT /* Don't fail if file didn't exist */) { fprintf(stderr, "CRIT: Err remove %s! %s\n", STOCK_FILE, strerror(errno)); remove(TEMP_STOCK_FILE_BILLING); stock_upd_ok=0; printf("<div class='error'>CRIT ERR: Cannot remove original stock file. Bill NOT processed, stock NOT updated.</div>\n"); }
-        else if (rename(TEMP_STOCK_FILE_BILLING, STOCK_FILE)!=0) { fprintf(stderr, "CRIT: Err rename %s->%s! %s\n", TEMP_STOCK_FILE_BILLING, STOCK_FILE, strerror(errno)); stock_upd_ok=0; printf("<div class='error'>CRIT ERR: Cannot save updated stock file. Bill NOT processed, stock NOT updated. Data may be in '%s'.</div>\n", TEMP_STOCK_FILE_BILLING); }
-        else { fprintf(stderr, "Stock file updated OK bill.\n"); stock_upd_ok = 1; }
-    }
+void stockExpiryUnpack(int expiry, int *year, int *month, int *day) { *year = expiry >> 9; *month = (expiry >> 5) & 15; *day = expiry & 31; }
 
-    // --- If Stock Update Successful, Update Memory and Save Sales ---
-    if (stock_upd_ok) {
-        fprintf(stderr, "Updating memory...\n"); int all_mem_ok = 1; for (int i = 0; i < n_items; i++) { int h_upd = updateHashTableQuantity(globalHashTable, globalHashTableSize, req_items[i].code, req_items[i].new_stock_qty); int b_upd = updateBstQuantity(globalBstRoot, req_items[i].code, req_items[i].new_stock_qty); if (!h_upd || !b_upd) { fprintf(stderr, "Warn: Mem update fail C%d (H:%d,B:%d)\n", req_items[i].code, h_upd, b_upd); all_mem_ok = 0; } }
-         if (!all_mem_ok) { printf("<p class='warning' style='font-size:0.9em;'><i class='bi bi-exclamation-circle-fill'></i> Warn: Stock file OK, live view cache inconsistent.</p>"); }
-
-        // Generate Invoice ID (Timestamp + Process ID for uniqueness)
-        long current_time_secs = (long)time(NULL);
-        pid_t current_pid = getpid();
-        snprintf(generated_invoice_id, sizeof(generated_invoice_id), "%ld-%d", current_time_secs, current_pid);
-        fprintf(stderr, "Generated Invoice ID: %s\n", generated_invoice_id);
-
-        // Save Sales Record
-        fprintf(stderr, "Saving sales records...\n"); struct sale_record sale; time_t t = time(NULL); struct tm tm = *localtime(&t); char date_s[11], time_s[9]; strftime(date_s, 11, "%Y-%m-%d", &tm); strftime(time_s, 9, "%H:%M:%S", &tm);
-    
-        for (int i = 0; i < n_items; i++) {
-            strcpy(sale.invoice_id, generated_invoice_id); // Set the invoice ID for this sale item
-            strcpy(sale.date_str, date_s);
-            strcpy(sale.time_str, time_s);
-            strncpy(sale.customer_name, cust_name, 49); sale.customer_name[49]='\0';
-            sale.medicine_code = req_items[i].code;
-            strncpy(sale.medicine_name, req_items[i].name, 39); sale.medicine_name[39]='\0';
-            sale.quantity = req_items[i].quantity_requested;
-            sale.price_per_item = req_items[i].price_per_item;
-            sale.total_cost = sale.price_per_item * sale.quantity;
-            if (saveSaleRecord(&sale)) { saved_count++; } else { fprintf(stderr, "Warn: Fail save sales C%d.\n", sale.medicine_code); }
-        }
-        sales_saved = (saved_count == n_items);
-        if (!sales_saved) fprintf(stderr, "Warn: Only %d/%d sales saved.\n", saved_count, n_items); else fprintf(stderr, "All %d sales saved.\n", saved_count);
-
-        // --- Generate HTML Bill Output ---
-        printf("<div class='bill-details'>");
-        printf("<h3>Bill Generated</h3>");
-        printf("<p><strong>Invoice ID:</strong> %s</p>", generated_invoice_id); // Display Invoice ID
-        time_t t_now = time(NULL); struct tm tm_now = *localtime(&t_now); printf("<p><strong>Date:</strong> %04d-%02d-%02d %02d:%02d:%02d</p>", tm_now.tm_year + 1900, tm_now.tm_mon + 1, tm_now.tm_mday, tm_now.tm_hour, tm_now.tm_min, tm_now.tm_sec);
-        printf("<p><strong>Customer:</strong> %s</p>", cust_name);
-        printf("<hr style='border-top: 1px dashed var(--accent); margin: 10px 0;'>");
-        printf("<table style='width:100%%;margin-top:15px;border-collapse:collapse;font-size:0.95rem;'>");
-        printf("<thead><tr style='background-color:var(--secondary);color:white;'><th style='padding:8px;text-align:left;'>Item</th><th style='padding:8px;text-align:right;'>Code</th><th style='padding:8px;text-align:right;'>Qty</th><th style='padding:8px;text-align:right;'>Price</th><th style='padding:8px;text-align:right;'>Total</th></tr></thead><tbody>");
-        grand_total = 0.0;
-        for (int i = 0; i < n_items; i++) {
-            float line_total = req_items[i].price_per_item * req_items[i].quantity_requested; grand_total += line_total;
-            printf("<tr><td style='padding:8px;border-bottom:1px dotted var(--accent);'>%s</td><td style='padding:8px;text-align:right;border-bottom:1px dotted var(--accent);'>%d</td><td style='padding:8px;text-align:right;border-bottom:1px dotted var(--accent);'>%d</td><td style='padding:8px;text-align:right;border-bottom:1px dotted var(--accent);'>₹%.2f</td><td style='padding:8px;text-align:right;border-bottom:1px dotted var(--accent);'>₹%.2f</td></tr>", req_items[i].name, req_items[i].code, req_items[i].quantity_requested, req_items[i].price_per_item, line_total);
-        }
-        printf("</tbody></table>");
-        printf("<p class='bill-total' style='margin-top:20px;padding-top:15px;border-top:1px solid var(--accent);text-align:right;'><strong>Grand Total: ₹%.2f</strong></p>", grand_total);
-        printf("<p style='font-size:0.9em;color:var(--status-active-text);'><i class='bi bi-check-circle-fill'></i> Stock file updated.</p>");
-        if (sales_saved) { printf("<p style='font-size:0.9em;color:var(--status-active-text);'><i class='bi bi-journal-check'></i> Sales recorded.</p>"); } else { printf("<p class='error' style='font-size:0.9em;'><i class='bi bi-exclamation-triangle-fill'></i> Warn: Sales record save failed.</p>"); }
-        printf("</div>");
-        printf("<p style='margin-top: 20px; text-align:center;'><a href='../billing.html' class='btn btn-primary'>Generate Another Bill</a></p>");
-
-    } else { // Stock update failed (rename failed after temp file write)
-        fprintf(stderr, "Bill processing failed due to stock file persistence error. No sales recorded.\n");
-        // Display error message already printed during the rename failure check.
-        printf("<p><a href='../billing.html' class='btn'>Back</a></p>");
-    }
+// FNV-1a; the pool's slot table is kept at most half full
+static unsigned int stringPoolHash(const char *text) {
+    unsigned int h = 2166136261u; for (; *text; text++) { h ^= (unsigned char)*text; h *= 16777619u; }
+    return h;
+}
+
+static int stringPoolRehash(StringPool *pool, unsigned int slot_count) {
+    unsigned int *slots = (unsigned int *)calloc(slot_count, sizeof(unsigned int)); if (slots == NULL) return 0;
+    for (unsigned int id = 0; id < pool->count; id++) { unsigned int pos = stringPoolHash(pool->data + pool->offsets[id]) & (slot_count - 1);
+        while (slots[pos] != 0) pos = (pos + 1) & (slot_count - 1);
+        slots[pos] = id + 1; }
+    free(pool->slots); pool->slots = slots; pool->slot_count = slot_count; return 1;
+}
 
-    fflush(stdout); fprintf(stderr, "processBillingMultiple: Finished.\n"); fflush(stderr);
+// The data and offsets arrays may lie in stockSnapshotMap (an attached snapshot): they grow through stockRealloc, and
+// the slot table, which the snapshot does not carry, is only built when something is interned.
+unsigned int stringPoolIntern(StringPool *pool, const char *text) {
+    if ((pool->count + 1) * 2 > pool->slot_count) { unsigned int n = pool->slot_count ? pool->slot_count : 1024; while ((pool->count + 1) * 2 > n) n *= 2;
+        if (!stringPoolRehash(pool, n)) { fprintf(stderr, "Error: Mem alloc failed string pool slots.\n"); return STRING_POOL_NONE; } }
+    unsigned int pos = stringPoolHash(text) & (pool->slot_count - 1);
+    for (; pool->slots[pos] != 0; pos = (pos + 1) & (pool->slot_count - 1)) { if (strcmp(pool->data + pool->offsets[pool->slots[pos] - 1], text) == 0) return pool->slots[pos] - 1; }
+    size_t len = strlen(text) + 1;
+    if (pool->count == UINT_MAX - 1 || (size_t)pool->len + len > UINT_MAX) { fprintf(stderr, "Error: String pool full.\n"); return STRING_POOL_NONE; }
+    if (pool->count == pool->id_cap) { unsigned int cap = pool->id_cap ? pool->id_cap * 2 : 1024; unsigned int *o = (unsigned int *)stockRealloc(pool->offsets, sizeof(unsigned int) * pool->id_cap, sizeof(unsigned int) * cap);
+        if (o == NULL) { fprintf(stderr, "Error: Mem alloc failed string pool ids.\n"); return STRING_POOL_NONE; } pool->offsets = o; pool->id_cap = cap; }
+    if (pool->len + len > pool->cap) { size_t cap = pool->cap ? pool->cap : 16384; while (pool->len + len > cap) cap *= 2; if (cap > UINT_MAX) cap = UINT_MAX;
+        char *d = (char *)stockRealloc(pool->data, pool->cap, cap); if (d == NULL) { fprintf(stderr, "Error: Mem alloc failed string pool.\n"); return STRING_POOL_NONE; }
+        pool->data = d; pool->cap = (unsigned int)cap; }
+    memcpy(pool->data + pool->len, text, len); pool->offsets[pool->count] = pool->len; pool->len += (unsigned int)len;
+    pool->slots[pos] = pool->count + 1; return pool->count++;
 }
 
+const char *stringPoolGet(const StringPool *pool, unsigned int id) { return id < pool->count ? pool->data + pool->offsets[id] : ""; }
+
+static void freeStringPool(StringPool *pool) { stockFree(pool->data); stockFree(pool->offsets); free(pool->slots); memset(pool, 0, sizeof(*pool)); }
 
-// checkExpiry remains unchanged...
-void checkExpiry() {
-    fprintf(stderr, "checkExpiry: Started.\n"); time_t now_t = time(NULL); struct tm now_tm = *localtime(&now_t); now_tm.tm_hour=0; now_tm.tm_min=0; now_tm.tm_sec=0; time_t today_start = mktime(&now_tm);
-    const int warn_days = 90; struct tm warn_tm = now_tm; warn_tm.tm_mday += warn_days; mktime(&warn_tm); time_t warn_start = mktime(&warn_tm);
-    printf("<h2>Stock Expiry Status</h2><p>Showing expired or expiring within %d days.</p>", warn_days); printf("<div class='table-container-box'><table class='expiry-table'><thead><tr><th>Name</th><th>Code</th><th>Expiry</th><th style='text-align: center;'>Status</th></tr></thead><tbody>"); fflush(stdout);
-    int found = 0; if (globalBstRoot == NULL) { fprintf(stderr, "checkExpiry: BST empty.\n"); } else { checkExpiryRecursive(globalBstRoot, today_start, warn_start, &found, warn_days); }
-    if (found == 0) { printf("<tr><td colspan='4' style='text-align:center; font-style:italic;'>No items expired or expiring soon.</td></tr>"); }
-    printf("</tbody></table></div>"); fprintf(stderr, "checkExpiry: Finished.\n"); fflush(stdout);
+static size_t stringPoolBytes(const StringPool *pool) { return (size_t)pool->cap + sizeof(unsigned int) * ((size_t)pool->id_cap + pool->slot_count); }
+
+// The hot part of a flat row. 0 if its expiry or price cannot be packed (callers validate first: stockRowFromCsv, stockRowProblem)
+static int stockItemFromRow(const struct medicine *med, StockItem *m) {
+    m->mcode = med->mcode; m->quantity = med->quantity; m->expiry = stockExpiryPack(med->year, med->month, med->day);
+    if (m->expiry < 0 || !(med->price >= -STOCK_PRICE_MAX && med->price <= STOCK_PRICE_MAX)) return 0;
+    m->price_paise = (int)(med->price * 100.0 + (med->price < 0 ? -0.5 : 0.5)); return 1;
 }
 
-// Modified generateReport to include Invoice ID
-void generateReport() {
-    fprintf(stderr, "generateReport (Detailed Table with Invoice ID): Called.\n");
-    FILE *fp = fopen(SALES_FILE, "r");
-    if (fp == NULL) {
-        if (errno == ENOENT) { fprintf(stderr, "Sales file %s not found.\n", SALES_FILE); printf("<h2>Sales Report</h2><div class='report-summary'><p>No sales have been recorded yet.</p></div>"); }
-        else { fprintf(stderr, "Error opening sales file %s: %s\n", SALES_FILE, strerror(errno)); printf("<h2>Error Generating Report</h2><p class='error'>Could not open sales history (%s). %s</p>", SALES_FILE, strerror(errno)); }
-        fflush(stdout); return;
-    }
+StockHandle stockStoreAdd(StockStore *store, const struct medicine *med) {
+    StockItem item; if (store == NULL || med == NULL || store->count == UINT_MAX - 1) return 0;
+    if (!stockItemFromRow(med, &item)) { fprintf(stderr, "Error: Code %d has an expiry or price the store cannot hold.\n", med->mcode); return 0; }
+    unsigned int slot = store->count % STOCK_STORE_CHUNK; int chunk = (int)(store->count / STOCK_STORE_CHUNK);
+    if (slot == 0 && chunk == store->chunk_count) {
+        if (store->chunk_count == store->chunk_capacity) { int cap = store->chunk_capacity ? store->chunk_capacity * 2 : 16;
+            StockItem **c = (StockItem **)realloc(store->chunks, sizeof(StockItem *) * (size_t)cap); if (c != NULL) { store->chunks = c; }
+            StockItemCold **cc = c ? (StockItemCold **)realloc(store->cold, sizeof(StockItemCold *) * (size_t)cap) : NULL; if (cc != NULL) { store->cold = cc; }
+            if (c == NULL || cc == NULL) { fprintf(stderr, "Error: Mem alloc failed stock store chunk list.\n"); return 0; } store->chunk_capacity = cap; }
+        StockItem *recs = (StockItem *)malloc(sizeof(StockItem) * STOCK_STORE_CHUNK); StockItemCold *cold = (StockItemCold *)malloc(sizeof(StockItemCold) * STOCK_STORE_CHUNK);
+        if (recs == NULL || cold == NULL) { fprintf(stderr, "Error: Mem alloc failed stock store chunk.\n"); free(recs); free(cold); return 0; }
+        store->chunks[store->chunk_count] = recs; store->cold[store->chunk_count++] = cold; }
+    StockItemCold *c = &store->cold[chunk][slot]; c->name = stringPoolIntern(&store->names, med->name); c->supplier = stringPoolIntern(&store->suppliers, med->s_name); c->s_contact = med->s_contact;
+    if (c->name == STRING_POOL_NONE || c->supplier == STRING_POOL_NONE) return 0;
+    store->chunks[chunk][slot] = item; return ++store->count;
+}
+
+StockItem* stockStoreGet(const StockStore *store, StockHandle handle) {
+    if (store == NULL || handle == 0 || handle > store->count) return NULL;
+    return &store->chunks[(handle - 1) / STOCK_STORE_CHUNK][(handle - 1) % STOCK_STORE_CHUNK];
+}
 
-    printf("<h2>Sales Report</h2>");
+StockItemCold* stockStoreCold(const StockStore *store, StockHandle handle) {
+    if (store == NULL || handle == 0 || handle > store->count) return NULL;
+    return &store->cold[(handle - 1) / STOCK_STORE_CHUNK][(handle - 1) % STOCK_STORE_CHUNK];
+}
 
-    // --- Detailed Sales Table ---
-    printf("<div class='table-container-box' style='margin-bottom: 30px;'>"); // Add margin below table
-    printf("<h2>Detailed Sales History</h2>");
-    printf("<table class='stock-table'><thead>"); // Use stock-table style for consistency
-    // Added Invoice ID column header
-    printf("<tr><th>Invoice ID</th><th>Date</th><th>Time</th><th>Customer</th><th>Med Code</th><th>Med Name</th><th style='text-align:right;'>Qty</th><th style='text-align:right;'>Price/Item</th><th style='text-align:right;'>Total Cost</th></tr>");
-    printf("</thead><tbody>");
-    fflush(stdout);
-
-    char line[512];
-    char *field;
-    char *line_ptr;
-    int is_quoted;
-    int line_num = 0;
-    int data_found = 0;
-    int is_header = 1;
-    double total_sales_value = 0.0;
-    long total_items_sold = 0;
-    long transaction_count = 0; // Counts unique invoice IDs
-
-    // To track unique invoices for summary
-    char **unique_invoices = NULL;
-    int unique_invoice_count = 0;
-    int unique_invoice_capacity = 0;
+const char *stockStoreName(const StockStore *store, StockHandle handle) {
+    const StockItemCold *c = stockStoreCold(store, handle); return c ? stringPoolGet(&store->names, c->name) : "";
+}
 
+static void stockRowFromParts(const StockItem *m, const StockItemCold *c, const StringPool *names, const StringPool *suppliers, struct medicine *row) {
+    memset(row, 0, sizeof(*row)); snprintf(row->name, sizeof(row->name), "%s", stringPoolGet(names, c->name)); snprintf(row->s_name, sizeof(row->s_name), "%s", stringPoolGet(suppliers, c->supplier));
+    row->mcode = m->mcode; row->s_contact = c->s_contact; row->price = (float)(m->price_paise / 100.0); row->quantity = m->quantity; stockExpiryUnpack(m->expiry, &row->year, &row->month, &row->day);
+}
 
-    while (fgets(line, sizeof(line), fp)) {
-        line_num++;
-        line[strcspn(line, "\r\n")] = 0; // Remove trailing newline/CR
-        if (strspn(line, " \t") == strlen(line)) continue; // Skip blank lines
-
-        if (is_header) {
-             // Basic header check including InvoiceID
-            if (strstr(line, "InvoiceID") && strstr(line, "Date") && strstr(line, "CustomerName") && strstr(line, "TotalCost")) {
-                is_header = 0; continue; // Skip the header row
-            } else {
-                 fprintf(stderr, "generateReport: Warning - Sales file header might be missing or invalid (expected InvoiceID).\n");
-                 is_header = 0; // Assume header missing, try processing this line
-            }
-        }
+void stockStoreRow(const StockStore *store, StockHandle handle, struct medicine *row) {
+    const StockItem *m = stockStoreGet(store, handle); if (m == NULL) { memset(row, 0, sizeof(*row)); return; }
+    stockRowFromParts(m, stockStoreCold(store, handle), &store->names, &store->suppliers, row);
+}
 
-        // Use a temporary sale record struct to hold parsed data
-        struct sale_record current_sale = {0};
-        int field_index = 0;
-        int parse_ok = 1;
-        line_ptr = line; // Initialize pointer for get_csv_field
-
-        while ((field = get_csv_field(&line_ptr, &is_quoted)) != NULL) {
-            // Trim leading/trailing whitespace from field (important for conversions)
-            char *start_trimmed = field;
-            while (isspace((unsigned char)*start_trimmed)) start_trimmed++;
-            char *end_trimmed = start_trimmed + strlen(start_trimmed) - 1;
-            while (end_trimmed > start_trimmed && isspace((unsigned char)*end_trimmed)) end_trimmed--;
-            *(end_trimmed + 1) = '\0';
-
-            // Adjusted indices for InvoiceID at the start
-            switch (field_index) {
-                case 0: strncpy(current_sale.invoice_id, start_trimmed, sizeof(current_sale.invoice_id)-1); break;
-                case 1: strncpy(current_sale.date_str, start_trimmed, sizeof(current_sale.date_str)-1); break;
-                case 2: strncpy(current_sale.time_str, start_trimmed, sizeof(current_sale.time_str)-1); break;
-                case 3: strncpy(current_sale.customer_name, start_trimmed, sizeof(current_sale.customer_name)-1); break;
-                case 4: current_sale.medicine_code = atoi(start_trimmed); break;
-                case 5: strncpy(current_sale.medicine_name, start_trimmed, sizeof(current_sale.medicine_name)-1); break;
-                case 6: current_sale.quantity = atoi(start_trimmed); break;
-                case 7: current_sale.price_per_item = atof(start_trimmed); break;
-                case 8: current_sale.total_cost = atof(start_trimmed); break;
-                default: break; // Ignore extra fields
-            }
-            field_index++;
-        }
+void freeStockStore(StockStore *store) {
+    if (store == NULL) { return; } for (int i = 0; i < store->chunk_count; i++) { stockFree(store->chunks[i]); stockFree(store->cold[i]); }
+    free(store->chunks); free(store->cold); freeStringPool(&store->names); freeStringPool(&store->suppliers); free(store);
+}
 
-        // Basic validation: check if essential fields were parsed reasonably
-        // Expecting 9 fields now. Check Invoice ID length > 0 as well.
-        if (field_index >= 9 && strlen(current_sale.invoice_id) > 0 && current_sale.medicine_code > 0 && current_sale.quantity > 0 && current_sale.total_cost >= 0) {
-            data_found = 1;
-
-            // Count unique invoices for summary
-            int found_invoice = 0;
-            for(int i = 0; i < unique_invoice_count; ++i) {
-                if (strcmp(unique_invoices[i], current_sale.invoice_id) == 0) {
-                    found_invoice = 1;
-                    break;
-                }
-            }
-            if (!found_invoice) {
-                if (unique_invoice_count >= unique_invoice_capacity) {
-                    unique_invoice_capacity = (unique_invoice_capacity == 0) ? 10 : unique_invoice_capacity * 2;
-                    char **temp_realloc = realloc(unique_invoices, unique_invoice_capacity * sizeof(char*));
-                    if (!temp_realloc) {
-                        fprintf(stderr, "generateReport: Error reallocating memory for unique invoices. Summary count may be incorrect.\n");
-                        // Continue without tracking further unique invoices if realloc fails
-                    } else {
-                         unique_invoices = temp_realloc;
-                    }
-                }
-                 if (unique_invoice_count < unique_invoice_capacity) { // Check again in case realloc failed
-                    unique_invoices[unique_invoice_count] = strdup(current_sale.invoice_id);
-                    if (!unique_invoices[unique_invoice_count]) {
-                         fprintf(stderr, "generateReport: Error duplicating invoice ID string. Summary count may be incorrect.\n");
-                    } else {
-                        unique_invoice_count++;
-                        transaction_count++; // Increment count only for unique invoices
-                    }
-                 }
-            }
-
-            total_items_sold += current_sale.quantity;
-            total_sales_value += current_sale.total_cost;
-
-            // Print the table row including Invoice ID
-            printf("<tr>");
-            printf("<td>%s</td>", current_sale.invoice_id); // Display Invoice ID
-            printf("<td>%s</td>", current_sale.date_str);
-            printf("<td>%s</td>", current_sale.time_str);
-            printf("<td>%s</td>", current_sale.customer_name); // Consider HTML escaping if needed
-            printf("<td>%d</td>", current_sale.medicine_code);
-            printf("<td>%s</td>", current_sale.medicine_name); // Consider HTML escaping
-            printf("<td style='text-align:right;'>%d</td>", current_sale.quantity);
-            printf("<td style='text-align:right;'>₹%.2f</td>", current_sale.price_per_item); // Added Rupee Symbol
-            printf("<td style='text-align:right;'>₹%.2f</td>", current_sale.total_cost);    // Added Rupee Symbol
-            printf("</tr>\n");
-            fflush(stdout);
-        } else if (strlen(line) > 0 && !is_header) { // Avoid warning on blank lines or the actual header
-             fprintf(stderr, "generateReport: Malformed or incomplete line %d in %s. Parsed %d fields. Skipping row.\n", line_num, SALES_FILE, field_index);
-        }
-    } // End while loop reading file
+size_t stockStoreBytes(const StockStore *store) {
+    return store ? sizeof(StockStore) + (sizeof(StockItem *) + sizeof(StockItemCold *)) * (size_t)store->chunk_capacity + (sizeof(StockItem) + sizeof(StockItemCold)) * STOCK_STORE_CHUNK * (size_t)store->chunk_count
+        + stringPoolBytes(&store->names) + stringPoolBytes(&store->suppliers) : 0;
+}
 
-    if (ferror(fp)) {
-        fprintf(stderr, "generateReport: Error reading %s: %s\n", SALES_FILE, strerror(errno));
-        printf("<tr><td colspan='9' class='error'>Error reading sales data. Report may be incomplete.</td></tr>"); // Increased colspan
-    }
-    if (!data_found && !ferror(fp)) {
-        printf("<tr><td colspan='9' style='text-align:center; font-style:italic;'>No sales data found in the file.</td></tr>"); // Increased colspan
-    }
+// Records are never removed, so a record that reached the store but not every index cannot be taken back out. The
+// caller has already written STOCK_FILE and stamped it; forgetting the stamp makes the next syncStockFromDisk rebuild
+// the store and indexes from disk instead of serving views and lookups that disagree.
+static int stockInsertFailed(const char *what, int code) {
+    fprintf(stderr, "Error: %s insert failed code %d; indexes out of step, reloading on the next sync.\n", what, code); forgetStockFileStamp(); return -1;
+}
 
-    fclose(fp);
-    printf("</tbody></table></div>"); // Close table and container box
-
-    // --- Summary Section ---
-    printf("<div class='report-summary'>");
-    printf("<h2>Sales Summary</h2>");
-    if (transaction_count > 0) {
-        printf("<ul>");
-        printf("<li><strong>Total Unique Invoices (Transactions):</strong> %ld</li>", transaction_count); // Clarified meaning
-        printf("<li><strong>Total Individual Items Sold:</strong> %ld</li>", total_items_sold);
-        printf("<li><strong>Total Sales Value:</strong> ₹%.2f</li>", total_sales_value); // Added Rupee Symbol
-        printf("</ul>");
-    } else {
-        printf("<p>No valid sales transactions found to summarize.</p>");
-    }
-    printf("</div>"); // Close report-summary
+// bulk=1 is the load path: the ordered indexes are appended to and must be finished with orderedIndexFinishLoad.
+int addStockRecord(const struct medicine *med, int bulk) {
+    if (searchHashTableByCode(globalHashTable, med->mcode) != NULL) { logAt(LOG_WARN, "Warn: Duplicate code %d, not added.\n", med->mcode); return 0; }
+    StockHandle h = stockStoreAdd(globalStockStore, med); if (h == 0) return -1;
+    if (insertIntoHashTable(globalHashTable, h) != 1) return stockInsertFailed("Hash", med->mcode);
+    OrderedIndex *ordered[2] = { globalStockIndex, globalExpiryIndex };
+    for (int i = 0; i < 2; i++) { if (bulk ? !orderedIndexAppend(ordered[i], h) : insertOrderedIndex(ordered[i], h) != 1) return stockInsertFailed("Ordered index", med->mcode); }
+    if (!nameIndexAdd(globalNameIndex, h)) return stockInsertFailed("Name index", med->mcode);
+    return 1;
+}
+
+
+int addStockRecords(const struct medicine *meds, int count) {
+    StockHandle *handles = (StockHandle *)malloc(sizeof(StockHandle) * (size_t)(count ? count : 1)); if (handles == NULL) return -1;
+    int ok = hashTableReserve(globalHashTable, globalHashTable->count + count);
+    for (int i = 0; i < count && ok; i++) { handles[i] = stockStoreAdd(globalStockStore, &meds[i]);
+        ok = handles[i] != 0 && insertIntoHashTable(globalHashTable, handles[i]) == 1 && nameIndexAdd(globalNameIndex, handles[i]); }
+    ok = ok && orderedIndexInsertBatch(globalStockIndex, handles, count) && orderedIndexInsertBatch(globalExpiryIndex, handles, count);
+    free(handles); if (!ok) { fprintf(stderr, "Error: Batch insert of %d records failed.\n", count); forgetStockFileStamp(); return -1; } // Some may be half-indexed (see stockInsertFailed)
+    return 1;
+}
+
+
+// --- Hashing Function Implementations ---
+// Open addressing with Robin Hood probing: a slot holds the key and a handle into table->store, so a
+// lookup scans a few adjacent 8-byte slots instead of chasing list nodes. The probe distance of a
+// resident key is recomputed from its hash, so slots stay compact. Records are never removed.
+
+unsigned int hashFunction(int key, int tableSize) {
+    unsigned int hash = (unsigned int)key; // Murmur3 finalizer: sequential codes spread over the whole table
+    hash ^= hash >> 16; hash *= 0x85ebca6bu; hash ^= hash >> 13; hash *= 0xc2b2ae35u; hash ^= hash >> 16;
+    return hash & (unsigned int)(tableSize - 1); // tableSize is always a power of two
+}
+
+HashTable* createHashTable(int size, StockStore *store) {
+    if (size <= 0 || store == NULL) { fprintf(stderr, "Error: Invalid hash table size (%d) or no store.\n", size); return NULL; }
+    int capacity = 16; while (capacity < size && capacity < (1 << 30)) capacity <<= 1;
+    HashTable *table = (HashTable *)calloc(1, sizeof(HashTable));
+    if (table != NULL) { table->slots = (HashSlot *)calloc((size_t)capacity, sizeof(HashSlot)); }
+    if (table == NULL || table->slots == NULL) { fprintf(stderr, "Error: Mem alloc failed for hash table (size %d).\n", size); if (table) { free(table->slots); free(table); } return NULL; }
+    table->capacity = capacity; table->store = store;
+    logAt(LOG_DEBUG, "Hash table created (capacity %d).\n", capacity);
+    return table;
+}
 
-    // Free memory used for tracking unique invoices
-    for(int i = 0; i < unique_invoice_count; ++i) {
-        free(unique_invoices[i]);
+// Places (code, handle) using Robin Hood displacement. Caller guarantees the code is absent and a free slot exists.
+static void hashTablePlace(HashSlot *slots, int capacity, int code, StockHandle handle) {
+    unsigned int mask = (unsigned int)capacity - 1, pos = hashFunction(code, capacity), dist = 0;
+    HashSlot cur = { code, handle };
+    for (;;) {
+        HashSlot *s = &slots[pos];
+        if (s->handle == 0) { *s = cur; return; }
+        unsigned int s_dist = (pos - hashFunction(s->mcode, capacity)) & mask;
+        if (s_dist < dist) { HashSlot tmp = *s; *s = cur; cur = tmp; dist = s_dist; } // Take from the rich (short probe), give to the poor
+        pos = (pos + 1) & mask; dist++;
     }
-    free(unique_invoices);
+}
 
-    fprintf(stderr, "generateReport: Finished.\n");
-    fflush(stdout);
+static int hashTableGrow(HashTable *table) {
+    int new_capacity = table->capacity * 2; HashSlot *slots = (HashSlot *)calloc((size_t)new_capacity, sizeof(HashSlot));
+    if (slots == NULL) { fprintf(stderr, "Error: Mem alloc failed growing hash table to %d.\n", new_capacity); return 0; }
+    for (int i = 0; i < table->capacity; i++) { if (table->slots[i].handle != 0) hashTablePlace(slots, new_capacity, table->slots[i].mcode, table->slots[i].handle); }
+    stockFree(table->slots); table->slots = slots; table->capacity = new_capacity; return 1;
 }
 
+// Grows the table until 'count' records fit under the load factor (bulk loads size it once up front)
+int hashTableReserve(HashTable *table, int count) {
+    while ((long long)count * 8 > (long long)table->capacity * 7) { if (!hashTableGrow(table)) return 0; }
+    return 1;
+}
 
-// Modified searchMedicine to add Rupee symbol
-void searchMedicine(char *request_data) {
-    fprintf(stderr, "searchMedicine: Started.\n"); char *query = get_param(request_data, "searchQuery"); int matches = 0;
-    if (!query || strlen(query) == 0) { printf("<p class='error'>No search term.</p><p><a href=\"medical.exe\" class='btn'>View All</a></p>"); if (query) free(query); return; }
-    int code = 0; int is_code = 0; char *e; errno = 0; long pcode = strtol(query, &e, 10); int is_num = (errno==0 && e!=query && pcode>=INT_MIN && pcode<=INT_MAX); while (is_num && isspace((unsigned char)*e)) e++;
-    if (is_num && *e=='\0' && pcode>0) { code=(int)pcode; is_code=1; fprintf(stderr, "Search: Code query %d\n", code); } else { fprintf(stderr, "Search: Name query '%s'\n", query); }
-    printf("<div style='overflow-x:auto;'><table class='stock-table'><thead><tr><th>Code</th><th>Name</th><th>Supplier</th><th>Contact</th><th>Price</th><th>Quantity</th><th>Expiry Date</th></tr></thead><tbody>"); fflush(stdout);
-    if (is_code) { fprintf(stderr, "Search hash code %d\n", code); struct medicine* med = searchHashTableByCode(globalHashTable, globalHashTableSize, code);
-        if (med != NULL) { matches=1; struct medicine m = *med;
-            // Added Rupee symbol below
-            printf("<tr><td>%d</td><td>%s</td><td>%s</td><td>%lld</td><td>₹%.2f</td><td style='text-align:center;'>%d</td><td>%04d-%02d-%02d</td></tr>\n", m.mcode, m.name, m.s_name, m.s_contact, m.price, m.quantity, m.year, m.month, m.day); fflush(stdout); }
-        else { fprintf(stderr, "Code %d not found hash.\n", code); } }
-    else { fprintf(stderr, "Search BST name '%s'\n", query); if (globalBstRoot == NULL) { fprintf(stderr, "BST empty, cannot search name.\n"); }
-           else { searchBSTByNameSubstring(globalBstRoot, query, &matches); } // This function already modified for Rupee symbol
+int insertIntoHashTable(HashTable *table, StockHandle handle) {
+    StockItem *med = table ? stockStoreGet(table->store, handle) : NULL; if (med == NULL) return -1;
+    if (hashTableFind(table, med->mcode) != 0) { logAt(LOG_WARN, "Warn: Duplicate code %d in hash insert.\n", med->mcode); return 0; }
+    if ((table->count + 1) * 8 > table->capacity * 7 && !hashTableGrow(table)) return -1; // Keep load factor <= 7/8
+    hashTablePlace(table->slots, table->capacity, med->mcode, handle); table->count++; return 1;
+}
+
+StockHandle hashTableFind(const HashTable *table, int code) {
+    if (table == NULL) return 0;
+    unsigned int mask = (unsigned int)table->capacity - 1, pos = hashFunction(code, table->capacity), dist = 0;
+    for (;;) {
+        const HashSlot *s = &table->slots[pos];
+        if (s->handle == 0) return 0;
+        if (s->mcode == code) return s->handle;
+        if (((pos - hashFunction(s->mcode, table->capacity)) & mask) < dist) return 0; // Robin Hood invariant: code would have been placed by now
+        pos = (pos + 1) & mask; dist++;
     }
-    if (matches == 0) { printf("<tr><td colspan='7' style='text-align:center; font-style:italic;'>No match found for '%s'.</td></tr>", query); }
-    printf("</tbody></table></div>"); printf("<p style=\"margin-top: 20px; text-align:center;\"><a href=\"medical.exe\" class=\"btn btn-secondary\">View All Stock</a></p>"); fflush(stdout);
-    if (query) free(query); fprintf(stderr, "searchMedicine: Finished.\n"); fflush(stderr);
 }
 
+StockItem* searchHashTableByCode(HashTable *table, int code) { return table ? stockStoreGet(table->store, hashTableFind(table, code)) : NULL; }
 
-// --- Main Function (Simplified Routing Logic) ---
-int main() {
-    // Seed random number generator for potential use (like invoice ID)
-    srand((unsigned int)time(NULL) ^ (unsigned int)getpid());
+void freeHashTable(HashTable *table) {
+    if (table == NULL) return;
+    logAt(LOG_DEBUG, "Freeing hash table...\n");
+    stockFree(table->slots); free(table); logAt(LOG_DEBUG, "Hash table freed.\n");
+}
 
-    fprintf(stderr, "\n--------------------\nmedical.exe: Started (HS/BST).\n"); fflush(stderr);
-    char *req_method = NULL, *req_data = NULL, *q_string = NULL, *len_s = NULL;
-    char *action = NULL, *actionType = NULL; long data_len = 0; int processed = 0, loaded_ok = 0;
-
-    globalHashTable = createHashTable(globalHashTableSize); globalBstRoot = NULL;
-    if (globalHashTable == NULL) { printf("Content-Type: text/html\n\n<!DOCTYPE html><html><body><h1>Internal Error</h1><p class='error'>Hash Table init failed.</p></body></html>"); fprintf(stderr, "FATAL: Hash table alloc failed.\n"); return 1; }
-    loaded_ok = loadStockData(STOCK_FILE, &globalHashTable, &globalHashTableSize, &globalBstRoot);
-    if (!loaded_ok) { printf("Content-Type: text/html\n\n<!DOCTYPE html><html><body><h1>Internal Error</h1><p class='error'>Failed load stock data from '%s'.</p></body></html>", STOCK_FILE); fprintf(stderr, "FATAL: loadStockData failed.\n"); freeHashTable(globalHashTable, globalHashTableSize); freeTree(globalBstRoot); return 1; }
-
-    printf("Content-Type: text/html\n\n"); fflush(stdout);
-    printf("<!DOCTYPE html><html lang=\"en\"><head>");
-    printf("<meta charset=\"UTF-8\"><meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">");
-    printf("<title>Discount Pharmacy - Management (HS/BST)</title>");
-    printf("<link rel=\"stylesheet\" href=\"https://cdn.jsdelivr.net/npm/bootstrap@5.3.0/dist/css/bootstrap.min.css\">");
-    printf("<link rel=\"stylesheet\" href=\"https://cdn.jsdelivr.net/npm/bootstrap-icons/font/bootstrap-icons.css\">");
-    printf("<link rel=\"icon\" href=\"../discount pharmacy.png\" type=\"image/x-icon\">");
-    printf("<style>"); // --- Embed All Shared CSS Rules ---
-    // CSS rules remain unchanged...
-    printf(":root{--primary:#1976D2;--secondary:#64B5F6;--accent:#BBDEFB;--text:#2d3748;--light:#fff;--bg-gradient:linear-gradient(135deg,#1976D2 0%%,#64B5F6 100%%);--navbar-bg:rgba(255,255,255,.95);--card-bg:rgba(255,255,255,.9);--table-border:rgba(187,222,251,.6);--table-header-bg:var(--primary);--table-header-text:var(--light);--table-row-hover:rgba(187,222,251,.3);--status-expired-bg:#FEE2E2;--status-expired-text:#B91C1C;--status-warning-bg:#FEF3C7;--status-warning-text:#B45309;--status-active-bg:#D1FAE5;--status-active-text:#047857;--status-active-default:var(--text)}");
-    printf("*{margin:0;padding:0;box-sizing:border-box}body{background:var(--bg-gradient);color:var(--text);font-family:'Poppins','Segoe UI',Tahoma,Geneva,Verdana,sans-serif;min-height:100vh;overflow-x:hidden;position:relative;background-attachment:fixed}");
-    printf(".bg-circles{position:fixed;top:0;left:0;width:100%%;height:100%%;z-index:-2;overflow:hidden;pointer-events:none}.circle{position:absolute;border-radius:50%%;background:rgba(255,255,255,.08);animation:float 20s infinite ease-in-out alternate}.circle-1{width:300px;height:300px;top:-100px;left:-100px;animation-duration:25s}.circle-2{width:400px;height:400px;bottom:-150px;right:-150px;animation-duration:30s;animation-delay:2s}.circle-3{width:200px;height:200px;top:25%%;right:15%%;animation-duration:20s;animation-delay:1s}@keyframes float{0%%{transform:translateY(0) scale(1)}100%%{transform:translateY(-20px) scale(1.05)}}");
-    printf(".navbar{background-color:var(--navbar-bg);box-shadow:0 4px 30px rgba(0,0,0,.1);backdrop-filter:blur(5px);border-bottom:1px solid rgba(255,255,255,.3);display:flex;align-items:center;padding:25px 40px;position:sticky;top:0;z-index:100}.logo a{display:flex;align-items:center;text-decoration:none;color:var(--primary);font-weight:700;font-size:20px;transition:all .3s ease;flex-shrink:0}.logo a:hover{transform:scale(1.05)}.logo img{height:35px;width:35px;margin-right:10px}.nav-links{display:flex;flex-wrap:wrap;gap:15px 20px;margin-left:auto}.nav-links a{text-decoration:none;color:var(--text);font-weight:500;padding:8px 16px;border-radius:30px;transition:all .3s ease;position:relative;font-size:1.1rem}.nav-links a:after{content:'';position:absolute;width:0;height:2px;bottom:-2px;left:50%%;background:var(--primary);transition:all .3s ease;transform:translateX(-50%%)}.nav-links a:hover{color:var(--primary)}.nav-links a:hover:after{width:70%%}");
-    printf(".user-menu{position:relative;margin-left:20px;flex-shrink:0}.user-icon{width:40px;height:40px;background:var(--bg-gradient);border-radius:50%%;display:flex;align-items:center;justify-content:center;color:#fff;cursor:pointer;box-shadow:0 4px 10px rgba(25,118,210,.3);transition:all .3s ease}.user-icon i{font-size:1.3rem;line-height:1}.user-icon:hover{transform:scale(1.1)}.dropdown-card{position:absolute;right:0;top:55px;background:#fff;border-radius:10px;box-shadow:0 10px 30px rgba(0,0,0,.1);padding:10px;min-width:120px;opacity:0;visibility:hidden;transform:translateY(-10px);transition:all .3s ease;z-index:110}.user-menu:hover .dropdown-card,.user-menu:focus-within .dropdown-card{opacity:1;visibility:visible;transform:translateY(0)}.logout-btn{display:flex;align-items:center;gap:8px;padding:10px 15px;color:#e53e3e;text-decoration:none;font-weight:500;border-radius:8px;transition:all .3s ease}.logout-btn i{font-size:1rem}.logout-btn:hover{background-color:#fed7d7}");
-    printf(".page-content{display:flex;flex-direction:column;align-items:center;padding:40px 20px;z-index:1;position:relative;width:100%%}");
-    printf("h2.page-title{color:#fff;font-size:36px;font-weight:700;text-align:center;margin:30px 0 40px 0;text-shadow:0 2px 10px rgba(0,0,0,.2);letter-spacing:1px}");
-    printf(".search-container{display:flex;justify-content:center;margin-bottom:30px;width:100%%;max-width:600px}.search-container form{display:flex;width:100%%}.search-container input[type=search]{flex-grow:1;padding:10px 15px;font-size:1rem;border:1px solid var(--accent);border-right:none;border-radius:8px 0 0 8px;background-color:rgba(255,255,255,.8);color:var(--text);transition:border-color .3s ease,box-shadow .3s ease;outline:none}.search-container input[type=search]:focus{border-color:var(--primary);box-shadow:0 0 0 3px rgba(25,118,210,.2);z-index:2;position:relative}.search-container button{padding:10px 15px;border:1px solid var(--accent);background-color:var(--light);color:var(--primary);border-radius:0 8px 8px 0;cursor:pointer;transition:background-color .3s ease,color .3s ease;flex-shrink:0;display:flex;align-items:center;justify-content:center}.search-container button:hover{background-color:var(--accent);color:var(--primary)}.search-container button i{font-size:1.2rem}");
-    printf(".table-container-box{background:var(--card-bg);backdrop-filter:blur(10px);border-radius:20px;box-shadow:0 15px 30px rgba(0,0,0,.2);border:1px solid rgba(255,255,255,.5);padding:30px 35px;max-width:1100px;width:95%%;margin:0 auto 40px auto;z-index:2;overflow-x:auto}.table-container-box h2{color:var(--primary);font-size:28px;margin-top:0;margin-bottom:25px;text-shadow:none;text-align:center}");
-    printf(".error{color:#D8000C;background-color:#FFD2D2;border:1px solid #D8000C;margin:10px 0;padding:15px;border-radius:4px}.success{color:#4F8A10;background-color:#DFF2BF;border:1px solid #4F8A10;margin:10px 0;padding:15px;border-radius:4px}.warning{color:#9F6000;background-color:#FEEFB3;border:1px solid #9F6000;margin:10px 0;padding:15px;border-radius:4px}");
-    printf(".stock-table{width:100%%;border-collapse:collapse;margin-top:15px;color:var(--text);font-size:.95rem}.stock-table th,.stock-table td{border:1px solid var(--table-border);padding:12px 15px;text-align:left;vertical-align:middle}.stock-table th{background-color:var(--table-header-bg);color:var(--table-header-text);font-weight:600;text-transform:uppercase;letter-spacing:.5px}.stock-table tbody tr:hover td{background-color:var(--table-row-hover) !important;}");
-    printf(".expiry-table{width:100%%;border-collapse:collapse;margin-top:15px;color:var(--text);font-size:.95rem}.expiry-table th,.expiry-table td{border:1px solid var(--table-border);padding:12px 15px;text-align:left;vertical-align:middle}.expiry-table th{background-color:var(--table-header-bg);color:var(--table-header-text);font-weight:600;text-transform:uppercase;letter-spacing:.5px}");
-    printf(".status-cell{font-weight:600;text-align:center;border-radius:15px;padding:5px 10px;display:inline-block;min-width:100px;line-height:1.2;}");
-    printf("tr.status-expired td{background-color:var(--status-expired-bg);}td span.status-expired{color:var(--status-expired-text);border:1px solid var(--status-expired-text);}");
-    printf("tr.status-warning td{background-color:var(--status-warning-bg);}td span.status-warning{color:var(--status-warning-text);border:1px solid var(--status-warning-text);}");
-    printf("tr.status-active td{}td span.status-active{color:var(--status-active-default);border:1px solid #ccc;}");
-    printf(".expiry-table tbody tr:hover td{background-color:var(--table-row-hover) !important;color:var(--text) !important;}.expiry-table tbody tr:hover td span.status-cell{color:var(--text) !important;border-color:var(--text) !important;background-color:transparent !important;}");
-    printf(".bill-details{border:1px solid var(--accent);padding:25px;margin-top:20px;border-radius:15px;background-color:rgba(255,255,255,.9);box-shadow:0 10px 25px rgba(0,0,0,.1);backdrop-filter:blur(5px);max-width:700px;width:95%%;margin-left:auto;margin-right:auto;}.bill-details h3{color:var(--primary);margin-bottom:20px;border-bottom:1px solid var(--accent);padding-bottom:15px;text-align:center;font-size:1.6rem;}.bill-details p{margin-bottom:10px;line-height:1.6;font-size:1rem;}.bill-details strong{color:var(--text);font-weight:600;}.bill-total{font-weight:bold;font-size:1.2rem;margin-top:20px;padding-top:15px;border-top:1px solid var(--accent);text-align:right;}");
-    printf(".report-summary{background:var(--card-bg);backdrop-filter:blur(10px);border-radius:15px;box-shadow:0 10px 25px rgba(0,0,0,.1);border:1px solid rgba(255,255,255,.5);padding:25px 35px;max-width:700px;width:95%%;margin:20px auto;z-index:2;}.report-summary ul{list-style:none;padding:0;}.report-summary li{font-size:1.1rem;margin-bottom:12px;padding-bottom:12px;border-bottom:1px dashed var(--accent);}.report-summary li:last-child{border-bottom:none;margin-bottom:0;padding-bottom:0;}.report-summary strong{color:var(--primary);}");
-    printf(".btn{display:inline-block;font-weight:400;color:#212529;text-align:center;vertical-align:middle;user-select:none;background-color:transparent;border:1px solid transparent;padding:.375rem .75rem;font-size:1rem;line-height:1.5;border-radius:.25rem;transition:color .15s ease-in-out,background-color .15s ease-in-out,border-color .15s ease-in-out,box-shadow .15s ease-in-out}.btn-primary{color:#fff;background-color:#1976D2;border-color:#1976D2}.btn-primary:hover{color:#fff;background-color:#1565C0;border-color:#115293}.btn-secondary{color:#fff;background-color:#6c757d;border-color:#6c757d}.btn-secondary:hover{color:#fff;background-color:#5a6268;border-color:#545b62}.btn-info{color:#fff;background-color:#0dcaf0;border-color:#0dcaf0}.btn-info:hover{color:#fff;background-color:#0baccc;border-color:#0aa1bf}");
-    printf("</style></head><body>");
-    printf("<div class=\"bg-circles\"><div class=\"circle circle-1\"></div><div class=\"circle circle-2\"></div><div class=\"circle circle-3\"></div></div>");
-    printf("<header><nav class=\"navbar\">"); // Navbar
-    printf("<div class=\"logo\"><a href=\"../medical shop.html\"><img src=\"../discount pharmacy.png\" alt=\"Logo\"><span>DISCOUNT PHARMACY</span></a></div>");
-    printf("<div class=\"nav-links\"><a href=\"../medical shop.html\">Home</a><a href=\"medical.exe?action=generate_report\">Reports</a><a href=\"medical.exe?action=check_expiry\">Expiry</a></div>");
-    printf("<div class=\"user-menu\" tabindex=\"0\"><div class=\"user-icon\"><i class=\"bi bi-person-fill\"></i></div><div class=\"dropdown-card\"><a href=\"../login.html\" class=\"logout-btn\"><i class=\"bi bi-box-arrow-right\"></i> Logout</a></div></div>");
-    printf("</nav></header>");
-    printf("<main class=\"page-content\">"); fflush(stdout); // Main Content Start
+int updateHashTableQuantity(HashTable *table, int code, int new_quantity) {
+    if (table == NULL) return -1;
+    StockItem* med_ptr = searchHashTableByCode(table, code);
+    if (med_ptr != NULL) { med_ptr->quantity = new_quantity; logAt(LOG_DEBUG, "Qty updated code %d -> %d.\n", code, new_quantity); return 1; }
+    logAt(LOG_WARN, "Warn: Code %d not found for qty update.\n", code); return 0;
+}
 
-    // --- Get Request Data ---
-    // Request data fetching remains unchanged...
-    req_method = getenv("REQUEST_METHOD"); if (req_method == NULL) req_method = "GET";
-    fprintf(stderr, "Method: %s\n", req_method); req_data = NULL;
-    if (strcmp(req_method, "POST") == 0) { len_s = getenv("CONTENT_LENGTH"); if (len_s != NULL) { errno = 0; data_len = strtol(len_s, NULL, 10);
-            if (errno == 0 && data_len > 0 && data_len <= 20*1024*1024) { req_data = (char *)malloc(data_len + 1); if (req_data) { size_t rd = fread(req_data, 1, data_len, stdin); if (rd==(size_t)data_len) { req_data[data_len]='\0'; fprintf(stderr, "Read %ld POST\n", data_len); } else { free(req_data); req_data = NULL; fprintf(stderr, "POST read err (%zu/%ld)\n", rd, data_len); } } else { fprintf(stderr, "Malloc fail POST %ld\n", data_len); } }
-            else if (data_len > 20*1024*1024) { fprintf(stderr, "POST too large: %ld\n", data_len); } else { fprintf(stderr, "Bad CONTENT_LENGTH: %s\n", len_s); } } else { fprintf(stderr, "No CONTENT_LENGTH POST\n"); } }
-    else if (strcmp(req_method, "GET") == 0) { q_string = getenv("QUERY_STRING"); if (q_string != NULL && strlen(q_string) > 0) { req_data = strdup(q_string); if (!req_data) fprintf(stderr, "strdup fail GET\n"); else fprintf(stderr, "GET data: %s\n", req_data); } else { fprintf(stderr, "No QUERY_STRING GET\n"); } }
 
-    // --- Routing ---
-    // Routing logic remains unchanged...
-    if (req_data != NULL) { action = get_param(req_data, "action"); if (action == NULL) { actionType = get_param(req_data, "actionType"); } }
-    if (action != NULL) { fprintf(stderr, "Route action='%s'\n", action);
-        if (strcmp(action, "add_stock") == 0 && strcmp(req_method, "POST") == 0) { printf("<h2 class='page-title'>Add Stock Results</h2>"); processAddStock(req_data); processed = 1; }
-        else if (strcmp(action, "update_stock") == 0 && strcmp(req_method, "POST") == 0) { printf("<h2 class='page-title'>Update Stock Results</h2>"); processUpdateStock(req_data); processed = 1; }
-        else if (strcmp(action, "billing") == 0 && strcmp(req_method, "POST") == 0) { printf("<h2 class='page-title'>Billing Results</h2>"); processBillingMultiple(req_data); processed = 1; }
-        else if (strcmp(action, "generate_report") == 0 && strcmp(req_method, "GET") == 0) { generateReport(); processed = 1; } // generateReport prints its own title
-        else if (strcmp(action, "check_expiry") == 0 && strcmp(req_method, "GET") == 0) { checkExpiry(); processed = 1; } // checkExpiry prints its own title
-        else { fprintf(stderr, "Unknown action/method: %s (%s)\n", action, req_method); printf("<h2 class='page-title'>Error</h2><div class='error'>Invalid action ('%s')/method.</div>\n", action ? action : "NULL"); processed = 1; }
-        free(action); }
-    else if (actionType != NULL) { fprintf(stderr, "Route actionType='%s'\n", actionType);
-         if (strcmp(actionType, "searchStock") == 0 && req_data != NULL ) { printf("<h2 class='page-title'>Stock Search Results</h2>"); printf("<div class=\"search-container\"><form action=\"medical.exe\" method=\"post\" class=\"d-flex w-100\"><input class=\"form-control\" type=\"search\" placeholder=\"Search...\" name=\"searchQuery\" required><input type=\"hidden\" name=\"actionType\" value=\"searchStock\"><button class=\"btn btn-primary\" type=\"submit\"><i class=\"bi bi-search\"></i></button></form></div>"); fflush(stdout); searchMedicine(req_data); processed = 1; }
-         else { fprintf(stderr, "Unknown actionType: %s\n", actionType); printf("<h2 class='page-title'>Error</h2><div class='error'>Invalid action type ('%s').</div>\n", actionType); processed = 1; }
-        free(actionType); }
+// --- Ordered Index Implementation ---
+// Sorted array of (key, handle) entries plus a small sorted insert buffer (delta). Lookups binary-search both; the delta
+// is merged into the main array once it fills, so single inserts cost O(ORDERED_DELTA_MAX) plus an
+// amortised O(n / ORDERED_DELTA_MAX). Bulk loads append and sort once. Nothing here recurses, so depth
+// does not depend on the order codes appear in stock.csv. The same structure backs the code order
+// (globalStockIndex) and the expiry order (globalExpiryIndex); only the key function differs.
 
-    if (!processed) { // Default Action: View Stock
-        fprintf(stderr, "Default action: viewStock.\n"); printf("<h2 class='page-title'>Pharmacy Stock</h2>");
-        printf("<div class=\"search-container\"><form action=\"medical.exe\" method=\"post\" class=\"d-flex w-100\"><input class=\"form-control\" type=\"search\" placeholder=\"Search stock...\" name=\"searchQuery\" required><input type=\"hidden\" name=\"actionType\" value=\"searchStock\"><button class=\"btn btn-primary\" type=\"submit\"><i class=\"bi bi-search\"></i></button></form></div>");
-        printf("<div class=\"table-container-box\"><h2>Current Stock Levels</h2>"); fflush(stdout); viewStock(); printf("</div>"); // viewStock now shows Rupee symbol
-    }
+OrderedKey orderedKeyByCode(const StockItem *m) { return (OrderedKey)m->mcode; }
 
-    printf("</main></body></html>"); fflush(stdout); // End HTML
+OrderedKey orderedKeyByExpiry(const StockItem *m) {
+    int y, mo, d; stockExpiryUnpack(m->expiry, &y, &mo, &d);
+    return (OrderedKey)daysFromCivil(y, mo, d) * 4294967296LL + (OrderedKey)(unsigned int)m->mcode;
+}
 
-    // --- Cleanup ---
-    if (req_data) free(req_data);
-    fprintf(stderr, "Freeing memory...\n"); fflush(stderr);
-    freeHashTable(globalHashTable, globalHashTableSize); freeTree(globalBstRoot); globalHashTable = NULL; globalBstRoot = NULL;
-    fprintf(stderr, "medical.exe: Finished.\n--------------------\n\n"); fflush(stderr); return 0;
-} // END main
\ No newline at end of file
+// Howard Hinnant's days_from_civil: exact for any date, and cheap enough to run per row at load time
+long daysFromCivil(int year, int month, int day) {
+    long y = (long)year - (month <= 2); long era = (y >= 0 ? y : y - 399) / 400; long yoe = y - era * 400;
+    long doy = (153L * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1; long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+void civilFromDays(long days, int *year, int *month, int *day) {
+    long z = days + 719468; long era = (z >= 0 ? z : z - 146096) / 146097; long doe = z - era * 146097;
+    long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; long doy = doe - (365 * yoe + yoe / 4 - yoe / 100); long mp = (5 * doy + 2) / 153;
+    *day = (int)(doy - (153 * mp + 2) / 5 + 1); *month = (int)(mp < 10 ? mp + 3 : mp - 9); *year = (int)(yoe + era * 400 + (*month <= 2));
+}
+
+OrderedIndex* createOrderedIndex(StockStore *store, OrderedKeyFn key_of) {
+    OrderedIndex *idx = (OrderedIndex *)calloc(1, sizeof(OrderedIndex)); if (idx == NULL) { fprintf(stderr, "Error: Mem alloc failed ordered index.\n"); return NULL; }
+    idx->store = store; idx->key_of = key_of ? key_of : orderedKeyByCode; idx->delta = (OrderedEntry *)malloc(sizeof(OrderedEntry) * ORDERED_DELTA_MAX);
+    if (idx->delta == NULL) { fprintf(stderr, "Error: Mem alloc failed ordered index delta.\n"); free(idx); return NULL; }
+    return idx;
+}
+
+// First position in a[0..n) whose key is >= key
+static int orderedLowerBound(const OrderedEntry *a, int n, OrderedKey key) {
+    int lo = 0, hi = n; while (lo < hi) { int mid = lo + (hi - lo) / 2; if (a[mid].key < key) lo = mid + 1; else hi = mid; }
+    return lo;
+}
+
+static int orderedReserve(OrderedIndex *idx, int needed) {
+    if (needed <= idx->capacity) return 1;
+    int cap = idx->capacity ? idx->capacity : 1024; while (cap < needed) cap *= 2;
+    OrderedEntry *n = (OrderedEntry *)stockRealloc(idx->items, sizeof(OrderedEntry) * (size_t)idx->capacity, sizeof(OrderedEntry) * (size_t)cap); if (n == NULL) { fprintf(stderr, "Error: Mem alloc failed ordered index grow.\n"); return 0; }
+    idx->items = n; idx->capacity = cap; return 1;
+}
+
+// Merges the delta into items from the back, in place
+static int orderedMergeDelta(OrderedIndex *idx) {
+    if (idx->delta_count == 0) { return 1; } if (!orderedReserve(idx, idx->count + idx->delta_count)) { return 0; }
+    int i = idx->count - 1, j = idx->delta_count - 1, k = idx->count + idx->delta_count - 1;
+    while (j >= 0) { if (i >= 0 && idx->items[i].key > idx->delta[j].key) idx->items[k--] = idx->items[i--]; else idx->items[k--] = idx->delta[j--]; }
+    idx->count += idx->delta_count; idx->delta_count = 0; return 1;
+}
+
+int insertOrderedIndex(OrderedIndex *idx, StockHandle handle) {
+    StockItem *med = idx ? stockStoreGet(idx->store, handle) : NULL; if (med == NULL) return -1;
+    OrderedEntry e = { idx->key_of(med), handle };
+    if (searchOrderedIndex(idx, e.key) != NULL) { logAt(LOG_WARN, "Warn: Duplicate code %d in ordered index insert.\n", med->mcode); return 0; }
+    if (idx->delta_count == 0 && (idx->count == 0 || e.key > idx->items[idx->count - 1].key)) { // Ascending input: plain append
+        if (!orderedReserve(idx, idx->count + 1)) { return -1; } idx->items[idx->count++] = e; return 1; }
+    if (idx->delta_count == ORDERED_DELTA_MAX && !orderedMergeDelta(idx)) return -1;
+    int pos = orderedLowerBound(idx->delta, idx->delta_count, e.key);
+    memmove(&idx->delta[pos + 1], &idx->delta[pos], sizeof(OrderedEntry) * (size_t)(idx->delta_count - pos)); idx->delta[pos] = e; idx->delta_count++;
+    return 1;
+}
+
+int orderedIndexAppend(OrderedIndex *idx, StockHandle handle) {
+    StockItem *med = idx ? stockStoreGet(idx->store, handle) : NULL;
+    if (med == NULL || !orderedReserve(idx, idx->count + 1)) return 0;
+    OrderedKey key = idx->key_of(med); if (idx->count > 0 && key <= idx->items[idx->count - 1].key) idx->unsorted = 1;
+    idx->items[idx->count].key = key; idx->items[idx->count].handle = handle; idx->count++; return 1;
+}
+
+static int compareOrderedEntry(const void *a, const void *b) {
+    OrderedKey x = ((const OrderedEntry *)a)->key, y = ((const OrderedEntry *)b)->key; return (x > y) - (x < y);
+}
+
+int orderedIndexFinishLoad(OrderedIndex *idx) {
+    if (idx == NULL) { return 0; } if (!idx->unsorted) { return 1; }
+    qsort(idx->items, (size_t)idx->count, sizeof(OrderedEntry), compareOrderedEntry); idx->unsorted = 0;
+    int w = 0; for (int r = 0; r < idx->count; r++) { if (w > 0 && idx->items[w - 1].key == idx->items[r].key) { logAt(LOG_WARN, "Warn: Duplicate key %lld in ordered index load, dropped.\n", idx->items[r].key); continue; } idx->items[w++] = idx->items[r]; }
+    idx->count = w; return 1;
+}
+
+int orderedIndexInsertBatch(OrderedIndex *idx, const StockHandle *handles, int count) {
+    if (count <= 0) return 1;
+    OrderedEntry *batch = (OrderedEntry *)malloc(sizeof(OrderedEntry) * (size_t)count); if (batch == NULL || !orderedReserve(idx, idx->count + count)) { free(batch); return 0; }
+    for (int i = 0; i < count; i++) { batch[i].key = idx->key_of(stockStoreGet(idx->store, handles[i])); batch[i].handle = handles[i]; }
+    qsort(batch, (size_t)count, sizeof(OrderedEntry), compareOrderedEntry);
+    int i = idx->count - 1, j = count - 1, k = idx->count + count - 1; // Merged from the back, in place, like orderedMergeDelta
+    while (j >= 0) { if (i >= 0 && idx->items[i].key > batch[j].key) idx->items[k--] = idx->items[i--]; else idx->items[k--] = batch[j--]; }
+    idx->count += count; free(batch); return 1;
+}
+
+StockItem* searchOrderedIndex(OrderedIndex *idx, OrderedKey key) {
+    if (idx == NULL) return NULL;
+    int i = orderedLowerBound(idx->items, idx->count, key); if (i < idx->count && idx->items[i].key == key) return stockStoreGet(idx->store, idx->items[i].handle);
+    int j = orderedLowerBound(idx->delta, idx->delta_count, key); if (j < idx->delta_count && idx->delta[j].key == key) return stockStoreGet(idx->store, idx->delta[j].handle);
+    return NULL;
+}
+
+void orderedIndexSeek(const OrderedIndex *idx, OrderedKey from, OrderedIndexIter *it) {
+    it->idx = idx; it->i = idx ? orderedLowerBound(idx->items, idx->count, from) : 0; it->j = idx ? orderedLowerBound(idx->delta, idx->delta_count, from) : 0;
+}
+
+OrderedKey orderedIndexPeekKey(const OrderedIndexIter *it) {
+    const OrderedIndex *idx = it->idx; if (idx == NULL) return ORDERED_KEY_MAX;
+    OrderedKey a = it->i < idx->count ? idx->items[it->i].key : ORDERED_KEY_MAX, b = it->j < idx->delta_count ? idx->delta[it->j].key : ORDERED_KEY_MAX;
+    return a < b ? a : b;
+}
+
+StockHandle orderedIndexNextHandle(OrderedIndexIter *it) {
+    const OrderedIndex *idx = it->idx; if (idx == NULL) return 0;
+    int has_i = it->i < idx->count, has_j = it->j < idx->delta_count;
+    if (has_i && (!has_j || idx->items[it->i].key < idx->delta[it->j].key)) return idx->items[it->i++].handle;
+    if (has_j) return idx->delta[it->j++].handle;
+    return 0;
+}
+
+StockItem* orderedIndexNext(OrderedIndexIter *it) { StockHandle h = orderedIndexNextHandle(it); return h ? stockStoreGet(it->idx->store, h) : NULL; }
+
+int orderedIndexSize(const OrderedIndex *idx) { return idx ? idx->count + idx->delta_count : 0; }
+
+void freeOrderedIndex(OrderedIndex *idx) {
+    if (idx == NULL) { return; } stockFree(idx->items); free(idx->delta); free(idx);
+}
+
+size_t orderedIndexBytes(const OrderedIndex *idx) {
+    return idx ? sizeof(OrderedIndex) + sizeof(OrderedEntry) * ((size_t)idx->capacity + ORDERED_DELTA_MAX) : 0;
+}
+
+// Seeks to q->from_code and prints rows in code order until q->limit have passed the filters, to_code is passed, or
+// STOCK_PAGE_SCAN_MAX rows were examined, so a page costs the same whatever the size of the stock. With Rupee symbol.
+int printStockPage(OrderedIndex *idx, const StockPageQuery *q, int *next_code) {
+    OrderedIndexIter it; orderedIndexSeek(idx, (OrderedKey)q->from_code, &it); StockHandle h; int shown = 0, scanned = 0; *next_code = -1;
+    while (orderedIndexPeekKey(&it) <= (OrderedKey)q->to_code) {
+        if (shown == q->limit || scanned == STOCK_PAGE_SCAN_MAX) { *next_code = (int)orderedIndexPeekKey(&it); break; } // Keys are codes, so the next key is the cursor
+        if ((h = orderedIndexNextHandle(&it)) == 0) { break; } scanned++;
+        const StockItem *m = stockStoreGet(idx->store, h); double price = m->price_paise / 100.0; // Same double as the typed-in price, so the bounds are exact
+        if (m->quantity < q->min_qty || m->quantity > q->max_qty || price < q->min_price || price > q->max_price) continue;
+        outStockRow(idx->store, h); shown++; }
+    return shown;
+}
+
+// Expiry keys are (day << 32 | code), so everything expiring before today + warning_days is one prefix of
+// the index: the scan stops at the first later row instead of visiting the whole stock.
+void printExpiringStock(OrderedIndex *expiry_index, long today, int warning_days, int *relevant_items_found) {
+    OrderedIndexIter it; orderedIndexSeek(expiry_index, ORDERED_KEY_MIN, &it); OrderedKey end = (OrderedKey)(today + warning_days) * 4294967296LL; StockHandle h;
+    while (orderedIndexPeekKey(&it) < end && (h = orderedIndexNextHandle(&it)) != 0) {
+        const StockItem *m = stockStoreGet(expiry_index->store, h); int y, mo, d; stockExpiryUnpack(m->expiry, &y, &mo, &d);
+        int expired = daysFromCivil(y, mo, d) < today; const char *status_class = expired ? "status-expired" : "status-warning"; (*relevant_items_found)++;
+        outPrintf("<tr class='%s'><td>", status_class); outHtml(stockStoreName(expiry_index->store, h));
+        outPrintf("</td><td>%d</td><td>%04d-%02d-%02d</td><td style='text-align: center;'><span class='status-cell %s'>%s</span></td></tr>\n", m->mcode, y, mo, d, status_class, expired ? "Expired" : "Expiring Soon"); }
+}
+
+
+// --- Name Search Index Implementation ---
+// Every lower-cased three-byte window of a name maps to the ascending list of handles whose name contains
+// it. A query of three or more bytes intersects the postings of its own trigrams, so only names sharing
+// all of them are compared byte-for-byte; shorter queries fall back to checking every name. Matches are
+// returned sorted by code.
+
+// ASCII-only lower-casing, matching what stristr() compared before
+static void nameLower(char *dst, const char *src, size_t size) {
+    size_t i = 0; for (; src[i] && i + 1 < size; i++) { unsigned char c = (unsigned char)src[i]; dst[i] = (char)((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c); }
+    dst[i] = '\0';
+}
+
+static unsigned int nameTrigram(const char *p) { return ((unsigned int)(unsigned char)p[0] << 16) | ((unsigned int)(unsigned char)p[1] << 8) | (unsigned char)p[2]; }
+
+NameIndex* createNameIndex(StockStore *store) {
+    NameIndex *idx = (NameIndex *)calloc(1, sizeof(NameIndex)); if (idx != NULL) { idx->slots = (NameTrigramSlot *)calloc(1024, sizeof(NameTrigramSlot)); }
+    if (idx == NULL || idx->slots == NULL) { fprintf(stderr, "Error: Mem alloc failed name index.\n"); free(idx); return NULL; }
+    idx->store = store; idx->capacity = 1024; return idx;
+}
+
+static NameTrigramSlot *nameIndexSlot(const NameIndex *idx, unsigned int trigram) {
+    unsigned int mask = (unsigned int)idx->capacity - 1;
+    for (unsigned int pos = hashFunction((int)trigram, idx->capacity); ; pos = (pos + 1) & mask) { NameTrigramSlot *s = &idx->slots[pos]; if (s->trigram == trigram || s->trigram == 0) return s; }
+}
+
+static int nameIndexGrow(NameIndex *idx) {
+    NameIndex bigger = *idx; bigger.capacity = idx->capacity * 2; bigger.slots = (NameTrigramSlot *)calloc((size_t)bigger.capacity, sizeof(NameTrigramSlot));
+    if (bigger.slots == NULL) { fprintf(stderr, "Error: Mem alloc failed growing name index.\n"); return 0; }
+    for (int i = 0; i < idx->capacity; i++) { if (idx->slots[i].trigram != 0) *nameIndexSlot(&bigger, idx->slots[i].trigram) = idx->slots[i]; }
+    free(idx->slots); idx->slots = bigger.slots; idx->capacity = bigger.capacity; return 1;
+}
+
+int nameIndexAdd(NameIndex *idx, StockHandle handle) {
+    if (idx == NULL || stockStoreGet(idx->store, handle) == NULL) return 0;
+    char name[64]; nameLower(name, stockStoreName(idx->store, handle), sizeof(name)); size_t len = strlen(name);
+    for (size_t i = 0; i + 3 <= len; i++) {
+        unsigned int trigram = nameTrigram(name + i);
+        if ((idx->count + 1) * 4 > idx->capacity * 3 && !nameIndexGrow(idx)) return 0;
+        NameTrigramSlot *s = nameIndexSlot(idx, trigram);
+        if (s->trigram == 0) { s->trigram = trigram; idx->count++; }
+        if (s->count > 0 && s->postings[s->count - 1] == handle) continue; // Trigram repeats within this name
+        if (s->count == s->capacity) { int cap = s->capacity ? s->capacity * 2 : 4; StockHandle *p = (StockHandle *)stockRealloc(s->postings, sizeof(StockHandle) * (size_t)s->capacity, sizeof(StockHandle) * (size_t)cap); if (p == NULL) { fprintf(stderr, "Error: Mem alloc failed name postings.\n"); return 0; } s->postings = p; s->capacity = cap; }
+        s->postings[s->count++] = handle; }
+    return 1;
+}
+
+// Used by the parallel loader, which indexes consecutive handle ranges separately and merges them in order,
+// so each trigram's postings are concatenated and stay ascending.
+int nameIndexMerge(NameIndex *dst, const NameIndex *src) {
+    for (int i = 0; i < src->capacity; i++) {
+        const NameTrigramSlot *from = &src->slots[i]; if (from->trigram == 0) continue;
+        if ((dst->count + 1) * 4 > dst->capacity * 3 && !nameIndexGrow(dst)) return 0;
+        NameTrigramSlot *s = nameIndexSlot(dst, from->trigram);
+        if (s->trigram == 0) { s->trigram = from->trigram; dst->count++; }
+        if (s->count + from->count > s->capacity) { int cap = s->capacity ? s->capacity : 4; while (cap < s->count + from->count) cap *= 2;
+            StockHandle *p = (StockHandle *)stockRealloc(s->postings, sizeof(StockHandle) * (size_t)s->capacity, sizeof(StockHandle) * (size_t)cap); if (p == NULL) { fprintf(stderr, "Error: Mem alloc failed name postings.\n"); return 0; } s->postings = p; s->capacity = cap; }
+        memcpy(s->postings + s->count, from->postings, sizeof(StockHandle) * (size_t)from->count); s->count += from->count; }
+    return 1;
+}
+
+static int nameMatches(const char *stock_name, const char *lower_query, size_t qlen, int prefix) {
+    char name[64]; nameLower(name, stock_name, sizeof(name));
+    return prefix ? strncmp(name, lower_query, qlen) == 0 : strstr(name, lower_query) != NULL;
+}
+
+int searchNameIndex(NameIndex *idx, const char *query, int prefix, OrderedEntry **results) {
+    *results = NULL; if (idx == NULL || query == NULL) return -1;
+    char q[64]; nameLower(q, query, sizeof(q)); size_t qlen = strlen(q);
+    StockHandle *cand = NULL; int n = 0;
+    if (qlen < 3) { // Too short for a trigram: check every record
+        cand = (StockHandle *)malloc(sizeof(StockHandle) * (idx->store->count ? idx->store->count : 1)); if (cand == NULL) return -1;
+        for (StockHandle h = 1; h <= idx->store->count; h++) cand[n++] = h; }
+    else {
+        const NameTrigramSlot *lists[62]; int n_lists = 0, shortest = 0;
+        for (size_t i = 0; i + 3 <= qlen; i++) { const NameTrigramSlot *s = nameIndexSlot(idx, nameTrigram(q + i)); if (s->trigram == 0) return 0; // Some trigram occurs in no name
+            lists[n_lists] = s; if (s->count < lists[shortest]->count) shortest = n_lists; n_lists++; }
+        cand = (StockHandle *)malloc(sizeof(StockHandle) * (size_t)lists[shortest]->count); if (cand == NULL) return -1;
+        memcpy(cand, lists[shortest]->postings, sizeof(StockHandle) * (size_t)lists[shortest]->count); n = lists[shortest]->count;
+        for (int l = 0; l < n_lists && n > 0; l++) { if (l == shortest) continue; // Keep candidates present in every list (all ascending)
+            const StockHandle *p = lists[l]->postings; int pc = lists[l]->count, j = 0, w = 0;
+            for (int i = 0; i < n; i++) { while (j < pc && p[j] < cand[i]) j++; if (j < pc && p[j] == cand[i]) cand[w++] = cand[i]; }
+            n = w; } }
+    OrderedEntry *out = (OrderedEntry *)malloc(sizeof(OrderedEntry) * (size_t)(n ? n : 1)); int found = 0;
+    if (out == NULL) { free(cand); return -1; }
+    for (int i = 0; i < n; i++) { StockItem *m = stockStoreGet(idx->store, cand[i]); if (m && nameMatches(stockStoreName(idx->store, cand[i]), q, qlen, prefix)) { out[found].key = m->mcode; out[found].handle = cand[i]; found++; } }
+    free(cand); qsort(out, (size_t)found, sizeof(OrderedEntry), compareOrderedEntry);
+    *results = out; return found;
+}
+
+void freeNameIndex(NameIndex *idx) {
+    if (idx == NULL) { return; } for (int i = 0; i < idx->capacity; i++) { stockFree(idx->slots[i].postings); } free(idx->slots); free(idx);
+}
+
+size_t nameIndexBytes(const NameIndex *idx) {
+    size_t bytes = idx ? sizeof(NameIndex) + sizeof(NameTrigramSlot) * (size_t)idx->capacity : 0;
+    for (int i = 0; idx && i < idx->capacity; i++) { bytes += sizeof(StockHandle) * (size_t)idx->slots[i].capacity; }
+    return bytes;
+}
+
+// Prints name matches in code order, with Rupee symbol
+void searchStockByName(const char* nameQuery, int prefix, int* matchCount) {
+    OrderedEntry *hits = NULL; unsigned long long t0 = metricsNow(); int n = searchNameIndex(globalNameIndex, nameQuery, prefix, &hits); metricsRecord(METRIC_LOOKUP, t0);
+    if (n < 0) { fprintf(stderr, "searchStockByName: Name index search failed.\n"); return; }
+    for (int i = 0; i < n; i++) { (*matchCount)++; outStockRow(globalStockStore, hits[i].handle); }
+    free(hits);
+}
+
+
+// --- Data Loading Implementation ---
+// The CSV reader and the binary snapshot reader both hand each row to a StockRowHandler, so the
+// hash/ordered index building below is shared and the readers can be timed on their own.
+
+typedef struct { int loaded; } StockLoadCtx;
+
+static int insertLoadedRow(const struct medicine *m, void *ctx_ptr) {
+    StockLoadCtx *ctx = (StockLoadCtx *)ctx_ptr; int add_result = addStockRecord(m, 1);
+    if (add_result == 1) { ctx->loaded++; }
+    else if (add_result == -1) { fprintf(stderr, "FATAL: Stock record insert failed.\n"); return 0; }
+    return 1;
+}
+
+// One STOCK_FILE row into 'm'. Names must be non-empty and fit their fields; every number must be the whole field, and
+// the date and price must fit a StockItem (years 1-9999, months 1-12, days 1-31; at most STOCK_PRICE_MAX either way).
+int stockRowFromCsv(const CsvField *f, int count, struct medicine *m) {
+    memset(m, 0, sizeof(*m)); double price;
+    if (count < STOCK_CSV_FIELDS || f[0].len == 0 || f[2].len == 0) return 0;
+    if (csvFieldCopy(&f[0], m->name, sizeof(m->name)) >= sizeof(m->name) || csvFieldCopy(&f[2], m->s_name, sizeof(m->s_name)) >= sizeof(m->s_name)) return 0;
+    if (!csvFieldInt32(&f[1], &m->mcode) || !csvFieldInt(&f[3], &m->s_contact) || !csvFieldDecimal(&f[4], &price) || !csvFieldInt32(&f[5], &m->quantity)) return 0;
+    if (!csvFieldInt32(&f[6], &m->year) || !csvFieldInt32(&f[7], &m->month) || !csvFieldInt32(&f[8], &m->day)) return 0;
+    if (stockExpiryPack(m->year, m->month, m->day) < 0 || price < -STOCK_PRICE_MAX || price > STOCK_PRICE_MAX) return 0;
+    m->price = (float)price; return 1;
+}
+
+// STOCK_FILE's row format; names holding commas or quotes are quoted so they read back intact.
+int formatStockCsvRow(const struct medicine *m, char *buf, size_t size) {
+    char name_q[2 * sizeof(m->name) + 3], s_name_q[2 * sizeof(m->s_name) + 3];
+    return snprintf(buf, size, "%s,%d,%s,%lld,%.2f,%d,%d,%d,%d\n", csvQuoteField(m->name, name_q, sizeof(name_q)), m->mcode, csvQuoteField(m->s_name, s_name_q, sizeof(s_name_q)), m->s_contact, m->price, m->quantity, m->year, m->month, m->day);
+}
+
+int readStockCsv(const char *filename, StockRowHandler handler, void *ctx) {
+    size_t len = 0; char *buf = readWholeFile(filename, &len);
+    if (buf == NULL) { if (errno == ENOENT) { logAt(LOG_INFO, "readStockCsv: File %s not found. OK.\n", filename); return 1; } else { fprintf(stderr, "FATAL: Error reading %s: %s\n", filename, strerror(errno)); return 0; } }
+    struct medicine m; CsvScanner sc; CsvField f[STOCK_CSV_FIELDS]; int count, line_num = 0; csvScanInit(&sc, buf, len);
+    while ((count = csvNextRow(&sc, f, STOCK_CSV_FIELDS)) > 0) {
+        line_num++; if (count == 1 && f[0].len == 0 && !f[0].quoted) continue; // Blank line
+        if (stockRowFromCsv(f, count, &m)) { if (!handler(&m, ctx)) { free(buf); return 0; } }
+        else { globalMetrics.stock_rows_malformed++; logAt(LOG_WARN, "readStockCsv: Malformed line %d in %s.\n", line_num, filename); } }
+    free(buf); return 1;
+}
+
+static int stockLoadReady() { return globalStockStore != NULL && globalStockStore->count == 0 && globalHashTable != NULL && globalStockIndex != NULL && globalExpiryIndex != NULL && globalNameIndex != NULL; }
+
+static int loadStockDataParallel(const char *filename, int threads);
+
+int loadStockData(const char* filename) {
+    logAt(LOG_DEBUG, "loadStockData: Loading from %s\n", filename);
+    if (!stockLoadReady()) { fprintf(stderr, "loadStockData: Error - Structures not pre-initialized.\n"); return 0; }
+    struct stat st; int threads = stat(filename, &st) == 0 ? loadThreads((size_t)st.st_size) : 1;
+    if (threads > 1) return loadStockDataParallel(filename, threads);
+    StockLoadCtx ctx = { 0 };
+    if (!readStockCsv(filename, insertLoadedRow, &ctx) || !orderedIndexFinishLoad(globalStockIndex) || !orderedIndexFinishLoad(globalExpiryIndex)) return 0;
+    logAt(LOG_INFO, "loadStockData: Loaded %d records.\n", ctx.loaded); return 1;
+}
+
+
+// --- Parallel Loading ---
+// Large files are cut at row boundaries into one chunk per thread. For STOCK_FILE the workers parse their rows
+// and sort them by code and by expiry key; the caller then merges the sorted runs in chunk order, which finds
+// duplicate codes (the first row in the file wins, exactly as in the sequential loader) and yields both
+// ordered indexes without a global sort. Records enter the store in file order, the hash table is sized
+// once and filled from the merged run, and the name index is built per handle range in parallel and merged.
+// The result is the same store, handles and indexes the sequential loader builds.
+
+int loadThreads(size_t bytes) {
+    int n = loadThreadCount;
+#ifndef _WIN32
+    if (n <= 0) { long cpus = sysconf(_SC_NPROCESSORS_ONLN); n = cpus > 0 ? (int)cpus : 1; }
+#else
+    n = 1; // No pthreads: the sequential loaders
+#endif
+    if (n > LOAD_MAX_THREADS) n = LOAD_MAX_THREADS;
+    if ((size_t)n > bytes / LOAD_MIN_CHUNK_BYTES) n = (int)(bytes / LOAD_MIN_CHUNK_BYTES);
+    return n > 1 ? n : 1;
+}
+
+#ifndef _WIN32
+typedef struct { void (*fn)(void *task); void *task; } LoadThreadArg;
+static void *loadThreadMain(void *arg) { LoadThreadArg *a = (LoadThreadArg *)arg; a->fn(a->task); return NULL; }
+#endif
+
+void runLoadTasks(void (*fn)(void *task), void *tasks, size_t task_size, int count) {
+#ifndef _WIN32
+    pthread_t tid[LOAD_MAX_THREADS]; LoadThreadArg args[LOAD_MAX_THREADS]; int started[LOAD_MAX_THREADS] = { 0 };
+    for (int i = 1; i < count && i < LOAD_MAX_THREADS; i++) { args[i].fn = fn; args[i].task = (char *)tasks + task_size * (size_t)i; started[i] = pthread_create(&tid[i], NULL, loadThreadMain, &args[i]) == 0; }
+    fn(tasks);
+    for (int i = 1; i < count; i++) { if (i < LOAD_MAX_THREADS && started[i]) pthread_join(tid[i], NULL); else fn((char *)tasks + task_size * (size_t)i); } // Could not start: run it here
+#else
+    for (int i = 0; i < count; i++) fn((char *)tasks + task_size * (size_t)i);
+#endif
+}
+
+int csvSplitRows(const char *buf, size_t len, int parts, size_t *bounds) {
+    int used = 0; bounds[0] = 0;
+    for (int i = 1; i < parts; i++) {
+        size_t at = len / (size_t)parts * (size_t)i; if (at < bounds[used]) at = bounds[used];
+        const char *nl = at < len ? (const char *)memchr(buf + at, '\n', len - at) : NULL; if (nl == NULL) break;
+        size_t next = (size_t)(nl - buf) + 1; if (next > bounds[used] && next < len) bounds[++used] = next; }
+    bounds[++used] = len; return used;
+}
+
+typedef struct {
+    const char *buf; size_t begin, end;          // In: rows [begin, end) of the file
+    struct medicine *rows; int count, capacity;  // Out: parsed rows, file order
+    OrderedEntry *by_code, *by_expiry;           // Out: (key, row index within the chunk) sorted by key, then row
+    int lines, *bad_lines, bad_count, ok;        // Lines seen; malformed ones (1-based within the chunk)
+} StockLoadChunk;
+
+static int compareOrderedEntryThenHandle(const void *a, const void *b) {
+    const OrderedEntry *x = (const OrderedEntry *)a, *y = (const OrderedEntry *)b;
+    if (x->key != y->key) return (x->key > y->key) - (x->key < y->key);
+    return (x->handle > y->handle) - (x->handle < y->handle);
+}
+
+static void stockLoadChunkRun(void *task) {
+    StockLoadChunk *c = (StockLoadChunk *)task; CsvScanner sc; CsvField f[STOCK_CSV_FIELDS]; int count, bad_cap = 0; c->ok = 0;
+    csvScanInit(&sc, c->buf + c->begin, c->end - c->begin);
+    while ((count = csvNextRow(&sc, f, STOCK_CSV_FIELDS)) > 0) {
+        c->lines++; if (count == 1 && f[0].len == 0 && !f[0].quoted) continue; // Blank line
+        if (c->count == c->capacity) { int cap = c->capacity ? c->capacity * 2 : 4096; struct medicine *r = (struct medicine *)realloc(c->rows, sizeof(struct medicine) * (size_t)cap); if (r == NULL) return; c->rows = r; c->capacity = cap; }
+        if (stockRowFromCsv(f, count, &c->rows[c->count])) { c->count++; continue; }
+        if (c->bad_count == bad_cap) { bad_cap = bad_cap ? bad_cap * 2 : 16; int *b = (int *)realloc(c->bad_lines, sizeof(int) * (size_t)bad_cap); if (b == NULL) return; c->bad_lines = b; }
+        c->bad_lines[c->bad_count++] = c->lines; }
+    c->by_code = (OrderedEntry *)malloc(sizeof(OrderedEntry) * (size_t)(c->count ? c->count : 1)); c->by_expiry = (OrderedEntry *)malloc(sizeof(OrderedEntry) * (size_t)(c->count ? c->count : 1));
+    if (c->by_code == NULL || c->by_expiry == NULL) return;
+    for (int i = 0; i < c->count; i++) { StockItem item; stockItemFromRow(&c->rows[i], &item); // Rows passed stockRowFromCsv, so they pack
+        c->by_code[i].key = orderedKeyByCode(&item); c->by_code[i].handle = (StockHandle)i; c->by_expiry[i].key = orderedKeyByExpiry(&item); c->by_expiry[i].handle = (StockHandle)i; }
+    qsort(c->by_code, (size_t)c->count, sizeof(OrderedEntry), compareOrderedEntryThenHandle); qsort(c->by_expiry, (size_t)c->count, sizeof(OrderedEntry), compareOrderedEntryThenHandle);
+    c->ok = 1;
+}
+
+typedef struct { NameIndex *idx; StockHandle first, last; int ok; } NameLoadRange;
+
+static void nameLoadRangeRun(void *task) {
+    NameLoadRange *r = (NameLoadRange *)task; r->ok = 1;
+    for (StockHandle h = r->first; h <= r->last && r->ok; h++) r->ok = nameIndexAdd(r->idx, h);
+}
+
+// Picks the chunk whose next entry in 'runs' has the smallest key (ties: lowest chunk, i.e. earlier in the file). -1 when all are done
+static int stockLoadNextRun(StockLoadChunk *chunks, int n, const int *pos, int expiry) {
+    int best = -1; OrderedKey best_key = 0;
+    for (int c = 0; c < n; c++) { if (pos[c] >= chunks[c].count) continue; OrderedKey k = (expiry ? chunks[c].by_expiry : chunks[c].by_code)[pos[c]].key; if (best < 0 || k < best_key) { best = c; best_key = k; } }
+    return best;
+}
+
+static int loadStockDataParallel(const char *filename, int threads) {
+    size_t len = 0; char *buf = readWholeFile(filename, &len);
+    if (buf == NULL) { if (errno == ENOENT) { logAt(LOG_INFO, "readStockCsv: File %s not found. OK.\n", filename); return 1; } fprintf(stderr, "FATAL: Error reading %s: %s\n", filename, strerror(errno)); return 0; }
+    size_t bounds[LOAD_MAX_THREADS + 1]; int n = csvSplitRows(buf, len, threads, bounds), ok = 1, total = 0, loaded = 0, line_base = 0;
+    StockLoadChunk chunks[LOAD_MAX_THREADS]; memset(chunks, 0, sizeof(chunks)); int pos[LOAD_MAX_THREADS] = { 0 };
+    for (int c = 0; c < n; c++) { chunks[c].buf = buf; chunks[c].begin = bounds[c]; chunks[c].end = bounds[c + 1]; }
+    runLoadTasks(stockLoadChunkRun, chunks, sizeof(StockLoadChunk), n); free(buf);
+    for (int c = 0; c < n; c++) { ok = ok && chunks[c].ok; total += chunks[c].count;
+        globalMetrics.stock_rows_malformed += (unsigned long long)chunks[c].bad_count;
+        for (int i = 0; i < chunks[c].bad_count; i++) logAt(LOG_WARN, "readStockCsv: Malformed line %d in %s.\n", line_base + chunks[c].bad_lines[i], filename);
+        line_base += chunks[c].lines; }
+    StockHandle *handle_of[LOAD_MAX_THREADS] = { 0 }; // Per chunk row: its store handle, 0 if it lost to an earlier duplicate
+    for (int c = 0; c < n && ok; c++) { handle_of[c] = (StockHandle *)calloc((size_t)(chunks[c].count ? chunks[c].count : 1), sizeof(StockHandle)); ok = handle_of[c] != NULL; }
+    OrderedEntry *merged = ok ? (OrderedEntry *)malloc(sizeof(OrderedEntry) * (size_t)(total ? total : 1)) : NULL; int m = 0; ok = ok && merged != NULL;
+    if (!ok) { fprintf(stderr, "FATAL: Parallel stock load failed (alloc).\n"); }
+    // 1. Merge the code runs: the first row of each code (lowest chunk, then lowest row) survives
+    for (int c; ok && (c = stockLoadNextRun(chunks, n, pos, 0)) >= 0; pos[c]++) {
+        const OrderedEntry *e = &chunks[c].by_code[pos[c]];
+        if (m > 0 && merged[m - 1].key == e->key) { logAt(LOG_WARN, "Warn: Duplicate code %d, not added.\n", (int)e->key); continue; }
+        merged[m].key = e->key; merged[m].handle = (StockHandle)c; handle_of[c][e->handle] = 1; m++; } // Chunk number for now; marks the survivor
+    // 2. Survivors enter the store in file order, so handles match the sequential loader's
+    for (int c = 0; c < n && ok; c++) { for (int i = 0; i < chunks[c].count && ok; i++) { if (handle_of[c][i] == 0) continue;
+        StockHandle h = stockStoreAdd(globalStockStore, &chunks[c].rows[i]); if (h == 0) { ok = 0; break; } handle_of[c][i] = h; loaded++; }
+        free(chunks[c].rows); chunks[c].rows = NULL; }
+    // 3. Code index straight from the merged run, and the hash table sized once and filled from it
+    if (ok) { memset(pos, 0, sizeof(pos)); int w = 0;
+        for (int c; (c = stockLoadNextRun(chunks, n, pos, 0)) >= 0; pos[c]++) { const OrderedEntry *e = &chunks[c].by_code[pos[c]]; StockHandle h = handle_of[c][e->handle];
+            if (h != 0 && (w == 0 || merged[w - 1].key != e->key)) { merged[w].key = e->key; merged[w].handle = h; w++; } }
+        ok = hashTableReserve(globalHashTable, m) && orderedReserve(globalStockIndex, m) && orderedReserve(globalExpiryIndex, m); }
+    if (ok) { for (int i = 0; i < m; i++) { hashTablePlace(globalHashTable->slots, globalHashTable->capacity, (int)merged[i].key, merged[i].handle); globalStockIndex->items[i] = merged[i]; }
+        globalHashTable->count = m; globalStockIndex->count = m;
+        // 4. Expiry index: merge the expiry runs, skipping rows that lost to a duplicate
+        memset(pos, 0, sizeof(pos)); int w = 0;
+        for (int c; (c = stockLoadNextRun(chunks, n, pos, 1)) >= 0; pos[c]++) { const OrderedEntry *e = &chunks[c].by_expiry[pos[c]]; StockHandle h = handle_of[c][e->handle];
+            if (h != 0) { globalExpiryIndex->items[w].key = e->key; globalExpiryIndex->items[w].handle = h; w++; } }
+        globalExpiryIndex->count = w; }
+    free(merged); for (int c = 0; c < n; c++) { free(chunks[c].rows); free(chunks[c].by_code); free(chunks[c].by_expiry); free(chunks[c].bad_lines); free(handle_of[c]); }
+    // 5. Name index: one partial index per handle range, merged in range order
+    if (ok && loaded > 0) { NameLoadRange ranges[LOAD_MAX_THREADS]; int parts = threads < loaded ? threads : loaded;
+        for (int r = 0; r < parts; r++) { ranges[r].idx = r == 0 ? globalNameIndex : createNameIndex(globalStockStore); ranges[r].first = (StockHandle)((long long)loaded * r / parts) + 1; ranges[r].last = (StockHandle)((long long)loaded * (r + 1) / parts); ranges[r].ok = 0; if (ranges[r].idx == NULL) ok = 0; }
+        if (ok) runLoadTasks(nameLoadRangeRun, ranges, sizeof(NameLoadRange), parts);
+        for (int r = 0; r < parts; r++) { if (ranges[r].idx == NULL) continue; ok = ok && ranges[r].ok && (r == 0 || nameIndexMerge(globalNameIndex, ranges[r].idx)); if (r > 0) freeNameIndex(ranges[r].idx); } }
+    if (!ok) { fprintf(stderr, "FATAL: Parallel stock load failed.\n"); return 0; }
+    logAt(LOG_INFO, "loadStockData: Loaded %d records (%d threads).\n", loaded, n); return 1;
+}
+
+
+// --- Binary Stock Snapshot ---
+// STOCK_SNAPSHOT_FILE caches STOCK_FILE's rows (not the journal) together with the indexes built over them, stamped
+// with the CSV's size, mtime (with nanoseconds) and inode. Layout: SnapshotHeader, the records in handle order (the StockItems, then the
+// StockItemColds, as the store holds them), the hash table's slots, the code and expiry OrderedEntry arrays, the name
+// index's trigram slots and their postings, and last the two string pools (name offsets, supplier offsets, name bytes,
+// supplier bytes). loadStockSnapshot maps the file copy-on-write and points the global stock into it, so a
+// CGI process neither parses nor indexes, and every process shares the page cache's copy until it writes a page.
+// A stale snapshot, or one from a build with different struct sizes, is ignored and rebuilt from the CSV, which
+// stays the import/export format.
+
+typedef struct {
+    unsigned int magic, version, record_size, record_count;
+    long long source_size, source_mtime, source_mtime_ns, source_inode; // STOCK_FILE stamp the snapshot was built from
+    unsigned int layout;                               // SNAPSHOT_LAYOUT of the build that wrote it
+    unsigned int hash_capacity, name_capacity, name_count;
+    unsigned int name_pool_count, name_pool_bytes, supplier_pool_count, supplier_pool_bytes; // StockStore.names / .suppliers
+    unsigned long long posting_count;
+} SnapshotHeader;
+
+typedef struct { unsigned int trigram, count, first; } SnapshotTrigram; // first: index of the slot's first posting
+
+#define SNAPSHOT_LAYOUT ((unsigned int)(sizeof(HashSlot) << 16 | sizeof(OrderedEntry) << 8 | sizeof(StockHandle)))
+#define SNAPSHOT_RECORD_SIZE ((unsigned int)(sizeof(StockItem) << 16 | sizeof(StockItemCold)))
+
+// File size the header's counts imply; the reader refuses any other
+static size_t snapshotSize(const SnapshotHeader *hdr) {
+    return sizeof(SnapshotHeader) + (size_t)hdr->record_count * (sizeof(StockItem) + sizeof(StockItemCold) + 2 * sizeof(OrderedEntry)) + (size_t)hdr->hash_capacity * sizeof(HashSlot)
+        + (size_t)hdr->name_capacity * sizeof(SnapshotTrigram) + (size_t)hdr->posting_count * sizeof(StockHandle)
+        + sizeof(unsigned int) * ((size_t)hdr->name_pool_count + hdr->supplier_pool_count) + hdr->name_pool_bytes + hdr->supplier_pool_bytes;
+}
+
+// Writes the index's entries in key order, folding in its insert buffer
+static int snapshotWriteOrdered(FILE *fp, const OrderedIndex *idx) {
+    if (idx->delta_count == 0) return idx->count == 0 || fwrite(idx->items, sizeof(OrderedEntry), (size_t)idx->count, fp) == (size_t)idx->count;
+    int n = idx->count + idx->delta_count, i = 0, j = 0, k = 0; OrderedEntry *merged = (OrderedEntry *)malloc(sizeof(OrderedEntry) * (size_t)n); if (merged == NULL) return 0;
+    while (k < n) { merged[k++] = (j >= idx->delta_count || (i < idx->count && idx->items[i].key < idx->delta[j].key)) ? idx->items[i++] : idx->delta[j++]; }
+    int ok = fwrite(merged, sizeof(OrderedEntry), (size_t)n, fp) == (size_t)n; free(merged); return ok;
+}
+
+int writeStockSnapshot(const char *filename, const struct stat *source) {
+    StockStore *store = globalStockStore; HashTable *table = globalHashTable; NameIndex *names = globalNameIndex; unsigned int count = store->count;
+    if ((unsigned int)table->count != count || orderedIndexSize(globalStockIndex) != (int)count || orderedIndexSize(globalExpiryIndex) != (int)count) {
+        logAt(LOG_WARN, "writeStockSnapshot: Store (%u), hash (%d) and ordered indexes (%d, %d) disagree, not writing.\n", count, table->count, orderedIndexSize(globalStockIndex), orderedIndexSize(globalExpiryIndex)); return 0; }
+    SnapshotHeader hdr; memset(&hdr, 0, sizeof(hdr)); hdr.magic = SNAPSHOT_MAGIC; hdr.version = SNAPSHOT_VERSION; hdr.record_size = SNAPSHOT_RECORD_SIZE; hdr.record_count = count;
+    hdr.source_size = (long long)source->st_size; hdr.source_mtime = (long long)source->st_mtime; hdr.source_mtime_ns = statMtimeNs(source); hdr.source_inode = (long long)source->st_ino; hdr.layout = SNAPSHOT_LAYOUT;
+    hdr.hash_capacity = (unsigned int)table->capacity; hdr.name_capacity = (unsigned int)names->capacity; hdr.name_count = (unsigned int)names->count;
+    hdr.name_pool_count = store->names.count; hdr.name_pool_bytes = store->names.len; hdr.supplier_pool_count = store->suppliers.count; hdr.supplier_pool_bytes = store->suppliers.len;
+    SnapshotTrigram *tri = (SnapshotTrigram *)calloc((size_t)names->capacity, sizeof(SnapshotTrigram));
+    if (tri == NULL) { fprintf(stderr, "writeStockSnapshot: Mem alloc failed.\n"); return 0; }
+    for (int i = 0; i < names->capacity; i++) { tri[i].trigram = names->slots[i].trigram; tri[i].count = (unsigned int)names->slots[i].count; tri[i].first = (unsigned int)hdr.posting_count; hdr.posting_count += tri[i].count; }
+    char temp_name[64]; snprintf(temp_name, sizeof(temp_name), TEMP_STOCK_SNAPSHOT_FILE, (int)getpid());
+    FILE *fp = fopen(temp_name, "wb"); int ok = fp != NULL && fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    for (unsigned int done = 0; ok && done < count; done += STOCK_STORE_CHUNK) { size_t n = count - done < STOCK_STORE_CHUNK ? count - done : STOCK_STORE_CHUNK; ok = fwrite(store->chunks[done / STOCK_STORE_CHUNK], sizeof(StockItem), n, fp) == n; }
+    for (unsigned int done = 0; ok && done < count; done += STOCK_STORE_CHUNK) { size_t n = count - done < STOCK_STORE_CHUNK ? count - done : STOCK_STORE_CHUNK; ok = fwrite(store->cold[done / STOCK_STORE_CHUNK], sizeof(StockItemCold), n, fp) == n; }
+    ok = ok && fwrite(table->slots, sizeof(HashSlot), (size_t)table->capacity, fp) == (size_t)table->capacity && snapshotWriteOrdered(fp, globalStockIndex) && snapshotWriteOrdered(fp, globalExpiryIndex)
+        && fwrite(tri, sizeof(SnapshotTrigram), (size_t)names->capacity, fp) == (size_t)names->capacity;
+    for (int i = 0; ok && i < names->capacity; i++) { int n = names->slots[i].count; ok = n == 0 || fwrite(names->slots[i].postings, sizeof(StockHandle), (size_t)n, fp) == (size_t)n; }
+    const StringPool *pools[2] = { &store->names, &store->suppliers };
+    for (int i = 0; ok && i < 2; i++) { ok = pools[i]->count == 0 || fwrite(pools[i]->offsets, sizeof(unsigned int), pools[i]->count, fp) == pools[i]->count; }
+    for (int i = 0; ok && i < 2; i++) { ok = pools[i]->len == 0 || fwrite(pools[i]->data, 1, pools[i]->len, fp) == pools[i]->len; }
+    if (fp != NULL && fclose(fp) != 0) ok = 0;
+    free(tri);
+#ifdef _WIN32
+    if (ok) remove(filename);
+#endif
+    if (!ok || rename(temp_name, filename) != 0) { fprintf(stderr, "writeStockSnapshot: Failed to write %s: %s\n", filename, strerror(errno)); remove(temp_name); return 0; }
+    logAt(LOG_INFO, "writeStockSnapshot: %u records and indexes -> %s.\n", count, filename); return 1;
+}
+
+static void snapshotUnmap(unsigned char *base, size_t size) {
+#ifndef _WIN32
+    munmap(base, size);
+#else
+    (void)size; free(base);
+#endif
+}
+
+// Maps 'filename' privately (writes stay in this process) if it is a valid snapshot of 'source'. 1 ok, 0 missing/stale/invalid
+static int snapshotMap(const char *filename, const struct stat *source, unsigned char **base_out, size_t *size_out) {
+    FILE *fp = fopen(filename, "rb"); if (fp == NULL) return 0;
+    struct stat st; if (fstat(fileno(fp), &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) { fclose(fp); return 0; }
+    size_t size = (size_t)st.st_size; unsigned char *base = NULL;
+#ifndef _WIN32
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0); base = (map == MAP_FAILED) ? NULL : (unsigned char *)map;
+#else
+    unsigned char *heap = (unsigned char *)malloc(size); if (heap && fread(heap, 1, size, fp) == size) { base = heap; } else { free(heap); }
+#endif
+    fclose(fp); if (base == NULL) { fprintf(stderr, "snapshotMap: Cannot map %s.\n", filename); return 0; }
+    const SnapshotHeader *hdr = (const SnapshotHeader *)base; const char *problem = NULL;
+    if (hdr->magic != SNAPSHOT_MAGIC || hdr->version != SNAPSHOT_VERSION || hdr->record_size != SNAPSHOT_RECORD_SIZE || hdr->layout != SNAPSHOT_LAYOUT) { problem = "has wrong magic/version/layout"; }
+    else if (hdr->source_size != (long long)source->st_size || hdr->source_mtime != (long long)source->st_mtime || hdr->source_mtime_ns != statMtimeNs(source) || hdr->source_inode != (long long)source->st_ino) { problem = "is stale"; }
+    else if (snapshotSize(hdr) != size || hdr->hash_capacity < 16 || (hdr->hash_capacity & (hdr->hash_capacity - 1)) != 0 || hdr->name_capacity == 0 || (hdr->name_capacity & (hdr->name_capacity - 1)) != 0) { problem = "is truncated/corrupt"; }
+    if (problem == NULL) { *base_out = base; *size_out = size; return 1; }
+    logAt(LOG_WARN, "snapshotMap: %s %s, ignoring.\n", filename, problem); snapshotUnmap(base, size); return 0;
+}
+
+// The string pools at the end of a mapped snapshot, as read-only StringPools (no slot table). 0 if an offset or the last string is bad
+static int snapshotPools(unsigned char *base, StringPool *names, StringPool *suppliers) {
+    const SnapshotHeader *hdr = (const SnapshotHeader *)base;
+    unsigned int *offsets = (unsigned int *)(base + snapshotSize(hdr) - hdr->name_pool_bytes - hdr->supplier_pool_bytes - sizeof(unsigned int) * ((size_t)hdr->name_pool_count + hdr->supplier_pool_count));
+    char *bytes = (char *)(offsets + hdr->name_pool_count + hdr->supplier_pool_count);
+    memset(names, 0, sizeof(*names)); memset(suppliers, 0, sizeof(*suppliers));
+    names->offsets = offsets; names->count = names->id_cap = hdr->name_pool_count; names->data = bytes; names->len = names->cap = hdr->name_pool_bytes;
+    suppliers->offsets = offsets + hdr->name_pool_count; suppliers->count = suppliers->id_cap = hdr->supplier_pool_count; suppliers->data = bytes + hdr->name_pool_bytes; suppliers->len = suppliers->cap = hdr->supplier_pool_bytes;
+    StringPool *pools[2] = { names, suppliers };
+    for (int i = 0; i < 2; i++) { if (pools[i]->len > 0 && pools[i]->data[pools[i]->len - 1] != '\0') return 0;
+        for (unsigned int id = 0; id < pools[i]->count; id++) { if (pools[i]->offsets[id] >= pools[i]->len) return 0; } }
+    return 1;
+}
+
+int readStockSnapshot(const char *filename, const struct stat *source, StockRowHandler handler, void *ctx) {
+    unsigned char *base; size_t size; if (!snapshotMap(filename, source, &base, &size)) return 0;
+    const SnapshotHeader *hdr = (const SnapshotHeader *)base; StringPool names, suppliers; int result = 1; struct medicine row;
+    const StockItem *recs = (const StockItem *)(base + sizeof(SnapshotHeader)); const StockItemCold *cold = (const StockItemCold *)(recs + hdr->record_count);
+    if (!snapshotPools(base, &names, &suppliers)) { logAt(LOG_WARN, "readStockSnapshot: %s has bad string pools, ignoring.\n", filename); snapshotUnmap(base, size); return 0; }
+    for (unsigned int i = 0; i < hdr->record_count; i++) { stockRowFromParts(&recs[i], &cold[i], &names, &suppliers, &row); if (!handler(&row, ctx)) { result = -1; break; } }
+    snapshotUnmap(base, size); return result;
+}
+
+// Only the name index's slot array and the store's last, partly filled hot and cold chunks are copied (the store
+// appends into those, and in the mapping they would run into the next section); everything else, the string pools
+// included, is used where it lies.
+int loadStockSnapshot(const char *filename, const struct stat *source) {
+    if (!stockLoadReady() || stockSnapshotMap.base != NULL) { fprintf(stderr, "loadStockSnapshot: Error - Structures not pre-initialized.\n"); return -1; }
+    unsigned char *base; size_t size; if (!snapshotMap(filename, source, &base, &size)) return 0;
+    const SnapshotHeader *hdr = (const SnapshotHeader *)base; unsigned int n = hdr->record_count;
+    StockItem *recs = (StockItem *)(base + sizeof(SnapshotHeader)); StockItemCold *cold = (StockItemCold *)(recs + n); HashSlot *slots = (HashSlot *)(cold + n);
+    OrderedEntry *by_code = (OrderedEntry *)(slots + hdr->hash_capacity), *by_expiry = by_code + n;
+    const SnapshotTrigram *tri = (const SnapshotTrigram *)(by_expiry + n); StockHandle *postings = (StockHandle *)(tri + hdr->name_capacity);
+    int chunks = (int)((n + STOCK_STORE_CHUNK - 1) / STOCK_STORE_CHUNK); unsigned int tail = n % STOCK_STORE_CHUNK; StringPool names, suppliers;
+    StockItem **chunk_list = (StockItem **)malloc(sizeof(StockItem *) * (size_t)(chunks ? chunks : 1)); StockItemCold **cold_list = (StockItemCold **)malloc(sizeof(StockItemCold *) * (size_t)(chunks ? chunks : 1));
+    StockItem *tail_chunk = tail ? (StockItem *)malloc(sizeof(StockItem) * STOCK_STORE_CHUNK) : NULL; StockItemCold *tail_cold = tail ? (StockItemCold *)malloc(sizeof(StockItemCold) * STOCK_STORE_CHUNK) : NULL;
+    NameTrigramSlot *name_slots = (NameTrigramSlot *)calloc(hdr->name_capacity, sizeof(NameTrigramSlot)); const char *bad = NULL;
+    if (chunk_list == NULL || cold_list == NULL || (tail && (tail_chunk == NULL || tail_cold == NULL)) || name_slots == NULL) { fprintf(stderr, "loadStockSnapshot: Mem alloc failed.\n"); free(chunk_list); free(cold_list); free(tail_chunk); free(tail_cold); free(name_slots); snapshotUnmap(base, size); return -1; }
+    for (unsigned int i = 0; i < hdr->name_capacity && bad == NULL; i++) { const SnapshotTrigram *t = &tri[i]; if (t->trigram == 0) continue;
+        if ((unsigned long long)t->first + t->count > hdr->posting_count) { bad = "postings"; break; }
+        name_slots[i].trigram = t->trigram; name_slots[i].postings = postings + t->first; name_slots[i].count = name_slots[i].capacity = (int)t->count; }
+    if (bad == NULL && !snapshotPools(base, &names, &suppliers)) { bad = "string pools"; }
+    if (bad != NULL) { logAt(LOG_WARN, "loadStockSnapshot: %s has bad %s, ignoring.\n", filename, bad); free(chunk_list); free(cold_list); free(tail_chunk); free(tail_cold); free(name_slots); snapshotUnmap(base, size); return 0; }
+    for (int c = 0; c < chunks; c++) { chunk_list[c] = recs + (size_t)c * STOCK_STORE_CHUNK; cold_list[c] = cold + (size_t)c * STOCK_STORE_CHUNK; }
+    if (tail) { memcpy(tail_chunk, chunk_list[chunks - 1], sizeof(StockItem) * tail); chunk_list[chunks - 1] = tail_chunk; memcpy(tail_cold, cold_list[chunks - 1], sizeof(StockItemCold) * tail); cold_list[chunks - 1] = tail_cold; }
+
+    StockStore *store = globalStockStore; free(store->chunks); free(store->cold); store->chunks = chunk_list; store->cold = cold_list; store->chunk_count = store->chunk_capacity = chunks; store->count = n;
+    freeStringPool(&store->names); freeStringPool(&store->suppliers); store->names = names; store->suppliers = suppliers;
+    free(globalHashTable->slots); globalHashTable->slots = slots; globalHashTable->capacity = (int)hdr->hash_capacity; globalHashTable->count = (int)n;
+    OrderedIndex *ordered[2] = { globalStockIndex, globalExpiryIndex }; OrderedEntry *entries[2] = { by_code, by_expiry };
+    for (int i = 0; i < 2; i++) { free(ordered[i]->items); ordered[i]->items = entries[i]; ordered[i]->count = ordered[i]->capacity = (int)n; ordered[i]->unsorted = 0; }
+    free(globalNameIndex->slots); globalNameIndex->slots = name_slots; globalNameIndex->capacity = (int)hdr->name_capacity; globalNameIndex->count = (int)hdr->name_count;
+    stockSnapshotMap.base = base; stockSnapshotMap.size = size;
+    logAt(LOG_INFO, "loadStockSnapshot: Attached %u records from %s.\n", n, filename); return 1;
+}
+
+void stockSnapshotRelease() {
+    if (stockSnapshotMap.base == NULL) return;
+    snapshotUnmap(stockSnapshotMap.base, stockSnapshotMap.size); stockSnapshotMap.base = NULL; stockSnapshotMap.size = 0;
+}
+
+
+// --- Stock Journal Implementation ---
+// Quantity changes are appended to STOCK_JOURNAL_FILE instead of rewriting STOCK_FILE per bill/update.
+// Format (text, one record per line):
+//   S,<mcode>,<delta>,<new_qty>   one stock change
+//   C,<count>                     commit marker closing a group of <count> S records
+// A group without its commit marker (crash mid-write) is ignored on replay. Records carry the resulting
+// quantity as well as the delta so replay is idempotent: replaying after a half-finished compaction is harmless.
+
+static int journalAppendGroupUntimed(const int *codes, const int *deltas, const int *new_qtys, int count);
+
+int journalAppendGroup(const int *codes, const int *deltas, const int *new_qtys, int count) {
+    unsigned long long t0 = metricsNow(); int ok = journalAppendGroupUntimed(codes, deltas, new_qtys, count); metricsRecord(METRIC_STOCK_WRITE, t0); return ok;
+}
+
+static int journalAppendGroupUntimed(const int *codes, const int *deltas, const int *new_qtys, int count) {
+    if (count <= 0) return 1;
+    size_t cap = (size_t)count * 48 + 32, len = 0; char *buf = (char *)malloc(cap);
+    if (buf == NULL) { fprintf(stderr, "journalAppendGroup: Mem alloc failed.\n"); return 0; }
+    for (int i = 0; i < count; i++) { len += (size_t)snprintf(buf + len, cap - len, "S,%d,%d,%d\n", codes[i], deltas[i], new_qtys[i]); }
+    len += (size_t)snprintf(buf + len, cap - len, "C,%d\n", count);
+    if (!stockLockRange(STOCK_LOCK_JOURNAL_BYTE, 1, 1)) { free(buf); return 0; } // Appends are serialised, so the rollback below only ever cuts our own bytes
+    FILE *fp = fopen(STOCK_JOURNAL_FILE, "ab");
+    if (fp == NULL) { fprintf(stderr, "journalAppendGroup: Error opening %s: %s\n", STOCK_JOURNAL_FILE, strerror(errno)); stockLockRange(STOCK_LOCK_JOURNAL_BYTE, 1, 0); free(buf); return 0; }
+    fseek(fp, 0, SEEK_END); long start = ftell(fp);
+    int ok = (fwrite(buf, 1, len, fp) == len) && (fflush(fp) == 0) && (fsync(fileno(fp)) == 0); // One write + one fsync per group
+    if (!ok) { fprintf(stderr, "journalAppendGroup: Write/fsync failed: %s. Rolling back.\n", strerror(errno)); if (start >= 0 && ftruncate(fileno(fp), start) != 0) { fprintf(stderr, "journalAppendGroup: Rollback truncate failed.\n"); } }
+    fclose(fp); stockLockRange(STOCK_LOCK_JOURNAL_BYTE, 1, 0); free(buf);
+    return ok;
+}
+
+// Other processes may be appending while we read, so a line without its newline (a group still being written)
+// ends the replay; *applied_end then points at the end of the last complete group for the next catch-up.
+int replayStockJournal(const char *filename, long long from, long long *applied_end) {
+    *applied_end = from; FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) { if (errno == ENOENT) { *applied_end = 0; return 0; } fprintf(stderr, "replayStockJournal: Error opening %s: %s\n", filename, strerror(errno)); return -1; }
+    if (from > 0 && fseek(fp, (long)from, SEEK_SET) != 0) { fprintf(stderr, "replayStockJournal: Cannot seek %s to %lld.\n", filename, from); fclose(fp); return -1; }
+    int cap = 64, pending = 0, groups = 0, line_num = 0; char line[128]; long long pos = from;
+    int *codes = (int *)malloc(sizeof(int) * cap), *qtys = (int *)malloc(sizeof(int) * cap);
+    if (!codes || !qtys) { free(codes); free(qtys); fclose(fp); return -1; }
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strlen(line); if (line[len - 1] != '\n') break; // Partial tail: not ours to judge yet
+        pos += (long long)len; line_num++; int code = 0, delta = 0, qty = 0, count = 0;
+        if (line[0] == 'S' && sscanf(line, "S,%d,%d,%d", &code, &delta, &qty) == 3) {
+            if (pending == cap) { cap *= 2; int *nc = (int *)realloc(codes, sizeof(int) * cap), *nq = (int *)realloc(qtys, sizeof(int) * cap); if (nc) codes = nc; if (nq) qtys = nq; if (!nc || !nq) { fprintf(stderr, "replayStockJournal: Mem alloc failed.\n"); break; } }
+            codes[pending] = code; qtys[pending] = qty; pending++; }
+        else if (line[0] == 'C' && sscanf(line, "C,%d", &count) == 1 && count == pending) {
+            for (int i = 0; i < pending; i++) { StockItem *med = searchHashTableByCode(globalHashTable, codes[i]);
+                if (med) { med->quantity = qtys[i]; } else { logAt(LOG_WARN, "replayStockJournal: Code %d not in stock (line %d), skipped.\n", codes[i], line_num); } }
+            groups++; pending = 0; *applied_end = pos; }
+        else { logAt(LOG_WARN, "replayStockJournal: Bad/uncommitted record at line %d, dropping %d pending.\n", line_num, pending); pending = 0; *applied_end = pos; }
+    }
+    if (pending > 0) { logAt(LOG_WARN, "replayStockJournal: Ignoring %d uncommitted trailing record(s).\n", pending); }
+    int read_error = ferror(fp); fclose(fp); free(codes); free(qtys);
+    logAt(LOG_INFO, "replayStockJournal: Applied %d group(s) from %s (bytes %lld-%lld).\n", groups, filename, from, *applied_end);
+    return read_error ? -1 : groups;
+}
+
+// Rewrites STOCK_FILE in its original line order with the in-memory quantities, then empties the journal.
+// The new file is fsync'd and renamed over the old one, so STOCK_FILE is never missing.
+int compactStockJournal() {
+    size_t in_len = 0; char *in = readWholeFile(STOCK_FILE, &in_len); FILE *out = in ? fopen(TEMP_STOCK_FILE_COMPACT, "w") : NULL; int file_error = 0;
+    if (!in || !out) { fprintf(stderr, "compactStockJournal: Cannot open files: %s\n", strerror(errno)); free(in); if (out) fclose(out); remove(TEMP_STOCK_FILE_COMPACT); return 0; }
+    CsvScanner sc; CsvField f[STOCK_CSV_FIELDS]; int count; struct medicine m_line; char row[512]; csvScanInit(&sc, in, in_len);
+    while ((count = csvNextRow(&sc, f, STOCK_CSV_FIELDS)) > 0) { // Rows the loader accepts get the live quantity; anything else is copied as it was
+        StockItem *med = stockRowFromCsv(f, count, &m_line) ? searchHashTableByCode(globalHashTable, m_line.mcode) : NULL;
+        if (med != NULL) { m_line.quantity = med->quantity; int n = formatStockCsvRow(&m_line, row, sizeof(row)); if (n < 0 || (size_t)n >= sizeof(row) || fputs(row, out) == EOF) { file_error = 1; break; } }
+        else if (fwrite(in + sc.row_start, 1, sc.row_end - sc.row_start, out) != sc.row_end - sc.row_start) { file_error = 1; break; } }
+    free(in);
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0) { file_error = 1; } if (fclose(out) != 0) { file_error = 1; }
+    if (file_error) { fprintf(stderr, "compactStockJournal: Write failed, journal kept.\n"); remove(TEMP_STOCK_FILE_COMPACT); return 0; }
+#ifdef _WIN32
+    remove(STOCK_FILE); // rename() does not replace an existing file on Windows
+#endif
+    if (rename(TEMP_STOCK_FILE_COMPACT, STOCK_FILE) != 0) { fprintf(stderr, "compactStockJournal: Rename failed: %s. Journal kept.\n", strerror(errno)); remove(TEMP_STOCK_FILE_COMPACT); return 0; }
+    if (remove(STOCK_JOURNAL_FILE) != 0 && errno != ENOENT) { fprintf(stderr, "compactStockJournal: Cannot remove %s: %s\n", STOCK_JOURNAL_FILE, strerror(errno)); } // Replay is idempotent, so a leftover journal is harmless
+    logAt(LOG_INFO, "compactStockJournal: %s rewritten, journal emptied.\n", STOCK_FILE); recordStockFileStamp(); stockJournalApplied = 0;
+    struct stat csv_st; if (stat(STOCK_FILE, &csv_st) == 0) { writeStockSnapshot(STOCK_SNAPSHOT_FILE, &csv_st); } // Memory now matches the new STOCK_FILE exactly
+    return 1;
+}
+
+// Compaction rewrites STOCK_FILE from memory, so it runs with every lock held and only after catching up
+void maybeCompactStockJournal() {
+    struct stat st; if (stat(STOCK_JOURNAL_FILE, &st) != 0 || st.st_size <= JOURNAL_COMPACT_BYTES) return;
+    if (!stockLockRange(0, 0, 1)) return;
+    if (stat(STOCK_JOURNAL_FILE, &st) == 0 && st.st_size > JOURNAL_COMPACT_BYTES && syncStockFromDisk()) { logAt(LOG_INFO, "Journal %lld bytes, compacting.\n", (long long)st.st_size); unsigned long long t0 = metricsNow(); compactStockJournal(); metricsRecord(METRIC_COMPACT, t0); } // Re-checked: another process may have compacted while we waited
+    stockLockRange(0, 0, 0);
+}
+
+
+// --- Sales Index Implementation ---
+// SALES_FILE stays the append-only record of every sale. SALES_INDEX_FILE holds its valid rows as columns (byte
+// offset, integer invoice ID, day number, code, quantity, amount in paise) plus running totals, so generateReport
+// prints its summary from the header, seeks straight to one page of rows, and aggregates date ranges over the
+// columns instead of re-parsing the whole history. The index covers a prefix of SALES_FILE (hdr.sales_bytes): rows
+// appended by anything that did not update it (older builds, a crash between the two writes) are parsed and added
+// on the next refresh, and a SALES_FILE that shrank or was replaced, or an index written by an older version,
+// triggers a full rebuild from SALES_FILE.
+
+unsigned long long invoiceHash(const char *invoice_id) {
+    unsigned long long h = 14695981039346656037ULL; for (const char *p = invoice_id; *p; p++) { h = (h ^ (unsigned char)*p) * 1099511628211ULL; }
+    return h ? h : 1; // 0 marks an empty set slot
+}
+
+// One SALES_FILE row's fields into 'sale'. Returns 1 if it is a valid sale row
+int saleFromCsv(const CsvField *f, int count, struct sale_record *sale) {
+    long long code = 0, qty = 0; double price = 0, total = 0; memset(sale, 0, sizeof(*sale));
+    if (count < SALE_CSV_FIELDS) return 0;
+    csvFieldCopy(&f[0], sale->invoice_id, sizeof(sale->invoice_id)); csvFieldCopy(&f[1], sale->date_str, sizeof(sale->date_str)); csvFieldCopy(&f[2], sale->time_str, sizeof(sale->time_str));
+    csvFieldCopy(&f[3], sale->customer_name, sizeof(sale->customer_name)); csvFieldCopy(&f[5], sale->medicine_name, sizeof(sale->medicine_name));
+    if (!csvFieldInt(&f[4], &code) || !csvFieldInt(&f[6], &qty) || !csvFieldDecimal(&f[7], &price) || !csvFieldDecimal(&f[8], &total) || code > INT_MAX || qty > INT_MAX) return 0;
+    sale->medicine_code = (int)code; sale->quantity = (int)qty; sale->price_per_item = price; sale->total_cost = total;
+    if (total >= 0 && total < 1e13) sale->total_paise = (long long)(total * 100.0 + 0.5); // From the double: the float loses paise above ~1 lakh
+    return sale->invoice_id[0] != '\0' && sale->medicine_code > 0 && sale->quantity > 0 && total >= 0 && total < 1e13;
+}
+
+// One SALES_FILE data line (without its newline) into 'sale'. Returns 1 if it is a valid sale row
+int parseSaleLine(const char *line, struct sale_record *sale) {
+    CsvScanner sc; CsvField f[SALE_CSV_FIELDS]; csvScanInit(&sc, line, strlen(line));
+    int count = csvNextRow(&sc, f, SALE_CSV_FIELDS); if (count == 0) { memset(sale, 0, sizeof(*sale)); return 0; }
+    return saleFromCsv(f, count, sale);
+}
+
+static void freeSalesRollup(SalesIndex *si) {
+    for (int i = 0; i < si->day_count; i++) { free(si->days[i].items); } free(si->days); si->days = NULL; si->day_count = si->day_capacity = si->rollup_built = 0;
+    free(si->code_slots); si->code_slots = NULL; si->code_slot_capacity = 0; si->code_pass = 0;
+}
+
+static void freeSalesColumns(SalesColumns *c) {
+    free(c->offset); free(c->amount); free(c->invoice); free(c->day); free(c->mcode); free(c->quantity); free(c->first_of_invoice); memset(c, 0, sizeof(*c));
+}
+
+static void resetSalesIndex(SalesIndex *si) {
+    freeSalesRollup(si); freeSalesColumns(&si->col); free(si->invoices); memset(si, 0, sizeof(*si));
+    si->hdr.magic = SALES_INDEX_MAGIC; si->hdr.version = SALES_INDEX_VERSION; si->loaded = 1;
+}
+
+int salesDayFromDate(const char *date_str) {
+    int y, m, d; char extra;
+    if (sscanf(date_str, "%d-%d-%d%c", &y, &m, &d, &extra) != 3 || y < 1900 || y > 9999 || m < 1 || m > 12 || d < 1 || d > 31) return SALES_DAY_NONE;
+    return (int)daysFromCivil(y, m, d);
+}
+
+// --- Sales Columns ---
+// In memory each column is its own array; in SALES_INDEX_FILE each is one region of hdr.column_capacity rows, in
+// salesColumnWidth order after the header. The regions are written with slack, so an append writes the new rows
+// into every region and then the header, and only a full region forces a rewrite (with double the capacity).
+
+static const size_t salesColumnWidth[SALES_COLUMNS] = { sizeof(long long), sizeof(unsigned long long), sizeof(long long), sizeof(int), sizeof(int), sizeof(int), 1 };
+
+static char *salesColumnData(const SalesColumns *c, int k) { // Column k, in region order
+    switch (k) { case 0: return (char *)c->offset; case 1: return (char *)c->invoice; case 2: return (char *)c->amount; case 3: return (char *)c->day;
+                 case 4: return (char *)c->mcode; case 5: return (char *)c->quantity; default: return (char *)c->first_of_invoice; }
+}
+
+// File position of 'row' in column k of a file whose regions hold 'capacity' rows (k = SALES_COLUMNS: the end of the file)
+static long salesColumnPos(long long capacity, int k, long long row) {
+    long long pos = (long long)sizeof(SalesIndexHeader); for (int i = 0; i < k; i++) pos += capacity * (long long)salesColumnWidth[i];
+    return (long)(pos + (k < SALES_COLUMNS ? row * (long long)salesColumnWidth[k] : 0));
+}
+
+// Reads (write = 0) or writes rows [from, to) of every column. Returns 1 on success
+static int salesColumnsIo(FILE *fp, const SalesColumns *c, long long capacity, long long from, long long to, int write) {
+    for (int k = 0; k < SALES_COLUMNS && from < to; k++) { size_t w = salesColumnWidth[k], n = (size_t)(to - from); char *data = salesColumnData(c, k) + (size_t)from * w;
+        if (fseek(fp, salesColumnPos(capacity, k, from), SEEK_SET) != 0 || (write ? fwrite(data, w, n, fp) : fread(data, w, n, fp)) != n) return 0; }
+    return 1;
+}
+
+static void *salesColumnGrow(void *column, size_t width, long long capacity, int *ok) {
+    void *p = *ok ? realloc(column, width * (size_t)capacity) : NULL; if (p == NULL) { *ok = 0; return column; } return p;
+}
+
+// Makes room for 'rows' in every column. Returns 1 on success, 0 on alloc failure (the columns keep their rows)
+static int salesColumnsReserve(SalesIndex *si, long long rows) {
+    if (rows <= si->capacity) return 1;
+    long long cap = si->capacity ? si->capacity : 1024; while (cap < rows) cap *= 2; SalesColumns *c = &si->col; int ok = 1;
+    c->offset = (long long *)salesColumnGrow(c->offset, sizeof(long long), cap, &ok); c->invoice = (unsigned long long *)salesColumnGrow(c->invoice, sizeof(unsigned long long), cap, &ok);
+    c->amount = (long long *)salesColumnGrow(c->amount, sizeof(long long), cap, &ok); c->day = (int *)salesColumnGrow(c->day, sizeof(int), cap, &ok);
+    c->mcode = (int *)salesColumnGrow(c->mcode, sizeof(int), cap, &ok); c->quantity = (int *)salesColumnGrow(c->quantity, sizeof(int), cap, &ok);
+    c->first_of_invoice = (unsigned char *)salesColumnGrow(c->first_of_invoice, 1, cap, &ok);
+    if (!ok) { fprintf(stderr, "Error: Mem alloc failed sales index.\n"); return 0; }
+    si->capacity = cap; return 1;
+}
+
+// --- Sales Aggregation Kernels ---
+// Rows are appended in time order, so each day's sales are one run of the day column. Group-by-date finds where a
+// run ends (comparing 4 or 8 days at once) and sums the run's quantity, amount and first_of_invoice columns with
+// 64-bit vector adds: quantities are widened from 32 bits, the flag bytes are summed with PSADBW. As with the CSV
+// scanner, SSE2 and AVX2 versions are chosen at runtime on x86 GCC/Clang builds and everything else uses the scalar
+// loops. The sums are integers, so every level gives the same totals to the paisa.
+
+typedef void (*SalesSumFn)(const SalesColumns *c, long long from, long long to, SalesSums *s); // Adds rows [from, to) into *s
+typedef long long (*SalesRunFn)(const int *day, long long from, long long to);                 // First row after 'from' whose day differs, or 'to'
+
+static void salesSumScalar(const SalesColumns *c, long long from, long long to, SalesSums *s) {
+    long long units = 0, paise = 0, invoices = 0;
+    for (long long i = from; i < to; i++) { units += c->quantity[i]; paise += c->amount[i]; invoices += c->first_of_invoice[i]; }
+    s->units += units; s->paise += paise; s->invoices += invoices;
+}
+
+static long long salesRunEndScalar(const int *day, long long from, long long to) {
+    long long i = from + 1; while (i < to && day[i] == day[from]) { i++; } return i;
+}
+
+#ifdef CSV_SIMD_X86
+__attribute__((target("sse2"))) static void salesSumSse2(const SalesColumns *c, long long from, long long to, SalesSums *s) {
+    const __m128i zero = _mm_setzero_si128(); __m128i units = zero, paise = zero, invoices = zero; long long i = from, u[2], p[2], v[2];
+    for (; i + 16 <= to; i += 16) {
+        for (int k = 0; k < 16; k += 4) { __m128i q = _mm_loadu_si128((const __m128i *)(c->quantity + i + k)), sign = _mm_cmpgt_epi32(zero, q);
+            units = _mm_add_epi64(units, _mm_add_epi64(_mm_unpacklo_epi32(q, sign), _mm_unpackhi_epi32(q, sign))); }
+        for (int k = 0; k < 16; k += 2) paise = _mm_add_epi64(paise, _mm_loadu_si128((const __m128i *)(c->amount + i + k)));
+        invoices = _mm_add_epi64(invoices, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(c->first_of_invoice + i)), zero)); }
+    _mm_storeu_si128((__m128i *)u, units); _mm_storeu_si128((__m128i *)p, paise); _mm_storeu_si128((__m128i *)v, invoices);
+    s->units += u[0] + u[1]; s->paise += p[0] + p[1]; s->invoices += v[0] + v[1];
+    salesSumScalar(c, i, to, s);
+}
+
+__attribute__((target("sse2"))) static long long salesRunEndSse2(const int *day, long long from, long long to) {
+    const __m128i d = _mm_set1_epi32(day[from]); long long i = from + 1;
+    for (; i + 4 <= to; i += 4) { int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(day + i)), d)));
+        if (same != 0xF) return i + csvCtz64((unsigned long long)(~same & 0xF)); }
+    while (i < to && day[i] == day[from]) { i++; } return i;
+}
+
+__attribute__((target("avx2"))) static void salesSumAvx2(const SalesColumns *c, long long from, long long to, SalesSums *s) {
+    const __m256i zero = _mm256_setzero_si256(); __m256i units = zero, paise = zero, invoices = zero; long long i = from, u[4], p[4], v[4];
+    for (; i + 32 <= to; i += 32) {
+        for (int k = 0; k < 32; k += 8) { __m256i q = _mm256_loadu_si256((const __m256i *)(c->quantity + i + k));
+            units = _mm256_add_epi64(units, _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(q)), _mm256_cvtepi32_epi64(_mm256_extracti128_si256(q, 1)))); }
+        for (int k = 0; k < 32; k += 4) paise = _mm256_add_epi64(paise, _mm256_loadu_si256((const __m256i *)(c->amount + i + k)));
+        invoices = _mm256_add_epi64(invoices, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(c->first_of_invoice + i)), zero)); }
+    _mm256_storeu_si256((__m256i *)u, units); _mm256_storeu_si256((__m256i *)p, paise); _mm256_storeu_si256((__m256i *)v, invoices);
+    s->units += u[0] + u[1] + u[2] + u[3]; s->paise += p[0] + p[1] + p[2] + p[3]; s->invoices += v[0] + v[1] + v[2] + v[3];
+    salesSumScalar(c, i, to, s);
+}
+
+__attribute__((target("avx2"))) static long long salesRunEndAvx2(const int *day, long long from, long long to) {
+    const __m256i d = _mm256_set1_epi32(day[from]); long long i = from + 1;
+    for (; i + 8 <= to; i += 8) { int same = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(day + i)), d)));
+        if (same != 0xFF) return i + csvCtz64((unsigned long long)(~same & 0xFF)); }
+    while (i < to && day[i] == day[from]) { i++; } return i;
+}
+#endif
+
+static int salesLevel = -1; // Not chosen yet
+static SalesSumFn salesSum = salesSumScalar;
+static SalesRunFn salesRunEnd = salesRunEndScalar;
+
+int salesSetKernelLevel(int level) {
+    int best = simdBestLevel();
+    if (level < 0 || level > best) level = best;
+    salesLevel = level; salesSum = salesSumScalar; salesRunEnd = salesRunEndScalar;
+#ifdef CSV_SIMD_X86
+    if (level == 1) { salesSum = salesSumSse2; salesRunEnd = salesRunEndSse2; } else if (level == 2) { salesSum = salesSumAvx2; salesRunEnd = salesRunEndAvx2; }
+#endif
+    return level;
+}
+
+void salesSumRows(const SalesColumns *col, long long from, long long to, SalesSums *sums) {
+    if (salesLevel < 0) salesSetKernelLevel(-1);
+    memset(sums, 0, sizeof(*sums)); if (from < to) salesSum(col, from, to, sums);
+}
+
+// Finds or inserts the rollup of 'day'. Days arrive in order almost always, so the last day is checked first. NULL on alloc failure
+static SalesDay *salesRollupDay(SalesIndex *si, int day) {
+    int lo = 0, hi = si->day_count;
+    if (hi > 0 && si->days[hi - 1].day < day) { lo = hi; }
+    else { while (lo < hi) { int mid = lo + (hi - lo) / 2; if (si->days[mid].day < day) lo = mid + 1; else hi = mid; } }
+    if (lo == si->day_count || si->days[lo].day != day) {
+        if (si->day_count == si->day_capacity) { int cap = si->day_capacity ? si->day_capacity * 2 : 64; SalesDay *nd = (SalesDay *)realloc(si->days, sizeof(SalesDay) * (size_t)cap); if (nd == NULL) { fprintf(stderr, "Error: Mem alloc failed sales rollup.\n"); return NULL; } si->days = nd; si->day_capacity = cap; }
+        memmove(&si->days[lo + 1], &si->days[lo], sizeof(SalesDay) * (size_t)(si->day_count - lo)); memset(&si->days[lo], 0, sizeof(SalesDay)); si->days[lo].day = day; si->day_count++; }
+    return &si->days[lo];
+}
+
+static SalesCodeSlot *salesCodeSlotFind(const SalesIndex *si, int code) { // Its slot, or the empty one it would take
+    unsigned mask = (unsigned)si->code_slot_capacity - 1;
+    for (unsigned pos = (unsigned)(((unsigned long long)(unsigned)code * 0x9E3779B97F4A7C15ULL) >> 32) & mask; ; pos = (pos + 1) & mask) {
+        SalesCodeSlot *s = &si->code_slots[pos]; if (s->pass != si->code_pass || s->mcode == code) return s; }
+}
+
+// Starts a new pass for 'day': grows the slot table to under half full and enters the day's items. Returns 0 on alloc failure
+static int salesCodeSlotsReset(SalesIndex *si, const SalesDay *day) {
+    if ((day->item_count + 1) * 2 > si->code_slot_capacity) { int cap = si->code_slot_capacity ? si->code_slot_capacity : 256; while (cap < (day->item_count + 1) * 2) cap *= 2;
+        SalesCodeSlot *slots = (SalesCodeSlot *)calloc((size_t)cap, sizeof(SalesCodeSlot)); if (slots == NULL) { fprintf(stderr, "Error: Mem alloc failed sales rollup.\n"); return 0; }
+        free(si->code_slots); si->code_slots = slots; si->code_slot_capacity = cap; si->code_pass = 0; }
+    if (++si->code_pass == 0) { memset(si->code_slots, 0, sizeof(SalesCodeSlot) * (size_t)si->code_slot_capacity); si->code_pass = 1; } // Stamps wrapped
+    for (int i = 0; i < day->item_count; i++) { SalesCodeSlot *s = salesCodeSlotFind(si, day->items[i].mcode); s->mcode = day->items[i].mcode; s->pass = si->code_pass; s->item = i; }
+    return 1;
+}
+
+// Group-by-code of rows [from, to), all of one day, into day->items. This one stays scalar: adding a vector of rows
+// into the slots of their codes is a scatter with repeated codes, which SSE2/AVX2 cannot do without conflict detection
+static int salesRollupCodes(SalesIndex *si, SalesDay *day, long long from, long long to) {
+    const int *code = si->col.mcode, *qty = si->col.quantity; const long long *paise = si->col.amount;
+    if (!salesCodeSlotsReset(si, day)) return 0;
+    for (long long r = from; r < to; r++) {
+        SalesCodeSlot *s = salesCodeSlotFind(si, code[r]);
+        if (s->pass != si->code_pass) { // First sale of this code on this day
+            if (day->item_count == day->item_capacity) { int cap = day->item_capacity ? day->item_capacity * 2 : 8; SalesRollupItem *ni = (SalesRollupItem *)realloc(day->items, sizeof(SalesRollupItem) * (size_t)cap); if (ni == NULL) { fprintf(stderr, "Error: Mem alloc failed sales rollup.\n"); return 0; } day->items = ni; day->item_capacity = cap; }
+            SalesRollupItem *it = &day->items[day->item_count]; it->mcode = code[r]; it->units = 0; it->revenue_paise = 0; s->mcode = code[r]; s->pass = si->code_pass; s->item = day->item_count++; }
+        day->items[s->item].units += qty[r]; day->items[s->item].revenue_paise += paise[r];
+        if (day->item_count * 2 > si->code_slot_capacity && !salesCodeSlotsReset(si, day)) return 0; }
+    return 1;
+}
+
+// Folds rows [from, to) into the daily rollups, one run of equal days at a time. Returns 1 on success, 0 on alloc failure
+static int salesRollupRows(SalesIndex *si, long long from, long long to) {
+    if (salesLevel < 0) salesSetKernelLevel(-1);
+    for (long long i = from, end; i < to; i = end) {
+        end = salesRunEnd(si->col.day, i, to); if (si->col.day[i] == SALES_DAY_NONE) continue;
+        SalesDay *day = salesRollupDay(si, si->col.day[i]); if (day == NULL) return 0;
+        SalesSums sums = { 0, 0, 0 }; salesSum(&si->col, i, end, &sums); day->units += sums.units; day->revenue_paise += sums.paise; day->invoices += sums.invoices;
+        if (!salesRollupCodes(si, day, i, end)) return 0; }
+    return 1;
+}
+
+int buildSalesRollup(SalesIndex *si) {
+    if (si->rollup_built) return 1;
+    freeSalesRollup(si);
+    if (!salesRollupRows(si, 0, si->hdr.rows)) { freeSalesRollup(si); return 0; }
+    si->rollup_built = 1; logAt(LOG_DEBUG, "buildSalesRollup: %lld rows -> %d days (%s kernels).\n", si->hdr.rows, si->day_count, csvScanLevelName(salesLevel)); return 1;
+}
+
+static int compareRollupItemCode(const void *a, const void *b) { int x = ((const SalesRollupItem *)a)->mcode, y = ((const SalesRollupItem *)b)->mcode; return (x > y) - (x < y); }
+
+int querySalesRange(SalesIndex *si, int from_day, int to_day, SalesDay *totals, SalesRollupItem **items) {
+    memset(totals, 0, sizeof(*totals)); *items = NULL;
+    if (!buildSalesRollup(si)) return -1;
+    int lo = 0, hi = si->day_count; while (lo < hi) { int mid = lo + (hi - lo) / 2; if (si->days[mid].day < from_day) lo = mid + 1; else hi = mid; }
+    int n = 0; for (int d = lo; d < si->day_count && si->days[d].day <= to_day; d++) { n += si->days[d].item_count; }
+    SalesRollupItem *all = (SalesRollupItem *)malloc(sizeof(SalesRollupItem) * (size_t)(n ? n : 1)); if (all == NULL) return -1;
+    n = 0; for (int d = lo; d < si->day_count && si->days[d].day <= to_day; d++) { const SalesDay *day = &si->days[d];
+        totals->units += day->units; totals->revenue_paise += day->revenue_paise; totals->invoices += day->invoices; totals->item_count++; // item_count = days with sales
+        memcpy(all + n, day->items, sizeof(SalesRollupItem) * (size_t)day->item_count); n += day->item_count; }
+    qsort(all, (size_t)n, sizeof(SalesRollupItem), compareRollupItemCode); int out = 0; // Merge the per-day entries of each code
+    for (int i = 0; i < n; i++) { if (out > 0 && all[out - 1].mcode == all[i].mcode) { all[out - 1].units += all[i].units; all[out - 1].revenue_paise += all[i].revenue_paise; } else { all[out++] = all[i]; } }
+    *items = all; return out;
+}
+
+// Adds to the invoice set; returns 1 if the invoice is new, 0 if seen before, -1 on alloc failure
+static int salesInvoiceAdd(SalesIndex *si, unsigned long long h) {
+    if ((si->invoice_count + 1) * 2 > si->invoice_capacity) { // Grow (or build from the invoice column on first use) at half load
+        long long cap = si->invoice_capacity ? si->invoice_capacity * 2 : 1024; while (cap < (si->hdr.rows + 1) * 2) cap *= 2;
+        unsigned long long *slots = (unsigned long long *)calloc((size_t)cap, sizeof(unsigned long long)); if (slots == NULL) { fprintf(stderr, "Error: Mem alloc failed invoice set.\n"); return -1; }
+        unsigned long long *old = si->invoices; long long old_cap = si->invoice_capacity; si->invoices = slots; si->invoice_capacity = cap; si->invoice_count = 0;
+        if (old == NULL) { for (long long i = 0; i < si->hdr.rows; i++) salesInvoiceAdd(si, si->col.invoice[i]); }
+        else { for (long long i = 0; i < old_cap; i++) { if (old[i] != 0) salesInvoiceAdd(si, old[i]); } }
+        free(old); }
+    for (long long pos = (long long)(h & (unsigned long long)(si->invoice_capacity - 1)); ; pos = (pos + 1) & (si->invoice_capacity - 1)) {
+        if (si->invoices[pos] == h) return 0;
+        if (si->invoices[pos] == 0) { si->invoices[pos] = h; si->invoice_count++; return 1; } }
+}
+
+// Records one valid row at 'offset' and folds it into the running totals. Returns 1 on success, 0 on alloc failure
+// Everything about an entry that depends only on its own row (loader threads build these in parallel)
+static void salesEntryFromSale(const struct sale_record *sale, long long offset, SalesIndexEntry *e) {
+    memset(e, 0, sizeof(*e));
+    e->offset = offset; e->invoice = invoiceHash(sale->invoice_id); e->day = salesDayFromDate(sale->date_str); e->mcode = sale->medicine_code; e->quantity = sale->quantity; e->amount = sale->total_paise;
+}
+
+// The order-dependent rest: first_of_invoice, totals and rollup. Entries must arrive in file order
+static int salesIndexAppendEntry(SalesIndex *si, const SalesIndexEntry *entry) {
+    if (!salesColumnsReserve(si, si->hdr.rows + 1)) return 0;
+    int is_new = salesInvoiceAdd(si, entry->invoice); if (is_new < 0) return 0;
+    long long r = si->hdr.rows; SalesColumns *c = &si->col;
+    c->offset[r] = entry->offset; c->invoice[r] = entry->invoice; c->amount[r] = entry->amount; c->day[r] = entry->day; c->mcode[r] = entry->mcode; c->quantity[r] = entry->quantity; c->first_of_invoice[r] = (unsigned char)is_new;
+    si->hdr.rows++;
+    if (si->rollup_built && !salesRollupRows(si, r, r + 1)) { freeSalesRollup(si); } // Rebuilt from the columns on the next query
+    si->hdr.transactions += is_new; si->hdr.items_sold += entry->quantity; si->hdr.total_paise += entry->amount; return 1;
+}
+
+static int salesIndexAddRow(SalesIndex *si, const struct sale_record *sale, long long offset) {
+    SalesIndexEntry e; salesEntryFromSale(sale, offset, &e); return salesIndexAppendEntry(si, &e);
+}
+
+static int readSalesIndexFile(SalesIndex *si) {
+    FILE *fp = fopen(SALES_INDEX_FILE, "rb"); if (fp == NULL) return 0;
+    SalesIndexHeader hdr; SalesIndex fresh; memset(&fresh, 0, sizeof(fresh));
+    int ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == SALES_INDEX_MAGIC;
+    if (ok && hdr.version != SALES_INDEX_VERSION) { fclose(fp); logAt(LOG_INFO, "readSalesIndexFile: %s is version %u, rebuilding it from %s as version %d.\n", SALES_INDEX_FILE, hdr.version, SALES_FILE, SALES_INDEX_VERSION); return 0; }
+    ok = ok && hdr.rows >= 0 && hdr.sales_bytes >= 0 && hdr.column_capacity >= hdr.rows && salesColumnsReserve(&fresh, hdr.rows ? hdr.rows : 1) && salesColumnsIo(fp, &fresh.col, hdr.column_capacity, 0, hdr.rows, 0);
+    fclose(fp);
+    if (!ok) { logAt(LOG_WARN, "readSalesIndexFile: %s is invalid or truncated, rebuilding.\n", SALES_INDEX_FILE); freeSalesColumns(&fresh.col); return 0; }
+    resetSalesIndex(si); si->hdr = hdr; si->col = fresh.col; si->capacity = fresh.capacity; return 1;
+}
+
+static int writeSalesIndexFile(const SalesIndex *si) {
+    SalesIndexHeader hdr = si->hdr; hdr.column_capacity = 1024; while (hdr.column_capacity <= hdr.rows) hdr.column_capacity *= 2; // Every region keeps room for appends
+    FILE *fp = fopen(TEMP_SALES_INDEX_FILE, "wb"); int ok = fp != NULL;
+    if (ok) { ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && salesColumnsIo(fp, &si->col, hdr.column_capacity, 0, hdr.rows, 1)
+                   && fseek(fp, salesColumnPos(hdr.column_capacity, SALES_COLUMNS, 0) - 1, SEEK_SET) == 0 && fputc(0, fp) != EOF // Out to the end of the last region
+                   && fflush(fp) == 0 && fsync(fileno(fp)) == 0; // On disk before the rename can make it SALES_INDEX_FILE
+              if (fclose(fp) != 0) ok = 0; }
+#ifdef _WIN32
+    if (ok) remove(SALES_INDEX_FILE);
+#endif
+    if (!ok || rename(TEMP_SALES_INDEX_FILE, SALES_INDEX_FILE) != 0) { fprintf(stderr, "writeSalesIndexFile: Failed to write %s: %s\n", SALES_INDEX_FILE, strerror(errno)); remove(TEMP_SALES_INDEX_FILE); return 0; }
+    return 1;
+}
+
+// Writes the newest 'added' rows into each column's slack and rewrites the header in place: columns first, fsync'd, so a
+// crash or power loss leaves a header that still matches the rows it counts (the rows are then re-added from SALES_FILE
+// on the next refresh). Without the fsync the kernel may persist the header page before the column pages.
+static int appendSalesIndexFile(const SalesIndex *si, int added) {
+    FILE *fp = fopen(SALES_INDEX_FILE, "r+b"); if (fp == NULL) return writeSalesIndexFile(si);
+    SalesIndexHeader disk, hdr = si->hdr; long long from = si->hdr.rows - added;
+    if (fread(&disk, sizeof(disk), 1, fp) != 1 || disk.magic != SALES_INDEX_MAGIC || disk.version != SALES_INDEX_VERSION || disk.rows != from || disk.column_capacity < si->hdr.rows) { fclose(fp); return writeSalesIndexFile(si); } // On-disk copy is behind memory or a region is full: rewrite it whole
+    hdr.column_capacity = disk.column_capacity;
+    int ok = salesColumnsIo(fp, &si->col, disk.column_capacity, from, si->hdr.rows, 1) && fflush(fp) == 0 && fsync(fileno(fp)) == 0
+             && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) { fprintf(stderr, "appendSalesIndexFile: Write to %s failed: %s\n", SALES_INDEX_FILE, strerror(errno)); }
+    return ok;
+}
+
+// Adopts rows another process already appended to SALES_INDEX_FILE, so a long-lived process catching up reads
+// 37 bytes per row instead of re-parsing (and re-writing) them. Returns 1 if it advanced.
+static int adoptSalesIndexFileTail(SalesIndex *si, long long csv_size) {
+    FILE *fp = fopen(SALES_INDEX_FILE, "rb"); if (fp == NULL) return 0;
+    SalesIndexHeader hdr; long long last_offset = 0, have = si->hdr.rows; int ok = 0;
+    if (fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == SALES_INDEX_MAGIC && hdr.version == SALES_INDEX_VERSION && hdr.rows > have && hdr.column_capacity >= hdr.rows && hdr.sales_bytes > si->hdr.sales_bytes && hdr.sales_bytes <= csv_size
+        && (have == 0 || (fseek(fp, salesColumnPos(hdr.column_capacity, 0, have - 1), SEEK_SET) == 0 && fread(&last_offset, sizeof(last_offset), 1, fp) == 1 && last_offset == si->col.offset[have - 1]))) { // Same history up to our last row
+        ok = salesColumnsReserve(si, hdr.rows) && salesColumnsIo(fp, &si->col, hdr.column_capacity, have, hdr.rows, 0); }
+    fclose(fp); if (!ok) return 0;
+    for (long long i = have; i < hdr.rows && si->invoices != NULL; i++) { // Keep the invoice set and rollups (if built) in step
+        if (salesInvoiceAdd(si, si->col.invoice[i]) < 0) { free(si->invoices); si->invoices = NULL; si->invoice_capacity = si->invoice_count = 0; } }
+    if (si->rollup_built && !salesRollupRows(si, have, hdr.rows)) { freeSalesRollup(si); }
+    si->hdr = hdr; return 1;
+}
+
+typedef struct {
+    const char *buf; size_t begin, end; long long base; // In: complete rows [begin, end) of buf; base = SALES_FILE offset of buf[0]
+    SalesIndexEntry *entries; long long count, capacity; long long *bad; int bad_count, bad_capacity, ok; // Out, in file order
+} SalesLoadChunk;
+
+static void salesLoadChunkRun(void *task) {
+    SalesLoadChunk *c = (SalesLoadChunk *)task; CsvScanner sc; CsvField f[SALE_CSV_FIELDS]; struct sale_record sale; int count; c->ok = 0;
+    csvScanInit(&sc, c->buf + c->begin, c->end - c->begin);
+    while ((count = csvNextRow(&sc, f, SALE_CSV_FIELDS)) > 0) {
+        long long row_offset = c->base + (long long)(c->begin + sc.row_start);
+        if ((count == 1 && f[0].len == 0 && !f[0].quoted) || (row_offset == 0 && csvFieldEquals(&f[0], "InvoiceID"))) continue; // Blank line / header
+        if (!saleFromCsv(f, count, &sale)) { if (c->bad_count == c->bad_capacity) { int cap = c->bad_capacity ? c->bad_capacity * 2 : 16; long long *b = (long long *)realloc(c->bad, sizeof(long long) * (size_t)cap); if (b == NULL) return; c->bad = b; c->bad_capacity = cap; }
+            c->bad[c->bad_count++] = row_offset; continue; }
+        if (c->count == c->capacity) { long long cap = c->capacity ? c->capacity * 2 : 4096; SalesIndexEntry *e = (SalesIndexEntry *)realloc(c->entries, sizeof(SalesIndexEntry) * (size_t)cap); if (e == NULL) return; c->entries = e; c->capacity = cap; }
+        salesEntryFromSale(&sale, row_offset, &c->entries[c->count++]); }
+    c->ok = 1;
+}
+
+int refreshSalesIndex() {
+    SalesIndex *si = &globalSales; struct stat st;
+    if (stat(SALES_FILE, &st) != 0) { if (errno != ENOENT) { fprintf(stderr, "refreshSalesIndex: Cannot stat %s: %s\n", SALES_FILE, strerror(errno)); return 0; }
+        resetSalesIndex(si); return 1; } // No sales yet
+    if (!si->loaded && !readSalesIndexFile(si)) { resetSalesIndex(si); }
+    if ((long long)st.st_size == si->hdr.sales_bytes) return 1; // Up to date: the common case
+    if (si->hdr.rows > 0 && adoptSalesIndexFileTail(si, (long long)st.st_size) && (long long)st.st_size == si->hdr.sales_bytes) return 1; // Another writer indexed them
+    FILE *fp = fopen(SALES_FILE, "rb"); if (fp == NULL) { fprintf(stderr, "refreshSalesIndex: Cannot open %s: %s\n", SALES_FILE, strerror(errno)); return 0; }
+    if (si->hdr.sales_bytes > 0) { // The covered prefix must still end on a row boundary, or SALES_FILE was replaced
+        int last = (fseek(fp, (long)(si->hdr.sales_bytes - 1), SEEK_SET) == 0) ? fgetc(fp) : EOF;
+        if ((long long)st.st_size < si->hdr.sales_bytes || last != '\n') { logAt(LOG_WARN, "refreshSalesIndex: %s no longer matches %s, rebuilding.\n", SALES_INDEX_FILE, SALES_FILE); resetSalesIndex(si); } }
+    long long added = 0, offset = si->hdr.sales_bytes; int ok = 1, threads = loadThreads((size_t)((long long)st.st_size - offset)); size_t cap = (size_t)CSV_READ_CHUNK * (size_t)threads, have = 0, got;
+    char *buf = (char *)malloc(cap); if (buf == NULL) { fprintf(stderr, "refreshSalesIndex: Mem alloc failed.\n"); fclose(fp); return 0; }
+    fseek(fp, (long)offset, SEEK_SET);
+    while (ok && (got = fread(buf + have, 1, cap - have, fp)) > 0) { // Whole rows are parsed straight out of the chunk; a partial one carries over
+        have += got; size_t used = have; while (used > 0 && buf[used - 1] != '\n') used--; // A newline always ends a row
+        SalesLoadChunk chunks[LOAD_MAX_THREADS]; size_t bounds[LOAD_MAX_THREADS + 1]; int n = csvSplitRows(buf, used, threads, bounds); memset(chunks, 0, sizeof(chunks));
+        for (int c = 0; c < n; c++) { chunks[c].buf = buf; chunks[c].begin = bounds[c]; chunks[c].end = bounds[c + 1]; chunks[c].base = offset; }
+        if (used > 0) runLoadTasks(salesLoadChunkRun, chunks, sizeof(SalesLoadChunk), n);
+        for (int c = 0; c < n; c++) { // Appended in chunk order, so the index is the one a single pass would build
+            if (used > 0 && !chunks[c].ok) { fprintf(stderr, "refreshSalesIndex: Mem alloc failed.\n"); ok = 0; }
+            globalMetrics.sales_rows_malformed += (unsigned long long)chunks[c].bad_count;
+            for (int i = 0; i < chunks[c].bad_count && ok; i++) logAt(LOG_WARN, "refreshSalesIndex: Malformed sales row at byte %lld, skipping.\n", chunks[c].bad[i]);
+            for (long long i = 0; i < chunks[c].count && ok; i++) { if (!salesIndexAppendEntry(si, &chunks[c].entries[i])) ok = 0; else added++; }
+            free(chunks[c].entries); free(chunks[c].bad); }
+        if (!ok) break;
+        offset += (long long)used; memmove(buf, buf + used, have - used); have -= used;
+        if (have == cap) { char *nb = (char *)realloc(buf, cap * 2); if (nb == NULL) { fprintf(stderr, "refreshSalesIndex: Mem alloc failed.\n"); ok = 0; break; } buf = nb; cap *= 2; } // One row longer than the buffer
+    } // Bytes still in buf at EOF are a row being written: left for the next refresh
+    if (ferror(fp)) { fprintf(stderr, "refreshSalesIndex: Error reading %s: %s\n", SALES_FILE, strerror(errno)); ok = 0; }
+    free(buf); fclose(fp); if (!ok) return 0;
+    si->hdr.sales_bytes = offset; logAt(LOG_INFO, "refreshSalesIndex: Indexed %lld new sales rows (%lld total).\n", added, si->hdr.rows);
+    writeSalesIndexFile(si); return 1;
+}
+
+void freeSalesIndex() { freeSalesRollup(&globalSales); freeSalesColumns(&globalSales.col); free(globalSales.invoices); memset(&globalSales, 0, sizeof(globalSales)); }
+
+
+// --- Core Logic Functions ---
+
+// The handlers' stock lookup: the global hash table, timed under "lookup". The record is stockStoreGet(globalStockStore, handle)
+static StockHandle lookupStock(int code) {
+    unsigned long long t0 = metricsNow(); StockHandle h = hashTableFind(globalHashTable, code); metricsRecord(METRIC_LOOKUP, t0); return h;
+}
+
+// processAddStock remains unchanged...
+void processAddStock(const RequestParams *req) {
+    logAt(LOG_DEBUG, "processAddStock: Started.\n"); struct medicine m; memset(&m, 0, sizeof(m)); const char *temp = NULL; int y=0, mo=0, d=0, parse_error = 0;
+    temp = requestParam(req, "medicineName"); if (temp) { strncpy(m.name, temp, 39); m.name[39] = '\0'; } else { parse_error=1; fprintf(stderr,"Missing Name\n");}
+    temp = requestParam(req, "medicineCode"); if (temp) { m.mcode = atoi(temp); } else { parse_error=1; fprintf(stderr,"Missing Code\n");}
+    temp = requestParam(req, "suppliername"); if (temp) { strncpy(m.s_name, temp, 49); m.s_name[49] = '\0'; } else { parse_error=1; fprintf(stderr,"Missing S.Name\n");}
+    temp = requestParam(req, "suppliercontact"); if (temp) { m.s_contact = atoll(temp); } else { parse_error=1; fprintf(stderr,"Missing S.Contact\n");}
+    temp = requestParam(req, "price"); if (temp) { m.price = atof(temp); } else { parse_error=1; fprintf(stderr,"Missing Price\n");}
+    temp = requestParam(req, "quantity"); if (temp) { m.quantity = atoi(temp); } else { parse_error=1; fprintf(stderr,"Missing Qty\n");}
+    temp = requestParam(req, "expiry"); if (temp) { if (sscanf(temp, "%d-%d-%d", &y, &mo, &d) == 3) { m.year = y; m.month = mo; m.day = d; } else { parse_error=1; outPrintf("<p class='error'>Invalid Expiry '"); outHtml(temp); outPrintf("'.</p>"); } } else { parse_error=1; fprintf(stderr,"Missing Expiry\n"); }
+    int validation_failed = (parse_error || stockRowProblem(&m) != NULL);
+    if (validation_failed) { logAt(LOG_WARN, "Add Validation Failed.\n"); outPrintf("<h2>Error Adding</h2><p class='error'>Invalid/missing data.</p><p><a href='../add_stock.html' class='btn btn-secondary'>Back</a></p>"); outFlush(); return; }
+    if (!stockLockRange(0, 0, 1) || !syncStockFromDisk()) { stockLockRange(0, 0, 0); fprintf(stderr, "Add abort: lock/sync failed.\n"); outPrintf("<h2>Internal Error</h2><p class='error'>Cannot read current stock.</p>"); outFlush(); return; } // Appends to STOCK_FILE: exclude everyone
+    if (lookupStock(m.mcode) != 0) { stockLockRange(0, 0, 0); logAt(LOG_WARN, "Add Error: Code %d exists.\n", m.mcode); outPrintf("<h2>Error Adding</h2><p class='error'>Code %d already exists.</p><p><a href='../add_stock.html' class='btn btn-secondary'>Back</a></p>", m.mcode); outFlush(); return; }
+    FILE *fp = fopen(STOCK_FILE, "a+b"); if (fp == NULL) { stockLockRange(0, 0, 0); fprintf(stderr, "FATAL: Error opening %s: %s\n", STOCK_FILE, strerror(errno)); outPrintf("<h2>Internal Error</h2><p class='error'>Cannot open file.</p>"); outFlush(); return; }
+    char row[512]; size_t used = 0; fseek(fp, 0, SEEK_END); long start = ftell(fp);
+    if (start > 0 && fseek(fp, -1, SEEK_END) == 0 && fgetc(fp) != '\n') row[used++] = '\n'; // Last row still open: end it rather than gluing onto it
+    int n = formatStockCsvRow(&m, row + used, sizeof(row) - used), write_errno = 0; unsigned long long t0 = metricsNow();
+    int write_result = n >= 0 && (size_t)n < sizeof(row) - used && fseek(fp, 0, SEEK_END) == 0 && fwrite(row, 1, used + (size_t)n, fp) == used + (size_t)n && fflush(fp) == 0 && fsync(fileno(fp)) == 0 ? 0 : -1;
+    if (write_result < 0) { write_errno = errno; if (start >= 0 && ftruncate(fileno(fp), start) != 0) { fprintf(stderr, "Add: Rollback truncate failed.\n"); } } // Leave stock.csv as it was
+    if (fclose(fp) != 0 && write_result == 0) { write_result = -1; write_errno = errno; } metricsRecord(METRIC_STOCK_WRITE, t0); recordStockFileStamp(); stockLockRange(0, 0, 0);
+    if (write_result < 0) { fprintf(stderr, "Error writing %s: %s\n", STOCK_FILE, strerror(write_errno)); outPrintf("<h2>Error Adding</h2><p class='error'>Failed write.</p><p><a href='../add_stock.html' class='btn btn-secondary'>Back</a></p>"); outFlush(); }
+    else { logAt(LOG_DEBUG, "Written code %d. Adding mem.\n", m.mcode); int hash_add = addStockRecord(&m, 0);
+        if (hash_add == 1) { logAt(LOG_DEBUG, "Added code %d.\n", m.mcode); char esc[6 * sizeof(m.name)]; outPrintf("<div class='success'><h2>Stock Added</h2><p>%s (%d)</p><p>Qty: %d</p><p>%04d-%02d-%02d</p><p><a href='../add_stock.html' class='btn btn-primary'>Add Another</a>|<a href='medical.exe' class='btn btn-secondary'>View</a></p></div>", htmlEscape(m.name, esc, sizeof(esc)), m.mcode, m.quantity, m.year, m.month, m.day); outFlush(); }
+        else if (hash_add == 0){ logAt(LOG_WARN, "Warn: Code %d already in hash?\n", m.mcode); outPrintf("<h2>Internal Warning</h2><p class='warning'>File saved, error live view.</p>"); }
+        else { fprintf(stderr, "FATAL: Mem error add code %d.\n", m.mcode); outPrintf("<h2>Internal Error</h2><p class='error'>File saved, mem error live view.</p>"); } }
+    logAt(LOG_DEBUG, "processAddStock: Finished.\n"); fflush(stderr);
+}
+
+const char *stockRowProblem(const struct medicine *m) {
+    if (strlen(m->name) == 0) return "Missing name";
+    if (m->mcode <= 0) return "Code must be positive";
+    if (strlen(m->s_name) == 0) return "Missing supplier";
+    if (m->s_contact <= 0) return "Bad supplier contact";
+    if (m->quantity <= 0) return "Quantity must be positive";
+    if (m->price < 0) return "Negative price";
+    if (!(m->price <= STOCK_PRICE_MAX)) return "Price too large";
+    if (m->year < 1970 || m->year > 9999 || m->month < 1 || m->month > 12 || m->day < 1 || m->day > 31) return "Bad expiry date";
+    return NULL;
+}
+
+typedef struct { int line, code; const char *problem; } StockImportError;
+typedef struct { int code, row; } StockImportCode; // For spotting codes repeated within the file
+
+static int compareImportCode(const void *a, const void *b) {
+    const StockImportCode *x = (const StockImportCode *)a, *y = (const StockImportCode *)b;
+    return x->code != y->code ? (x->code > y->code) - (x->code < y->code) : (x->row > y->row) - (x->row < y->row);
+}
+
+static int compareImportError(const void *a, const void *b) {
+    int x = ((const StockImportError *)a)->line, y = ((const StockImportError *)b)->line; return (x > y) - (x < y);
+}
+
+static int importNoteError(StockImportError **errors, int *count, int *cap, int line, int code, const char *problem) {
+    if (*count == *cap) { int c = *cap ? *cap * 2 : 64; StockImportError *e = (StockImportError *)realloc(*errors, sizeof(StockImportError) * (size_t)c); if (e == NULL) return 0; *errors = e; *cap = c; }
+    (*errors)[*count].line = line; (*errors)[*count].code = code; (*errors)[*count].problem = problem; (*count)++; return 1;
+}
+
+// Same rows and rules as add_stock, for a whole delivery at once: one pass parses and validates every row (an
+// optional header line is skipped), rows that pass are appended to STOCK_FILE in a single fsync'd write and then
+// indexed as a batch. Rejected rows are listed with their line numbers; atomic=1 rejects the file if any row fails.
+void processImportStock(const RequestParams *req, const char *csv) {
+    unsigned long long t_start = metricsNow(); if (csv == NULL) csv = requestParam(req, "stockCsv");
+    const char *atomic_s = requestParam(req, "atomic"); int atomic = atomic_s != NULL && strcmp(atomic_s, "1") == 0;
+    if (csv == NULL || csv[0] == '\0') { outPrintf("<h2>Import Error</h2><p class='error'>No delivery file: POST it as text/csv, or in the stockCsv field.</p>"); outFlush(); return; }
+    size_t len = strlen(csv); int rows_cap = 1024, rows = 0, err_count = 0, err_cap = 0, lines = 0, count; CsvScanner sc; CsvField f[STOCK_CSV_FIELDS];
+    struct medicine *meds = (struct medicine *)malloc(sizeof(struct medicine) * (size_t)rows_cap); int *row_line = (int *)malloc(sizeof(int) * (size_t)rows_cap); StockImportError *errors = NULL;
+    if (meds == NULL || row_line == NULL) { free(meds); free(row_line); outPrintf("<h2>Internal Error</h2><p class='error'>Out of memory.</p>"); outFlush(); return; }
+    // 1. Parse and validate every row
+    csvScanInit(&sc, csv, len);
+    while ((count = csvNextRow(&sc, f, STOCK_CSV_FIELDS)) > 0) {
+        lines++; if (count == 1 && f[0].len == 0 && !f[0].quoted) continue; // Blank line
+        if (rows == rows_cap) { rows_cap *= 2; struct medicine *nm = (struct medicine *)realloc(meds, sizeof(struct medicine) * (size_t)rows_cap); int *nl = (int *)realloc(row_line, sizeof(int) * (size_t)rows_cap);
+            if (nm) { meds = nm; }
+            if (nl) { row_line = nl; }
+            if (!nm || !nl) { free(meds); free(row_line); free(errors); outPrintf("<h2>Internal Error</h2><p class='error'>Out of memory.</p>"); outFlush(); return; } }
+        struct medicine *m = &meds[rows]; int code = 0, numeric_code = count > 1 && csvFieldInt32(&f[1], &code);
+        if (!stockRowFromCsv(f, count, m)) { if (rows == 0 && err_count == 0 && count > 1 && !numeric_code) continue; // Header line
+            importNoteError(&errors, &err_count, &err_cap, lines, code, count < STOCK_CSV_FIELDS ? "Expected 9 fields: name,code,supplier,contact,price,quantity,year,month,day" : "Malformed field"); continue; }
+        const char *problem = stockRowProblem(m); if (problem != NULL) { importNoteError(&errors, &err_count, &err_cap, lines, m->mcode, problem); continue; }
+        row_line[rows++] = lines; }
+    // 2. Under the stock lock: drop codes already stocked or repeated in the file (the first occurrence wins)
+    int locked = stockLockRange(0, 0, 1) && syncStockFromDisk(); // Appends to STOCK_FILE: exclude everyone, as add_stock does
+    if (!locked) { stockLockRange(0, 0, 0); free(meds); free(row_line); free(errors); fprintf(stderr, "Import abort: lock/sync failed.\n"); outPrintf("<h2>Internal Error</h2><p class='error'>Cannot read current stock.</p>"); outFlush(); return; }
+    StockImportCode *codes = (StockImportCode *)malloc(sizeof(StockImportCode) * (size_t)(rows ? rows : 1)); char *drop = (char *)calloc((size_t)(rows ? rows : 1), 1);
+    if (codes == NULL || drop == NULL) { stockLockRange(0, 0, 0); free(codes); free(drop); free(meds); free(row_line); free(errors); outPrintf("<h2>Internal Error</h2><p class='error'>Out of memory.</p>"); outFlush(); return; }
+    for (int i = 0; i < rows; i++) { codes[i].code = meds[i].mcode; codes[i].row = i; }
+    qsort(codes, (size_t)rows, sizeof(StockImportCode), compareImportCode);
+    for (int i = 0; i < rows; i++) { int r = codes[i].row;
+        if (i > 0 && codes[i - 1].code == codes[i].code) { drop[r] = 1; importNoteError(&errors, &err_count, &err_cap, row_line[r], meds[r].mcode, "Code repeated earlier in the file"); }
+        else if (lookupStock(meds[r].mcode) != 0) { drop[r] = 1; importNoteError(&errors, &err_count, &err_cap, row_line[r], meds[r].mcode, "Code already in stock"); } }
+    free(codes);
+    int keep = 0; for (int i = 0; i < rows; i++) { if (!drop[i]) { meds[keep] = meds[i]; row_line[keep] = row_line[i]; keep++; } } free(drop);
+    if (atomic && err_count > 0) keep = 0;
+    // 3. One append for every accepted row, rolled back if it cannot be completed
+    int write_ok = 1;
+    if (keep > 0) { size_t cap = (size_t)keep * STOCK_CSV_ROW_MAX + 2, used = 0; char *buf = (char *)malloc(cap); FILE *fp = buf ? fopen(STOCK_FILE, "a+b") : NULL; long start = -1; int overflow = 0;
+        if (fp != NULL) { fseek(fp, 0, SEEK_END); start = ftell(fp); if (start > 0 && fseek(fp, -1, SEEK_END) == 0 && fgetc(fp) != '\n') buf[used++] = '\n'; } // Last row still open
+        for (int i = 0; fp != NULL && i < keep; i++) { int n = formatStockCsvRow(&meds[i], buf + used, cap - used); if (n < 0 || (size_t)n >= cap - used) { write_ok = 0; overflow = 1; break; } used += (size_t)n; }
+        unsigned long long t0 = metricsNow();
+        write_ok = write_ok && fp != NULL && fseek(fp, 0, SEEK_END) == 0 && fwrite(buf, 1, used, fp) == used && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+        if (overflow) { fprintf(stderr, "Import: Row buffer overflow formatting %s rows, nothing written.\n", STOCK_FILE); }
+        else if (!write_ok) { fprintf(stderr, "Import: write to %s failed: %s. Rolling back.\n", STOCK_FILE, strerror(errno)); }
+        if (!write_ok && fp != NULL && start >= 0 && ftruncate(fileno(fp), start) != 0) { fprintf(stderr, "Import: Rollback truncate failed.\n"); }
+        if (fp != NULL && fclose(fp) != 0) write_ok = 0;
+        metricsRecord(METRIC_STOCK_WRITE, t0); free(buf); recordStockFileStamp(); }
+    stockLockRange(0, 0, 0);
+    // 4. Index the new rows in one batch and report
+    int indexed = keep > 0 && write_ok ? addStockRecords(meds, keep) : 1; double secs = (metricsNow() - t_start) / 1e9;
+    if (!write_ok) { outPrintf("<h2>Import Error</h2><p class='error'>Could not write %s; nothing was imported.</p>", STOCK_FILE); }
+    else if (atomic && err_count > 0) { outPrintf("<h2>Import Rejected</h2><p class='error'>%d row(s) have problems and atomic=1 was given, so nothing was imported.</p>", err_count); }
+    else { outPrintf("<div class='success'><h2>Stock Imported</h2><p>%d row(s) added in %.1f ms (%.0f rows/sec).</p>%s</div>", keep, secs * 1e3, secs > 0 ? keep / secs : 0.0, indexed == 1 ? "" : "<p class='warning'>File saved, error live view.</p>"); }
+    logAt(LOG_INFO, "Import: %d row(s) added, %d rejected, %.1f ms.\n", write_ok ? keep : 0, err_count, secs * 1e3);
+    if (err_count > 0) {
+        qsort(errors, (size_t)err_count, sizeof(StockImportError), compareImportError);
+        outPrintf("<h3>Rejected Rows (%d)</h3><div style='overflow-x:auto;'><table class='stock-table'><thead><tr><th>Line</th><th>Code</th><th>Problem</th></tr></thead><tbody>", err_count);
+        for (int i = 0; i < err_count && i < IMPORT_MAX_ERRORS_SHOWN; i++) outPrintf("<tr><td>%d</td><td>%d</td><td>%s</td></tr>\n", errors[i].line, errors[i].code, errors[i].problem);
+        if (err_count > IMPORT_MAX_ERRORS_SHOWN) outPrintf("<tr><td colspan='3'>... and %d more.</td></tr>", err_count - IMPORT_MAX_ERRORS_SHOWN);
+        outPrintf("</tbody></table></div>"); }
+    outPrintf("<p><a href='../add_stock.html' class='btn btn-secondary'>Back</a>|<a href='medical.exe' class='btn btn-secondary'>View</a></p>"); outFlush();
+    free(meds); free(row_line); free(errors);
+}
+
+// Query string for another page of the same view: the cursor plus every filter that differs from the default
+static void stockPageLink(const StockPageQuery *q, int from_code, char *buf, size_t size) {
+    size_t n = (size_t)snprintf(buf, size, "medical.exe?from_code=%d", from_code);
+    if (q->to_code != INT_MAX && n < size) n += (size_t)snprintf(buf + n, size - n, "&amp;to_code=%d", q->to_code);
+    if (q->limit != STOCK_PAGE_ROWS && n < size) n += (size_t)snprintf(buf + n, size - n, "&amp;limit=%d", q->limit);
+    if (q->min_qty != INT_MIN && n < size) n += (size_t)snprintf(buf + n, size - n, "&amp;min_qty=%d", q->min_qty);
+    if (q->max_qty != INT_MAX && n < size) n += (size_t)snprintf(buf + n, size - n, "&amp;max_qty=%d", q->max_qty);
+    if (q->min_price != -FLT_MAX && n < size) n += (size_t)snprintf(buf + n, size - n, "&amp;min_price=%.2f", q->min_price);
+    if (q->max_price != FLT_MAX && n < size) snprintf(buf + n, size - n, "&amp;max_price=%.2f", q->max_price);
+}
+
+// Cursor-paginated stock list: seeks the code-ordered index to from_code and renders one window of rows, so the
+// page stays small and quick however large the catalogue is. Next links carry the following code as the cursor.
+void viewStock(const RequestParams *req) {
+    logAt(LOG_DEBUG, "viewStock: Called.\n");
+    StockPageQuery q = { 0, INT_MAX, STOCK_PAGE_ROWS, INT_MIN, INT_MAX, -FLT_MAX, FLT_MAX }; int bad = 0;
+    bad |= requestParamInt(req, "from_code", 0, INT_MAX, &q.from_code) < 0; bad |= requestParamInt(req, "to_code", 0, INT_MAX, &q.to_code) < 0;
+    bad |= requestParamInt(req, "limit", 1, STOCK_PAGE_MAX_ROWS, &q.limit) < 0;
+    bad |= requestParamInt(req, "min_qty", INT_MIN, INT_MAX, &q.min_qty) < 0; bad |= requestParamInt(req, "max_qty", INT_MIN, INT_MAX, &q.max_qty) < 0;
+    bad |= requestParamDouble(req, "min_price", -FLT_MAX, FLT_MAX, &q.min_price) < 0; bad |= requestParamDouble(req, "max_price", -FLT_MAX, FLT_MAX, &q.max_price) < 0;
+    if (bad) { outPrintf("<p class='warning'>Some filter values were not valid numbers (limit: 1-%d) and were ignored.</p>", STOCK_PAGE_MAX_ROWS); }
+    int filtered = q.min_qty != INT_MIN || q.max_qty != INT_MAX || q.min_price != -FLT_MAX || q.max_price != FLT_MAX, total = orderedIndexSize(globalStockIndex);
+    char v[7][24] = { "", "", "", "", "", "", "" }; // Current values for the form, blank when not given
+    if (q.from_code > 0) { snprintf(v[0], sizeof(v[0]), "%d", q.from_code); } if (q.to_code != INT_MAX) { snprintf(v[1], sizeof(v[1]), "%d", q.to_code); }
+    if (q.min_qty != INT_MIN) { snprintf(v[2], sizeof(v[2]), "%d", q.min_qty); } if (q.max_qty != INT_MAX) { snprintf(v[3], sizeof(v[3]), "%d", q.max_qty); }
+    if (q.min_price != -FLT_MAX) { snprintf(v[4], sizeof(v[4]), "%.2f", q.min_price); } if (q.max_price != FLT_MAX) { snprintf(v[5], sizeof(v[5]), "%.2f", q.max_price); } snprintf(v[6], sizeof(v[6]), "%d", q.limit);
+    outPrintf("<form method='GET' action='medical.exe' style='margin-bottom:15px;'><label>Codes <input type='number' name='from_code' min='0' value='%s' placeholder='from'></label> <label>to <input type='number' name='to_code' min='0' value='%s'></label> ", v[0], v[1]);
+    outPrintf("<label>Qty <input type='number' name='min_qty' value='%s' placeholder='min'></label> <label>to <input type='number' name='max_qty' value='%s' placeholder='max'></label> ", v[2], v[3]);
+    outPrintf("<label>Price <input type='number' step='0.01' name='min_price' value='%s' placeholder='min'></label> <label>to <input type='number' step='0.01' name='max_price' value='%s' placeholder='max'></label> ", v[4], v[5]);
+    outPrintf("<label>Rows <input type='number' name='limit' min='1' max='%d' value='%s'></label> <button type='submit' class='btn'>Show</button></form>", STOCK_PAGE_MAX_ROWS, v[6]);
+    outPrintf("<div style='overflow-x:auto;'><table class='stock-table'><thead><tr><th>Code</th><th>Name</th><th>Supplier</th><th>Contact</th><th>Price</th><th>Quantity</th><th>Expiry Date</th></tr></thead><tbody>");
+    int next = -1, shown = total > 0 ? printStockPage(globalStockIndex, &q, &next) : 0;
+    if (shown == 0) { outPrintf("<tr><td colspan='7' style='text-align:center; font-style:italic;'>%s</td></tr>", total == 0 ? "No stock." : next >= 0 ? "No matching items in this part of the stock." : "No matching items."); }
+    outPrintf("</tbody></table></div>");
+    outPrintf("<p>%d item(s) shown%s, %d in stock.", shown, filtered ? " (filtered)" : "", total);
+    if (filtered && next >= 0 && shown < q.limit) { outPrintf(" Stopped after checking %d items; Next continues from code %d.", STOCK_PAGE_SCAN_MAX, next); }
+    outPrintf("</p><p>"); char link[256];
+    if (q.from_code > 0) { stockPageLink(&q, 0, link, sizeof(link)); outPrintf("<a href='%s' class='btn'>First</a> ", link); }
+    if (next >= 0) { stockPageLink(&q, next, link, sizeof(link)); outPrintf("<a href='%s' class='btn'>Next</a>", link); }
+    outPrintf("</p>"); outFlush(); logAt(LOG_DEBUG, "viewStock: Finished (%d rows, next %d).\n", shown, next);
+}
+
+// Shared by the HTML and JSON update handlers: adds qty_change to the code's quantity (clamped at 0) under the item lock
+// and journals it. 1 done (*final_qty, *clamped and name set), 0 code not in stock, -1 internal error (nothing changed).
+int applyStockUpdate(int code, int qty_change, int *final_qty, int *clamped, char *name, size_t name_size) {
+    if (!stockLockItems(&code, 1) || !syncStockFromDisk()) { stockUnlockItems(&code, 1); fprintf(stderr, "Update abort: lock/sync failed.\n"); return -1; }
+    StockHandle h = lookupStock(code); StockItem* med_ptr = stockStoreGet(globalStockStore, h);
+    if (med_ptr == NULL) { stockUnlockItems(&code, 1); logAt(LOG_WARN, "Update Error: Code %d not found.\n", code); return 0; }
+    snprintf(name, name_size, "%s", stockStoreName(globalStockStore, h)); *final_qty = med_ptr->quantity + qty_change; *clamped = (*final_qty < 0);
+    if (*clamped) { logAt(LOG_WARN, "Warn: Update %d -> neg stock. Set 0.\n", code); *final_qty = 0; }
+    int journal_delta = *final_qty - med_ptr->quantity; // Delta actually applied (clamped at 0)
+    if (!journalAppendGroup(&code, &journal_delta, final_qty, 1)) { stockUnlockItems(&code, 1); fprintf(stderr, "Update fail: journal write err %d.\n", code); return -1; }
+    logAt(LOG_DEBUG, "Journal OK %d. Update mem.\n", code); med_ptr->quantity = *final_qty; stockUnlockItems(&code, 1); return 1;
+}
+
+// processUpdateStock remains unchanged...
+void processUpdateStock(const RequestParams *req) {
+    logAt(LOG_DEBUG, "processUpdateStock: Started.\n"); const char *code_str = requestParam(req, "medicineCode"), *qty_add_str = requestParam(req, "newQuantity");
+    char tname[40] = "N/A"; int code = 0, qty_change = 0, final_qty = 0, clamped = 0, validation_error = 0;
+    if (!code_str || strlen(code_str) == 0) { outPrintf("<p class='error'>Code needed.</p>"); validation_error = 1; } else { char *e; errno=0; long c=strtol(code_str,&e,10); if(errno!=0||*e!='\0'||c<=0||c>INT_MAX){ outPrintf("<p class='error'>Invalid Code.</p>");validation_error=1;} else code=(int)c; }
+    if (!qty_add_str || strlen(qty_add_str)==0) { outPrintf("<p class='error'>Qty needed.</p>"); validation_error=1; } else { char *e; errno=0; long q=strtol(qty_add_str,&e,10); if(errno!=0||*e!='\0'||q>INT_MAX||q<INT_MIN){ outPrintf("<p class='error'>Invalid Qty.</p>");validation_error=1;} else qty_change=(int)q; }
+    if (validation_error) { outPrintf("<p><a href='../update_stock.html' class='btn'>Back</a>|<a href='medical.exe' class='btn'>View</a></p>"); logAt(LOG_WARN, "Update validation failed.\n"); fflush(stderr); return; }
+    logAt(LOG_DEBUG, "Update Req: Code=%d, Change=%d\n", code, qty_change);
+    int updated = applyStockUpdate(code, qty_change, &final_qty, &clamped, tname, sizeof(tname));
+    if (updated < 0) { outPrintf("<div class='error'>Internal error updating stock. Stock not modified.</div><p><a href='../update_stock.html' class='btn'>Back</a>|<a href='medical.exe' class='btn'>View</a></p>"); outFlush(); return; }
+    if (updated == 0) { outPrintf("<div class='error'>Code %d not found.</div>", code); outPrintf("<p><a href='../update_stock.html' class='btn'>Back</a>|<a href='medical.exe' class='btn'>View</a></p>"); outFlush(); return; }
+    char tname_html[6 * sizeof(tname)]; htmlEscape(tname, tname_html, sizeof(tname_html));
+    if (clamped) { outPrintf("<p class='warning'>Warn: Update %s (%d) -> neg stock. Set 0.</p>", tname_html, code); }
+    outPrintf("<div class='success'><h2>Stock Updated</h2><p>%s (%d)</p><p>Change: %d</p><p>New Qty: %d</p><p><a href='../update_stock.html' class='btn'>Update Another</a>|<a href='medical.exe' class='btn'>View</a></p></div>", tname_html, code, qty_change, final_qty);
+    outFlush(); logAt(LOG_DEBUG, "processUpdateStock: Finished.\n"); fflush(stderr);
+}
+
+// Group commit: all rows of a bill (any number of records, from one invoice or several) are formatted into one
+// buffer and appended with a single write + fsync, so SALES_FILE never holds part of a bill. A failed write is
+// rolled back by truncating to the old end. The rows then go into the sales index in one append.
+static int saveSaleRecordsLocked(const struct sale_record *sales, int count);
+
+int saveSaleRecords(const struct sale_record *sales, int count) {
+    if (count <= 0) return 1;
+    if (!stockLockRange(STOCK_LOCK_SALES_BYTE, 1, 1)) return 0; // One sales writer at a time: the rollback and the index append assume our rows are the last ones
+    int ok = saveSaleRecordsLocked(sales, count); stockLockRange(STOCK_LOCK_SALES_BYTE, 1, 0); return ok;
+}
+
+static int saveSaleRecordsLocked(const struct sale_record *sales, int count) {
+    int indexed = refreshSalesIndex(); if (!indexed) { logAt(LOG_WARN, "Warn: Sales index unavailable, %s will be re-indexed later.\n", SALES_INDEX_FILE); }
+    FILE *fp = fopen(SALES_FILE, "a+b"); if (fp == NULL) { fprintf(stderr, "Err opening sales %s: %s\n", SALES_FILE, strerror(errno)); return 0; } // a+: the newline check below reads
+    fseek(fp, 0, SEEK_END); long size = ftell(fp); int need_newline = 0;
+    if (size > 0) { fseek(fp, -1, SEEK_END); need_newline = (fgetc(fp) != '\n'); fseek(fp, 0, SEEK_END); } // Ensure newline before appending data
+    size_t cap = (size_t)count * 256 + 128, len = 0; char *buf = (char *)malloc(cap); long long *row_off = (long long *)malloc(sizeof(long long) * (size_t)count);
+    if (buf == NULL || row_off == NULL) { fprintf(stderr, "saveSaleRecords: Mem alloc failed.\n"); free(buf); free(row_off); fclose(fp); return 0; }
+    if (size == 0) { len += (size_t)snprintf(buf + len, cap - len, "InvoiceID,Date,Time,CustomerName,MedicineCode,MedicineName,Quantity,PricePerItem,TotalCost\n"); } // Write header with InvoiceID
+    else if (need_newline) { buf[len++] = '\n'; }
+    for (int i = 0; i < count; i++) { const struct sale_record *sale = &sales[i]; row_off[i] = (long long)size + (long long)len;
+        // Using "%s" for invoice ID assumes it doesn't contain quotes or commas (true for timestamp-pid IDs)
+        len += (size_t)snprintf(buf + len, cap - len, "\"%s\",%s,%s,\"%s\",%d,\"%s\",%d,%.2f,%lld.%02lld\n", // Total from total_paise, so the text matches the index
+                                sale->invoice_id, sale->date_str, sale->time_str, sale->customer_name,
+                                sale->medicine_code, sale->medicine_name, sale->quantity,
+                                sale->price_per_item, sale->total_paise / 100, sale->total_paise % 100);
+        if (len >= cap) { fprintf(stderr, "saveSaleRecords: Row buffer overflow.\n"); free(buf); free(row_off); fclose(fp); return 0; } }
+    int ok = (fwrite(buf, 1, len, fp) == len) && (fflush(fp) == 0) && (fsync(fileno(fp)) == 0); // One write + one fsync per group
+    if (!ok) { fprintf(stderr, "saveSaleRecords: Write/fsync to %s failed: %s. Rolling back.\n", SALES_FILE, strerror(errno)); if (ftruncate(fileno(fp), size) != 0) { fprintf(stderr, "saveSaleRecords: Rollback truncate failed.\n"); } }
+    fclose(fp); free(buf);
+    if (!ok) { free(row_off); return 0; }
+    // Only extend the index when nothing but our header/newline lies between its end and these rows; otherwise the next refresh picks them up
+    if (indexed && globalSales.hdr.sales_bytes == (long long)size) {
+        int added = 0; while (added < count && salesIndexAddRow(&globalSales, &sales[added], row_off[added])) added++;
+        if (added == count) { globalSales.hdr.sales_bytes = (long long)size + (long long)len; appendSalesIndexFile(&globalSales, added); }
+        else { freeSalesIndex(); } } // Out of memory midway: drop it, the next refresh rebuilds from SALES_FILE
+    free(row_off);
+    logAt(LOG_DEBUG, "Sales saved: %d rows, Inv# %s, Cust %s\n", count, sales[0].invoice_id, sales[0].customer_name); return 1;
+}
+
+int saveSaleRecord(const struct sale_record *sale) { return saveSaleRecords(sale, 1); }
+
+
+// Shared by the HTML and JSON billing handlers, given parsed items (code and quantity_requested set): locks the
+// items, validates stock, journals the whole bill as one group, updates memory, then saves the sales rows under a
+// new invoice ID. 1 billed (items filled in, *sales_saved 0 if only the sales write failed), 0 stock validation
+// failed (error_msg set on the failing items, nothing changed), -1 internal error (nothing changed).
+int commitBill(const char *cust_name, struct bill_item_request *req_items, int n_items, char *invoice_id, size_t id_size, int *sales_saved) {
+    int lock_codes[MAX_BILL_ITEMS], valid = 1; *sales_saved = 0; if (n_items <= 0 || n_items > MAX_BILL_ITEMS) return -1;
+    for (int i = 0; i < n_items; i++) { lock_codes[i] = req_items[i].code; }
+    if (!stockLockItems(lock_codes, n_items) || !syncStockFromDisk()) { stockUnlockItems(lock_codes, n_items); fprintf(stderr, "Billing abort: lock/sync failed.\n"); return -1; }
+    for (int i = 0; i < n_items; i++) { StockHandle h = lookupStock(req_items[i].code); StockItem* med = stockStoreGet(globalStockStore, h);
+        if (med == NULL) { req_items[i].found_in_stock = 0; snprintf(req_items[i].error_msg, 100, "Code %d not found.", req_items[i].code); logAt(LOG_WARN, " [FAIL] Code %d: Not found hash.\n", req_items[i].code); valid = 0; }
+        else { req_items[i].found_in_stock = 1; req_items[i].stock_data_ptr = med; strncpy(req_items[i].name, stockStoreName(globalStockStore, h), 39); req_items[i].name[39] = '\0'; req_items[i].price_per_item = med->price_paise / 100.0f; req_items[i].original_stock_qty = med->quantity;
+            if (med->quantity >= req_items[i].quantity_requested) { req_items[i].sufficient_stock = 1; req_items[i].new_stock_qty = med->quantity - req_items[i].quantity_requested; logAt(LOG_DEBUG, " [OK] C%d (%s): Stock %d >= Req %d. New %d\n", req_items[i].code, req_items[i].name, med->quantity, req_items[i].quantity_requested, req_items[i].new_stock_qty); }
+            else { req_items[i].sufficient_stock = 0; req_items[i].new_stock_qty = med->quantity; snprintf(req_items[i].error_msg, 100, "Insufficient '%s' (C%d). Has: %d, Req: %d.", req_items[i].name, req_items[i].code, med->quantity, req_items[i].quantity_requested); logAt(LOG_WARN, " [FAIL] C%d (%s): Insufficient. Has %d, needs %d.\n", req_items[i].code, req_items[i].name, med->quantity, req_items[i].quantity_requested); valid = 0; } }
+        req_items[i].stock_validation_done = 1; }
+    if (!valid) { stockUnlockItems(lock_codes, n_items); logAt(LOG_WARN, "Billing abort: stock validation.\n"); return 0; }
+    logAt(LOG_DEBUG, "All validated. Journal stock changes.\n");
+    // --- Stock Journal Commit (one fsync'd group for the whole bill) ---
+    int j_codes[MAX_BILL_ITEMS], j_deltas[MAX_BILL_ITEMS], j_qtys[MAX_BILL_ITEMS];
+    for (int i = 0; i < n_items; i++) { j_codes[i] = req_items[i].code; j_deltas[i] = -req_items[i].quantity_requested; j_qtys[i] = req_items[i].new_stock_qty; }
+    if (!journalAppendGroup(j_codes, j_deltas, j_qtys, n_items)) { stockUnlockItems(lock_codes, n_items); fprintf(stderr, "Billing fail: journal write err. Stock NOT updated.\n"); return -1; }
+    logAt(LOG_DEBUG, "Stock journal updated OK bill.\n");
+
+    // --- Stock Update Successful: Update Memory and Save Sales ---
+    logAt(LOG_DEBUG, "Updating memory...\n"); for (int i = 0; i < n_items; i++) { req_items[i].stock_data_ptr->quantity = req_items[i].new_stock_qty; } // One record per item, shared by both indexes
+    stockUnlockItems(lock_codes, n_items); // Committed: other bills for these items may go ahead
+
+    // Generate Invoice ID (Timestamp + Process ID + per-process sequence: --serve bills many times a second from one process)
+    static unsigned int invoice_seq = 0; // Only the request thread bills, so no atomics needed
+    long current_time_secs = (long)time(NULL);
+    pid_t current_pid = getpid();
+    snprintf(invoice_id, id_size, "%ld-%d-%u", current_time_secs, (int)current_pid, ++invoice_seq); // <= 10+1+7+1+10 chars, fits invoice_id[30]
+    logAt(LOG_DEBUG, "Generated Invoice ID: %s\n", invoice_id);
+
+    // Save Sales Records (one group commit for the whole invoice)
+    logAt(LOG_DEBUG, "Saving sales records...\n"); struct sale_record bill_sales[MAX_BILL_ITEMS]; time_t t = time(NULL); struct tm tm = *localtime(&t); char date_s[11], time_s[9]; strftime(date_s, 11, "%Y-%m-%d", &tm); strftime(time_s, 9, "%H:%M:%S", &tm);
+
+    for (int i = 0; i < n_items; i++) {
+        struct sale_record sale; memset(&sale, 0, sizeof(sale));
+        snprintf(sale.invoice_id, sizeof(sale.invoice_id), "%s", invoice_id); // Set the invoice ID for this sale item
+        strcpy(sale.date_str, date_s);
+        strcpy(sale.time_str, time_s);
+        strncpy(sale.customer_name, cust_name, 49); sale.customer_name[49]='\0';
+        sale.medicine_code = req_items[i].code;
+        strncpy(sale.medicine_name, req_items[i].name, 39); sale.medicine_name[39]='\0';
+        sale.quantity = req_items[i].quantity_requested;
+        sale.price_per_item = req_items[i].price_per_item;
+        sale.total_paise = (long long)req_items[i].stock_data_ptr->price_paise * sale.quantity; sale.total_cost = (float)(sale.total_paise / 100.0);
+        bill_sales[i] = sale;
+    }
+    unsigned long long t0 = metricsNow(); *sales_saved = saveSaleRecords(bill_sales, n_items); metricsRecord(METRIC_SALES_APPEND, t0);
+    if (!*sales_saved) logAt(LOG_WARN, "Warn: Fail save sales for Inv# %s.\n", invoice_id); else logAt(LOG_DEBUG, "All %d sales saved.\n", n_items);
+    return 1;
+}
+
+// Modified processBillingMultiple to generate, display, and save Invoice ID
+void processBillingMultiple(const RequestParams *req) {
+    logAt(LOG_DEBUG, "processBillingMultiple: Started.\n"); const char *cust_raw = NULL, *code_s[MAX_BILL_ITEMS] = {NULL}, *qty_s[MAX_BILL_ITEMS] = {NULL}; struct bill_item_request req_items[MAX_BILL_ITEMS]; char cust_name[50] = "";
+    int n_codes = 0, n_qtys = 0, n_items = 0, err = 0, valid = 1, sales_saved = 0; double grand_total = 0.0;
+    // Invoice ID generation variable
+    char generated_invoice_id[30] = "";
+
+    cust_raw = requestParam(req, "customerName"); if (!cust_raw || strlen(cust_raw) == 0) { outPrintf("<p class='error'>Customer Name needed.</p>"); err = 1; } else { strncpy(cust_name, cust_raw, 49); cust_name[49] = '\0'; for (int i = 0; cust_name[i]; i++) { if (strchr("<>\"", cust_name[i])) { outPrintf("<p class='error'>Invalid chars in Name.</p>"); err = 1; break; } } }
+    n_codes = requestParamValues(req, "medicineCode[]", code_s, MAX_BILL_ITEMS); n_qtys = requestParamValues(req, "quantity[]", qty_s, MAX_BILL_ITEMS);
+    logAt(LOG_DEBUG, "Parsed %d codes, %d qtys.\n", n_codes, n_qtys);
+    if (n_codes <= 0 || n_qtys <= 0) { outPrintf("<p class='error'>No items.</p>"); err = 1; } else if (n_codes != n_qtys) { outPrintf("<p class='error'>Code/Qty mismatch.</p>"); err = 1; } else if (n_codes > MAX_BILL_ITEMS) { outPrintf("<p class='error'>Too many items (max %d per bill).</p>", MAX_BILL_ITEMS); err = 1; }
+    else { n_items = n_codes;
+        for (int i = 0; i < n_items; i++) { memset(&req_items[i], 0, sizeof(req_items[0])); strcpy(req_items[i].error_msg, ""); long c_val = 0, q_val = 0; char *e_c, *e_q; errno = 0;
+            if (!code_s[i] || strlen(code_s[i])==0) { snprintf(req_items[i].error_msg, 100, "Item %d: No Code.", i+1); valid=0; } else { c_val=strtol(code_s[i],&e_c,10); if(errno!=0||*e_c!='\0'||c_val<=0||c_val>INT_MAX){ snprintf(req_items[i].error_msg, 100, "Item %d: Bad Code '%s'.", i+1, code_s[i]); valid=0;} else req_items[i].code=(int)c_val; }
+            if (!qty_s[i] || strlen(qty_s[i])==0) { snprintf(req_items[i].error_msg, 100, "Item %d (C%d): No Qty.", i+1, req_items[i].code); valid=0; } else { q_val=strtol(qty_s[i],&e_q,10); if(errno!=0||*e_q!='\0'||q_val<=0||q_val>INT_MAX){ snprintf(req_items[i].error_msg, 100, "Item %d (C%d): Bad Qty '%s'.", i+1, req_items[i].code, qty_s[i]); valid=0;} else req_items[i].quantity_requested=(int)q_val; } } }
+    if (err || !valid) { outPrintf("<h3>Billing Errors</h3>"); for (int i = 0; i < n_items; i++) { if (strlen(req_items[i].error_msg) > 0) { outPrintf("<p class='error'>"); outHtml(req_items[i].error_msg); outPrintf("</p>"); } } outPrintf("<p><a href='../billing.html' class='btn'>Back</a></p>"); outFlush(); logAt(LOG_WARN, "Billing abort: input validation.\n"); return; }
+    logAt(LOG_DEBUG, "Input OK %d items for '%s'. Lock items, validate stock hash.\n", n_items, cust_name);
+    int billed = commitBill(cust_name, req_items, n_items, generated_invoice_id, sizeof(generated_invoice_id), &sales_saved);
+    if (billed < 0) { outPrintf("<p class='error'>Internal error updating stock. Aborted.</p><p><a href='../billing.html' class='btn'>Back</a></p>"); outFlush(); return; }
+    if (billed == 0) { outPrintf("<h3>Billing Errors</h3>"); for (int i = 0; i < n_items; i++) { if (strlen(req_items[i].error_msg) > 0) { outPrintf("<p class='error'>"); outHtml(req_items[i].error_msg); outPrintf("</p>"); } } outPrintf("<p><a href='../billing.html' class='btn'>Back</a></p>"); outFlush(); return; }
+
+    // --- Generate HTML Bill Output ---
+    outPrintf("<div class='bill-details'>");
+    outPrintf("<h3>Bill Generated</h3>");
+    outPrintf("<p><strong>Invoice ID:</strong> %s</p>", generated_invoice_id); // Display Invoice ID
+    time_t t_now = time(NULL); struct tm tm_now = *localtime(&t_now); outPrintf("<p><strong>Date:</strong> %04d-%02d-%02d %02d:%02d:%02d</p>", tm_now.tm_year + 1900, tm_now.tm_mon + 1, tm_now.tm_mday, tm_now.tm_hour, tm_now.tm_min, tm_now.tm_sec);
+    char esc[6 * sizeof(cust_name)]; outPrintf("<p><strong>Customer:</strong> %s</p>", htmlEscape(cust_name, esc, sizeof(esc)));
+    outPrintf("<hr style='border-top: 1px dashed var(--accent); margin: 10px 0;'>");
+    outPrintf("<table style='width:100%%;margin-top:15px;border-collapse:collapse;font-size:0.95rem;'>");
+    outPrintf("<thead><tr style='background-color:var(--secondary);color:white;'><th style='padding:8px;text-align:left;'>Item</th><th style='padding:8px;text-align:right;'>Code</th><th style='padding:8px;text-align:right;'>Qty</th><th style='padding:8px;text-align:right;'>Price</th><th style='padding:8px;text-align:right;'>Total</th></tr></thead><tbody>");
+    grand_total = 0.0;
+    for (int i = 0; i < n_items; i++) {
+        float line_total = req_items[i].price_per_item * req_items[i].quantity_requested; grand_total += line_total;
+        outPrintf("<tr><td style='padding:8px;border-bottom:1px dotted var(--accent);'>%s</td><td style='padding:8px;text-align:right;border-bottom:1px dotted var(--accent);'>%d</td><td style='padding:8px;text-align:right;border-bottom:1px dotted var(--accent);'>%d</td><td style='padding:8px;text-align:right;border-bottom:1px dotted var(--accent);'>₹%.2f</td><td style='padding:8px;text-align:right;border-bottom:1px dotted var(--accent);'>₹%.2f</td></tr>", htmlEscape(req_items[i].name, esc, sizeof(esc)), req_items[i].code, req_items[i].quantity_requested, req_items[i].price_per_item, line_total);
+    }
+    outPrintf("</tbody></table>");
+    outPrintf("<p class='bill-total' style='margin-top:20px;padding-top:15px;border-top:1px solid var(--accent);text-align:right;'><strong>Grand Total: ₹%.2f</strong></p>", grand_total);
+    outPrintf("<p style='font-size:0.9em;color:var(--status-active-text);'><i class='bi bi-check-circle-fill'></i> Stock file updated.</p>");
+    if (sales_saved) { outPrintf("<p style='font-size:0.9em;color:var(--status-active-text);'><i class='bi bi-journal-check'></i> Sales recorded.</p>"); } else { outPrintf("<p class='error' style='font-size:0.9em;'><i class='bi bi-exclamation-triangle-fill'></i> Warn: Sales record save failed.</p>"); }
+    outPrintf("</div>");
+    outPrintf("<p style='margin-top: 20px; text-align:center;'><a href='../billing.html' class='btn btn-primary'>Generate Another Bill</a></p>");
+
+    outFlush(); logAt(LOG_DEBUG, "processBillingMultiple: Finished.\n"); fflush(stderr);
+}
+
+
+// Modified checkExpiry: window from the 'days' parameter, rows from an expiry-index range scan
+void checkExpiry(const RequestParams *req) {
+    logAt(LOG_DEBUG, "checkExpiry: Started.\n"); time_t now_t = time(NULL); struct tm now_tm = *localtime(&now_t); long today = daysFromCivil(now_tm.tm_year + 1900, now_tm.tm_mon + 1, now_tm.tm_mday);
+    int warn_days = EXPIRY_DEFAULT_DAYS; const char *days_str = requestParam(req, "days");
+    if (days_str) { char *e; errno = 0; long d = strtol(days_str, &e, 10); if (errno == 0 && e != days_str && *e == '\0' && d >= 0 && d <= EXPIRY_MAX_DAYS) { warn_days = (int)d; } else { outPrintf("<p class='warning'>Invalid days value, showing %d days.</p>", warn_days); } }
+    outPrintf("<h2>Stock Expiry Status</h2><p>Showing expired or expiring within %d days.</p>", warn_days);
+    outPrintf("<form method='GET' action='medical.exe' style='margin-bottom:15px;'><input type='hidden' name='action' value='check_expiry'><label>Days: <input type='number' name='days' min='0' max='%d' value='%d'></label> <button type='submit' class='btn'>Check</button></form>", EXPIRY_MAX_DAYS, warn_days);
+    outPrintf("<div class='table-container-box'><table class='expiry-table'><thead><tr><th>Name</th><th>Code</th><th>Expiry</th><th style='text-align: center;'>Status</th></tr></thead><tbody>");
+    int found = 0; if (orderedIndexSize(globalExpiryIndex) == 0) { logAt(LOG_DEBUG, "checkExpiry: Stock empty.\n"); } else { printExpiringStock(globalExpiryIndex, today, warn_days, &found); }
+    if (found == 0) { outPrintf("<tr><td colspan='4' style='text-align:center; font-style:italic;'>No items expired or expiring soon.</td></tr>"); }
+    outPrintf("</tbody></table></div>"); logAt(LOG_DEBUG, "checkExpiry: Finished (%d rows).\n", found); outFlush();
+}
+
+// Date-range section of the report: a from/to form, quick links, and (when a range is given) totals, a daily
+// breakdown and per-medicine totals answered from the daily rollups.
+static void printSalesRange(SalesIndex *si, const RequestParams *req) {
+    time_t now_t = time(NULL); struct tm now_tm = *localtime(&now_t); int today = (int)daysFromCivil(now_tm.tm_year + 1900, now_tm.tm_mon + 1, now_tm.tm_mday);
+    int y, m, d;
+    const char *from_str = requestParam(req, "from"), *to_str = requestParam(req, "to");
+    int from_day = (from_str && *from_str) ? salesDayFromDate(from_str) : SALES_DAY_NONE + 1, to_day = (to_str && *to_str) ? salesDayFromDate(to_str) : INT_MAX;
+    int have_range = (from_str && *from_str) || (to_str && *to_str), bad = (from_day == SALES_DAY_NONE || to_day == SALES_DAY_NONE);
+    outPrintf("<div class='table-container-box' style='margin-bottom: 30px;'><h2>Sales by Date</h2>");
+    outPrintf("<form method='GET' action='medical.exe' style='margin-bottom:15px;'><input type='hidden' name='action' value='generate_report'><label>From: <input type='date' name='from' value='%s'></label> <label>To: <input type='date' name='to' value='%s'></label> <button type='submit' class='btn'>Show</button></form>",
+           (from_str && !bad) ? from_str : "", (to_str && !bad) ? to_str : "");
+    civilFromDays(today, &y, &m, &d); outPrintf("<p><a href='medical.exe?action=generate_report&amp;from=%04d-%02d-%02d&amp;to=%04d-%02d-%02d' class='btn'>Today</a> ", y, m, d, y, m, d);
+    outPrintf("<a href='medical.exe?action=generate_report&amp;from=%04d-%02d-01&amp;to=%04d-%02d-%02d' class='btn'>This month</a> ", y, m, y, m, d);
+    civilFromDays(today - 29, &y, &m, &d); outPrintf("<a href='medical.exe?action=generate_report&amp;from=%04d-%02d-%02d' class='btn'>Last 30 days</a></p>", y, m, d);
+    if (bad) { outPrintf("<p class='error'>Dates must be YYYY-MM-DD.</p></div>"); return; }
+    if (!have_range) { outPrintf("</div>"); return; }
+    if (from_day > to_day) { outPrintf("<p class='error'>'From' date is after 'To' date.</p></div>"); return; }
+
+    SalesDay totals; SalesRollupItem *items = NULL; int n = querySalesRange(si, from_day, to_day, &totals, &items);
+    if (n < 0) { fprintf(stderr, "printSalesRange: Rollup query failed.\n"); outPrintf("<p class='error'>Could not summarise sales for this range.</p></div>"); return; }
+    if (totals.item_count == 0) { outPrintf("<p>No sales in this period.</p></div>"); free(items); return; }
+    outPrintf("<ul><li><strong>Invoices:</strong> %lld</li><li><strong>Items Sold:</strong> %lld</li><li><strong>Sales Value:</strong> ₹%.2f</li></ul>", totals.invoices, totals.units, totals.revenue_paise / 100.0);
+    outPrintf("<table class='stock-table'><thead><tr><th>Date</th><th style='text-align:right;'>Invoices</th><th style='text-align:right;'>Items</th><th style='text-align:right;'>Sales Value</th></tr></thead><tbody>");
+    int lo = 0, hi = si->day_count; while (lo < hi) { int mid = lo + (hi - lo) / 2; if (si->days[mid].day < from_day) lo = mid + 1; else hi = mid; }
+    for (int i = lo; i < si->day_count && si->days[i].day <= to_day; i++) { const SalesDay *day = &si->days[i]; civilFromDays(day->day, &y, &m, &d);
+        outPrintf("<tr><td>%04d-%02d-%02d</td><td style='text-align:right;'>%lld</td><td style='text-align:right;'>%lld</td><td style='text-align:right;'>₹%.2f</td></tr>\n", y, m, d, day->invoices, day->units, day->revenue_paise / 100.0); }
+    outPrintf("</tbody></table><h3>By Medicine</h3><table class='stock-table'><thead><tr><th>Med Code</th><th>Med Name</th><th style='text-align:right;'>Qty</th><th style='text-align:right;'>Sales Value</th></tr></thead><tbody>");
+    for (int i = 0; i < n; i++) { StockHandle h = hashTableFind(globalHashTable, items[i].mcode);
+        outPrintf("<tr><td>%d</td><td>", items[i].mcode); outHtml(h ? stockStoreName(globalStockStore, h) : "-"); outPrintf("</td><td style='text-align:right;'>%lld</td><td style='text-align:right;'>₹%.2f</td></tr>\n", items[i].units, items[i].revenue_paise / 100.0); }
+    outPrintf("</tbody></table></div>"); free(items);
+}
+
+// Modified generateReport to include Invoice ID. The summary comes from the sales index totals; the detail table
+// shows one page of SALES_REPORT_PAGE_ROWS rows, read by seeking to the indexed offsets.
+void generateReport(const RequestParams *req) {
+    logAt(LOG_DEBUG, "generateReport (Detailed Table with Invoice ID): Called.\n");
+    int refreshed = stockLockRange(STOCK_LOCK_SALES_BYTE, 1, 1) && refreshSalesIndex(); stockLockRange(STOCK_LOCK_SALES_BYTE, 1, 0); // Refresh may rewrite SALES_INDEX_FILE
+    if (!refreshed) { outPrintf("<h2>Error Generating Report</h2><p class='error'>Could not read sales history (%s). %s</p>", SALES_FILE, strerror(errno)); outFlush(); return; }
+    SalesIndex *si = &globalSales;
+    if (si->hdr.rows == 0) { FILE *probe = fopen(SALES_FILE, "r"); if (probe == NULL) { logAt(LOG_DEBUG, "Sales file %s not found.\n", SALES_FILE); outPrintf("<h2>Sales Report</h2><div class='report-summary'><p>No sales have been recorded yet.</p></div>"); outFlush(); return; } fclose(probe); }
+
+    long long pages = (si->hdr.rows + SALES_REPORT_PAGE_ROWS - 1) / SALES_REPORT_PAGE_ROWS, page = pages; // Newest rows by default
+    const char *page_str = requestParam(req, "page");
+    if (page_str) { char *e; errno = 0; long long v = strtoll(page_str, &e, 10); if (errno == 0 && *e == '\0' && v >= 1) { page = v < pages ? v : pages; } else { logAt(LOG_WARN, "generateReport: Ignoring bad page '%s'.\n", page_str); } }
+    if (page < 1) page = 1;
+    long long first = (page - 1) * SALES_REPORT_PAGE_ROWS, last = first + SALES_REPORT_PAGE_ROWS; if (last > si->hdr.rows) last = si->hdr.rows;
+
+    outPrintf("<h2>Sales Report</h2>");
+    printSalesRange(si, req);
+
+    // --- Detailed Sales Table ---
+    outPrintf("<div class='table-container-box' style='margin-bottom: 30px;'>"); // Add margin below table
+    outPrintf("<h2>Detailed Sales History</h2>");
+    if (pages > 1) { outPrintf("<p>Rows %lld-%lld of %lld (page %lld of %lld)</p>", first + 1, last, si->hdr.rows, page, pages); }
+    outPrintf("<table class='stock-table'><thead>"); // Use stock-table style for consistency
+    // Added Invoice ID column header
+    outPrintf("<tr><th>Invoice ID</th><th>Date</th><th>Time</th><th>Customer</th><th>Med Code</th><th>Med Name</th><th style='text-align:right;'>Qty</th><th style='text-align:right;'>Price/Item</th><th style='text-align:right;'>Total Cost</th></tr>");
+    outPrintf("</thead><tbody>");
+
+    int data_found = 0, read_error = 0; char line[512]; struct sale_record current_sale;
+    FILE *fp = (first < last) ? fopen(SALES_FILE, "rb") : NULL;
+    if (first < last && fp == NULL) { fprintf(stderr, "Error opening sales file %s: %s\n", SALES_FILE, strerror(errno)); read_error = 1; }
+    for (long long i = first; fp != NULL && i < last; i++) {
+        if (fseek(fp, (long)si->col.offset[i], SEEK_SET) != 0 || fgets(line, sizeof(line), fp) == NULL) { read_error = 1; break; }
+        line[strcspn(line, "\r\n")] = 0;
+        if (!parseSaleLine(line, &current_sale)) { logAt(LOG_WARN, "generateReport: Indexed row %lld no longer parses, skipping.\n", i); continue; }
+        data_found = 1;
+
+        // Print the table row including Invoice ID (text fields come from the CSV, so they are escaped)
+        outPrintf("<tr><td>"); outHtml(current_sale.invoice_id); outPrintf("</td><td>"); outHtml(current_sale.date_str); outPrintf("</td><td>"); outHtml(current_sale.time_str);
+        outPrintf("</td><td>"); outHtml(current_sale.customer_name); outPrintf("</td><td>%d</td><td>", current_sale.medicine_code); outHtml(current_sale.medicine_name);
+        outPrintf("</td><td style='text-align:right;'>%d</td><td style='text-align:right;'>₹%.2f</td><td style='text-align:right;'>₹%.2f</td></tr>\n", // Added Rupee Symbol
+                  current_sale.quantity, current_sale.price_per_item, current_sale.total_cost);
+    }
+    if (fp != NULL) fclose(fp);
+
+    if (read_error) {
+        fprintf(stderr, "generateReport: Error reading %s: %s\n", SALES_FILE, strerror(errno));
+        outPrintf("<tr><td colspan='9' class='error'>Error reading sales data. Report may be incomplete.</td></tr>"); // Increased colspan
+    }
+    if (!data_found && !read_error) {
+        outPrintf("<tr><td colspan='9' style='text-align:center; font-style:italic;'>No sales data found in the file.</td></tr>"); // Increased colspan
+    }
+    outPrintf("</tbody></table>");
+    if (pages > 1) {
+        outPrintf("<p>");
+        char range[160] = "", enc[64]; const char *from_str = requestParam(req, "from"), *to_str = requestParam(req, "to"); size_t rn = 0; // Keep the summary's range while paging (&amp;: it goes into href)
+        if (from_str && *from_str) { rn = (size_t)snprintf(range, sizeof(range), "&amp;from=%s", urlEncode(from_str, enc, sizeof(enc))); }
+        if (to_str && *to_str && rn < sizeof(range)) { snprintf(range + rn, sizeof(range) - rn, "&amp;to=%s", urlEncode(to_str, enc, sizeof(enc))); }
+        if (page > 1) { outPrintf("<a href='medical.exe?action=generate_report&amp;page=1%s' class='btn'>First</a> <a href='medical.exe?action=generate_report&amp;page=%lld%s' class='btn'>Previous</a> ", range, page - 1, range); }
+        if (page < pages) { outPrintf("<a href='medical.exe?action=generate_report&amp;page=%lld%s' class='btn'>Next</a> <a href='medical.exe?action=generate_report&amp;page=%lld%s' class='btn'>Latest</a>", page + 1, range, pages, range); }
+        outPrintf("</p>");
+    }
+    outPrintf("</div>"); // Close table container box
+
+    // --- Summary Section (running totals kept by the sales index) ---
+    outPrintf("<div class='report-summary'>");
+    outPrintf("<h2>Sales Summary</h2>");
+    if (si->hdr.transactions > 0) {
+        outPrintf("<ul>");
+        outPrintf("<li><strong>Total Unique Invoices (Transactions):</strong> %lld</li>", si->hdr.transactions); // Clarified meaning
+        outPrintf("<li><strong>Total Individual Items Sold:</strong> %lld</li>", si->hdr.items_sold);
+        outPrintf("<li><strong>Total Sales Value:</strong> ₹%.2f</li>", si->hdr.total_paise / 100.0); // Added Rupee Symbol
+        outPrintf("</ul>");
+    } else {
+        outPrintf("<p>No valid sales transactions found to summarize.</p>");
+    }
+    outPrintf("</div>"); // Close report-summary
+
+    logAt(LOG_DEBUG, "generateReport: Finished (page %lld of %lld).\n", page, pages);
+    outFlush();
+}
+
+
+// A whole positive number is a code; anything else a name, matched as a prefix with searchMode=prefix or a trailing '*' ("para*")
+int parseSearchQuery(const RequestParams *req, const char *query, char *name_query, size_t size, int *prefix) {
+    char *e; errno = 0; long pcode = strtol(query, &e, 10); int is_num = (errno==0 && e!=query && pcode>=INT_MIN && pcode<=INT_MAX); while (is_num && isspace((unsigned char)*e)) e++;
+    if (is_num && *e=='\0' && pcode>0) { logAt(LOG_DEBUG, "Search: Code query %ld\n", pcode); return (int)pcode; }
+    logAt(LOG_DEBUG, "Search: Name query '%s'\n", query);
+    const char *mode = requestParam(req, "searchMode"); *prefix = (mode != NULL && strcmp(mode, "prefix") == 0);
+    size_t qlen = strlen(query); snprintf(name_query, size, "%s", query); if (qlen > 1 && qlen < size && name_query[qlen - 1] == '*') { name_query[qlen - 1] = '\0'; *prefix = 1; }
+    return 0;
+}
+
+// Modified searchMedicine to add Rupee symbol
+void searchMedicine(const RequestParams *req) {
+    logAt(LOG_DEBUG, "searchMedicine: Started.\n"); const char *query = requestParam(req, "searchQuery"); int matches = 0;
+    if (!query || strlen(query) == 0) { outPrintf("<p class='error'>No search term.</p><p><a href=\"medical.exe\" class='btn'>View All</a></p>"); outFlush(); return; }
+    char name_query[64]; int prefix = 0, code = parseSearchQuery(req, query, name_query, sizeof(name_query), &prefix), is_code = (code > 0);
+    outPrintf("<div style='overflow-x:auto;'><table class='stock-table'><thead><tr><th>Code</th><th>Name</th><th>Supplier</th><th>Contact</th><th>Price</th><th>Quantity</th><th>Expiry Date</th></tr></thead><tbody>");
+    if (is_code) { logAt(LOG_DEBUG, "Search hash code %d\n", code); StockHandle h = lookupStock(code);
+        if (h != 0) { matches=1;
+            // Added Rupee symbol below
+            outStockRow(globalStockStore, h); }
+        else { logAt(LOG_DEBUG, "Code %d not found hash.\n", code); } }
+    else { logAt(LOG_DEBUG, "Search name '%s' (%s)\n", name_query, prefix ? "prefix" : "substring"); if (orderedIndexSize(globalStockIndex) == 0) { logAt(LOG_DEBUG, "Stock empty, cannot search name.\n"); }
+           else { searchStockByName(name_query, prefix, &matches); } // Trigram index; prints with Rupee symbol
+    }
+    if (matches == 0) { outPrintf("<tr><td colspan='7' style='text-align:center; font-style:italic;'>No match found for '"); outHtml(query); outPrintf("'.</td></tr>"); }
+    outPrintf("</tbody></table></div>"); outPrintf("<p style=\"margin-top: 20px; text-align:center;\"><a href=\"medical.exe\" class=\"btn btn-secondary\">View All Stock</a></p>"); outFlush();
+    logAt(LOG_DEBUG, "searchMedicine: Finished.\n"); fflush(stderr);
+}
+
+
+// --- JSON API ---
+// Compact answers for POS terminals and barcode scanners: one object per response with no page shell, selected by
+// format=json or an Accept header naming application/json (format=html keeps the page). action=lookup only exists
+// here. Failures are {"ok":false,"error":"..."} with a 4xx/5xx status; stock validation failures of a bill are 409.
+//   action=lookup&code=101,102[&code=...]      GET/POST: batch lookup, up to JSON_LOOKUP_MAX_CODES codes, in request order
+//   actionType=searchStock&searchQuery=...     code, name substring or "name*" prefix, as on the search page
+//   action=billing (POST)                      customerName and items=101:3,104:5 (or the form's medicineCode[]/quantity[])
+//   action=update_stock (POST)                 medicineCode and newQuantity (the change), as on the form
+//   action=check_expiry[&days=N] (GET)         expired and expiring rows in expiry order
+
+int requestWantsJson(const RequestParams *req) {
+    const char *format = requestParam(req, "format"); if (format != NULL) return strcmp(format, "json") == 0;
+    return requestAccept != NULL && stristr(requestAccept, "application/json") != NULL;
+}
+
+void outJsonString(const char *text) {
+    outWrite("\"", 1);
+    while (text && *text) { const char *run = text; while (*text && *text != '"' && *text != '\\' && (unsigned char)*text >= 0x20) text++;
+        outWrite(run, (size_t)(text - run));
+        if (*text == '"' || *text == '\\') { outPrintf("\\%c", *text++); } else if (*text) { outPrintf("\\u%04x", (unsigned char)*text++); } }
+    outWrite("\"", 1);
+}
+
+static void jsonStart(const char *status) {
+    int gzip = clientAcceptsGzip() && outPrepareGzip(); printResponseHeaders(status, "application/json", NULL, gzip); if (gzip) { outStartGzip(); }
+}
+
+static void jsonError(const char *status, const char *message) {
+    jsonStart(status); outPrintf("{\"ok\":false,\"error\":"); outJsonString(message); outPrintf("}\n"); logAt(LOG_DEBUG, "JSON %s: %s\n", status, message);
+}
+
+static void outJsonMedicine(StockHandle handle) {
+    const StockItem *m = stockStoreGet(globalStockStore, handle); int y, mo, d; stockExpiryUnpack(m->expiry, &y, &mo, &d);
+    outPrintf("{\"code\":%d,\"name\":", m->mcode); outJsonString(stockStoreName(globalStockStore, handle));
+    outPrintf(",\"price\":%.2f,\"qty\":%d,\"expiry\":\"%04d-%02d-%02d\"}", m->price_paise / 100.0, m->quantity, y, mo, d);
+}
+
+// Every code= value is a comma-separated list; answers come in request order, unknown codes under "missing"
+static void jsonLookup(const RequestParams *req) {
+    int codes[JSON_LOOKUP_MAX_CODES], n = 0, found = 0; StockHandle meds[JSON_LOOKUP_MAX_CODES];
+    for (int i = requestParamFind(req, "code"); i >= 0; i = req->params[i].next) {
+        for (const char *p = requestParamAt(req, i); *p; ) { char *e; errno = 0; long c = strtol(p, &e, 10);
+            if (e == p || errno != 0 || c <= 0 || c > INT_MAX || (*e != ',' && *e != '\0')) { jsonError("400 Bad Request", "code must be a comma-separated list of positive whole numbers"); return; }
+            if (n == JSON_LOOKUP_MAX_CODES) { char msg[64]; snprintf(msg, sizeof(msg), "at most %d codes per lookup", JSON_LOOKUP_MAX_CODES); jsonError("400 Bad Request", msg); return; }
+            codes[n++] = (int)c; p = (*e == ',') ? e + 1 : e; } }
+    if (n == 0) { jsonError("400 Bad Request", "code needed"); return; }
+    for (int i = 0; i < n; i++) { meds[i] = lookupStock(codes[i]); }
+    jsonStart("200 OK"); outPrintf("{\"items\":[");
+    for (int i = 0; i < n; i++) { if (meds[i] == 0) continue; if (found++) { outWrite(",", 1); } outJsonMedicine(meds[i]); }
+    outPrintf("],\"missing\":["); found = 0;
+    for (int i = 0; i < n; i++) { if (meds[i] == 0) { outPrintf(found++ ? ",%d" : "%d", codes[i]); } }
+    outPrintf("]}\n");
+}
+
+static void jsonSearch(const RequestParams *req) {
+    const char *query = requestParam(req, "searchQuery"); if (query == NULL || *query == '\0') { jsonError("400 Bad Request", "searchQuery needed"); return; }
+    char name_query[64]; int prefix = 0, code = parseSearchQuery(req, query, name_query, sizeof(name_query), &prefix), n = 0; OrderedEntry *hits = NULL; StockHandle med = 0;
+    if (code > 0) { med = lookupStock(code); }
+    else if (orderedIndexSize(globalStockIndex) > 0) { unsigned long long t0 = metricsNow(); n = searchNameIndex(globalNameIndex, name_query, prefix, &hits); metricsRecord(METRIC_LOOKUP, t0);
+        if (n < 0) { fprintf(stderr, "jsonSearch: Name index search failed.\n"); jsonError("500 Internal Server Error", "search failed"); return; } }
+    jsonStart("200 OK"); outPrintf("{\"items\":[");
+    if (med != 0) { outJsonMedicine(med); }
+    for (int i = 0; i < n; i++) { if (i > 0) { outWrite(",", 1); } outJsonMedicine(hits[i].handle); }
+    outPrintf("]}\n"); free(hits);
+}
+
+// items=code:qty,... (compact, for scanners), else the billing form's medicineCode[]/quantity[] pairs. Returns the
+// item count, or 0 with 'err' set
+static int jsonBillItems(const RequestParams *req, struct bill_item_request *items, char *err, size_t err_size) {
+    const char *list = requestParam(req, "items"), *code_s[MAX_BILL_ITEMS], *qty_s[MAX_BILL_ITEMS]; int n = 0;
+    if (list != NULL) {
+        for (const char *p = list; *p; n++) { char *e, *f; errno = 0; long c = strtol(p, &e, 10), q = (*e == ':') ? strtol(e + 1, &f, 10) : 0;
+            if (n == MAX_BILL_ITEMS) { snprintf(err, err_size, "at most %d items per bill", MAX_BILL_ITEMS); return 0; }
+            if (e == p || *e != ':' || f == e + 1 || (*f != ',' && *f != '\0') || errno != 0 || c <= 0 || c > INT_MAX || q <= 0 || q > INT_MAX) { snprintf(err, err_size, "item %d: expected code:quantity with both positive", n + 1); return 0; }
+            items[n].code = (int)c; items[n].quantity_requested = (int)q; p = (*f == ',') ? f + 1 : f; } }
+    else { int n_codes = requestParamValues(req, "medicineCode[]", code_s, MAX_BILL_ITEMS), n_qtys = requestParamValues(req, "quantity[]", qty_s, MAX_BILL_ITEMS);
+        if (n_codes != n_qtys) { snprintf(err, err_size, "medicineCode[]/quantity[] count mismatch"); return 0; }
+        if (n_codes > MAX_BILL_ITEMS) { snprintf(err, err_size, "at most %d items per bill", MAX_BILL_ITEMS); return 0; }
+        for (; n < n_codes; n++) { char *e, *f; errno = 0; long c = strtol(code_s[n], &e, 10), q = strtol(qty_s[n], &f, 10);
+            if (e == code_s[n] || *e != '\0' || f == qty_s[n] || *f != '\0' || errno != 0 || c <= 0 || c > INT_MAX || q <= 0 || q > INT_MAX) { snprintf(err, err_size, "item %d: code and quantity must be positive whole numbers", n + 1); return 0; }
+            items[n].code = (int)c; items[n].quantity_requested = (int)q; } }
+    if (n == 0) { snprintf(err, err_size, "no items"); }
+    return n;
+}
+
+static void jsonBilling(const RequestParams *req) {
+    struct bill_item_request items[MAX_BILL_ITEMS]; char cust_name[50], invoice_id[30], err[96]; memset(items, 0, sizeof(items));
+    const char *cust = requestParam(req, "customerName"); if (cust == NULL || *cust == '\0') { jsonError("400 Bad Request", "customerName needed"); return; }
+    snprintf(cust_name, sizeof(cust_name), "%s", cust); if (strpbrk(cust_name, "<>\"") != NULL) { jsonError("400 Bad Request", "invalid characters in customerName"); return; }
+    int n = jsonBillItems(req, items, err, sizeof(err)); if (n == 0) { jsonError("400 Bad Request", err); return; }
+    int sales_saved = 0, billed = commitBill(cust_name, items, n, invoice_id, sizeof(invoice_id), &sales_saved);
+    if (billed < 0) { jsonError("500 Internal Server Error", "stock update failed, nothing billed"); return; }
+    if (billed == 0) { jsonStart("409 Conflict"); outPrintf("{\"ok\":false,\"error\":\"stock\",\"items\":["); int failed = 0;
+        for (int i = 0; i < n; i++) { if (items[i].error_msg[0] == '\0') continue;
+            outPrintf("%s{\"code\":%d,\"requested\":%d,", failed++ ? "," : "", items[i].code, items[i].quantity_requested); if (items[i].found_in_stock) { outPrintf("\"available\":%d,", items[i].original_stock_qty); }
+            outPrintf("\"error\":"); outJsonString(items[i].error_msg); outWrite("}", 1); }
+        outPrintf("]}\n"); return; }
+    long long total_paise = 0; for (int i = 0; i < n; i++) { total_paise += (long long)items[i].stock_data_ptr->price_paise * items[i].quantity_requested; } // Exact; the page's float total can drift
+    jsonStart("200 OK"); outPrintf("{\"ok\":true,\"invoice\":\"%s\",\"total\":%lld.%02lld,\"sales_saved\":%s,\"items\":[", invoice_id, total_paise / 100, (total_paise < 0 ? -total_paise : total_paise) % 100, sales_saved ? "true" : "false");
+    for (int i = 0; i < n; i++) { outPrintf("%s{\"code\":%d,\"name\":", i ? "," : "", items[i].code); outJsonString(items[i].name);
+        outPrintf(",\"qty\":%d,\"price\":%.2f,\"left\":%d}", items[i].quantity_requested, items[i].price_per_item, items[i].new_stock_qty); }
+    outPrintf("]}\n");
+}
+
+static void jsonUpdateStock(const RequestParams *req) {
+    int code = 0, change = 0, final_qty = 0, clamped = 0; char name[40];
+    if (requestParamInt(req, "medicineCode", 1, INT_MAX, &code) != 1) { jsonError("400 Bad Request", "medicineCode must be a positive whole number"); return; }
+    if (requestParamInt(req, "newQuantity", INT_MIN, INT_MAX, &change) != 1) { jsonError("400 Bad Request", "newQuantity must be a whole number (the change to apply)"); return; }
+    int updated = applyStockUpdate(code, change, &final_qty, &clamped, name, sizeof(name));
+    if (updated < 0) { jsonError("500 Internal Server Error", "stock update failed, stock not modified"); return; }
+    if (updated == 0) { jsonError("404 Not Found", "code not in stock"); return; }
+    jsonStart("200 OK"); outPrintf("{\"ok\":true,\"code\":%d,\"name\":", code); outJsonString(name);
+    outPrintf(",\"change\":%d,\"qty\":%d,\"clamped\":%s}\n", change, final_qty, clamped ? "true" : "false");
+}
+
+// Same range scan as printExpiringStock
+static void jsonExpiry(const RequestParams *req) {
+    int days = EXPIRY_DEFAULT_DAYS, y, mo, d; if (requestParamInt(req, "days", 0, EXPIRY_MAX_DAYS, &days) < 0) { jsonError("400 Bad Request", "days must be a whole number of days"); return; }
+    time_t now_t = time(NULL); struct tm now_tm = *localtime(&now_t); long today = daysFromCivil(now_tm.tm_year + 1900, now_tm.tm_mon + 1, now_tm.tm_mday); civilFromDays(today, &y, &mo, &d);
+    jsonStart("200 OK"); outPrintf("{\"today\":\"%04d-%02d-%02d\",\"days\":%d,\"items\":[", y, mo, d, days);
+    OrderedIndexIter it; orderedIndexSeek(globalExpiryIndex, ORDERED_KEY_MIN, &it); OrderedKey end = (OrderedKey)(today + days) * 4294967296LL; StockHandle h; int found = 0;
+    while (orderedIndexPeekKey(&it) < end && (h = orderedIndexNextHandle(&it)) != 0) { const StockItem *m = stockStoreGet(globalStockStore, h); stockExpiryUnpack(m->expiry, &y, &mo, &d);
+        outPrintf("%s{\"code\":%d,\"name\":", found++ ? "," : "", m->mcode); outJsonString(stockStoreName(globalStockStore, h));
+        outPrintf(",\"qty\":%d,\"expiry\":\"%04d-%02d-%02d\",\"expired\":%s}", m->quantity, y, mo, d, daysFromCivil(y, mo, d) < today ? "true" : "false"); }
+    outPrintf("]}\n");
+}
+
+int handleJsonRequest(const char *req_method, const RequestParams *req) {
+    const char *action = requestParam(req, "action"), *action_type = requestParam(req, "actionType");
+    int lookup = action != NULL && strcmp(action, "lookup") == 0, get = strcmp(req_method, "GET") == 0, post = strcmp(req_method, "POST") == 0;
+    if (!lookup && !requestWantsJson(req)) return 0;
+    unsigned long long t_render = metricsNow();
+    if (lookup) { jsonLookup(req); }
+    else if (action == NULL && action_type != NULL && strcmp(action_type, "searchStock") == 0) { jsonSearch(req); }
+    else if (action == NULL) { jsonError("400 Bad Request", "action needed: lookup, billing, update_stock, check_expiry, or actionType=searchStock"); }
+    else if (post && strcmp(action, "billing") == 0) { jsonBilling(req); }
+    else if (post && strcmp(action, "update_stock") == 0) { jsonUpdateStock(req); }
+    else if (get && strcmp(action, "check_expiry") == 0) { jsonExpiry(req); }
+    else { logAt(LOG_WARN, "Unknown JSON action/method: %s (%s)\n", action, req_method); jsonError("400 Bad Request", "unknown action, or wrong method for it"); }
+    metricsRecord(METRIC_RENDER, t_render); return 1;
+}
+
+
+// --- Stock Loading / Request Handling ---
+
+static int loadGlobalStockUntimed();
+
+int loadGlobalStock() { unsigned long long t0 = metricsNow(); int ok = loadGlobalStockUntimed(); metricsRecord(METRIC_LOAD, t0); return ok; }
+
+static int loadGlobalStockUntimed() {
+    if (!createGlobalStock()) { fprintf(stderr, "FATAL: Stock store/index alloc failed.\n"); return 0; }
+    struct stat csv_st; int have_csv = (stat(STOCK_FILE, &csv_st) == 0), snap = 0;
+    if (have_csv) { snap = loadStockSnapshot(STOCK_SNAPSHOT_FILE, &csv_st); }
+    int rebuild_lock = 0; // Stale snapshot: the first process rebuilds it, the others wait for the lock and then attach to the new one
+    if (snap == 0 && have_csv && (rebuild_lock = stockLockRange(STOCK_LOCK_SNAPSHOT_BYTE, 1, 1)) && stat(STOCK_FILE, &csv_st) == 0) { snap = loadStockSnapshot(STOCK_SNAPSHOT_FILE, &csv_st); }
+    if (snap == 0) { // No usable snapshot: parse the CSV, then cache the rows and indexes for the next process
+        if (!loadStockData(STOCK_FILE)) { snap = -1; }
+        else if (have_csv) { writeStockSnapshot(STOCK_SNAPSHOT_FILE, &csv_st); } } // Before journal replay: the snapshot mirrors STOCK_FILE only
+    if (rebuild_lock) { stockLockRange(STOCK_LOCK_SNAPSHOT_BYTE, 1, 0); }
+    if (snap < 0) { fprintf(stderr, "FATAL: Stock load (snapshot or %s) failed.\n", STOCK_FILE); freeGlobalStock(); return 0; }
+    if (replayStockJournal(STOCK_JOURNAL_FILE, 0, &stockJournalApplied) < 0) { fprintf(stderr, "FATAL: Stock journal replay failed.\n"); freeGlobalStock(); return 0; }
+    recordStockFileStamp(); return 1;
+}
+
+int createGlobalStock() {
+    globalStockStore = createStockStore(); globalHashTable = createHashTable(HASH_TABLE_SIZE, globalStockStore);
+    globalStockIndex = createOrderedIndex(globalStockStore, orderedKeyByCode); globalExpiryIndex = createOrderedIndex(globalStockStore, orderedKeyByExpiry);
+    globalNameIndex = createNameIndex(globalStockStore);
+    if (globalStockStore == NULL || globalHashTable == NULL || globalStockIndex == NULL || globalExpiryIndex == NULL || globalNameIndex == NULL) { freeGlobalStock(); return 0; }
+    return 1;
+}
+
+void freeGlobalStock() {
+    freeHashTable(globalHashTable); freeOrderedIndex(globalStockIndex); freeOrderedIndex(globalExpiryIndex); freeNameIndex(globalNameIndex); freeStockStore(globalStockStore);
+    globalHashTable = NULL; globalStockIndex = NULL; globalExpiryIndex = NULL; globalNameIndex = NULL; globalStockStore = NULL;
+    stockSnapshotRelease();
+}
+
+long long statMtimeNs(const struct stat *st) { // Sub-second part of the mtime where the platform keeps one
+#ifdef __linux__
+    return (long long)st->st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    return (long long)st->st_mtimespec.tv_nsec;
+#else
+    (void)st; return 0;
+#endif
+}
+
+// Size, mtime (to the nanosecond) and inode: a compaction can rewrite STOCK_FILE to the same size within one second
+void recordStockFileStamp() {
+    struct stat st; if (stat(STOCK_FILE, &st) == 0) { stockFileMtime = st.st_mtime; stockFileSize = (long long)st.st_size; stockFileMtimeNs = statMtimeNs(&st); stockFileInode = (long long)st.st_ino; }
+    else { stockFileMtime = 0; stockFileSize = -1; stockFileMtimeNs = 0; stockFileInode = 0; }
+}
+
+void forgetStockFileStamp() { stockFileMtime = 0; stockFileSize = -2; stockFileMtimeNs = 0; stockFileInode = 0; } // -2 matches no file, present or missing
+
+int stockFileChanged() {
+    struct stat st; if (stat(STOCK_FILE, &st) != 0) { return stockFileSize != -1; }
+    return st.st_mtime != stockFileMtime || (long long)st.st_size != stockFileSize || statMtimeNs(&st) != stockFileMtimeNs || (long long)st.st_ino != stockFileInode;
+}
+
+// Journal groups carry absolute quantities and are replayed in file order, so re-reading our own groups here is harmless
+int syncStockFromDisk() {
+    struct stat st; long long journal_size = (stat(STOCK_JOURNAL_FILE, &st) == 0) ? (long long)st.st_size : 0;
+    if (stockFileChanged() || journal_size < stockJournalApplied) { // Added stock or a compaction by another process
+        logAt(LOG_INFO, "syncStockFromDisk: %s changed on disk, reloading.\n", STOCK_FILE); freeGlobalStock(); return loadGlobalStock(); }
+    if (journal_size == stockJournalApplied) return 1;
+    return replayStockJournal(STOCK_JOURNAL_FILE, stockJournalApplied, &stockJournalApplied) >= 0;
+}
+
+
+// --- Stock Locking ---
+// Mutations lock STOCK_LOCK_FILE byte ranges with fcntl: one byte per medicine code, so bills for different items
+// run in parallel while bills sharing an item queue up; then they catch up with the journal before validating.
+// Adding stock and compaction lock the whole file. Locks belong to the process and vanish if it dies.
+
+#ifndef _WIN32
+static int stockLockFd = -1;
+#endif
+
+int stockLockRange(long long start, long long len, int lock) {
+#ifndef _WIN32
+    if (stockLockFd < 0) { stockLockFd = open(STOCK_LOCK_FILE, O_RDWR | O_CREAT, 0644); if (stockLockFd < 0) { fprintf(stderr, "stockLockRange: Cannot open %s: %s\n", STOCK_LOCK_FILE, strerror(errno)); return 0; } }
+    struct flock fl; memset(&fl, 0, sizeof(fl)); fl.l_type = lock ? F_WRLCK : F_UNLCK; fl.l_whence = SEEK_SET; fl.l_start = (off_t)start; fl.l_len = (off_t)len;
+    while (fcntl(stockLockFd, lock ? F_SETLKW : F_SETLK, &fl) != 0) { if (errno != EINTR) { fprintf(stderr, "stockLockRange: fcntl(%lld, %lld) failed: %s\n", start, len, strerror(errno)); return 0; } }
+#else
+    (void)start; (void)len; (void)lock; // Single-counter Windows setups run one CGI at a time
+#endif
+    return 1;
+}
+
+static int compareInt(const void *a, const void *b) { int x = *(const int *)a, y = *(const int *)b; return (x > y) - (x < y); }
+
+int stockLockItems(const int *codes, int count) {
+    int sorted[MAX_BILL_ITEMS]; if (count > MAX_BILL_ITEMS) return 0;
+    memcpy(sorted, codes, sizeof(int) * (size_t)count); qsort(sorted, (size_t)count, sizeof(int), compareInt); // One global order, so two bills cannot wait on each other
+    for (int i = 0; i < count; i++) { if (i > 0 && sorted[i] == sorted[i - 1]) continue;
+        if (!stockLockRange(sorted[i], 1, 1)) { for (int j = 0; j < i; j++) { stockLockRange(sorted[j], 1, 0); } return 0; } }
+    return 1;
+}
+
+void stockUnlockItems(const int *codes, int count) { for (int i = 0; i < count; i++) stockLockRange(codes[i], 1, 0); }
+
+int clientAcceptsGzip() {
+    const char *p = requestAcceptEncoding ? stristr(requestAcceptEncoding, "gzip") : NULL; if (p == NULL) return 0;
+    p += 4; while (*p == ' ') p++; if (*p != ';') return 1;
+    p++; while (*p == ' ') p++; if (tolower((unsigned char)*p) != 'q') return 1;
+    p++; while (*p == ' ') p++; return *p != '=' || strtod(p + 1, NULL) > 0; // "gzip;q=0" refuses it
+}
+
+int etagMatches(const char *if_none_match, const char *etag) {
+    while (*if_none_match == ' ') { if_none_match++; }
+    if (strcmp(if_none_match, "*") == 0) return 1;
+    const char *opaque = strchr(etag, '"'); return opaque != NULL && strstr(if_none_match, opaque) != NULL; // W/ prefixes don't matter
+}
+
+// The stock list, expiry check and report only change when the files behind them do, so their ETag is a hash
+// of that on-disk version: STOCK_FILE's stamp plus the journal bytes applied, SALES_FILE's indexed length for the
+// report, today's date where the page depends on it, and the decoded query. Anything else (forms, POSTs) is not cached.
+int pageEtag(const char *req_method, const RequestParams *req, char *etag, size_t size) {
+    if (strcmp(req_method, "GET") != 0) return 0;
+    const char *action = requestParam(req, "action"), *action_type = requestParam(req, "actionType");
+    int report = action && strcmp(action, "generate_report") == 0, expiry = action && strcmp(action, "check_expiry") == 0, cacheable = (!action && !action_type) || report || expiry;
+    if (!cacheable) return 0;
+    long long version[7] = { stockFileSize, (long long)stockFileMtime, stockFileMtimeNs, stockFileInode, stockJournalApplied, 0, 0 };
+    if (report) { int ok = stockLockRange(STOCK_LOCK_SALES_BYTE, 1, 1) && refreshSalesIndex(); stockLockRange(STOCK_LOCK_SALES_BYTE, 1, 0); if (!ok) return 0; version[5] = globalSales.hdr.sales_bytes; }
+    if (report || expiry) { time_t now_t = time(NULL); struct tm now_tm = *localtime(&now_t); version[6] = daysFromCivil(now_tm.tm_year + 1900, now_tm.tm_mon + 1, now_tm.tm_mday); }
+    unsigned long long h = 1469598103934665603ULL; const unsigned char *p = (const unsigned char *)version; // FNV-1a
+    for (size_t i = 0; i < sizeof(version); i++) { h ^= p[i]; h *= 1099511628211ULL; }
+    for (int i = 0; i < (req ? req->count : 0); i++) { // key=value& per pair, as they were sent
+        for (p = (const unsigned char *)req->params[i].key; *p; p++) { h ^= *p; h *= 1099511628211ULL; } h ^= '='; h *= 1099511628211ULL;
+        for (p = (const unsigned char *)requestParamAt(req, i); *p; p++) { h ^= *p; h *= 1099511628211ULL; } h ^= '&'; h *= 1099511628211ULL; }
+    snprintf(etag, size, "W/\"%016llx\"", h); return 1;
+}
+
+// Server mode speaks HTTP/1.0 directly, so it needs a status line instead of the CGI "Status:" header
+void printResponseHeaders(const char *status, const char *content_type, const char *etag, int gzip) {
+    const char *eol = serverMode ? "\r\n" : "\n";
+    if (serverMode) { outPrintf("HTTP/1.0 %s\r\nConnection: close\r\n", status); } else if (strcmp(status, "200 OK") != 0) { outPrintf("Status: %s\n", status); }
+    if (content_type) { outPrintf("Content-Type: %s%s", content_type, eol); }
+    if (etag) { outPrintf("ETag: %s%sCache-Control: no-cache%s", etag, eol, eol); } // Browsers keep the page but revalidate it every time
+    if (gzip) { outPrintf("Content-Encoding: gzip%s", eol); }
+    outPrintf("Vary: Accept-Encoding, Accept%s%s", eol, eol); // Accept picks JSON over the page
+}
+
+// A delivery file POSTed as text/csv is not a form, so the fields (action=import_stock, atomic=1) ride in the query
+// string. The caller frees both the returned data and requestCsvBody (then NULLs it) after the request.
+char *requestSplitCsvBody(const char *content_type, char *body, const char *query) {
+    if (body == NULL || content_type == NULL || strncmp(content_type, "text/csv", 8) != 0) return body;
+    requestCsvBody = body; char *fields = strdup(query ? query : ""); if (fields == NULL) fprintf(stderr, "strdup fail query\n");
+    return fields;
+}
+
+// Renders one full page (headers, shell, routed action). Used by both the CGI entry point and the server loop.
+// Plain-text answers outside the page shell: the metrics scrape, and the log level switch (POST level=debug etc.)
+static int handleServiceRequest(const char *req_method, const RequestParams *req, MetricAction label) {
+    if (label == METRIC_ACTION_METRICS && strcmp(req_method, "GET") == 0) { printResponseHeaders("200 OK", "text/plain; version=0.0.4", NULL, 0); metricsWritePrometheus(); return 1; }
+    if (label != METRIC_ACTION_LOG_LEVEL) return 0;
+    const char *name = requestParam(req, "level"); int level = logLevelFromName(name);
+    if (name != NULL && (strcmp(req_method, "POST") != 0 || level < 0)) { printResponseHeaders("400 Bad Request", "text/plain", NULL, 0); outPrintf("Use POST level=error|warn|info|debug.\n"); return 1; }
+    if (name != NULL) { logLevel = level; fprintf(stderr, "Log level set to %s.\n", logLevelName(level)); }
+    printResponseHeaders("200 OK", "text/plain", NULL, 0); outPrintf("log_level %s\n", logLevelName(logLevel)); return 1;
+}
+
+void handleRequest(const char *req_method, char *req_data) {
+    const char *action = NULL, *actionType = NULL; int processed = 0; char etag[64]; RequestParams req; unsigned long long t_request = metricsNow();
+    if (!parseRequestParams(req_data, &req)) { printResponseHeaders("500 Internal Server Error", "text/html", NULL, 0); outPrintf("<h1>Internal Error</h1><p class='error'>Out of memory reading the request.</p>"); outFinish(); return; }
+    metricsRecord(METRIC_PARSE, t_request);
+    MetricAction label = metricsAction(requestParam(&req, "action"), requestParam(&req, "actionType")); globalMetrics.requests[label]++;
+    if (handleServiceRequest(req_method, &req, label) || handleJsonRequest(req_method, &req)) { outFinish(); freeRequestParams(&req); metricsRecord(METRIC_REQUEST, t_request); return; }
+    int cacheable = pageEtag(req_method, &req, etag, sizeof(etag)); // req_data now holds the split fields; use only 'req' from here
+    if (cacheable && requestIfNoneMatch && etagMatches(requestIfNoneMatch, etag)) { logAt(LOG_DEBUG, "Not modified (%s).\n", etag); printResponseHeaders("304 Not Modified", NULL, etag, 0); outFinish(); freeRequestParams(&req); globalMetrics.not_modified++; metricsRecord(METRIC_REQUEST, t_request); return; }
+    int gzip = clientAcceptsGzip() && outPrepareGzip();
+    printResponseHeaders("200 OK", "text/html", cacheable ? etag : NULL, gzip); if (gzip) { outStartGzip(); }
+    outPrintf("<!DOCTYPE html><html lang=\"en\"><head>");
+    outPrintf("<meta charset=\"UTF-8\"><meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">");
+    outPrintf("<title>Discount Pharmacy - Management (HS/BST)</title>");
+    outPrintf("<link rel=\"stylesheet\" href=\"https://cdn.jsdelivr.net/npm/bootstrap@5.3.0/dist/css/bootstrap.min.css\">");
+    outPrintf("<link rel=\"stylesheet\" href=\"https://cdn.jsdelivr.net/npm/bootstrap-icons/font/bootstrap-icons.css\">");
+    outPrintf("<link rel=\"icon\" href=\"../discount pharmacy.png\" type=\"image/x-icon\">");
+    outPrintf("<link rel=\"stylesheet\" href=\"../medical.css\">"); // Shared CSS, cached by the browser instead of inlined in every page
+    outPrintf("</head><body>");
+    outPrintf("<div class=\"bg-circles\"><div class=\"circle circle-1\"></div><div class=\"circle circle-2\"></div><div class=\"circle circle-3\"></div></div>");
+    outPrintf("<header><nav class=\"navbar\">"); // Navbar
+    outPrintf("<div class=\"logo\"><a href=\"../medical shop.html\"><img src=\"../discount pharmacy.png\" alt=\"Logo\"><span>DISCOUNT PHARMACY</span></a></div>");
+    outPrintf("<div class=\"nav-links\"><a href=\"../medical shop.html\">Home</a><a href=\"medical.exe?action=generate_report\">Reports</a><a href=\"medical.exe?action=check_expiry\">Expiry</a></div>");
+    outPrintf("<div class=\"user-menu\" tabindex=\"0\"><div class=\"user-icon\"><i class=\"bi bi-person-fill\"></i></div><div class=\"dropdown-card\"><a href=\"../login.html\" class=\"logout-btn\"><i class=\"bi bi-box-arrow-right\"></i> Logout</a></div></div>");
+    outPrintf("</nav></header>");
+    outPrintf("<main class=\"page-content\">"); outFlush(); // Main Content Start
+
+    // --- Routing ---
+    // Routing logic remains unchanged...
+    unsigned long long t_render = metricsNow();
+    action = requestParam(&req, "action"); if (action == NULL) { actionType = requestParam(&req, "actionType"); } // Parsed once; handlers look their fields up in 'req'
+    if (action != NULL) { logAt(LOG_DEBUG, "Route action='%s'\n", action);
+        if (strcmp(action, "add_stock") == 0 && strcmp(req_method, "POST") == 0) { outPrintf("<h2 class='page-title'>Add Stock Results</h2>"); processAddStock(&req); processed = 1; }
+        else if (strcmp(action, "import_stock") == 0 && strcmp(req_method, "POST") == 0) { outPrintf("<h2 class='page-title'>Import Stock Results</h2>"); processImportStock(&req, requestCsvBody); processed = 1; }
+        else if (strcmp(action, "update_stock") == 0 && strcmp(req_method, "POST") == 0) { outPrintf("<h2 class='page-title'>Update Stock Results</h2>"); processUpdateStock(&req); processed = 1; }
+        else if (strcmp(action, "billing") == 0 && strcmp(req_method, "POST") == 0) { outPrintf("<h2 class='page-title'>Billing Results</h2>"); processBillingMultiple(&req); processed = 1; }
+        else if (strcmp(action, "generate_report") == 0 && strcmp(req_method, "GET") == 0) { generateReport(&req); processed = 1; } // generateReport prints its own title
+        else if (strcmp(action, "check_expiry") == 0 && strcmp(req_method, "GET") == 0) { checkExpiry(&req); processed = 1; } // checkExpiry prints its own title
+        else { logAt(LOG_WARN, "Unknown action/method: %s (%s)\n", action, req_method); char esc[256]; outPrintf("<h2 class='page-title'>Error</h2><div class='error'>Invalid action ('%s')/method.</div>\n", htmlEscape(action, esc, sizeof(esc))); processed = 1; }
+    }
+    else if (actionType != NULL) { logAt(LOG_DEBUG, "Route actionType='%s'\n", actionType);
+         if (strcmp(actionType, "searchStock") == 0) { outPrintf("<h2 class='page-title'>Stock Search Results</h2>"); outPrintf("<div class=\"search-container\"><form action=\"medical.exe\" method=\"post\" class=\"d-flex w-100\"><input class=\"form-control\" type=\"search\" placeholder=\"Search... (name* = starts with)\" name=\"searchQuery\" required><input type=\"hidden\" name=\"actionType\" value=\"searchStock\"><button class=\"btn btn-primary\" type=\"submit\"><i class=\"bi bi-search\"></i></button></form></div>"); outFlush(); searchMedicine(&req); processed = 1; }
+         else { logAt(LOG_WARN, "Unknown actionType: %s\n", actionType); char esc[256]; outPrintf("<h2 class='page-title'>Error</h2><div class='error'>Invalid action type ('%s').</div>\n", htmlEscape(actionType, esc, sizeof(esc))); processed = 1; }
+    }
+
+    if (!processed) { // Default Action: View Stock
+        logAt(LOG_DEBUG, "Default action: viewStock.\n"); outPrintf("<h2 class='page-title'>Pharmacy Stock</h2>");
+        outPrintf("<div class=\"search-container\"><form action=\"medical.exe\" method=\"post\" class=\"d-flex w-100\"><input class=\"form-control\" type=\"search\" placeholder=\"Search stock... (name* = starts with)\" name=\"searchQuery\" required><input type=\"hidden\" name=\"actionType\" value=\"searchStock\"><button class=\"btn btn-primary\" type=\"submit\"><i class=\"bi bi-search\"></i></button></form></div>");
+        outPrintf("<div class=\"table-container-box\"><h2>Current Stock Levels</h2>"); outFlush(); viewStock(&req); outPrintf("</div>"); // viewStock now shows Rupee symbol
+    }
+
+    metricsRecord(METRIC_RENDER, t_render);
+    outPrintf("</main></body></html>"); outFinish(); // End HTML
+    freeRequestParams(&req); metricsRecord(METRIC_REQUEST, t_request);
+}
+
+
+// --- Server Mode (POSIX only) ---
+// Keeps globalStockStore and its indexes resident across requests instead of reloading STOCK_FILE per hit.
+// Single-threaded accept loop: one request at a time, so handlers need no extra locking.
+#ifndef _WIN32
+
+// Reads "Content-Length" (case-insensitive) out of a raw header block. Returns -1 if absent.
+static long serverContentLength(const char *headers) {
+    const char *p = headers;
+    while ((p = strchr(p, '\n')) != NULL) { p++; if (strncasecmp(p, "Content-Length:", 15) == 0) { return strtol(p + 15, NULL, 10); } }
+    return -1;
+}
+
+// Copies the value of header 'name' (e.g. "Accept-Encoding:", case-insensitive) into value. Returns value, or NULL if absent.
+static const char *serverHeader(const char *headers, const char *name, char *value, size_t size) {
+    const char *p = headers; size_t name_len = strlen(name);
+    while ((p = strchr(p, '\n')) != NULL) { p++;
+        if (strncasecmp(p, name, name_len) == 0) { p += name_len; while (*p == ' ' || *p == '\t') p++;
+            size_t len = strcspn(p, "\r\n"); if (len >= size) len = size - 1; memcpy(value, p, len); value[len] = '\0'; return value; } }
+    return NULL;
+}
+
+// Serves a static file (the HTML forms, CSS, images) below doc_root. Rejects any path containing "..".
+// Files are cacheable for SERVER_STATIC_MAX_AGE with an ETag from their size/mtime (revalidated with a 304).
+// Text files go out gzipped when the client accepts it: from a "<file>.gz" next to them if that is at least
+// as new, otherwise compressed on the fly.
+static void serveStaticFile(int fd, const char *doc_root, const char *path) {
+    char full[1024], gz_path[1040]; const char *type = "application/octet-stream"; char hdr[512]; struct stat st, gz_st;
+    char decoded[512]; if (strlen(path) >= sizeof(decoded)) { path = "/"; } urlDecode(decoded, path);
+    if (strstr(decoded, "..") != NULL || strcmp(decoded, "/") == 0) { snprintf(full, sizeof(full), "%s/login.html", doc_root); } else { snprintf(full, sizeof(full), "%s%s", doc_root, decoded); }
+    const char *ext = strrchr(full, '.');
+    if (ext) { if (strcmp(ext, ".html") == 0) type = "text/html"; else if (strcmp(ext, ".css") == 0) type = "text/css"; else if (strcmp(ext, ".png") == 0) type = "image/png"; }
+    if (stat(full, &st) != 0 || !S_ISREG(st.st_mode)) { int len = snprintf(hdr, sizeof(hdr), "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\nNot found\n"); if (write(fd, hdr, len) < 0) { fprintf(stderr, "serveStaticFile: write failed.\n"); } return; }
+    char etag[64]; snprintf(etag, sizeof(etag), "\"%llx-%llx.%llx\"", (unsigned long long)st.st_size, (unsigned long long)st.st_mtime, (unsigned long long)statMtimeNs(&st)); // Nanoseconds: an edit in the same second is a new version
+    if (requestIfNoneMatch && etagMatches(requestIfNoneMatch, etag)) {
+        int len = snprintf(hdr, sizeof(hdr), "HTTP/1.0 304 Not Modified\r\nETag: %s\r\nCache-Control: max-age=%d\r\nConnection: close\r\n\r\n", etag, SERVER_STATIC_MAX_AGE);
+        if (write(fd, hdr, len) < 0) { fprintf(stderr, "serveStaticFile: write failed.\n"); } return; }
+    int text = strncmp(type, "text/", 5) == 0, gzipped = 0; size_t body_len = 0; char *body = NULL;
+    if (text && clientAcceptsGzip()) {
+        snprintf(gz_path, sizeof(gz_path), "%s.gz", full);
+        if (stat(gz_path, &gz_st) == 0 && (gz_st.st_mtime > st.st_mtime || (gz_st.st_mtime == st.st_mtime && statMtimeNs(&gz_st) >= statMtimeNs(&st)))) { body = readWholeFile(gz_path, &body_len); } // Not older than the source, to the nanosecond
+        if (body == NULL) { size_t raw_len; char *raw = readWholeFile(full, &raw_len); if (raw) { body = (char *)gzipCompress(raw, raw_len, &body_len); free(raw); } }
+        gzipped = body != NULL; }
+    if (body == NULL && (body = readWholeFile(full, &body_len)) == NULL) { fprintf(stderr, "serveStaticFile: cannot read %s: %s\n", full, strerror(errno)); return; }
+    int len = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\nETag: %s\r\nCache-Control: max-age=%d\r\n%s%sConnection: close\r\n\r\n",
+                       type, body_len, etag, SERVER_STATIC_MAX_AGE, text ? "Vary: Accept-Encoding\r\n" : "", gzipped ? "Content-Encoding: gzip\r\n" : "");
+    if (write(fd, hdr, len) >= 0) { size_t done = 0; ssize_t w; while (done < body_len && (w = write(fd, body + done, body_len - done)) > 0) done += (size_t)w; }
+    free(body);
+}
+
+// Reads one HTTP request from fd, routes it and writes the response. The connection is closed by the caller.
+static void serveConnection(int fd, const char *doc_root) {
+    char hdr[SERVER_MAX_HEADER + 1]; size_t got = 0; char *hdr_end = NULL; ssize_t r;
+    while (got < SERVER_MAX_HEADER && (r = read(fd, hdr + got, SERVER_MAX_HEADER - got)) > 0) { got += (size_t)r; hdr[got] = '\0'; if ((hdr_end = strstr(hdr, "\r\n\r\n")) != NULL) break; }
+    if (hdr_end == NULL) { fprintf(stderr, "Server: bad/oversized request header (%zu bytes).\n", got); return; }
+    *hdr_end = '\0'; char *body_start = hdr_end + 4; size_t body_have = got - (size_t)(body_start - hdr);
+    char method[8] = "", target[2048] = ""; if (sscanf(hdr, "%7s %2047s", method, target) != 2) { fprintf(stderr, "Server: bad request line.\n"); return; }
+    char *query = strchr(target, '?'); if (query) { *query++ = '\0'; }
+    char *req_data = NULL;
+    if (strcmp(method, "POST") == 0) { long data_len = serverContentLength(hdr);
+        if (data_len > 0 && data_len <= MAX_POST_SIZE) { req_data = (char *)malloc(data_len + 1);
+            if (req_data) { size_t have = body_have < (size_t)data_len ? body_have : (size_t)data_len; memcpy(req_data, body_start, have);
+                while (have < (size_t)data_len && (r = read(fd, req_data + have, (size_t)data_len - have)) > 0) { have += (size_t)r; }
+                if (have == (size_t)data_len) { req_data[data_len] = '\0'; } else { fprintf(stderr, "Server: POST read err (%zu/%ld)\n", have, data_len); free(req_data); req_data = NULL; } } }
+        else { fprintf(stderr, "Server: Bad/too large Content-Length %ld\n", data_len); } }
+    else if (strcmp(method, "GET") == 0) { if (query && *query) { req_data = strdup(query); } }
+    else { const char *resp = "HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n"; if (write(fd, resp, strlen(resp)) < 0) { fprintf(stderr, "Server: write failed.\n"); } return; }
+    char accept_encoding[256], if_none_match[256], accept[256], content_type[128]; // Read by handleRequest/serveStaticFile through the request globals
+    requestAcceptEncoding = serverHeader(hdr, "Accept-Encoding:", accept_encoding, sizeof(accept_encoding)); requestIfNoneMatch = serverHeader(hdr, "If-None-Match:", if_none_match, sizeof(if_none_match));
+    requestAccept = serverHeader(hdr, "Accept:", accept, sizeof(accept));
+    if (strcmp(method, "POST") == 0) { req_data = requestSplitCsvBody(serverHeader(hdr, "Content-Type:", content_type, sizeof(content_type)), req_data, query); }
+    size_t tlen = strlen(target);
+    if (tlen >= 11 && strcmp(target + tlen - 11, "medical.exe") == 0) {
+        if (!syncStockFromDisk()) { const char *resp = "HTTP/1.0 500 Internal Server Error\r\nConnection: close\r\n\r\nStock reload failed\n"; if (write(fd, resp, strlen(resp)) < 0) { fprintf(stderr, "Server: write failed.\n"); } free(req_data); free(requestCsvBody); requestCsvBody = NULL; return; }
+        fflush(stdout); int saved_stdout = dup(STDOUT_FILENO); dup2(fd, STDOUT_FILENO); // Handlers print to stdout; point it at the socket for this request
+        handleRequest(method, req_data);
+        fflush(stdout); dup2(saved_stdout, STDOUT_FILENO); close(saved_stdout); }
+    else { serveStaticFile(fd, doc_root, target); }
+    requestAcceptEncoding = requestIfNoneMatch = requestAccept = NULL;
+    if (req_data) free(req_data);
+    free(requestCsvBody); requestCsvBody = NULL;
+}
+
+int runServer(int port, const char *doc_root) {
+    signal(SIGPIPE, SIG_IGN); // A client hanging up mid-response must not kill the server
+    int lfd = socket(AF_INET, SOCK_STREAM, 0); if (lfd < 0) { fprintf(stderr, "FATAL: socket: %s\n", strerror(errno)); return 1; }
+    int yes = 1; setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in addr; memset(&addr, 0, sizeof(addr)); addr.sin_family = AF_INET; addr.sin_port = htons((unsigned short)port); addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // localhost only
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 64) != 0) { fprintf(stderr, "FATAL: bind/listen port %d: %s\n", port, strerror(errno)); close(lfd); return 1; }
+    if (!loadGlobalStock()) { close(lfd); return 1; }
+    serverMode = 1; setvbuf(stdout, NULL, _IOFBF, 65536);
+    logAt(LOG_INFO, "medical.exe: Serving http://127.0.0.1:%d/cgi-bin/medical.exe (static files from '%s').\n", port, doc_root); fflush(stderr);
+    for (;;) {
+        int cfd = accept(lfd, NULL, NULL); if (cfd < 0) { if (errno == EINTR) continue; fprintf(stderr, "Server: accept: %s\n", strerror(errno)); continue; }
+        serveConnection(cfd, doc_root); close(cfd);
+        maybeCompactStockJournal(); // Response already delivered, so compaction stays off the request path
+    }
+    return 0; // Not reached
+}
+#endif
+
+
+// --- Main Function (Simplified Routing Logic) ---
+// Usage: medical.exe                       one-shot CGI (REQUEST_METHOD/QUERY_STRING/CONTENT_LENGTH from the environment)
+//        medical.exe --serve [port] [docroot]  long-running localhost HTTP server (POSIX only)
+//        medical.exe --index-sales          builds or updates SALES_INDEX_FILE (converting an older one) and prints the totals
+#ifndef MEDICAL_NO_MAIN
+int main(int argc, char **argv) {
+    // Seed random number generator for potential use (like invoice ID)
+    srand((unsigned int)time(NULL) ^ (unsigned int)getpid());
+    const char *log_env = getenv("MEDICAL_LOG_LEVEL"); if (log_env != NULL) { int level = logLevelFromName(log_env); if (level >= 0) logLevel = level; else fprintf(stderr, "Unknown MEDICAL_LOG_LEVEL '%s', using info.\n", log_env); }
+
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+#ifndef _WIN32
+        int port = (argc > 2) ? atoi(argv[2]) : SERVER_DEFAULT_PORT; const char *doc_root = (argc > 3) ? argv[3] : "..";
+        if (port <= 0 || port > 65535) { fprintf(stderr, "Invalid port '%s'.\n", argv[2]); return 1; }
+        return runServer(port, doc_root);
+#else
+        fprintf(stderr, "--serve is not supported on Windows.\n"); return 1;
+#endif
+    }
+    if (argc > 1 && strcmp(argv[1], "--index-sales") == 0) { // Converts a large history ahead of the first report instead of inside it
+        int ok = stockLockRange(STOCK_LOCK_SALES_BYTE, 1, 1) && refreshSalesIndex(); stockLockRange(STOCK_LOCK_SALES_BYTE, 1, 0);
+        if (!ok) { fprintf(stderr, "Could not index %s.\n", SALES_FILE); return 1; }
+        printf("%s: %lld rows, %lld invoices, %lld items, %lld.%02lld total\n", SALES_INDEX_FILE, globalSales.hdr.rows, globalSales.hdr.transactions, globalSales.hdr.items_sold, globalSales.hdr.total_paise / 100, globalSales.hdr.total_paise % 100);
+        freeSalesIndex(); return 0;
+    }
+
+    logAt(LOG_DEBUG, "\n--------------------\nmedical.exe: Started (HS/BST).\n"); fflush(stderr);
+    char *req_method = NULL, *req_data = NULL, *q_string = NULL, *len_s = NULL; long data_len = 0;
+
+    if (!loadGlobalStock()) { printf("Content-Type: text/html\n\n<!DOCTYPE html><html><body><h1>Internal Error</h1><p class='error'>Failed load stock data from '%s'.</p></body></html>", STOCK_FILE); return 1; }
+
+    // --- Get Request Data ---
+    req_method = getenv("REQUEST_METHOD"); if (req_method == NULL) req_method = "GET";
+    logAt(LOG_DEBUG, "Method: %s\n", req_method); req_data = NULL;
+    if (strcmp(req_method, "POST") == 0) { len_s = getenv("CONTENT_LENGTH"); if (len_s != NULL) { errno = 0; data_len = strtol(len_s, NULL, 10);
+            if (errno == 0 && data_len > 0 && data_len <= MAX_POST_SIZE) { req_data = (char *)malloc(data_len + 1); if (req_data) { size_t rd = fread(req_data, 1, data_len, stdin); if (rd==(size_t)data_len) { req_data[data_len]='\0'; logAt(LOG_DEBUG, "Read %ld POST\n", data_len); } else { free(req_data); req_data = NULL; fprintf(stderr, "POST read err (%zu/%ld)\n", rd, data_len); } } else { fprintf(stderr, "Malloc fail POST %ld\n", data_len); } }
+            else if (data_len > MAX_POST_SIZE) { fprintf(stderr, "POST too large: %ld\n", data_len); } else { fprintf(stderr, "Bad CONTENT_LENGTH: %s\n", len_s); } } else { fprintf(stderr, "No CONTENT_LENGTH POST\n"); } }
+    else if (strcmp(req_method, "GET") == 0) { q_string = getenv("QUERY_STRING"); if (q_string != NULL && strlen(q_string) > 0) { req_data = strdup(q_string); if (!req_data) fprintf(stderr, "strdup fail GET\n"); else logAt(LOG_DEBUG, "GET data: %s\n", req_data); } else { logAt(LOG_DEBUG, "No QUERY_STRING GET\n"); } }
+
+    requestAcceptEncoding = getenv("HTTP_ACCEPT_ENCODING"); requestIfNoneMatch = getenv("HTTP_IF_NONE_MATCH"); requestAccept = getenv("HTTP_ACCEPT");
+    if (strcmp(req_method, "POST") == 0) { req_data = requestSplitCsvBody(getenv("CONTENT_TYPE"), req_data, getenv("QUERY_STRING")); }
+    handleRequest(req_method, req_data);
+    fflush(stdout); maybeCompactStockJournal(); // After the page is out, fold a large journal back into STOCK_FILE
+
+    // --- Cleanup ---
+    if (req_data) free(req_data);
+    free(requestCsvBody); requestCsvBody = NULL;
+    logAt(LOG_DEBUG, "Freeing memory...\n"); fflush(stderr);
+    freeGlobalStock(); freeSalesIndex();
+    logAt(LOG_DEBUG, "medical.exe: Finished.\n--------------------\n\n"); fflush(stderr); return 0;
+} // END main
+#endif
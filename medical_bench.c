@@ -0,0 +1,1285 @@
+// medical_bench.c - Benchmarks for medical.exe (POSIX only)
+// Build: gcc -O2 -pthread -o medical_bench medical_bench.c
+// Usage: ./medical_bench <benchmark> [options]   (run without arguments for the list)
+// Each benchmark works in a scratch directory it creates, so it never touches a real stock.csv/sales.csv.
+
+#define MEDICAL_NO_MAIN // Pull in all of medical.c except its main()
+#include "medical.c"
+
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h> // Cache-miss counts for the layout benchmark
+#endif
+
+// --- Bench Helpers ---
+
+static double benchNow() {
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts); return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compareDouble(const void *a, const void *b) { double x = *(const double *)a, y = *(const double *)b; return (x > y) - (x < y); }
+
+// Writes a synthetic stock.csv with 'rows' medicines. Codes are 1..rows, ascending when sorted=1, shuffled otherwise.
+static int benchWriteStockCsv(const char *path, int rows, int sorted) {
+    static const char *names[] = { "Paracetamol", "Amoxicillin", "Cetirizine", "Ibuprofen", "Azithromycin", "Omeprazole", "Metformin", "Atorvastatin", "Pantoprazole", "Dolo" };
+    static const char *suppliers[] = { "ABC Pharma", "Sun Distributors", "Medline Traders", "Apollo Wholesale" };
+    int *codes = (int *)malloc(sizeof(int) * (size_t)rows); if (!codes) return 0;
+    for (int i = 0; i < rows; i++) codes[i] = i + 1;
+    if (!sorted) { for (int i = rows - 1; i > 0; i--) { int j = rand() % (i + 1); int t = codes[i]; codes[i] = codes[j]; codes[j] = t; } }
+    FILE *fp = fopen(path, "w"); if (!fp) { free(codes); return 0; }
+    for (int i = 0; i < rows; i++) {
+        int c = codes[i];
+        fprintf(fp, "%s %d,%d,%s,%lld,%.2f,%d,%d,%d,%d\n", names[c % 10], c, c, suppliers[c % 4], 9800000000LL + c % 100000, 5.0 + (c % 400) * 0.25, 1000 + c % 500, 2025 + c % 4, 1 + c % 12, 1 + c % 28);
+    }
+    fclose(fp); free(codes); return 1;
+}
+
+// Writes a synthetic sales.csv in saveSaleRecords' format: 'rows' rows, three per invoice, spread over a year.
+static int benchWriteSalesCsv(const char *path, int rows) {
+    FILE *fp = fopen(path, "w"); if (!fp) return 0;
+    fprintf(fp, "InvoiceID,Date,Time,CustomerName,MedicineCode,MedicineName,Quantity,PricePerItem,TotalCost\n");
+    for (int i = 0; i < rows; i++) fprintf(fp, "\"%d-%d\",2026-%02d-%02d,10:%02d:00,\"Customer %d\",%d,\"Paracetamol %d\",%d,%.2f,%.2f\n", 1700000000 + i / 3, 4242, 1 + i % 12, 1 + i % 28, i % 60, i / 3, 1 + i % 500, 1 + i % 500, 1 + i % 5, 12.5, 12.5 * (1 + i % 5));
+    return fclose(fp) == 0;
+}
+
+// Creates and enters a fresh scratch directory under /tmp.
+static int benchEnterScratchDir(char *dir, size_t dir_size) {
+    snprintf(dir, dir_size, "/tmp/medical_bench_XXXXXX");
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0) { fprintf(stderr, "bench: cannot create scratch dir: %s\n", strerror(errno)); return 0; }
+    return 1;
+}
+
+
+// --- Benchmark: CGI vs --serve requests/sec ---
+
+// One CGI hit: fork/exec the binary with a GET environment, output discarded.
+static int benchCgiRequest(const char *exe, const char *query) {
+    pid_t pid = fork(); if (pid < 0) return 0;
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY); dup2(devnull, STDOUT_FILENO); dup2(devnull, STDERR_FILENO);
+        setenv("REQUEST_METHOD", "GET", 1); setenv("QUERY_STRING", query, 1);
+        execl(exe, exe, (char *)NULL); _exit(127);
+    }
+    int status = 0; waitpid(pid, &status, 0); return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// One HTTP GET against a running --serve instance; reads the whole response.
+static int benchHttpRequest(int port, const char *query) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0); if (fd < 0) return 0;
+    struct sockaddr_in addr; memset(&addr, 0, sizeof(addr)); addr.sin_family = AF_INET; addr.sin_port = htons((unsigned short)port); addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) { close(fd); return 0; }
+    char req[512]; int len = snprintf(req, sizeof(req), "GET /cgi-bin/medical.exe?%s HTTP/1.0\r\nHost: localhost\r\n\r\n", query);
+    if (write(fd, req, len) != len) { close(fd); return 0; }
+    char buf[65536]; ssize_t r; long total = 0; while ((r = read(fd, buf, sizeof(buf))) > 0) total += r;
+    close(fd); return total > 0;
+}
+
+// One form POST against a running --serve instance; the response (headers and body, truncated to 'size') lands in 'out'.
+static int benchHttpPost(int port, const char *body, char *out, size_t size) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0); if (fd < 0) return 0;
+    struct sockaddr_in addr; memset(&addr, 0, sizeof(addr)); addr.sin_family = AF_INET; addr.sin_port = htons((unsigned short)port); addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) { close(fd); return 0; }
+    char req[1024]; int len = snprintf(req, sizeof(req), "POST /cgi-bin/medical.exe HTTP/1.0\r\nHost: localhost\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: %zu\r\n\r\n%s", strlen(body), body);
+    if (len >= (int)sizeof(req) || write(fd, req, len) != len) { close(fd); return 0; }
+    size_t total = 0; ssize_t r; char sink[4096];
+    while ((r = read(fd, total + 1 < size ? out + total : sink, total + 1 < size ? size - 1 - total : sizeof(sink))) > 0) { if (total + 1 < size) total += (size_t)r; }
+    out[total] = '\0'; close(fd); return total > 0;
+}
+
+static int benchServe(int argc, char **argv) {
+    const char *exe = (argc > 0) ? argv[0] : "./medical.exe"; int rows = (argc > 1) ? atoi(argv[1]) : 20000; int requests = (argc > 2) ? atoi(argv[2]) : 20; int port = 18931;
+    char exe_abs[PATH_MAX], dir[64]; if (realpath(exe, exe_abs) == NULL) { fprintf(stderr, "bench serve: cannot find '%s' (build medical.exe first).\n", exe); return 1; }
+    if (!benchEnterScratchDir(dir, sizeof(dir)) || !benchWriteStockCsv(STOCK_FILE, rows, 0)) return 1; // Shuffled codes: same dataset as the runs before the ordered index
+    const char *query = "actionType=searchStock&searchQuery=4242"; // Code lookup: tiny page, so per-request startup dominates
+
+    double t0 = benchNow(); int ok = 0;
+    for (int i = 0; i < requests; i++) ok += benchCgiRequest(exe_abs, query);
+    double cgi_secs = benchNow() - t0;
+    printf("cgi:    %d/%d requests in %.3fs -> %.1f req/s (%d-row stock.csv)\n", ok, requests, cgi_secs, requests / cgi_secs, rows);
+
+    char port_s[16]; snprintf(port_s, sizeof(port_s), "%d", port);
+    pid_t srv = fork();
+    if (srv == 0) { int devnull = open("/dev/null", O_WRONLY); dup2(devnull, STDERR_FILENO); execl(exe_abs, exe_abs, "--serve", port_s, ".", (char *)NULL); _exit(127); }
+    for (int tries = 0; tries < 200 && !benchHttpRequest(port, query); tries++) usleep(20000); // Wait until it has loaded and is listening
+    t0 = benchNow(); ok = 0;
+    for (int i = 0; i < requests; i++) ok += benchHttpRequest(port, query);
+    double srv_secs = benchNow() - t0;
+    printf("server: %d/%d requests in %.3fs -> %.1f req/s (%.1fx)\n", ok, requests, srv_secs, requests / srv_secs, cgi_secs / srv_secs);
+    // Two bills back to back land in the same second from the same server process; their invoice IDs must still differ
+    char ids[2][64] = { "", "" };
+    for (int b = 0; b < 2; b++) { char resp[8192]; const char *inv;
+        if (benchHttpPost(port, "action=billing&format=json&customerName=Bench&medicineCode%5B%5D=1&quantity%5B%5D=1", resp, sizeof(resp)) && (inv = strstr(resp, "\"invoice\":\"")) != NULL) { sscanf(inv + 11, "%63[^\"]", ids[b]); } }
+    kill(srv, SIGTERM); waitpid(srv, NULL, 0);
+    if (ids[0][0] == '\0' || ids[1][0] == '\0' || strcmp(ids[0], ids[1]) == 0) { printf("server: back-to-back bills got invoice IDs '%s' and '%s'; expected two distinct IDs\n", ids[0], ids[1]); return 1; }
+    printf("server: back-to-back bills got distinct invoice IDs %s and %s\n", ids[0], ids[1]);
+    return 0;
+}
+
+
+// --- Benchmark: CGI time to first byte with a cold vs warm stock.snap ---
+
+// One CGI GET with stdout on a pipe: seconds from fork to the first byte of the response (-1 on failure). The rest is drained.
+static double benchCgiFirstByte(const char *exe, const char *query) {
+    int fds[2]; if (pipe(fds) != 0) return -1;
+    double t0 = benchNow(); pid_t pid = fork(); if (pid < 0) { close(fds[0]); close(fds[1]); return -1; }
+    if (pid == 0) {
+        close(fds[0]); dup2(fds[1], STDOUT_FILENO); int devnull = open("/dev/null", O_WRONLY); dup2(devnull, STDERR_FILENO);
+        setenv("REQUEST_METHOD", "GET", 1); setenv("QUERY_STRING", query, 1);
+        execl(exe, exe, (char *)NULL); _exit(127);
+    }
+    close(fds[1]); char buf[65536]; ssize_t r = read(fds[0], buf, sizeof(buf)); double first = benchNow() - t0; int got = r > 0;
+    while (r > 0) r = read(fds[0], buf, sizeof(buf));
+    close(fds[0]); int status = 0; waitpid(pid, &status, 0);
+    return (got && WIFEXITED(status) && WEXITSTATUS(status) == 0) ? first : -1;
+}
+
+static int benchCache(int argc, char **argv) {
+    const char *exe = (argc > 0) ? argv[0] : "./medical.exe"; int default_sizes[] = { 10000, 100000 }; int n_sizes = argc > 1 ? argc - 1 : 2, reps = 7;
+    char exe_abs[PATH_MAX], dir[64]; if (realpath(exe, exe_abs) == NULL) { fprintf(stderr, "bench cache: cannot find '%s' (build medical.exe first).\n", exe); return 1; }
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    static const char *pages[][2] = { { "viewStock", "" }, { "searchMedicine", "actionType=searchStock&searchQuery=para" } };
+    printf("%-9s %-15s %14s %14s %9s\n", "rows", "page", "cold ttfb (ms)", "warm ttfb (ms)", "speedup");
+    for (int k = 0; k < n_sizes; k++) {
+        int rows = argc > 1 ? atoi(argv[k + 1]) : default_sizes[k]; if (rows <= 0) continue;
+        benchWriteStockCsv(STOCK_FILE, rows, 0); remove(STOCK_JOURNAL_FILE);
+        for (int p = 0; p < 2; p++) { double cold[16], warm[16];
+            for (int i = 0; i < reps; i++) { remove(STOCK_SNAPSHOT_FILE); cold[i] = benchCgiFirstByte(exe_abs, pages[p][1]); } // Parse stock.csv, index it, write stock.snap
+            for (int i = 0; i < reps; i++) { warm[i] = benchCgiFirstByte(exe_abs, pages[p][1]); } // Attach to the stock.snap the last cold run left
+            qsort(cold, (size_t)reps, sizeof(double), compareDouble); qsort(warm, (size_t)reps, sizeof(double), compareDouble);
+            if (cold[0] < 0 || warm[0] < 0) { printf("%s request failed\n", pages[p][0]); return 1; }
+            printf("%-9d %-15s %14.2f %14.2f %8.1fx\n", rows, pages[p][0], cold[reps / 2] * 1e3, warm[reps / 2] * 1e3, cold[reps / 2] / warm[reps / 2]); } // Medians
+    }
+    return 0;
+}
+
+
+// --- Benchmark: stock.csv vs stock.snap startup ---
+
+static int benchCountRow(const struct medicine *m, void *ctx) { (void)m; (*(long *)ctx)++; return 1; }
+
+static int benchSnapshot(int argc, char **argv) {
+    int default_sizes[] = { 10000, 100000, 1000000 }; int n_sizes = argc > 0 ? argc : 3; char dir[64];
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    if (!getenv("BENCH_VERBOSE")) freopen("/dev/null", "w", stderr); // Loader chatter would dominate the timings
+    printf("%-9s %14s %14s %9s %14s %14s\n", "rows", "csv read (s)", "snap read (s)", "speedup", "csv load (s)", "snap load (s)");
+    for (int k = 0; k < n_sizes; k++) {
+        int rows = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (rows <= 0) continue;
+        benchWriteStockCsv(STOCK_FILE, rows, 0); struct stat csv_st; stat(STOCK_FILE, &csv_st);
+        createGlobalStock();
+        double t0 = benchNow(); loadStockData(STOCK_FILE); double csv_load = benchNow() - t0;
+        writeStockSnapshot(STOCK_SNAPSHOT_FILE, &csv_st); freeGlobalStock();
+        createGlobalStock();
+        t0 = benchNow(); loadStockSnapshot(STOCK_SNAPSHOT_FILE, &csv_st); double snap_load = benchNow() - t0; freeGlobalStock();
+        long n_csv = 0, n_snap = 0;
+        t0 = benchNow(); readStockCsv(STOCK_FILE, benchCountRow, &n_csv); double csv_read = benchNow() - t0;
+        t0 = benchNow(); readStockSnapshot(STOCK_SNAPSHOT_FILE, &csv_st, benchCountRow, &n_snap); double snap_read = benchNow() - t0;
+        if (n_csv != rows || n_snap != rows) { printf("row count mismatch: csv %ld, snapshot %ld\n", n_csv, n_snap); return 1; }
+        printf("%-9d %14.4f %14.4f %8.1fx %14.4f %14.4f\n", rows, csv_read, snap_read, csv_read / snap_read, csv_load, snap_load);
+    }
+    return 0;
+}
+
+
+// --- Benchmark: Robin Hood hash index vs the original 101-bucket chained table ---
+
+// The chained table medical.c used before the open-addressing rewrite, kept here as the baseline.
+typedef struct LegacyHashNode { struct medicine data; struct LegacyHashNode *next; } LegacyHashNode;
+#define LEGACY_HASH_TABLE_SIZE 101
+
+static int legacyInsert(LegacyHashNode **table, struct medicine med) {
+    unsigned int index = (unsigned int)med.mcode % LEGACY_HASH_TABLE_SIZE;
+    for (LegacyHashNode *cur = table[index]; cur; cur = cur->next) { if (cur->data.mcode == med.mcode) return 0; }
+    LegacyHashNode *n = (LegacyHashNode *)malloc(sizeof(LegacyHashNode)); if (!n) return -1;
+    n->data = med; n->next = table[index]; table[index] = n; return 1;
+}
+
+static struct medicine *legacySearch(LegacyHashNode **table, int code) {
+    for (LegacyHashNode *cur = table[(unsigned int)code % LEGACY_HASH_TABLE_SIZE]; cur; cur = cur->next) { if (cur->data.mcode == code) return &cur->data; }
+    return NULL;
+}
+
+static int benchHash(int argc, char **argv) {
+    int default_sizes[] = { 1000, 10000, 100000 }; int n_sizes = argc > 0 ? argc : 3; const int lookups = 1000000;
+    freopen("/dev/null", "w", stderr);
+    printf("%-8s %-12s %14s %16s\n", "items", "table", "insert (M/s)", "lookup (M/s)");
+    for (int k = 0; k < n_sizes; k++) {
+        int n = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (n <= 0) continue;
+        int *codes = (int *)malloc(sizeof(int) * (size_t)n), *probe = (int *)malloc(sizeof(int) * (size_t)lookups);
+        for (int i = 0; i < n; i++) codes[i] = i + 1;
+        for (int i = n - 1; i > 0; i--) { int j = rand() % (i + 1); int t = codes[i]; codes[i] = codes[j]; codes[j] = t; }
+        for (int i = 0; i < lookups; i++) probe[i] = 1 + rand() % (n + n / 10); // ~90% hits
+        struct medicine m; memset(&m, 0, sizeof(m)); strcpy(m.name, "Bench"); m.year = 2027; m.month = m.day = 1; long found = 0;
+
+        LegacyHashNode **legacy = (LegacyHashNode **)calloc(LEGACY_HASH_TABLE_SIZE, sizeof(LegacyHashNode *));
+        double t0 = benchNow(); for (int i = 0; i < n; i++) { m.mcode = codes[i]; legacyInsert(legacy, m); } double ins = benchNow() - t0;
+        t0 = benchNow(); for (int i = 0; i < lookups; i++) found += legacySearch(legacy, probe[i]) != NULL; double look = benchNow() - t0;
+        printf("%-8d %-12s %14.2f %16.2f\n", n, "chained-101", n / ins / 1e6, lookups / look / 1e6);
+        for (int b = 0; b < LEGACY_HASH_TABLE_SIZE; b++) { while (legacy[b]) { LegacyHashNode *t = legacy[b]; legacy[b] = t->next; free(t); } } free(legacy);
+
+        StockStore *store = createStockStore(); HashTable *table = createHashTable(HASH_TABLE_SIZE, store); // Insert timing includes the store copy, like the chained table's node copy
+        t0 = benchNow(); for (int i = 0; i < n; i++) { m.mcode = codes[i]; insertIntoHashTable(table, stockStoreAdd(store, &m)); } ins = benchNow() - t0;
+        t0 = benchNow(); for (int i = 0; i < lookups; i++) found += searchHashTableByCode(table, probe[i]) != NULL; look = benchNow() - t0;
+        printf("%-8d %-12s %14.2f %16.2f\n", n, "robin-hood", n / ins / 1e6, lookups / look / 1e6);
+        freeHashTable(table); freeStockStore(store); free(codes); free(probe);
+        if (found == 0) printf("(no hits?)\n");
+    }
+    return 0;
+}
+
+
+// --- Benchmark: ordered index vs the original unbalanced BST ---
+
+// The recursive BST medical.c used before the ordered index, kept here as the baseline.
+typedef struct LegacyBstNode { struct medicine data; struct LegacyBstNode *left, *right; } LegacyBstNode;
+#define LEGACY_BST_SORTED_MAX 20000 // Sorted input turns the BST into a list; past this the recursion risks the stack
+
+static LegacyBstNode *legacyBstInsert(LegacyBstNode *root, struct medicine med) {
+    if (root == NULL) { LegacyBstNode *n = (LegacyBstNode *)malloc(sizeof(LegacyBstNode)); if (n) { n->data = med; n->left = n->right = NULL; } return n; }
+    if (med.mcode < root->data.mcode) root->left = legacyBstInsert(root->left, med); else if (med.mcode > root->data.mcode) root->right = legacyBstInsert(root->right, med);
+    return root;
+}
+
+static LegacyBstNode *legacyBstSearch(LegacyBstNode *root, int code) {
+    if (root == NULL || root->data.mcode == code) return root;
+    return legacyBstSearch(code < root->data.mcode ? root->left : root->right, code);
+}
+
+static void legacyBstWalk(LegacyBstNode *root, long *sum) { if (root) { legacyBstWalk(root->left, sum); *sum += root->data.quantity; legacyBstWalk(root->right, sum); } }
+static void legacyBstFree(LegacyBstNode *root) { if (root) { legacyBstFree(root->left); legacyBstFree(root->right); free(root); } }
+
+static void benchOrderedRow(int n, const char *order, const char *structure, double build, double look, int lookups, double walk) {
+    printf("%-8d %-7s %-15s %11.4f %14.2f %11.4f\n", n, order, structure, build, lookups / look / 1e6, walk);
+}
+
+static int benchOrdered(int argc, char **argv) {
+    int default_sizes[] = { 10000, 100000, 1000000 }; int n_sizes = argc > 0 ? argc : 3; const int lookups = 1000000;
+    freopen("/dev/null", "w", stderr);
+    printf("%-8s %-7s %-15s %11s %14s %11s\n", "items", "order", "structure", "build (s)", "lookup (M/s)", "scan (s)");
+    for (int k = 0; k < n_sizes; k++) {
+        int n = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (n <= 0) continue;
+        int *codes = (int *)malloc(sizeof(int) * (size_t)n), *probe = (int *)malloc(sizeof(int) * (size_t)lookups);
+        for (int i = 0; i < lookups; i++) probe[i] = 1 + rand() % (n + n / 10); // ~90% hits
+        struct medicine m; memset(&m, 0, sizeof(m)); strcpy(m.name, "Bench"); m.quantity = 1; m.year = 2027; m.month = m.day = 1; long found = 0, sum = 0;
+        for (int sorted = 1; sorted >= 0; sorted--) {
+            const char *order = sorted ? "sorted" : "random";
+            for (int i = 0; i < n; i++) codes[i] = i + 1;
+            if (!sorted) { for (int i = n - 1; i > 0; i--) { int j = rand() % (i + 1); int t = codes[i]; codes[i] = codes[j]; codes[j] = t; } }
+
+            if (sorted && n > LEGACY_BST_SORTED_MAX) { printf("%-8d %-7s %-15s %11s\n", n, order, "legacy-bst", "skipped"); }
+            else {
+                LegacyBstNode *root = NULL; double t0 = benchNow();
+                for (int i = 0; i < n; i++) { m.mcode = codes[i]; root = legacyBstInsert(root, m); } double build = benchNow() - t0;
+                int bst_lookups = sorted ? lookups / 100 : lookups; // Each lookup walks ~n/2 nodes on a degenerate tree
+                t0 = benchNow(); for (int i = 0; i < bst_lookups; i++) found += legacyBstSearch(root, probe[i]) != NULL; double look = benchNow() - t0;
+                t0 = benchNow(); legacyBstWalk(root, &sum); double walk = benchNow() - t0;
+                benchOrderedRow(n, order, "legacy-bst", build, look, bst_lookups, walk); legacyBstFree(root);
+            }
+
+            StockStore *store = createStockStore(); for (int i = 0; i < n; i++) { m.mcode = codes[i]; stockStoreAdd(store, &m); } // Handle i+1 holds codes[i]
+            for (int bulk = 1; bulk >= 0; bulk--) {
+                OrderedIndex *idx = createOrderedIndex(store, orderedKeyByCode); double t0 = benchNow();
+                if (bulk) { for (int i = 0; i < n; i++) { orderedIndexAppend(idx, (StockHandle)i + 1); } orderedIndexFinishLoad(idx); } // Load path (stock.csv / stock.snap)
+                else { for (int i = 0; i < n; i++) { insertOrderedIndex(idx, (StockHandle)i + 1); } } // One-at-a-time path (add stock)
+                double build = benchNow() - t0;
+                t0 = benchNow(); for (int i = 0; i < lookups; i++) found += searchOrderedIndex(idx, probe[i]) != NULL; double look = benchNow() - t0;
+                t0 = benchNow(); OrderedIndexIter it; orderedIndexSeek(idx, ORDERED_KEY_MIN, &it); StockItem *p; while ((p = orderedIndexNext(&it)) != NULL) sum += p->quantity; double walk = benchNow() - t0;
+                if (orderedIndexSize(idx) != n) { printf("ordered index size mismatch: %d vs %d\n", orderedIndexSize(idx), n); return 1; }
+                benchOrderedRow(n, order, bulk ? "ordered-load" : "ordered-insert", build, look, lookups, walk); freeOrderedIndex(idx);
+            }
+            freeStockStore(store);
+        }
+        free(codes); free(probe);
+        if (found == 0 || sum == 0) printf("(no hits?)\n");
+    }
+    return 0;
+}
+
+
+// --- Benchmark: trigram name index vs the original stristr scan ---
+
+// The full in-order scan searchMedicine did before the name index, minus the printing.
+static int legacyNameScan(OrderedIndex *idx, const char *query) {
+    int matches = 0; OrderedIndexIter it; orderedIndexSeek(idx, ORDERED_KEY_MIN, &it); StockHandle h;
+    while ((h = orderedIndexNextHandle(&it)) != 0) { if (stristr(stockStoreName(idx->store, h), query) != NULL) matches++; }
+    return matches;
+}
+
+static int benchNames(int argc, char **argv) {
+    int default_sizes[] = { 10000, 100000 }; int n_sizes = argc > 0 ? argc : 2; char dir[64];
+    static const struct { const char *query; int prefix; } queries[] = { { "para", 0 }, { "AZITHRO", 0 }, { "mol 4242", 0 }, { "99", 0 }, { "dolo 12", 1 }, { "zzz", 0 } };
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    freopen("/dev/null", "w", stderr);
+    printf("%-8s %-10s %-7s %9s %13s %13s %9s\n", "items", "query", "mode", "matches", "scan (us/q)", "index (us/q)", "speedup");
+    for (int k = 0; k < n_sizes; k++) {
+        int n = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (n <= 0) continue;
+        benchWriteStockCsv(STOCK_FILE, n, 0); createGlobalStock(); loadStockData(STOCK_FILE);
+        for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+            int reps = 200000 / n > 0 ? 200000 / n : 1, scanned = 0, indexed = 0;
+            double t0 = benchNow(); for (int r = 0; r < reps; r++) scanned = legacyNameScan(globalStockIndex, queries[q].query); double scan = (benchNow() - t0) / reps;
+            int index_reps = reps * 20; t0 = benchNow();
+            for (int r = 0; r < index_reps; r++) { OrderedEntry *hits = NULL; indexed = searchNameIndex(globalNameIndex, queries[q].query, queries[q].prefix, &hits); free(hits); }
+            double index = (benchNow() - t0) / index_reps;
+            if (!queries[q].prefix && scanned != indexed) { printf("match count mismatch for '%s': scan %d, index %d\n", queries[q].query, scanned, indexed); return 1; }
+            printf("%-8d %-10s %-7s %9d %13.1f %13.1f %8.1fx\n", n, queries[q].query, queries[q].prefix ? "prefix" : "substr", indexed, scan * 1e6, index * 1e6, scan / index);
+        }
+        freeGlobalStock();
+    }
+    return 0;
+}
+
+
+// --- Benchmark: generateReport with the sales index ---
+
+static int benchSales(int argc, char **argv) {
+    int default_sizes[] = { 10000, 100000, 1000000 }; int n_sizes = argc > 0 ? argc : 3; char dir[64];
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    freopen("/dev/null", "w", stderr); FILE *out = stdout; stdout = fopen("/dev/null", "w"); // Report HTML is discarded
+    fprintf(out, "%-9s %14s %14s %14s %14s %14s\n", "rows", "build idx (s)", "cgi report (s)", "resident (s)", "cgi month (s)", "res month (s)");
+    for (int k = 0; k < n_sizes; k++) {
+        int rows = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (rows <= 0) continue;
+        remove(SALES_INDEX_FILE); if (!benchWriteSalesCsv(SALES_FILE, rows)) return 1;
+        double t0 = benchNow(); freeSalesIndex(); generateReport(NULL); double build = benchNow() - t0; // No sales.idx yet: parses the whole CSV once
+        t0 = benchNow(); freeSalesIndex(); generateReport(NULL); double cgi = benchNow() - t0;            // A fresh CGI process: reads sales.idx, prints the newest page
+        t0 = benchNow(); generateReport(NULL); double resident = benchNow() - t0;                          // --serve: index already in memory
+        SalesDay totals; SalesRollupItem *items = NULL; int from = salesDayFromDate("2026-06-01"), to = salesDayFromDate("2026-06-30");
+        t0 = benchNow(); freeSalesIndex(); refreshSalesIndex(); querySalesRange(&globalSales, from, to, &totals, &items); double cgi_month = benchNow() - t0; free(items); // Fresh process: read sales.idx, build the rollups
+        t0 = benchNow(); querySalesRange(&globalSales, from, to, &totals, &items); double res_month = benchNow() - t0; free(items);
+        if (totals.units == 0) { fprintf(out, "range query found no sales\n"); return 1; }
+        if (globalSales.hdr.rows != rows || globalSales.hdr.transactions != (rows + 2) / 3) { fprintf(out, "sales index mismatch: %lld rows, %lld invoices\n", globalSales.hdr.rows, globalSales.hdr.transactions); return 1; }
+        fprintf(out, "%-9d %14.4f %14.4f %14.6f %14.4f %14.6f\n", rows, build, cgi, resident, cgi_month, res_month);
+    }
+    freeSalesIndex(); return 0;
+}
+
+
+// --- Benchmark: buffered response writer vs printf + fflush per row ---
+
+// write() syscalls made by this process so far (Linux /proc accounting)
+static long long benchWriteSyscalls() {
+    FILE *fp = fopen("/proc/self/io", "r"); char line[128]; long long n = -1; if (!fp) return -1;
+    while (fgets(line, sizeof(line), fp)) { if (sscanf(line, "syscw: %lld", &n) == 1) break; }
+    fclose(fp); return n;
+}
+
+// viewStock's rows as printBstInOrder printed them: printf, then fflush per row.
+static void legacyViewStock() {
+    printf("<div style='overflow-x:auto;'><table class='stock-table'><thead><tr><th>Code</th><th>Name</th><th>Supplier</th><th>Contact</th><th>Price</th><th>Quantity</th><th>Expiry Date</th></tr></thead><tbody>"); fflush(stdout);
+    OrderedIndexIter it; orderedIndexSeek(globalStockIndex, ORDERED_KEY_MIN, &it); StockHandle h; struct medicine m;
+    while ((h = orderedIndexNextHandle(&it)) != 0) { stockStoreRow(globalStockStore, h, &m);
+        printf("<tr><td>%d</td><td>%s</td><td>%s</td><td>%lld</td><td>₹%.2f</td><td style='text-align:center;'>%d</td><td>%04d-%02d-%02d</td></tr>\n", m.mcode, m.name, m.s_name, m.s_contact, m.price, m.quantity, m.year, m.month, m.day); fflush(stdout); }
+    printf("</tbody></table></div>"); fflush(stdout);
+}
+
+// generateReport's detail page as it was printed before the response writer: one printf per cell, fflush per row.
+static void legacyReportPage() {
+    long long last = globalSales.hdr.rows, first = last > SALES_REPORT_PAGE_ROWS ? last - SALES_REPORT_PAGE_ROWS : 0; char line[512]; struct sale_record sale;
+    FILE *fp = fopen(SALES_FILE, "rb"); if (!fp) return;
+    printf("<table class='stock-table'><thead><tr><th>Invoice ID</th><th>Date</th><th>Time</th><th>Customer</th><th>Med Code</th><th>Med Name</th><th style='text-align:right;'>Qty</th><th style='text-align:right;'>Price/Item</th><th style='text-align:right;'>Total Cost</th></tr></thead><tbody>"); fflush(stdout);
+    for (long long i = first; i < last; i++) {
+        if (fseek(fp, (long)globalSales.col.offset[i], SEEK_SET) != 0 || fgets(line, sizeof(line), fp) == NULL) break;
+        line[strcspn(line, "\r\n")] = 0; if (!parseSaleLine(line, &sale)) continue;
+        printf("<tr>"); printf("<td>%s</td>", sale.invoice_id); printf("<td>%s</td>", sale.date_str); printf("<td>%s</td>", sale.time_str); printf("<td>%s</td>", sale.customer_name);
+        printf("<td>%d</td>", sale.medicine_code); printf("<td>%s</td>", sale.medicine_name); printf("<td style='text-align:right;'>%d</td>", sale.quantity);
+        printf("<td style='text-align:right;'>₹%.2f</td>", sale.price_per_item); printf("<td style='text-align:right;'>₹%.2f</td>", sale.total_cost); printf("</tr>\n"); fflush(stdout); }
+    printf("</tbody></table>"); fflush(stdout); fclose(fp);
+}
+
+static void benchOutputRow(FILE *out, int n, const char *page, const char *mode, void (*render)(), int reps) {
+    double bytes = 0, t = 0; long long writes = 0;
+    for (int r = 0; r < reps; r++) { // Each page overwrites the last, so the file offset afterwards is the page size
+        long long w0 = benchWriteSyscalls(); double t0 = benchNow(); render(); fflush(stdout); t += benchNow() - t0; writes += benchWriteSyscalls() - w0;
+        bytes += (double)lseek(fileno(stdout), 0, SEEK_CUR); rewind(stdout); }
+    fprintf(out, "%-8d %-8s %-9s %12.1f %14.1f %12.1f %10.4f\n", n, page, mode, bytes / reps / 1024, (double)writes / reps, bytes / t / (1024 * 1024), t / reps);
+}
+
+static void benchReportPage() { generateReport(NULL); }
+
+// The whole stock through the response writer, as viewStock printed it before it was paginated.
+static void benchBufferedViewStock() {
+    outPrintf("<div style='overflow-x:auto;'><table class='stock-table'><thead><tr><th>Code</th><th>Name</th><th>Supplier</th><th>Contact</th><th>Price</th><th>Quantity</th><th>Expiry Date</th></tr></thead><tbody>");
+    OrderedIndexIter it; orderedIndexSeek(globalStockIndex, ORDERED_KEY_MIN, &it); StockHandle h;
+    while ((h = orderedIndexNextHandle(&it)) != 0) { outStockRow(globalStockStore, h); }
+    outPrintf("</tbody></table></div>"); outFlush();
+}
+
+static int benchOutput(int argc, char **argv) {
+    int default_sizes[] = { 1000, 10000, 100000 }; int n_sizes = argc > 0 ? argc : 3; char dir[64];
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    freopen("/dev/null", "w", stderr); setvbuf(stderr, NULL, _IOFBF, 1 << 16); // Handler logging must not show up as write() calls
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w"); if (!out || !freopen("page.html", "w", stdout)) return 1; // Pages go to a scratch file through fd 1
+    if (benchWriteSyscalls() < 0) { fprintf(out, "output: /proc/self/io not available\n"); return 1; }
+    fprintf(out, "%-8s %-8s %-9s %12s %14s %12s %10s\n", "items", "page", "writer", "KiB/page", "writes/page", "MiB/s", "s/page");
+    for (int k = 0; k < n_sizes; k++) {
+        int n = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (n <= 0) continue; int reps = 2000000 / n > 0 ? 2000000 / n : 1;
+        benchWriteStockCsv(STOCK_FILE, n, 0); createGlobalStock(); loadStockData(STOCK_FILE);
+        benchOutputRow(out, n, "view", "legacy", legacyViewStock, reps); benchOutputRow(out, n, "view", "buffered", benchBufferedViewStock, reps);
+        freeGlobalStock();
+        FILE *fp = fopen(SALES_FILE, "w"); if (!fp) return 1; // n sales rows; the report prints the newest page of them
+        fprintf(fp, "InvoiceID,Date,Time,CustomerName,MedicineCode,MedicineName,Quantity,PricePerItem,TotalCost\n");
+        for (int i = 0; i < n; i++) fprintf(fp, "\"%d-%d\",2026-%02d-%02d,10:%02d:00,\"Customer %d\",%d,\"Paracetamol %d\",%d,%.2f,%.2f\n", 1700000000 + i / 3, 4242, 1 + i % 12, 1 + i % 28, i % 60, i / 3, 1 + i % 500, 1 + i % 500, 1 + i % 5, 12.5, 12.5 * (1 + i % 5));
+        fclose(fp); freeSalesIndex(); remove(SALES_INDEX_FILE); generateReport(NULL); // Build sales.idx outside the timing
+        benchOutputRow(out, n, "report", "legacy", legacyReportPage, 200); benchOutputRow(out, n, "report", "buffered", benchReportPage, 200);
+    }
+    freeSalesIndex(); fclose(out); return 0;
+}
+
+
+// --- Benchmark: cursor-paginated viewStock vs the full stock listing ---
+
+static int benchStockPage(int argc, char **argv) {
+    int default_sizes[] = { 10000, 100000, 1000000 }; int n_sizes = argc > 0 ? argc : 3; char dir[64];
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    freopen("/dev/null", "w", stderr); FILE *out = fdopen(dup(STDOUT_FILENO), "w"); if (!out || !freopen("page.html", "w", stdout)) return 1;
+    fprintf(out, "%-9s %-22s %10s %12s\n", "items", "page", "KiB", "ms/page");
+    for (int k = 0; k < n_sizes; k++) {
+        int n = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (n <= 0) continue;
+        benchWriteStockCsv(STOCK_FILE, n, 0); createGlobalStock(); loadStockData(STOCK_FILE);
+        char middle[48], wide[48], deep[48]; snprintf(middle, sizeof(middle), "from_code=%d", n / 2); snprintf(wide, sizeof(wide), "from_code=%d&limit=1000", n / 2);
+        snprintf(deep, sizeof(deep), "from_code=%d&min_qty=1450", n / 2); // Quantities are 1000-1499, so one row in ten passes
+        const struct { const char *page, *query; } pages[] = { { "first", "" }, { "middle", middle }, { "middle, limit=1000", wide }, { "middle, qty filter", deep } };
+        for (int p = 0; p < 5; p++) {
+            int reps = p == 4 ? (n >= 1000000 ? 2 : 5) : 200; double t = 0; long bytes = 0;
+            for (int r = 0; r < reps; r++) {
+                double t0 = benchNow();
+                if (p == 4) { benchBufferedViewStock(); } // The old viewStock: every row on one page
+                else { char query[128]; snprintf(query, sizeof(query), "%s", pages[p].query); RequestParams req; parseRequestParams(query, &req); viewStock(&req); freeRequestParams(&req); }
+                fflush(stdout); t += benchNow() - t0; bytes = (long)lseek(fileno(stdout), 0, SEEK_CUR); rewind(stdout); }
+            fprintf(out, "%-9d %-22s %10.1f %12.3f\n", n, p == 4 ? "all rows (before)" : pages[p].page, bytes / 1024.0, t / reps * 1e3); }
+        freeGlobalStock();
+    }
+    fclose(out); return 0;
+}
+
+
+// --- Benchmark: bytes on the wire per page (identity vs gzip vs 304) ---
+
+// Renders one full page into page.html (stdout) and returns its size; *secs gets the render time.
+static long benchWirePage(const char *query, double *secs) {
+    char data[2048]; snprintf(data, sizeof(data), "%s", query); double t0 = benchNow();
+    handleRequest("GET", data[0] ? data : NULL); fflush(stdout); *secs = benchNow() - t0;
+    long size = (long)lseek(fileno(stdout), 0, SEEK_CUR); rewind(stdout); return size;
+}
+
+static int benchWire(int argc, char **argv) {
+    int default_sizes[] = { 1000, 10000 }; int n_sizes = argc > 0 ? argc : 2; char dir[64];
+    static const struct { const char *page, *query; } pages[] = { { "view", "" }, { "expiry", "action=check_expiry&days=365" }, { "report", "action=generate_report&from=2026-01-01&to=2026-12-31" } };
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    freopen("/dev/null", "w", stderr); FILE *out = fdopen(dup(STDOUT_FILENO), "w"); if (!out || !freopen("page.html", "w", stdout)) return 1;
+    fprintf(out, "%-8s %-8s %12s %12s %8s %12s %12s %10s\n", "items", "page", "plain KiB", "gzip KiB", "ratio", "plain (ms)", "gzip (ms)", "304 bytes");
+    for (int k = 0; k < n_sizes; k++) {
+        int n = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (n <= 0) continue;
+        benchWriteStockCsv(STOCK_FILE, n, 0); createGlobalStock(); loadStockData(STOCK_FILE);
+        FILE *fp = fopen(SALES_FILE, "w"); if (!fp) return 1;
+        fprintf(fp, "InvoiceID,Date,Time,CustomerName,MedicineCode,MedicineName,Quantity,PricePerItem,TotalCost\n");
+        for (int i = 0; i < n; i++) fprintf(fp, "\"%d-%d\",2026-%02d-%02d,10:%02d:00,\"Customer %d\",%d,\"Paracetamol %d\",%d,%.2f,%.2f\n", 1700000000 + i / 3, 4242, 1 + i % 12, 1 + i % 28, i % 60, i / 3, 1 + (i * 7) % n, 1 + (i * 7) % n, 1 + i % 5, 12.5, 12.5 * (1 + i % 5));
+        fclose(fp); freeSalesIndex(); remove(SALES_INDEX_FILE);
+        for (size_t p = 0; p < sizeof(pages) / sizeof(pages[0]); p++) {
+            double plain_t, gzip_t, t; char etag[64] = "", query[256];
+            requestAcceptEncoding = requestIfNoneMatch = NULL; benchWirePage(pages[p].query, &t); // Warm up (builds sales.idx)
+            long plain = benchWirePage(pages[p].query, &plain_t);
+            requestAcceptEncoding = "gzip, deflate, br"; long gz = benchWirePage(pages[p].query, &gzip_t);
+            RequestParams req; snprintf(query, sizeof(query), "%s", pages[p].query); parseRequestParams(query, &req); pageEtag("GET", &req, etag, sizeof(etag)); freeRequestParams(&req);
+            requestIfNoneMatch = etag; long not_modified = benchWirePage(pages[p].query, &t);
+            fprintf(out, "%-8d %-8s %12.1f %12.1f %7.1fx %12.2f %12.2f %10ld\n", n, pages[p].page, plain / 1024.0, gz / 1024.0, (double)plain / gz, plain_t * 1e3, gzip_t * 1e3, not_modified);
+        }
+        freeGlobalStock(); requestAcceptEncoding = requestIfNoneMatch = NULL;
+    }
+    freeSalesIndex(); fclose(out); return 0;
+}
+
+
+// --- Benchmark: JSON API answers vs the HTML pages a terminal would otherwise scrape ---
+
+static int benchJson(int argc, char **argv) {
+    int default_sizes[] = { 10000, 100000 }; int n_sizes = argc > 0 ? argc : 2; char dir[64];
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    freopen("/dev/null", "w", stderr); FILE *out = fdopen(dup(STDOUT_FILENO), "w"); if (!out || !freopen("page.html", "w", stdout)) return 1;
+    fprintf(out, "%-8s %-22s %10s %10s %12s %12s %8s\n", "items", "answer", "html KiB", "json KiB", "html (ms)", "json (ms)", "speedup");
+    for (int k = 0; k < n_sizes; k++) {
+        int n = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (n <= 0) continue;
+        benchWriteStockCsv(STOCK_FILE, n, 0); createGlobalStock(); loadStockData(STOCK_FILE); requestAcceptEncoding = requestIfNoneMatch = requestAccept = NULL;
+        static const int batches[] = { 1, 20, 100 };
+        for (int b = 0; b < 3; b++) { // A scanner batch: one search page per code vs one lookup for all of them
+            char lookup[2048]; int len = snprintf(lookup, sizeof(lookup), "action=lookup&code=");
+            double html_t = 0, json_t = 0, t; long html_bytes = 0, json_bytes = 0; int reps = 200 / batches[b] > 0 ? 200 / batches[b] : 1;
+            for (int i = 0; i < batches[b]; i++) { len += snprintf(lookup + len, sizeof(lookup) - (size_t)len, i ? ",%d" : "%d", 1 + (int)((long long)i * n / batches[b])); }
+            for (int r = 0; r < reps; r++) {
+                for (int i = 0; i < batches[b]; i++) { char query[96]; snprintf(query, sizeof(query), "actionType=searchStock&searchQuery=%d", 1 + (int)((long long)i * n / batches[b])); html_bytes += benchWirePage(query, &t); html_t += t; }
+                json_bytes += benchWirePage(lookup, &t); json_t += t; }
+            char label[32]; snprintf(label, sizeof(label), "lookup %d code%s", batches[b], batches[b] > 1 ? "s" : "");
+            fprintf(out, "%-8d %-22s %10.1f %10.1f %12.3f %12.3f %7.1fx\n", n, label, html_bytes / 1024.0 / reps, json_bytes / 1024.0 / reps, html_t / reps * 1e3, json_t / reps * 1e3, html_t / json_t); }
+        static const struct { const char *answer, *html, *json; } pages[] = {
+            { "search 'Paracetamol 12*'", "actionType=searchStock&searchQuery=Paracetamol+12*", "actionType=searchStock&searchQuery=Paracetamol+12*&format=json" },
+            { "expiry 365 days", "action=check_expiry&days=365", "action=check_expiry&days=365&format=json" } };
+        for (int p = 0; p < 2; p++) {
+            double html_t = 0, json_t = 0, t; long html_bytes = 0, json_bytes = 0; int reps = 20;
+            for (int r = 0; r < reps; r++) { html_bytes = benchWirePage(pages[p].html, &t); html_t += t; json_bytes = benchWirePage(pages[p].json, &t); json_t += t; }
+            fprintf(out, "%-8d %-22s %10.1f %10.1f %12.3f %12.3f %7.1fx\n", n, pages[p].answer, html_bytes / 1024.0, json_bytes / 1024.0, html_t / reps * 1e3, json_t / reps * 1e3, html_t / json_t); }
+        freeGlobalStock();
+    }
+    fclose(out); return 0;
+}
+
+
+// --- Benchmark: CSV scanner vs fgets + sscanf / get_csv_field ---
+
+// readStockCsv, get_csv_field and parseSaleLine as they were before the CSV scanner, kept here as the baseline.
+static int legacyReadStockCsv(const char *filename, StockRowHandler handler, void *ctx) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) { if (errno == ENOENT) { fprintf(stderr, "readStockCsv: File %s not found. OK.\n", filename); return 1; } else { fprintf(stderr, "FATAL: Error opening %s: %s\n", filename, strerror(errno)); return 0; } }
+    struct medicine m; char line[256]; int line_num = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line_num++; line[strcspn(line, "\r\n")] = 0; if (strspn(line, " \t") == strlen(line)) continue;
+        memset(&m, 0, sizeof(m)); int items_parsed = sscanf(line, "%39[^,],%d,%49[^,],%lld,%f,%d,%d,%d,%d", m.name, &m.mcode, m.s_name, &m.s_contact, &m.price, &m.quantity, &m.year, &m.month, &m.day);
+        if (items_parsed == 9) { if (!handler(&m, ctx)) { fclose(fp); return 0; } }
+        else { fprintf(stderr, "readStockCsv: Malformed line %d in %s.\n", line_num, filename); } }
+    if (ferror(fp)) { fprintf(stderr, "readStockCsv: Error reading %s: %s\n", filename, strerror(errno)); } fclose(fp);
+    return 1;
+}
+
+static char *legacyGetCsvField(char **line_ptr, int *is_quoted) {
+    if (line_ptr == NULL || *line_ptr == NULL || **line_ptr == '\0') return NULL;
+
+    char *start;
+    char *ptr = *line_ptr;
+    char *field_end = NULL;
+    *is_quoted = 0;
+
+    // Trim leading whitespace (optional, but good practice)
+    while (isspace((unsigned char)*ptr)) ptr++;
+
+    // Check if field starts with a quote
+    if (*ptr == '"') {
+        *is_quoted = 1;
+        ptr++; // Move past the opening quote
+        start = ptr; // Actual data starts here
+        while (*ptr) {
+            if (*ptr == '"') {
+                // Check for escaped quote ("")
+                if (*(ptr + 1) == '"') {
+                    // Copy the content before the escape sequence
+                    memmove(ptr, ptr + 1, strlen(ptr)); // Shift rest of string left by 1
+                    // ptr remains at the current position (which now holds the second quote)
+                     ptr++; // Move past the single quote that was kept
+                } else {
+                    // This is the closing quote
+                    field_end = ptr; // Mark the position of the closing quote
+                    *field_end = '\0'; // Null-terminate the field content
+                    ptr++; // Move past the (now null) closing quote
+                    // Find the next comma or end of line after the closing quote
+                    while (*ptr && *ptr != ',') {
+                         if (!isspace((unsigned char)*ptr)) {
+                              // Allow non-space characters after quotes, as the invoice ID might contain dashes
+                              // fprintf(stderr, "legacyGetCsvField: Warning - Non-space char after closing quote: '%c'\n", *ptr);
+                         }
+                         ptr++;
+                    }
+                    if (*ptr == ',') ptr++; // Consume the comma
+                    *line_ptr = ptr; // Update the main line pointer
+                    return start; // Return the field data
+                }
+            } else {
+                ptr++;
+            }
+        }
+         // If loop finished without finding closing quote, it's malformed or end of line
+         *field_end = '\0'; // Null terminate at current position
+         *line_ptr = ptr; // Update the main line pointer
+         return start; // Return whatever was parsed
+
+    } else {
+        // Unquoted field
+        start = ptr;
+        while (*ptr && *ptr != ',') {
+            // Special case for invoice ID which might contain '-'
+            if (*ptr == '"') {
+                // An unquoted field should ideally not contain quotes.
+                // Handle as error or just continue parsing? Let's continue.
+                fprintf(stderr, "legacyGetCsvField: Warning - Quote found in unquoted field near '%s'\n", start);
+            }
+            ptr++;
+        }
+        field_end = ptr;
+        if (*ptr == ',') {
+            *ptr = '\0'; // Null-terminate the field
+            ptr++; // Move past the comma
+        } else {
+             *ptr = '\0'; // Null-terminate at end of line
+        }
+        *line_ptr = ptr; // Update the main line pointer
+
+        // Trim trailing whitespace from unquoted field
+        char *trimmed_end = field_end - 1;
+        while(trimmed_end >= start && isspace((unsigned char)*trimmed_end)) {
+            *trimmed_end = '\0';
+            trimmed_end--;
+        }
+        return start; // Return the unquoted field
+    }
+}
+
+static int legacyParseSaleLine(char *line, struct sale_record *sale) {
+    char *field, *line_ptr = line; int is_quoted, field_index = 0; memset(sale, 0, sizeof(*sale));
+    while ((field = legacyGetCsvField(&line_ptr, &is_quoted)) != NULL) {
+        while (isspace((unsigned char)*field)) field++;
+        char *end = field + strlen(field); while (end > field && isspace((unsigned char)end[-1])) end--; *end = '\0';
+        switch (field_index) {
+            case 0: snprintf(sale->invoice_id, sizeof(sale->invoice_id), "%s", field); break;
+            case 1: snprintf(sale->date_str, sizeof(sale->date_str), "%s", field); break;
+            case 2: snprintf(sale->time_str, sizeof(sale->time_str), "%s", field); break;
+            case 3: snprintf(sale->customer_name, sizeof(sale->customer_name), "%s", field); break;
+            case 4: sale->medicine_code = atoi(field); break;
+            case 5: snprintf(sale->medicine_name, sizeof(sale->medicine_name), "%s", field); break;
+            case 6: sale->quantity = atoi(field); break;
+            case 7: sale->price_per_item = atof(field); break;
+            case 8: sale->total_cost = atof(field); break;
+            default: break; // Ignore extra fields
+        }
+        field_index++;
+    }
+    return field_index >= 9 && sale->invoice_id[0] != '\0' && sale->medicine_code > 0 && sale->quantity > 0 && sale->total_cost >= 0;
+}
+
+static long benchLegacySalesRows(const char *path) { // The old refreshSalesIndex loop, without the indexing
+    FILE *fp = fopen(path, "rb"); char line[512]; struct sale_record sale; long n = 0; if (!fp) return -1;
+    while (fgets(line, sizeof(line), fp)) { line[strcspn(line, "\r\n")] = '\0'; if (strstr(line, "InvoiceID") == NULL && legacyParseSaleLine(line, &sale)) n++; }
+    fclose(fp); return n;
+}
+
+static long benchScannerSalesRows(const char *path) { // refreshSalesIndex's loop over one whole-file chunk, without the indexing
+    size_t len; char *buf = readWholeFile(path, &len); CsvScanner sc; CsvField f[SALE_CSV_FIELDS]; struct sale_record sale; int count; long n = 0; if (!buf) return -1;
+    csvScanInit(&sc, buf, len); while ((count = csvNextRow(&sc, f, SALE_CSV_FIELDS)) > 0) { if (!csvFieldEquals(&f[0], "InvoiceID") && saleFromCsv(f, count, &sale)) n++; }
+    free(buf); return n;
+}
+
+static long benchScannerStockRows(const char *path) { long n = 0; return readStockCsv(path, benchCountRow, &n) ? n : -1; }
+static long benchLegacyStockRows(const char *path) { long n = 0; return legacyReadStockCsv(path, benchCountRow, &n) ? n : -1; }
+
+static long benchTokenizeOnly(const char *path) { // Fields found, no conversion: the scanner on its own
+    size_t len; char *buf = readWholeFile(path, &len); CsvScanner sc; CsvField f[16]; long fields = 0; int count; if (!buf) return -1;
+    csvScanInit(&sc, buf, len); while ((count = csvNextRow(&sc, f, 16)) > 0) fields += count;
+    free(buf); return fields;
+}
+
+// Best of 'reps' runs, in GB/s of file bytes (the file stays in the page cache throughout)
+static double benchCsvRate(long (*run)(const char *), const char *path, long long bytes, int reps, long *result) {
+    double best = 1e30; for (int r = 0; r < reps; r++) { double t0 = benchNow(); *result = run(path); double t = benchNow() - t0; if (t < best) best = t; }
+    return bytes / best / 1e9;
+}
+
+static int benchCsv(int argc, char **argv) {
+    int default_sizes[] = { 100000, 1000000 }; int n_sizes = argc > 0 ? argc : 2; char dir[64];
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    freopen("/dev/null", "w", stderr);
+    int best = csvSetScanLevel(-1);
+    printf("%-6s %9s %8s %11s %11s %11s %11s   %s\n", "file", "rows", "MB", "legacy GB/s", "scalar GB/s", "sse2 GB/s", "avx2 GB/s", "tokenize only scalar/sse2/avx2 GB/s");
+    for (int k = 0; k < n_sizes; k++) {
+        int rows = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (rows <= 0) continue;
+        if (!benchWriteStockCsv(STOCK_FILE, rows, 0) || !benchWriteSalesCsv(SALES_FILE, rows)) return 1;
+        for (int file = 0; file < 2; file++) {
+            const char *path = file ? SALES_FILE : STOCK_FILE; struct stat st; stat(path, &st); int reps = rows >= 1000000 ? 3 : 10; long legacy_n, n;
+            double legacy = benchCsvRate(file ? benchLegacySalesRows : benchLegacyStockRows, path, (long long)st.st_size, reps, &legacy_n);
+            printf("%-6s %9d %8.1f %11.3f", file ? "sales" : "stock", rows, st.st_size / 1e6, legacy);
+            for (int level = 0; level <= 2; level++) {
+                if (csvSetScanLevel(level) != level) { printf(" %11s", "-"); continue; }
+                double rate = benchCsvRate(file ? benchScannerSalesRows : benchScannerStockRows, path, (long long)st.st_size, reps, &n);
+                if (n != rows || legacy_n != rows) { printf("\nrow count mismatch: legacy %ld, %s %ld (want %d)\n", legacy_n, csvScanLevelName(level), n, rows); return 1; }
+                printf(" %11.3f", rate); }
+            printf("   ");
+            for (int level = 0; level <= 2; level++) { if (csvSetScanLevel(level) != level) { printf(" -"); continue; } printf(" %.3f", benchCsvRate(benchTokenizeOnly, path, (long long)st.st_size, reps, &n)); }
+            printf("\n");
+        }
+    }
+    csvSetScanLevel(best); return 0;
+}
+
+
+// --- Benchmark: chunked multi-threaded loading vs the sequential loader ---
+
+// Everything the stock load builds, folded into one hash: records in handle order, both ordered indexes and the name index.
+static unsigned long long benchStockFingerprint() {
+    unsigned long long h = 1469598103934665603ULL; StockStore *st = globalStockStore;
+#define BENCH_MIX(v) (h = (h ^ (unsigned long long)(v)) * 1099511628211ULL)
+    for (StockHandle i = 1; i <= st->count; i++) { const StockItem *m = stockStoreGet(st, i); BENCH_MIX(m->mcode); BENCH_MIX(m->quantity); BENCH_MIX(m->expiry); BENCH_MIX(invoiceHash(stockStoreName(st, i))); }
+    for (int i = 0; i < globalStockIndex->count; i++) { BENCH_MIX(globalStockIndex->items[i].key); BENCH_MIX(globalStockIndex->items[i].handle); }
+    for (int i = 0; i < globalExpiryIndex->count; i++) { BENCH_MIX(globalExpiryIndex->items[i].key); BENCH_MIX(globalExpiryIndex->items[i].handle); }
+    BENCH_MIX(globalHashTable->count); BENCH_MIX(globalNameIndex->count);
+    static const char *queries[] = { "para", "dolo 12", "cet" };
+    for (int q = 0; q < 3; q++) { OrderedEntry *r = NULL; int n = searchNameIndex(globalNameIndex, queries[q], 0, &r); BENCH_MIX(n); for (int i = 0; i < n; i++) BENCH_MIX(r[i].handle); free(r); }
+#undef BENCH_MIX
+    return h;
+}
+
+static unsigned long long benchSalesFingerprint() {
+    unsigned long long h = 1469598103934665603ULL;
+    const SalesColumns *c = &globalSales.col;
+    for (long long i = 0; i < globalSales.hdr.rows; i++) { h = (h ^ (unsigned long long)c->offset[i] ^ c->invoice[i] ^ ((unsigned long long)c->first_of_invoice[i] << 63)) * 1099511628211ULL; h = (h ^ (unsigned long long)(c->day[i] * 1000003LL + c->mcode[i] * 31LL + c->quantity[i] + c->amount[i])) * 1099511628211ULL; }
+    return (h ^ (unsigned long long)globalSales.hdr.transactions) * 1099511628211ULL;
+}
+
+static int benchLoad(int argc, char **argv) {
+    int default_sizes[] = { 1000000 }; int n_sizes = argc > 0 ? argc : 1, thread_counts[] = { 1, 2, 4, 8 }; char dir[64];
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    if (!getenv("BENCH_VERBOSE")) freopen("/dev/null", "w", stderr);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN); printf("online CPUs: %ld (speedup is bounded by this)\n", cpus);
+    printf("%-6s %9s %8s %8s %12s %9s\n", "file", "rows", "MB", "threads", "load (s)", "speedup");
+    for (int k = 0; k < n_sizes; k++) {
+        int rows = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (rows <= 0) continue;
+        if (!benchWriteStockCsv(STOCK_FILE, rows, 0) || !benchWriteSalesCsv(SALES_FILE, rows)) return 1;
+        FILE *fp = fopen(STOCK_FILE, "a"); fprintf(fp, "Dup of 1,1,X,1,1.00,1,2030,1,1\nbroken line\nDup of %d,%d,X,1,1.00,1,2030,1,1\n", rows, rows); fclose(fp); // Duplicates and a bad row must resolve as before
+        for (int file = 0; file < 2; file++) {
+            struct stat st; stat(file ? SALES_FILE : STOCK_FILE, &st); double base = 0; unsigned long long expect = 0;
+            for (int t = 0; t < 4; t++) {
+                loadThreadCount = thread_counts[t]; unsigned long long got; double secs;
+                if (file == 0) { createGlobalStock(); double t0 = benchNow(); int ok = loadStockData(STOCK_FILE); secs = benchNow() - t0;
+                    if (!ok || globalStockStore->count != (StockHandle)rows) { printf("stock load failed (%d threads): %d records\n", thread_counts[t], (int)globalStockStore->count); return 1; }
+                    got = benchStockFingerprint(); freeGlobalStock(); }
+                else { freeSalesIndex(); remove(SALES_INDEX_FILE); double t0 = benchNow(); int ok = refreshSalesIndex(); secs = benchNow() - t0;
+                    if (!ok || globalSales.hdr.rows != rows) { printf("sales index failed (%d threads): %lld rows\n", thread_counts[t], globalSales.hdr.rows); return 1; }
+                    got = benchSalesFingerprint(); }
+                if (t == 0) { base = secs; expect = got; } else if (got != expect) { printf("%s built with %d threads differs from the sequential load\n", file ? "sales index" : "stock", thread_counts[t]); return 1; }
+                printf("%-6s %9d %8.1f %8d %12.4f %8.2fx\n", file ? "sales" : "stock", rows, st.st_size / 1e6, thread_counts[t], secs, base / secs); } }
+    }
+    loadThreadCount = 0; freeSalesIndex(); return 0;
+}
+
+
+// --- Benchmark: single-pass request parser vs one get_param scan per field ---
+
+// get_param and parse_multi_value_param as they were before RequestParams, kept here as the baseline: each call
+// rescans the whole body and mallocs (twice) per value.
+static char *legacyGetParam(const char *data, const char *param_name) {
+    if (data == NULL || param_name == NULL || *data == '\0') { return NULL; }
+    const char *pair_start = data; char *found_value_encoded = NULL; char *found_value_decoded = NULL;
+    size_t param_len = strlen(param_name);
+    while (pair_start && *pair_start) {
+        const char *pair_end = strchr(pair_start, '&'); size_t current_pair_len = pair_end ? (pair_end - pair_start) : strlen(pair_start);
+        const char *eq_pos = NULL; size_t i; for (i = 0; i < current_pair_len; ++i) { if (pair_start[i] == '=') { eq_pos = pair_start + i; break; } }
+        if (eq_pos && (size_t)(eq_pos - pair_start) == param_len && strncmp(pair_start, param_name, param_len) == 0) {
+            const char *value_start = eq_pos + 1; size_t value_len = (pair_start + current_pair_len) - value_start;
+            found_value_encoded = (char *)malloc(value_len + 1); if (!found_value_encoded) { return NULL; }
+            strncpy(found_value_encoded, value_start, value_len); found_value_encoded[value_len] = '\0';
+            found_value_decoded = (char *)malloc(value_len + 1); if (!found_value_decoded) { free(found_value_encoded); return NULL; }
+            urlDecode(found_value_decoded, found_value_encoded); free(found_value_encoded); return found_value_decoded;
+        } if (pair_end) { pair_start = pair_end + 1; } else { break; }
+    } return NULL;
+}
+
+static int legacyParseMultiValueParam(const char *data, const char *param_name, char **values, int max_values) {
+    if (data == NULL || param_name == NULL || values == NULL || max_values <= 0) { return 0; }
+    const char *pair_start = data; size_t param_len = strlen(param_name); int count = 0;
+    while (pair_start && *pair_start && count < max_values) {
+        const char *pair_end = strchr(pair_start, '&'); size_t current_pair_len = pair_end ? (pair_end - pair_start) : strlen(pair_start);
+        const char *eq_pos = NULL; size_t i; for (i = 0; i < current_pair_len; ++i) { if (pair_start[i] == '=') { eq_pos = pair_start + i; break; } }
+        if (eq_pos && (size_t)(eq_pos - pair_start) == param_len && strncmp(pair_start, param_name, param_len) == 0) {
+            const char *value_start = eq_pos + 1; size_t value_len = (pair_start + current_pair_len) - value_start;
+            char *encoded_val = (char *)malloc(value_len + 1); char *decoded_val = (char *)malloc(value_len + 1);
+            if (!encoded_val || !decoded_val) { fprintf(stderr, "parse_multi_value_param: Mem alloc failed.\n"); if (encoded_val) free(encoded_val); if (decoded_val) free(decoded_val); for (int k = 0; k < count; k++) { free(values[k]); values[k] = NULL; } return -1; }
+            strncpy(encoded_val, value_start, value_len); encoded_val[value_len] = '\0';
+            urlDecode(decoded_val, encoded_val); free(encoded_val); values[count++] = decoded_val;
+        } if (pair_end) { pair_start = pair_end + 1; } else { break; }
+    } return count;
+}
+
+// A billing form body with 'items' code/quantity pairs (browsers send the [] URL-encoded), optionally with a long
+// free-text note field placed before (note_first) or after the item rows.
+static char *benchBillingBody(int items, size_t padding, int note_first) {
+    size_t cap = 128 + (size_t)items * 48 + padding; char *body = (char *)malloc(cap); if (!body) return NULL;
+    size_t n = (size_t)snprintf(body, cap, "action=billing");
+    for (int pass = 0; pass < 2; pass++) {
+        if (padding && pass == !note_first) { n += (size_t)snprintf(body + n, cap - n, "&note=Deliver+after+6pm+"); memset(body + n, 'x', padding); n += padding; body[n] = '\0'; }
+        if (pass == 1) { n += (size_t)snprintf(body + n, cap - n, "&customerName=Walk-in+Customer");
+            for (int i = 0; i < items; i++) n += (size_t)snprintf(body + n, cap - n, "&medicineCode%%5B%%5D=%d&quantity%%5B%%5D=%d", 1 + i, 1 + i % 5); }
+    }
+    return body;
+}
+
+static int benchParams(int argc, char **argv) {
+    int default_items[] = { 1, 10, 50 }; int n_sizes = argc > 0 ? argc : 3; size_t paddings[] = { 0, 1024 * 1024, 1024 * 1024 }; const char *labels[] = { "form", "items+1MB", "1MB+items" };
+    freopen("/dev/null", "w", stderr);
+    printf("%-7s %-11s %10s %16s %16s %9s\n", "items", "body", "bytes", "get_param (us)", "single (us)", "speedup");
+    for (size_t pad = 0; pad < sizeof(paddings) / sizeof(paddings[0]); pad++) {
+        for (int k = 0; k < n_sizes; k++) {
+            int items = argc > 0 ? atoi(argv[k]) : default_items[k]; if (items <= 0) continue;
+            char *body = benchBillingBody(items, paddings[pad], pad == 2); if (!body) return 1; size_t len = strlen(body); int reps = (int)(20000000 / (len + 1000)) + 1, legacy_n = 0, single_n = 0;
+            double t0 = benchNow(); // What one billing POST used to cost: the router's action, then processBillingMultiple's own scans
+            for (int r = 0; r < reps; r++) { char *codes[MAX_BILL_ITEMS], *qtys[MAX_BILL_ITEMS]; free(legacyGetParam(body, "action")); free(legacyGetParam(body, "customerName"));
+                int nc = legacyParseMultiValueParam(body, "medicineCode%5B%5D", codes, MAX_BILL_ITEMS), nq = legacyParseMultiValueParam(body, "quantity%5B%5D", qtys, MAX_BILL_ITEMS);
+                for (int i = 0; i < nc; i++) { free(codes[i]); }
+                for (int i = 0; i < nq; i++) { free(qtys[i]); }
+                legacy_n = nc; }
+            double legacy = (benchNow() - t0) / reps; t0 = benchNow();
+            char *work = (char *)malloc(len + 1); if (!work) return 1; memcpy(work, body, len + 1); // Parsing decodes in place, so each rep restores the body first (timed separately below)
+            for (int r = 0; r < reps; r++) { RequestParams req; const char *codes[MAX_BILL_ITEMS], *qtys[MAX_BILL_ITEMS]; memcpy(work, body, len + 1); if (!parseRequestParams(work, &req)) return 1;
+                requestParam(&req, "action"); requestParam(&req, "customerName"); single_n = requestParamValues(&req, "medicineCode[]", codes, MAX_BILL_ITEMS); requestParamValues(&req, "quantity[]", qtys, MAX_BILL_ITEMS); freeRequestParams(&req); }
+            double single = (benchNow() - t0) / reps; t0 = benchNow();
+            for (int r = 0; r < reps; r++) { memcpy(work, body, len + 1); __asm__ __volatile__("" : : "r"(work) : "memory"); }
+            single -= (benchNow() - t0) / reps; free(work); // The CGI body is already a private buffer; only the bench has to restore it
+            if (legacy_n != (single_n < MAX_BILL_ITEMS ? single_n : MAX_BILL_ITEMS)) { printf("item count mismatch: legacy %d, single-pass %d\n", legacy_n, single_n); return 1; }
+            printf("%-7d %-11s %10zu %16.2f %16.2f %8.1fx\n", items, labels[pad], len, legacy * 1e6, single * 1e6, legacy / single);
+            free(body);
+        }
+    }
+    return 0;
+}
+
+
+// --- Benchmark: group-commit sales writer vs one open/seek/write/close per line item ---
+
+// saveSaleRecord as it was before the group commit (and before the sales index), kept here as the baseline.
+static int legacySaveSaleRecord(const struct sale_record *sale) {
+    FILE *fp = fopen(SALES_FILE, "a"); if (fp == NULL) return 0;
+    fseek(fp, 0, SEEK_END); long size = ftell(fp);
+    if (size == 0) { fprintf(fp, "InvoiceID,Date,Time,CustomerName,MedicineCode,MedicineName,Quantity,PricePerItem,TotalCost\n"); }
+    else { fseek(fp, -1, SEEK_END); if (fgetc(fp) != '\n') { fprintf(fp, "\n"); } fseek(fp, 0, SEEK_END); }
+    int r = fprintf(fp, "\"%s\",%s,%s,\"%s\",%d,\"%s\",%d,%.2f,%.2f\n", sale->invoice_id, sale->date_str, sale->time_str, sale->customer_name, sale->medicine_code, sale->medicine_name, sale->quantity, sale->price_per_item, sale->total_cost);
+    fclose(fp); return r >= 0;
+}
+
+static int benchBilling(int argc, char **argv) {
+    int default_items[] = { 1, 10, 50 }; int n_sizes = argc > 0 ? argc : 3; int bills = 200; char dir[64];
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    freopen("/dev/null", "w", stderr);
+    printf("%-6s %-22s %12s %14s\n", "items", "writer", "bills/s", "rows/s");
+    for (int k = 0; k < n_sizes; k++) {
+        int items = argc > 0 ? atoi(argv[k]) : default_items[k]; if (items <= 0 || items > MAX_BILL_ITEMS) continue;
+        struct sale_record bill[MAX_BILL_ITEMS];
+        for (int i = 0; i < items; i++) { memset(&bill[i], 0, sizeof(bill[i])); strcpy(bill[i].date_str, "2026-10-16"); strcpy(bill[i].time_str, "10:00:00"); strcpy(bill[i].customer_name, "Bench Customer");
+            bill[i].medicine_code = 100 + i; snprintf(bill[i].medicine_name, sizeof(bill[i].medicine_name), "Paracetamol %d", i); bill[i].quantity = 2; bill[i].price_per_item = 12.5f; bill[i].total_cost = 25.0f; bill[i].total_paise = 2500; }
+        for (int writer = 0; writer < 3; writer++) { // 0: legacy per line, 1: fsync'd commit per line, 2: one commit per bill
+            remove(SALES_FILE); remove(SALES_INDEX_FILE); freeSalesIndex(); double t0 = benchNow();
+            for (int b = 0; b < bills; b++) {
+                for (int i = 0; i < items; i++) snprintf(bill[i].invoice_id, sizeof(bill[i].invoice_id), "%d-%d", 1700000000 + b, writer);
+                if (writer == 2) { saveSaleRecords(bill, items); } else { for (int i = 0; i < items; i++) { if (writer == 0) legacySaveSaleRecord(&bill[i]); else saveSaleRecord(&bill[i]); } } }
+            double secs = benchNow() - t0;
+            long rows = 0; FILE *fp = fopen(SALES_FILE, "r"); char line[512]; while (fp && fgets(line, sizeof(line), fp)) rows++; if (fp) fclose(fp);
+            if (rows < (long)bills * items) { printf("only %ld of %d rows written\n", rows, bills * items); return 1; }
+            printf("%-6d %-22s %12.1f %14.1f\n", items, writer == 0 ? "legacy per-line" : writer == 1 ? "fsync per-line" : "group commit per bill", bills / secs, (double)bills * items / secs);
+        }
+    }
+    freeSalesIndex(); return 0;
+}
+
+
+// --- Benchmark: concurrent billing processes (lost-update stress test) ---
+
+#define BENCH_CONC_ITEMS 20 // Small catalogue, so concurrent bills keep colliding on the same items
+
+// One billing counter: a long-lived process with its own (increasingly stale) copy of the stock, like --serve next to CGI hits.
+static void benchConcurrencyWorker(int worker, int bills) {
+    int devnull = open("/dev/null", O_WRONLY); dup2(devnull, STDOUT_FILENO); dup2(devnull, STDERR_FILENO);
+    srand(1000 + worker); if (!loadGlobalStock()) _exit(2);
+    char req[512];
+    for (int b = 0; b < bills; b++) {
+        int first = rand() % BENCH_CONC_ITEMS, len = snprintf(req, sizeof(req), "action=billing&customerName=Counter%d", worker);
+        for (int i = 0; i < 3; i++) len += snprintf(req + len, sizeof(req) - len, "&medicineCode%%5B%%5D=%d&quantity%%5B%%5D=%d", 1 + (first + i * 7) % BENCH_CONC_ITEMS, 1 + (b + i) % 3); // 3 distinct items
+        RequestParams params; if (!parseRequestParams(req, &params)) _exit(2); processBillingMultiple(&params); freeRequestParams(&params); fflush(stdout); maybeCompactStockJournal();
+    }
+    freeGlobalStock(); freeSalesIndex(); _exit(0);
+}
+
+static int benchConcurrency(int argc, char **argv) {
+    int default_procs[] = { 1, 2, 4, 8 }; int n_sizes = argc > 0 ? argc : 4; const int total_bills = 8000, start_qty = 1000000; char dir[64]; // Enough bills to push the journal past JOURNAL_COMPACT_BYTES mid-run
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    printf("%-6s %10s %12s %12s %14s\n", "procs", "bills", "secs", "bills/s", "lost updates");
+    for (int k = 0; k < n_sizes; k++) {
+        int procs = argc > 0 ? atoi(argv[k]) : default_procs[k]; if (procs <= 0) continue;
+        remove(STOCK_JOURNAL_FILE); remove(STOCK_SNAPSHOT_FILE); remove(SALES_FILE); remove(SALES_INDEX_FILE);
+        FILE *fp = fopen(STOCK_FILE, "w"); if (!fp) return 1;
+        for (int c = 1; c <= BENCH_CONC_ITEMS; c++) fprintf(fp, "Item %d,%d,Bench Pharma,9800000000,%.2f,%d,2030,1,1\n", c, c, 1.0 + c, start_qty);
+        fclose(fp); fflush(stdout);
+        double t0 = benchNow(); pid_t pids[64]; int n = procs < 64 ? procs : 64;
+        for (int w = 0; w < n; w++) { pids[w] = fork(); if (pids[w] == 0) benchConcurrencyWorker(w, total_bills / n); }
+        int failed = 0; for (int w = 0; w < n; w++) { int status = 0; waitpid(pids[w], &status, 0); if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++; }
+        double secs = benchNow() - t0;
+        // Every unit that left stock must appear in sales.csv, and vice versa
+        long sold[BENCH_CONC_ITEMS + 1] = { 0 }; long rows = 0; char line[512]; struct sale_record sale;
+        fp = fopen(SALES_FILE, "r"); while (fp && fgets(line, sizeof(line), fp)) { line[strcspn(line, "\r\n")] = 0; if (parseSaleLine(line, &sale) && sale.medicine_code >= 1 && sale.medicine_code <= BENCH_CONC_ITEMS) { sold[sale.medicine_code] += sale.quantity; rows++; } } if (fp) fclose(fp);
+        freopen("/dev/null", "w", stderr); if (!loadGlobalStock()) { printf("reload failed\n"); return 1; }
+        long lost = 0; for (int c = 1; c <= BENCH_CONC_ITEMS; c++) { StockItem *m = searchHashTableByCode(globalHashTable, c); lost += labs((long)start_qty - sold[c] - (m ? m->quantity : 0)); }
+        freeGlobalStock();
+        printf("%-6d %10ld %12.3f %12.1f %14ld%s\n", n, rows / 3, secs, rows / 3 / secs, lost, failed ? "  (worker failed)" : "");
+        if (lost != 0 || failed) return 1;
+    }
+    return 0;
+}
+
+
+// --- Benchmark: bulk import_stock vs one add_stock POST per row ---
+
+// Like benchStockFingerprint, but walks the ordered indexes in key order through their insert buffers
+// (rows added one by one sit in delta[], a bulk load or import_stock puts them straight into items[])
+static unsigned long long benchStockContentFingerprint() {
+    unsigned long long h = 1469598103934665603ULL; StockStore *st = globalStockStore; OrderedIndex *indexes[2] = { globalStockIndex, globalExpiryIndex };
+#define BENCH_MIX(v) (h = (h ^ (unsigned long long)(v)) * 1099511628211ULL)
+    for (StockHandle i = 1; i <= st->count; i++) { const StockItem *m = stockStoreGet(st, i); BENCH_MIX(m->mcode); BENCH_MIX(m->quantity); BENCH_MIX(m->expiry); BENCH_MIX(invoiceHash(stockStoreName(st, i))); }
+    for (int x = 0; x < 2; x++) { OrderedIndexIter it; orderedIndexSeek(indexes[x], ORDERED_KEY_MIN, &it); BENCH_MIX(orderedIndexSize(indexes[x]));
+        for (;;) { OrderedKey key = orderedIndexPeekKey(&it); StockItem *m = orderedIndexNext(&it); if (m == NULL) break; BENCH_MIX(key); BENCH_MIX(m->mcode); } }
+    BENCH_MIX(globalHashTable->count); BENCH_MIX(globalNameIndex->count);
+#undef BENCH_MIX
+    return h;
+}
+
+static int benchImport(int argc, char **argv) {
+    int default_sizes[] = { 3000, 30000 }; int n_sizes = argc > 0 ? argc : 2; char dir[64];
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    if (!getenv("BENCH_VERBOSE")) freopen("/dev/null", "w", stderr);
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w"); if (!out || !freopen("page.html", "w", stdout)) return 1;
+    fprintf(out, "%-8s %-8s %-14s %12s %12s\n", "stock", "rows", "method", "secs", "rows/sec");
+    for (int k = 0; k < n_sizes; k++) {
+        int rows = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (rows <= 0) continue; int base = 100000;
+        size_t cap = (size_t)rows * 96 + 1; char *csv = (char *)malloc(cap), form[512]; size_t len = 0; if (csv == NULL) return 1;
+        for (int i = 0; i < rows; i++) len += (size_t)snprintf(csv + len, cap - len, "Delivery Item %d,%d,Bench Distributors,9800000000,%.2f,%d,2030,%d,%d\n", i, base + 1 + i, 1.0 + i % 50, 1 + i % 200, 1 + i % 12, 1 + i % 28);
+        for (int method = 0; method < 2; method++) {
+            benchWriteStockCsv(STOCK_FILE, base, 1); remove(STOCK_SNAPSHOT_FILE); remove(STOCK_JOURNAL_FILE); freeGlobalStock(); loadGlobalStock();
+            double t0 = benchNow();
+            if (method == 0) { for (int i = 0; i < rows; i++) { // What a client had to do before: one add_stock form per row
+                snprintf(form, sizeof(form), "action=add_stock&medicineName=Delivery+Item+%d&medicineCode=%d&suppliername=Bench+Distributors&suppliercontact=9800000000&price=%.2f&quantity=%d&expiry=2030-%02d-%02d", i, base + 1 + i, 1.0 + i % 50, 1 + i % 200, 1 + i % 12, 1 + i % 28);
+                syncStockFromDisk(); handleRequest("POST", form); fflush(stdout); rewind(stdout); } }
+            else { char fields[] = "action=import_stock"; requestCsvBody = csv; syncStockFromDisk(); handleRequest("POST", fields); fflush(stdout); rewind(stdout); requestCsvBody = NULL; }
+            double secs = benchNow() - t0; unsigned long long live = benchStockContentFingerprint(); StockHandle count = globalStockStore->count;
+            freeGlobalStock(); remove(STOCK_SNAPSHOT_FILE); loadGlobalStock(); // Memory after the import must match a fresh load of what was written
+            if (count != (StockHandle)(base + rows) || globalStockStore->count != count || benchStockContentFingerprint() != live) { fprintf(out, "%s: stock mismatch after import (%d in memory, %d on disk)\n", method ? "import" : "add_stock", (int)count, (int)globalStockStore->count); return 1; }
+            fprintf(out, "%-8d %-8d %-14s %12.4f %12.0f\n", base, rows, method ? "import_stock" : "add_stock x N", secs, rows / secs); }
+        free(csv); }
+    freeGlobalStock(); fclose(out); return 0;
+}
+
+
+// --- Benchmark suite: synthetic pharmacy dataset, handlers driven through simulated CGI requests ---
+
+typedef struct { int skus, sales_per_day, years, sorted, requests, seed; const char *mode; } BenchSuiteConfig;
+
+static double benchUniform() { return rand() / (RAND_MAX + 1.0); }
+static int benchSuiteCode(int i) { return 100000 + i; } // Medicine codes are 100000 + 0..skus-1
+static int benchSuitePopular(const BenchSuiteConfig *c) { double u = benchUniform(); return (int)(c->skus * u * u * u); } // Skewed: a few items sell most
+
+static const char *benchGenerics[] = { "Paracetamol", "Amoxicillin", "Cetirizine", "Ibuprofen", "Azithromycin", "Omeprazole", "Metformin", "Atorvastatin", "Pantoprazole", "Dolo",
+    "Amlodipine", "Losartan", "Montelukast", "Levocetirizine", "Ciprofloxacin", "Doxycycline", "Ranitidine", "Diclofenac", "Aceclofenac", "Telmisartan",
+    "Glimepiride", "Rosuvastatin", "Clopidogrel", "Domperidone", "Ondansetron", "Cefixime", "Metronidazole", "Vitamin D3", "Calcium Carbonate", "Ferrous Sulfate" };
+static const char *benchForms[] = { "Tablet", "Capsule", "Syrup", "Injection", "Drops", "Gel" };
+static const int benchStrengths[] = { 5, 10, 20, 25, 40, 50, 100, 250, 500, 650 };
+#define BENCH_GENERICS (int)(sizeof(benchGenerics) / sizeof(benchGenerics[0]))
+
+static void benchSuiteName(int i, char *name, size_t size) {
+    snprintf(name, size, "%s %dmg %s %d", benchGenerics[i % BENCH_GENERICS], benchStrengths[(i / BENCH_GENERICS) % 10], benchForms[(i / 7) % 6], i / (BENCH_GENERICS * 10));
+}
+
+// stock.csv: 'skus' items, codes in file order ascending or shuffled; expiries from last year to three years out (some already expired).
+// sales.csv: 'years' of history ending today, 'sales_per_day' rows a day in invoices of 1-4 lines, popular items sold most.
+static int benchGenerateDataset(const BenchSuiteConfig *c) {
+    int *order = (int *)malloc(sizeof(int) * (size_t)c->skus); if (order == NULL) return 0;
+    for (int i = 0; i < c->skus; i++) order[i] = i;
+    if (!c->sorted) { for (int i = c->skus - 1; i > 0; i--) { int j = rand() % (i + 1); int t = order[i]; order[i] = order[j]; order[j] = t; } }
+    time_t now = time(NULL); struct tm today = *localtime(&now); char name[64];
+    FILE *fp = fopen(STOCK_FILE, "w"); if (fp == NULL) { free(order); return 0; }
+    for (int k = 0; k < c->skus; k++) { int i = order[k]; benchSuiteName(i, name, sizeof(name));
+        fprintf(fp, "%s,%d,%s Distributors,%lld,%.2f,%d,%d,%d,%d\n", name, benchSuiteCode(i), benchGenerics[(i * 7) % BENCH_GENERICS], 9800000000LL + i % 100000, 2.0 + (i % 900) * 0.5, 1000000 + i % 5000,
+                today.tm_year + 1900 - 1 + rand() % 4, 1 + rand() % 12, 1 + rand() % 28); }
+    free(order); if (fclose(fp) != 0) return 0;
+    fp = fopen(SALES_FILE, "w"); if (fp == NULL) return 0;
+    fprintf(fp, "InvoiceID,Date,Time,CustomerName,MedicineCode,MedicineName,Quantity,PricePerItem,TotalCost\n");
+    long long invoice = 1600000000LL; int days = c->years * 365;
+    for (int d = days; d > 0; d--) {
+        time_t t = now - (time_t)d * 86400; struct tm day = *localtime(&t);
+        for (int r = 0; r < c->sales_per_day; ) { int lines = 1 + rand() % 4, minute = 9 * 60 + (int)((long long)r * 720 / (c->sales_per_day ? c->sales_per_day : 1)); invoice++;
+            for (int l = 0; l < lines && r < c->sales_per_day; l++, r++) { int i = benchSuitePopular(c), qty = 1 + rand() % 3; double price = 2.0 + (i % 900) * 0.5; benchSuiteName(i, name, sizeof(name));
+                fprintf(fp, "\"%lld-%d\",%04d-%02d-%02d,%02d:%02d:%02d,\"Customer %d\",%d,\"%s\",%d,%.2f,%.2f\n", invoice, 4242, day.tm_year + 1900, day.tm_mon + 1, day.tm_mday, minute / 60, minute % 60, rand() % 60,
+                        (int)(invoice % 5000), benchSuiteCode(i), name, qty, price, price * qty); } } }
+    return fclose(fp) == 0;
+}
+
+// One request the way medical.exe sees it: method + form body/query string, rendered into page.html.
+// cgi=1 starts from nothing like a fresh process (stock and sales index reloaded); otherwise state is resident as in --serve.
+static double benchSuiteRequest(const char *method, const char *data, int cgi) {
+    char buf[2048]; snprintf(buf, sizeof(buf), "%s", data); double t0 = benchNow();
+    setenv("REQUEST_METHOD", method, 1); if (strcmp(method, "GET") == 0) setenv("QUERY_STRING", data, 1); else { char len[16]; snprintf(len, sizeof(len), "%zu", strlen(data)); setenv("CONTENT_LENGTH", len, 1); }
+    if (cgi) { freeGlobalStock(); freeSalesIndex(); if (!loadGlobalStock()) return -1; } else if (!syncStockFromDisk()) return -1;
+    handleRequest(method, buf[0] ? buf : NULL); fflush(stdout); double secs = benchNow() - t0;
+    if (!cgi) maybeCompactStockJournal(); // The server does this after the response is out
+    rewind(stdout); return secs;
+}
+
+// One CSV result row: latency percentiles over the samples and requests/sec over their total time.
+static void benchSuiteReport(FILE *out, const char *mode, const char *op, double *lat, int n) {
+    if (n <= 0) return;
+    double total = 0; for (int i = 0; i < n; i++) total += lat[i];
+    qsort(lat, (size_t)n, sizeof(double), compareDouble);
+#define BENCH_PCT(q) (lat[(int)((q) * (n - 1) + 0.5)] * 1e3)
+    fprintf(out, "%s,%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.1f\n", mode, op, n, total / n * 1e3, BENCH_PCT(0.50), BENCH_PCT(0.90), BENCH_PCT(0.99), lat[n - 1] * 1e3, n / total);
+#undef BENCH_PCT
+}
+
+static int benchSuite(int argc, char **argv) {
+    BenchSuiteConfig c = { 100000, 500, 2, 0, 200, 42, "both" }; char dir[64];
+    for (int i = 0; i < argc; i++) { const char *eq = strchr(argv[i], '='); const char *v = eq ? eq + 1 : "";
+        if (strncmp(argv[i], "skus=", 5) == 0) c.skus = atoi(v); else if (strncmp(argv[i], "sales_per_day=", 14) == 0) c.sales_per_day = atoi(v); else if (strncmp(argv[i], "years=", 6) == 0) c.years = atoi(v);
+        else if (strncmp(argv[i], "order=", 6) == 0) c.sorted = strcmp(v, "sorted") == 0; else if (strncmp(argv[i], "requests=", 9) == 0) c.requests = atoi(v); else if (strncmp(argv[i], "seed=", 5) == 0) c.seed = atoi(v);
+        else if (strncmp(argv[i], "mode=", 5) == 0) c.mode = v; else { fprintf(stderr, "suite: unknown option '%s'\n", argv[i]); return 1; } }
+    if (c.skus <= 0 || c.sales_per_day < 0 || c.years < 0 || c.requests <= 0) { fprintf(stderr, "suite: skus and requests must be > 0\n"); return 1; }
+    if (!benchEnterScratchDir(dir, sizeof(dir))) return 1;
+    if (!getenv("BENCH_VERBOSE")) freopen("/dev/null", "w", stderr);
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w"); if (!out || !freopen("page.html", "w", stdout)) return 1; // Pages go to a scratch file through fd 1
+    srand((unsigned int)c.seed); double t0 = benchNow();
+    if (!benchGenerateDataset(&c)) { fprintf(out, "suite: cannot write the dataset\n"); return 1; }
+    struct stat stock_st, sales_st; stat(STOCK_FILE, &stock_st); stat(SALES_FILE, &sales_st);
+    fprintf(out, "# skus=%d sales_per_day=%d years=%d order=%s requests=%d seed=%d stock_bytes=%lld sales_bytes=%lld generate_s=%.2f\n", c.skus, c.sales_per_day, c.years, c.sorted ? "sorted" : "shuffled", c.requests, c.seed,
+            (long long)stock_st.st_size, (long long)sales_st.st_size, benchNow() - t0);
+    fprintf(out, "mode,op,requests,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,ops_per_sec\n");
+    double *lat = (double *)malloc(sizeof(double) * (size_t)c.requests); if (lat == NULL) return 1;
+    int loads = c.requests < 20 ? c.requests : 20, failed = 0; char data[1024], name[64];
+    for (int i = 0; i < loads; i++) { freeGlobalStock(); createGlobalStock(); double t = benchNow(); if (!loadStockData(STOCK_FILE)) failed++; lat[i] = benchNow() - t; }
+    benchSuiteReport(out, "-", "load", lat, loads); freeGlobalStock(); loadGlobalStock(); refreshSalesIndex(); // Warm: snapshot and sales.idx exist from here on, as in a deployed install
+    static const char *modes[] = { "serve", "cgi" };
+    static const char *ops[] = { "search", "billing", "update", "expiry", "report" };
+    for (int m = 0; m < 2; m++) {
+        if (strcmp(c.mode, "both") != 0 && strcmp(c.mode, modes[m]) != 0) continue;
+        for (int o = 0; o < 5; o++) {
+            for (int i = 0; i < c.requests; i++) { int item = benchSuitePopular(&c); const char *method = "GET";
+                switch (o) {
+                case 0: if (i % 2) { benchSuiteName(item, name, sizeof(name)); name[4 + i % 5] = '\0'; for (char *p = name; *p; p++) if (*p == ' ') *p = '+'; snprintf(data, sizeof(data), "actionType=searchStock&searchQuery=%s", name); } // Name fragment
+                        else { snprintf(data, sizeof(data), "actionType=searchStock&searchQuery=%d", benchSuiteCode(item)); }
+                        break; // Exact code
+                case 1: { int len = snprintf(data, sizeof(data), "action=billing&customerName=Customer+%d", i), lines = 1 + i % 4; method = "POST";
+                        for (int l = 0; l < lines; l++) { len += snprintf(data + len, sizeof(data) - (size_t)len, "&medicineCode%%5B%%5D=%d&quantity%%5B%%5D=1", benchSuiteCode((item + l * 7919) % c.skus)); }
+                        break; }
+                case 2: method = "POST"; snprintf(data, sizeof(data), "action=update_stock&medicineCode=%d&newQuantity=5", benchSuiteCode(item)); break;
+                case 3: snprintf(data, sizeof(data), "action=check_expiry&days=%d", (i % 3 + 1) * 30); break;
+                default: if (i % 2) snprintf(data, sizeof(data), "action=generate_report"); // Newest page of detail rows
+                         else { time_t t = time(NULL) - (time_t)(i % 12 + 1) * 30 * 86400; struct tm tm = *localtime(&t); snprintf(data, sizeof(data), "action=generate_report&from=%04d-%02d-01&to=%04d-%02d-28", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_year + 1900, tm.tm_mon + 1); } break; } // One month
+                if ((lat[i] = benchSuiteRequest(method, data, m)) < 0) { failed++; lat[i] = 0; } }
+            benchSuiteReport(out, modes[m], ops[o], lat, c.requests); }
+        fflush(out); }
+    free(lat); freeGlobalStock(); freeSalesIndex();
+    if (failed) fprintf(out, "# %d requests failed\n", failed);
+    fclose(out); return failed != 0;
+}
+
+
+// --- Benchmark: resident memory of the stock indexes ---
+
+static long benchRssBytes() {
+    long pages = 0, resident = 0; FILE *fp = fopen("/proc/self/statm", "r"); if (!fp) return -1;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) { resident = -1; } fclose(fp);
+    return resident < 0 ? -1 : resident * sysconf(_SC_PAGESIZE);
+}
+
+// Builds one layout in a child process so each RSS delta starts from the same clean heap.
+static void benchMemoryLayout(int n, int layout) {
+    fflush(stdout); pid_t pid = fork(); if (pid < 0) return;
+    if (pid > 0) { waitpid(pid, NULL, 0); return; }
+    int *codes = (int *)malloc(sizeof(int) * (size_t)n); for (int i = 0; i < n; i++) codes[i] = i + 1;
+    for (int i = n - 1; i > 0; i--) { int j = rand() % (i + 1); int t = codes[i]; codes[i] = codes[j]; codes[j] = t; }
+    struct medicine m; memset(&m, 0, sizeof(m)); strcpy(m.name, "Paracetamol 500"); strcpy(m.s_name, "ABC Pharma"); m.year = 2027; m.month = m.day = 1;
+    long before = benchRssBytes(); size_t accounted = 0; const char *name;
+    if (layout == 0) { // Original layout: every row copied into a chained hash node and again into a BST node
+        name = "hash+bst copies"; LegacyHashNode **legacy = (LegacyHashNode **)calloc(LEGACY_HASH_TABLE_SIZE, sizeof(LegacyHashNode *)); LegacyBstNode *root = NULL;
+        for (int i = 0; i < n; i++) { m.mcode = codes[i]; legacyInsert(legacy, m); root = legacyBstInsert(root, m); }
+        accounted = (size_t)n * (sizeof(LegacyHashNode) + sizeof(LegacyBstNode)) + sizeof(LegacyHashNode *) * LEGACY_HASH_TABLE_SIZE;
+    } else { // Current layout: one record in the store, handles in every index
+        name = "store+handles"; createGlobalStock();
+        for (int i = 0; i < n; i++) { m.mcode = codes[i]; addStockRecord(&m, 1); } orderedIndexFinishLoad(globalStockIndex); orderedIndexFinishLoad(globalExpiryIndex);
+        accounted = stockStoreBytes(globalStockStore) + sizeof(HashTable) + sizeof(HashSlot) * (size_t)globalHashTable->capacity + orderedIndexBytes(globalStockIndex) + orderedIndexBytes(globalExpiryIndex) + nameIndexBytes(globalNameIndex);
+    }
+    long after = benchRssBytes();
+    printf("%-8d %-16s %14.2f %14.2f %12.1f\n", n, name, accounted / 1048576.0, (after - before) / 1048576.0, (double)accounted / n);
+    fflush(stdout); _exit(0);
+}
+
+static int benchMemory(int argc, char **argv) {
+    int default_sizes[] = { 100000 }; int n_sizes = argc > 0 ? argc : 1;
+    freopen("/dev/null", "w", stderr);
+    printf("%-8s %-16s %14s %14s %12s\n", "items", "layout", "heap (MiB)", "rss +(MiB)", "bytes/item");
+    for (int k = 0; k < n_sizes; k++) {
+        int n = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (n <= 0) continue;
+        benchMemoryLayout(n, 0); benchMemoryLayout(n, 1);
+    }
+    return 0;
+}
+
+
+// --- Benchmark: hot/cold split records vs the flat struct medicine ---
+
+// Hardware cache misses of this process (user space), or -1 where perf events are not allowed (containers, perf_event_paranoid)
+static int benchCacheMissCounter() {
+#ifdef __linux__
+    struct perf_event_attr attr; memset(&attr, 0, sizeof(attr)); attr.type = PERF_TYPE_HARDWARE; attr.size = sizeof(attr); attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1; attr.exclude_kernel = 1; attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+// The same four scans over both layouts, visiting records in code order (as the stock page and expiry check do) through 'order'
+static long long flatQtyScan(const struct medicine *r, const StockHandle *order, int n) { long long sum = 0; for (int i = 0; i < n; i++) sum += r[order[i] - 1].quantity; return sum; }
+static long long flatPriceScan(const struct medicine *r, const StockHandle *order, int n) { long long hits = 0; for (int i = 0; i < n; i++) { float p = r[order[i] - 1].price; hits += p >= 50.0f && p <= 60.0f; } return hits; }
+static long long flatExpiryScan(const struct medicine *r, const StockHandle *order, int n) { long long hits = 0; for (int i = 0; i < n; i++) { const struct medicine *m = &r[order[i] - 1]; hits += (m->year << 9 | m->month << 5 | m->day) < (2026 << 9 | 6 << 5 | 1); } return hits; }
+static long long flatNameScan(const struct medicine *r, const StockHandle *order, int n) { long long hits = 0; for (int i = 0; i < n; i++) hits += r[order[i] - 1].name[0] == 'P'; return hits; }
+static long long splitQtyScan(const StockStore *st, const StockHandle *order, int n) { long long sum = 0; for (int i = 0; i < n; i++) sum += stockStoreGet(st, order[i])->quantity; return sum; }
+static long long splitPriceScan(const StockStore *st, const StockHandle *order, int n) { long long hits = 0; for (int i = 0; i < n; i++) { int p = stockStoreGet(st, order[i])->price_paise; hits += p >= 5000 && p <= 6000; } return hits; }
+static long long splitExpiryScan(const StockStore *st, const StockHandle *order, int n) { long long hits = 0; for (int i = 0; i < n; i++) hits += stockStoreGet(st, order[i])->expiry < (2026 << 9 | 6 << 5 | 1); return hits; }
+static long long splitNameScan(const StockStore *st, const StockHandle *order, int n) { long long hits = 0; for (int i = 0; i < n; i++) hits += stockStoreName(st, order[i])[0] == 'P'; return hits; }
+
+static const struct {
+    const char *name;
+    long long (*flat)(const struct medicine *r, const StockHandle *order, int n);
+    long long (*split)(const StockStore *st, const StockHandle *order, int n);
+} benchLayoutScans[] = { { "qty-sum", flatQtyScan, splitQtyScan }, { "price-range", flatPriceScan, splitPriceScan }, { "expiry", flatExpiryScan, splitExpiryScan }, { "name", flatNameScan, splitNameScan } };
+
+// One layout in a child process, so the RSS delta starts from the same clean heap. Rows are benchWriteStockCsv's, stored in
+// shuffled code order like a real stock.csv, so a code-order scan jumps around the records.
+static void benchLayoutRun(int n, int split) {
+    static const char *names[] = { "Paracetamol", "Amoxicillin", "Cetirizine", "Ibuprofen", "Azithromycin", "Omeprazole", "Metformin", "Atorvastatin", "Pantoprazole", "Dolo" };
+    static const char *suppliers[] = { "ABC Pharma", "Sun Distributors", "Medline Traders", "Apollo Wholesale" };
+    fflush(stdout); pid_t pid = fork(); if (pid < 0) return;
+    if (pid > 0) { waitpid(pid, NULL, 0); return; }
+    int *codes = (int *)malloc(sizeof(int) * (size_t)n); StockHandle *order = (StockHandle *)malloc(sizeof(StockHandle) * (size_t)n); if (!codes || !order) _exit(1);
+    for (int i = 0; i < n; i++) codes[i] = i + 1;
+    for (int i = n - 1; i > 0; i--) { int j = rand() % (i + 1); int t = codes[i]; codes[i] = codes[j]; codes[j] = t; }
+    for (int i = 0; i < n; i++) order[codes[i] - 1] = (StockHandle)i + 1; // Handle i+1 holds codes[i]
+    long before = benchRssBytes(); struct medicine m; memset(&m, 0, sizeof(m)); struct medicine *flat = NULL; StockStore *st = NULL; double bytes;
+    if (split) { st = createStockStore(); } else { flat = (struct medicine *)malloc(sizeof(struct medicine) * (size_t)n); if (!flat) _exit(1); }
+    for (int i = 0; i < n; i++) { int c = codes[i];
+        snprintf(m.name, sizeof(m.name), "%s %d", names[c % 10], c); snprintf(m.s_name, sizeof(m.s_name), "%s", suppliers[c % 4]); m.mcode = c; m.s_contact = 9800000000LL + c % 100000;
+        m.price = (float)(5.0 + (c % 400) * 0.25); m.quantity = 1000 + c % 500; m.year = 2025 + c % 4; m.month = 1 + c % 12; m.day = 1 + c % 28;
+        if (split) { if (stockStoreAdd(st, &m) == 0) _exit(1); } else { flat[i] = m; } }
+    long after = benchRssBytes(); bytes = split ? (double)stockStoreBytes(st) / n : (double)sizeof(struct medicine);
+    int fd = benchCacheMissCounter(), reps = 20;
+    for (size_t s = 0; s < sizeof(benchLayoutScans) / sizeof(benchLayoutScans[0]); s++) {
+        long long check = split ? benchLayoutScans[s].split(st, order, n) : benchLayoutScans[s].flat(flat, order, n), misses = 0; // Warm-up, and the answer both layouts must agree on
+#ifdef __linux__
+        if (fd >= 0) { ioctl(fd, PERF_EVENT_IOC_RESET, 0); ioctl(fd, PERF_EVENT_IOC_ENABLE, 0); }
+#endif
+        double t0 = benchNow();
+        for (int r = 0; r < reps; r++) { if ((split ? benchLayoutScans[s].split(st, order, n) : benchLayoutScans[s].flat(flat, order, n)) != check) _exit(1); }
+        double t = benchNow() - t0;
+#ifdef __linux__
+        if (fd >= 0) { ioctl(fd, PERF_EVENT_IOC_DISABLE, 0); if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) misses = -1; }
+#endif
+        char miss_text[32]; if (fd >= 0 && misses >= 0) { snprintf(miss_text, sizeof(miss_text), "%.3f", (double)misses / reps / n); } else { snprintf(miss_text, sizeof(miss_text), "n/a"); }
+        printf("%-8d %-7s %10.1f %10.2f %-12s %10.2f %12s %12lld\n", n, split ? "split" : "flat", bytes, (after - before) / 1048576.0, benchLayoutScans[s].name, t / reps / n * 1e9, miss_text, check); }
+    fflush(stdout); _exit(0);
+}
+
+static int benchLayout(int argc, char **argv) {
+    int default_sizes[] = { 100000, 1000000 }; int n_sizes = argc > 0 ? argc : 2;
+    freopen("/dev/null", "w", stderr);
+    printf("%-8s %-7s %10s %10s %-12s %10s %12s %12s\n", "items", "layout", "bytes/item", "rss+(MiB)", "scan", "ns/item", "misses/item", "result");
+    for (int k = 0; k < n_sizes; k++) {
+        int n = argc > 0 ? atoi(argv[k]) : default_sizes[k]; if (n <= 0) continue;
+        benchLayoutRun(n, 0); benchLayoutRun(n, 1);
+    }
+    return 0;
+}
+
+
+// --- Benchmark: sales summary over the sales.idx columns ---
+
+typedef struct { long long offset; unsigned long long invoice_hash; int day, mcode, quantity, first_of_invoice; double total_cost; } LegacySalesEntry; // A version 2 sales.idx row
+typedef struct { int mcode; long long units; double revenue; } LegacyRollupItem;
+typedef struct { int day; long long units, invoices; double revenue; LegacyRollupItem *items; int item_count, item_capacity; } LegacySalesDay;
+typedef struct { LegacySalesDay *days; int count, capacity; } LegacyRollup;
+
+// The old salesRollupAdd: one row struct at a time, a linear search of the day's codes (by_code = 0 stops after the day totals)
+static int legacyRollupAdd(LegacyRollup *r, const LegacySalesEntry *e, int by_code) {
+    if (e->day == SALES_DAY_NONE) return 1;
+    int lo = 0, hi = r->count;
+    if (hi > 0 && r->days[hi - 1].day < e->day) { lo = hi; } else { while (lo < hi) { int mid = lo + (hi - lo) / 2; if (r->days[mid].day < e->day) lo = mid + 1; else hi = mid; } }
+    if (lo == r->count || r->days[lo].day != e->day) {
+        if (r->count == r->capacity) { int cap = r->capacity ? r->capacity * 2 : 64; LegacySalesDay *nd = (LegacySalesDay *)realloc(r->days, sizeof(LegacySalesDay) * (size_t)cap); if (nd == NULL) return 0; r->days = nd; r->capacity = cap; }
+        memmove(&r->days[lo + 1], &r->days[lo], sizeof(LegacySalesDay) * (size_t)(r->count - lo)); memset(&r->days[lo], 0, sizeof(LegacySalesDay)); r->days[lo].day = e->day; r->count++; }
+    LegacySalesDay *day = &r->days[lo]; day->units += e->quantity; day->revenue += e->total_cost; day->invoices += e->first_of_invoice;
+    if (!by_code) return 1;
+    int i = 0; while (i < day->item_count && day->items[i].mcode != e->mcode) i++;
+    if (i == day->item_count) {
+        if (day->item_count == day->item_capacity) { int cap = day->item_capacity ? day->item_capacity * 2 : 8; LegacyRollupItem *ni = (LegacyRollupItem *)realloc(day->items, sizeof(LegacyRollupItem) * (size_t)cap); if (ni == NULL) return 0; day->items = ni; day->item_capacity = cap; }
+        day->items[i].mcode = e->mcode; day->items[i].units = 0; day->items[i].revenue = 0; day->item_count++; }
+    day->items[i].units += e->quantity; day->items[i].revenue += e->total_cost; return 1;
+}
+
+static void legacyRollupFree(LegacyRollup *r) { for (int i = 0; i < r->count; i++) free(r->days[i].items); free(r->days); memset(r, 0, sizeof(*r)); }
+
+// Rows are a synthetic history in time order: 2000 line items a day, 3 per invoice, 2000 codes
+static int benchRollup(int argc, char **argv) {
+    long long default_sizes[] = { 10000000 }; int n_sizes = argc > 0 ? argc : 1;
+    freopen("/dev/null", "w", stderr);
+    printf("%-9s %-8s %16s %16s %16s %7s %9s %14s\n", "rows", "path", "totals (Mrow/s)", "by date (Mrow/s)", "summary (Mrow/s)", "days", "day-codes", "sales value");
+    for (int k = 0; k < n_sizes; k++) {
+        long long n = argc > 0 ? atoll(argv[k]) : default_sizes[k]; if (n <= 0) continue;
+        SalesIndex si; memset(&si, 0, sizeof(si)); LegacySalesEntry *rows = (LegacySalesEntry *)malloc(sizeof(LegacySalesEntry) * (size_t)n);
+        if (rows == NULL || !salesColumnsReserve(&si, n)) { printf("out of memory for %lld rows\n", n); return 1; }
+        int first_day = salesDayFromDate("2020-01-01"); SalesColumns *c = &si.col;
+        for (long long i = 0; i < n; i++) { int code = 1 + rand() % 2000, qty = 1 + rand() % 5; long long paise = (long long)qty * (500 + code % 400 * 25);
+            c->offset[i] = i * 90; c->invoice[i] = (unsigned long long)(i / 3 + 1); c->day[i] = first_day + (int)(i / 2000); c->mcode[i] = code; c->quantity[i] = qty; c->amount[i] = paise; c->first_of_invoice[i] = i % 3 == 0;
+            LegacySalesEntry *e = &rows[i]; e->offset = c->offset[i]; e->invoice_hash = c->invoice[i]; e->day = c->day[i]; e->mcode = code; e->quantity = qty; e->first_of_invoice = c->first_of_invoice[i]; e->total_cost = (float)(paise / 100.0); }
+        si.hdr.rows = n;
+
+        // Old path: the row structs summed in double, rollups one row at a time
+        double t0 = benchNow(); long long units = 0, invoices = 0; double revenue = 0;
+        for (long long i = 0; i < n; i++) { units += rows[i].quantity; revenue += rows[i].total_cost; invoices += rows[i].first_of_invoice; }
+        double totals = benchNow() - t0; LegacyRollup by_day, by_code; memset(&by_day, 0, sizeof(by_day)); memset(&by_code, 0, sizeof(by_code));
+        t0 = benchNow(); for (long long i = 0; i < n; i++) { if (!legacyRollupAdd(&by_day, &rows[i], 0)) return 1; } double dates = benchNow() - t0;
+        t0 = benchNow(); for (long long i = 0; i < n; i++) { if (!legacyRollupAdd(&by_code, &rows[i], 1)) return 1; } double summary = totals + benchNow() - t0;
+        long long legacy_codes = 0; for (int d = 0; d < by_code.count; d++) legacy_codes += by_code.days[d].item_count;
+        printf("%-9lld %-8s %16.1f %16.1f %16.1f %7d %9lld %14.2f\n", n, "legacy", n / totals / 1e6, n / dates / 1e6, n / summary / 1e6, by_day.count, legacy_codes, revenue);
+
+        for (int level = 0; level <= 2; level++) {
+            if (salesSetKernelLevel(level) != level) { printf("%-9lld %-8s %16s %16s %16s\n", n, csvScanLevelName(level), "-", "-", "-"); continue; }
+            double best[3] = { 1e9, 1e9, 1e9 }; SalesSums all; int days = 0; long long codes = 0;
+            for (int rep = 0; rep < 3; rep++) {
+                t0 = benchNow(); salesSumRows(c, 0, n, &all); double t = benchNow() - t0; if (t < best[0]) best[0] = t;
+                t0 = benchNow(); SalesSums run_total = { 0, 0, 0 }; days = 0; // Group-by-date alone: run ends and per-run sums
+                for (long long i = 0, end; i < n; i = end) { end = salesRunEnd(c->day, i, n); SalesSums day = { 0, 0, 0 }; salesSum(c, i, end, &day); run_total.units += day.units; run_total.paise += day.paise; days++; }
+                t = benchNow() - t0; if (t < best[1]) best[1] = t;
+                if (run_total.units != all.units || run_total.paise != all.paise) { printf("%s: by-date sums differ from the totals\n", csvScanLevelName(level)); return 1; }
+                freeSalesRollup(&si); t0 = benchNow(); SalesSums sum; salesSumRows(c, 0, n, &sum); if (!buildSalesRollup(&si)) return 1; t = benchNow() - t0; if (t < best[2]) best[2] = t; }
+            codes = 0; for (int d = 0; d < si.day_count; d++) codes += si.days[d].item_count;
+            if (all.units != units || all.invoices != invoices || days != by_day.count || si.day_count != by_code.count || codes != legacy_codes) { printf("%s: summary differs from the old path\n", csvScanLevelName(level)); return 1; }
+            printf("%-9lld %-8s %16.1f %16.1f %16.1f %7d %9lld %11lld.%02lld\n", n, csvScanLevelName(level), n / best[0] / 1e6, n / best[1] / 1e6, n / best[2] / 1e6, days, codes, all.paise / 100, all.paise % 100);
+        }
+        legacyRollupFree(&by_day); legacyRollupFree(&by_code); free(rows); resetSalesIndex(&si);
+    }
+    salesSetKernelLevel(-1); return 0;
+}
+
+
+// --- Main ---
+
+typedef struct { const char *name; int (*run)(int argc, char **argv); const char *usage; } BenchEntry;
+
+static const BenchEntry benches[] = {
+    { "cache", benchCache, "cache [medical.exe] [rows...=10000 100000]   CGI time to first byte for viewStock and searchMedicine, cold vs warm stock.snap" },
+    { "snapshot", benchSnapshot, "snapshot [rows...=10000 100000 1000000]   stock.csv parse vs stock.snap read and attach time" },
+    { "hash", benchHash, "hash [items...=1000 10000 100000]   Robin Hood index vs legacy chained table insert/lookup throughput" },
+    { "ordered", benchOrdered, "ordered [items...=10000 100000 1000000]   Ordered index vs legacy unbalanced BST build/lookup/scan, sorted and random insertion" },
+    { "names", benchNames, "names [items...=10000 100000]   Trigram name index vs legacy stristr scan query latency" },
+    { "sales", benchSales, "sales [rows...=10000 100000 1000000]   Sales report and one-month rollup query: first run building sales.idx vs later runs reading it" },
+    { "rollup", benchRollup, "rollup [rows...=10000000]   Sales summary (totals, group-by-date, group-by-code rollups) over the sales.idx columns per SIMD level vs the old row entries (rows/sec)" },
+    { "billing", benchBilling, "billing [items...=1 10 50]   Sales writer throughput: legacy per-line appends vs fsync'd group commit per bill" },
+    { "concurrency", benchConcurrency, "concurrency [procs...=1 2 4 8]   Parallel billing processes on shared items: bills/sec and lost updates (must be 0)" },
+    { "output", benchOutput, "output [items...=1000 10000 100000]   viewStock / generateReport pages: legacy printf+fflush per row vs buffered writer (bytes/sec, write() calls per page)" },
+    { "stockpage", benchStockPage, "stockpage [items...=10000 100000 1000000]   viewStock page latency (first, middle, 1000 rows, filtered) vs listing every row" },
+    { "json", benchJson, "json [items...=10000 100000]   JSON API vs HTML pages: batched code lookups, name search and expiry (bytes and render time per answer)" },
+    { "wire", benchWire, "wire [items...=1000 10000]   Full page bytes and render time: identity vs gzip, and the 304 for an unchanged page" },
+    { "params", benchParams, "params [items...=1 10 50]   Billing form parsing: one get_param/parse_multi_value_param scan per field vs the single-pass RequestParams table" },
+    { "csv", benchCsv, "csv [rows...=100000 1000000]   stock.csv / sales.csv parsing: legacy fgets+sscanf/get_csv_field vs the CSV scanner per SIMD level (GB/s)" },
+    { "load", benchLoad, "load [rows...=1000000]   stock.csv load and sales.csv indexing on 1/2/4/8 threads; each result must match the sequential one" },
+    { "import", benchImport, "import [rows...=3000 30000]   Supplier delivery into a 100k-item stock: one add_stock POST per row vs a single import_stock (rows/sec)" },
+    { "suite", benchSuite, "suite [skus=100000] [sales_per_day=500] [years=2] [order=shuffled|sorted] [requests=200] [mode=both|serve|cgi] [seed=42]   Synthetic pharmacy; search/billing/update/expiry/report requests as CSV latency percentiles and requests/sec" },
+    { "layout", benchLayout, "layout [items...=100000 1000000]   Flat struct medicine rows vs hot StockItem + cold interned strings: bytes/item, RSS and code-order scan ns/item and cache misses" },
+    { "memory", benchMemory, "memory [items...=100000]   Resident size of duplicated hash+BST records vs the shared stock store" },
+    { "serve", benchServe, "serve [exe=./medical.exe] [rows=20000] [requests=20]   CGI fork/exec vs --serve requests/sec; then two back-to-back bills must get distinct invoice IDs" },
+};
+
+int main(int argc, char **argv) {
+    srand(12345); // Deterministic datasets
+    if (argc > 1) { for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) { if (strcmp(argv[1], benches[i].name) == 0) return benches[i].run(argc - 2, argv + 2); } }
+    fprintf(stderr, "Usage: %s <benchmark> [options]\n", argv[0]);
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) fprintf(stderr, "  %s\n", benches[i].usage);
+    return 1;
+}